@@ -6,6 +6,9 @@
  * Date: 10 July 2015
  */
 #include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -16,6 +19,44 @@
 
 #include "ejson.h"
 
+#define EJ_ARENA_CHUNK_SZ	(16 * 1024)
+#define EJ_ARENA_KEEP		4	/* chunks kept between messages */
+#define EJ_ARENA_MAGIC		0x616e6572614a45ULL
+#define EJ_HEAP_MAGIC		0x706165684a45ULL
+#define EJ_ALIGN(n)		(((n) + 15) & ~((size_t)15))
+
+/* header in front of every block handed to jansson */
+struct ej_blk_hdr {
+	uint64_t magic;
+	uint64_t pad;
+};
+
+struct ej_chunk {
+	struct ej_chunk *next;
+	char *end;
+	uint64_t pad[2];
+	char data[];
+};
+
+/* per thread bump allocator, reset when the outermost message is done */
+struct ej_arena {
+	struct ej_chunk *first;
+	struct ej_chunk *cur;
+	char *pos;
+	int depth;
+	int nchunks;
+};
+
+static int ArenaHooked;
+static int ArenaEnabled;	/* latched by the first ej_arena_init() */
+static int ArenaWanted = -1;
+static pthread_key_t ArenaKey;
+static pthread_once_t ArenaOnce = PTHREAD_ONCE_INIT;
+static __thread struct ej_arena Arena;
+static struct ej_alloc_stats AllocStats;
+
+static void free_fn(void *ptr);
+
 /*                    E A S Y   J S O N   A P I ' S                     */
 
 /*************************************************************************
@@ -62,12 +103,19 @@ int ej_load_buf(char *buf, json_t ** root)
  */
 int ej_store_buf(json_t * root, char *buf, int max)
 {
+	char *text;
+
 	if ((root == NULL) || (buf == NULL)) {
 		printf("Error: %s(): invalid arguments\n", __func__);
 		return -1;
 	}
 
-	strncpy(buf, json_dumps(root, 0), max);
+	text = json_dumps(root, 0);
+	if (text == NULL)
+		return -1;
+
+	strncpy(buf, text, max);
+	free_fn(text);
 
 	return 0;
 }
@@ -220,32 +268,384 @@ int ej_set_string(json_t * root, char *name, char *value)
 
 int ej_add_int(json_t ** root, char *name, int value)
 {
-	json_t *new;
-
 	if (name == NULL) {
 		printf("%s(): invalid arguments!\n", __func__);
 		return -1;
 	}
 
-	new = json_pack("{\nsi\n}", name, value);
-	if (new == NULL)
-		return -1;
-
-	return json_object_update(*root, new);
+	return json_object_set_new(*root, name, json_integer(value));
 }
 
 int ej_add_string(json_t ** root, char *name, char *value)
 {
-	json_t *new;
-
 	if ((name == NULL) || (value == NULL)) {
 		printf("%s(): invalid arguments!\n", __func__);
 		return -1;
 	}
 
-	new = json_pack("{\nss\n}", name, value);
-	if (new == NULL)
+	return json_object_set_new(*root, name, json_string(value));
+}
+
+
+/*************************************************************************
+ * function: ej_frame_len
+ *
+ * Messages are written back to back on a stream socket, so one read can
+ * hold several of them or only a part of one. This function finds where
+ * the first json object in the buffer ends, whitespace in front of it
+ * included. Braces inside strings are skipped.
+ *
+ * return: length of the object, 0 if it is not complete yet or -1 if the
+ *         buffer does not start with an object
+ */
+int ej_frame_len(const char *buf, int len)
+{
+	int i, depth = 0, in_str = 0, esc = 0;
+
+	for (i = 0; i < len; i++) {
+		char c = buf[i];
+
+		if (in_str) {
+			if (esc)
+				esc = 0;
+			else if (c == '\\')
+				esc = 1;
+			else if (c == '"')
+				in_str = 0;
+			continue;
+		}
+
+		if (depth == 0) {
+			if ((c == ' ') || (c == '\n') || (c == '\r') ||
+			    (c == '\t') || (c == '\0'))
+				continue;
+			if (c != '{')
+				return -1;
+		}
+
+		if (c == '"') {
+			in_str = 1;
+		} else if ((c == '{') || (c == '[')) {
+			depth++;
+		} else if ((c == '}') || (c == ']')) {
+			if (--depth == 0)
+				return i + 1;
+		}
+	}
+
+	return 0;
+}
+
+/*                    T E X T   W R I T E R                             */
+
+/* appends len bytes of text, marks out as failed if they don't fit */
+static void out_put(struct ej_out *out, const char *text, int len)
+{
+	if (out->len < 0)
+		return;
+	if (out->len + len >= out->max) {
+		out->len = -1;
+		return;
+	}
+	memcpy(out->buf + out->len, text, len);
+	out->len += len;
+}
+
+
+/* a value or key that follows another one needs a comma in front */
+static void out_sep(struct ej_out *out)
+{
+	char last;
+
+	if (out->len <= 0)
+		return;
+	last = out->buf[out->len - 1];
+	if ((last != '{') && (last != '[') && (last != ':'))
+		out_put(out, ",", 1);
+}
+
+
+/*************************************************************************
+ * function: ej_out_init
+ *
+ * The ej_out_* functions write compact json text without building a
+ * json_t first, for messages that are sent right away. Commas are put in as
+ * needed: an object is written as ej_out_open(out, '{'), then ej_out_key
+ * and a value for each member, then ej_out_close(out, '}').
+ *
+ * arg1: writer
+ * arg2: buffer for the text
+ * arg3: size of the buffer, the text and its '\0' must fit in
+ */
+void ej_out_init(struct ej_out *out, char *buf, int max)
+{
+	out->buf = buf;
+	out->max = max;
+	out->len = 0;
+}
+
+void ej_out_open(struct ej_out *out, char c)
+{
+	out_sep(out);
+	out_put(out, &c, 1);
+}
+
+void ej_out_close(struct ej_out *out, char c)
+{
+	out_put(out, &c, 1);
+}
+
+void ej_out_key(struct ej_out *out, const char *name)
+{
+	ej_out_string(out, name);
+	out_put(out, ":", 1);
+}
+
+void ej_out_string(struct ej_out *out, const char *value)
+{
+	const char *p, *run;
+	char esc[8];
+
+	out_sep(out);
+	out_put(out, "\"", 1);
+	for (run = p = value; *p; p++) {
+		unsigned char c = *p;
+
+		if ((c >= 0x20) && (c != '"') && (c != '\\'))
+			continue;
+		out_put(out, run, p - run);
+		switch (c) {
+		case '"':  strcpy(esc, "\\\""); break;
+		case '\\': strcpy(esc, "\\\\"); break;
+		case '\b': strcpy(esc, "\\b"); break;
+		case '\f': strcpy(esc, "\\f"); break;
+		case '\n': strcpy(esc, "\\n"); break;
+		case '\r': strcpy(esc, "\\r"); break;
+		case '\t': strcpy(esc, "\\t"); break;
+		default:   snprintf(esc, sizeof(esc), "\\u%04x", c); break;
+		}
+		out_put(out, esc, strlen(esc));
+		run = p + 1;
+	}
+	out_put(out, run, p - run);
+	out_put(out, "\"", 1);
+}
+
+void ej_out_int(struct ej_out *out, long long value)
+{
+	char text[24];
+
+	out_sep(out);
+	out_put(out, text, snprintf(text, sizeof(text), "%lld", value));
+}
+
+
+/*************************************************************************
+ * function: ej_out_end
+ *
+ * Terminates the text.
+ *
+ * return: length of the text or -1 if it did not fit in the buffer
+ */
+int ej_out_end(struct ej_out *out)
+{
+	if (out->len < 0)
 		return -1;
+	out->buf[out->len] = '\0';
+	return out->len;
+}
+
+/*                    M E S S A G E   A R E N A                         */
+
+static void *heap_alloc(size_t size)
+{
+	struct ej_blk_hdr *hdr;
 
-	return json_object_update(*root, new);
+	hdr = malloc(sizeof(struct ej_blk_hdr) + size);
+	if (hdr == NULL)
+		return NULL;
+
+	hdr->magic = EJ_HEAP_MAGIC;
+	__atomic_fetch_add(&AllocStats.heap, 1, __ATOMIC_RELAXED);
+	return hdr + 1;
+}
+
+static struct ej_chunk *arena_new_chunk(void)
+{
+	struct ej_chunk *chunk;
+
+	chunk = malloc(sizeof(struct ej_chunk) + EJ_ARENA_CHUNK_SZ);
+	if (chunk == NULL)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->end = chunk->data + EJ_ARENA_CHUNK_SZ;
+	Arena.nchunks++;
+	__atomic_fetch_add(&AllocStats.chunks, 1, __ATOMIC_RELAXED);
+
+	/* make sure the chunks are released when this thread exits */
+	if (pthread_getspecific(ArenaKey) == NULL)
+		pthread_setspecific(ArenaKey, &Arena);
+
+	return chunk;
+}
+
+static void *malloc_fn(size_t size)
+{
+	size_t need = EJ_ALIGN(sizeof(struct ej_blk_hdr) + size);
+	struct ej_blk_hdr *hdr;
+
+	/* outside a message scope or too big for a chunk, use the heap */
+	if ((Arena.depth == 0) || (need > EJ_ARENA_CHUNK_SZ / 2))
+		return heap_alloc(size);
+
+	if (Arena.first == NULL) {
+		Arena.first = Arena.cur = arena_new_chunk();
+		if (Arena.first == NULL)
+			return heap_alloc(size);
+		Arena.pos = Arena.first->data;
+	}
+
+	if (Arena.pos + need > Arena.cur->end) {
+		if (Arena.cur->next == NULL)
+			Arena.cur->next = arena_new_chunk();
+		if (Arena.cur->next == NULL)
+			return heap_alloc(size);
+		Arena.cur = Arena.cur->next;
+		Arena.pos = Arena.cur->data;
+	}
+
+	hdr = (struct ej_blk_hdr *)Arena.pos;
+	hdr->magic = EJ_ARENA_MAGIC;
+	Arena.pos += need;
+	__atomic_fetch_add(&AllocStats.arena, 1, __ATOMIC_RELAXED);
+	return hdr + 1;
+}
+
+static void free_fn(void *ptr)
+{
+	struct ej_blk_hdr *hdr;
+
+	if (ptr == NULL)
+		return;
+
+	if (!ArenaHooked) {
+		free(ptr);
+		return;
+	}
+
+	/* arena blocks are released all at once by ej_arena_end() */
+	hdr = (struct ej_blk_hdr *)ptr - 1;
+	if (hdr->magic == EJ_ARENA_MAGIC)
+		return;
+
+	if (hdr->magic == EJ_HEAP_MAGIC) {
+		hdr->magic = 0;
+		free(hdr);
+		return;
+	}
+
+	/* allocated before ej_arena_init() */
+	free(ptr);
+}
+
+static void arena_destroy(void *arg)
+{
+	struct ej_arena *arena = (struct ej_arena *)arg;
+	struct ej_chunk *chunk;
+
+	while (arena->first != NULL) {
+		chunk = arena->first;
+		arena->first = chunk->next;
+		free(chunk);
+	}
+	arena->cur = NULL;
+	arena->nchunks = 0;
+}
+
+static void arena_setup(void)
+{
+	ArenaEnabled = ArenaWanted;
+	pthread_key_create(&ArenaKey, arena_destroy);
+	json_set_alloc_funcs(malloc_fn, free_fn);
+	ArenaHooked = 1;
+}
+
+/*************************************************************************
+ * function: ej_arena_init
+ *
+ * This function hooks the message arena into jansson, for the whole
+ * process. Has to be called before any json object is created by the
+ * process, a block free_fn() did not hand out can't be told apart. With
+ * enable set to 0 all blocks come from malloc, but are still counted.
+ * The first call decides, scopes under way can't be cut short by another.
+ *
+ * return: 0, or -1 if the process was set up the other way already
+ */
+int ej_arena_init(int enable)
+{
+	int unset = -1;
+
+	__atomic_compare_exchange_n(&ArenaWanted, &unset, enable ? 1 : 0, 0,
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	pthread_once(&ArenaOnce, arena_setup);
+
+	return (ArenaEnabled == (enable ? 1 : 0)) ? 0 : -1;
+}
+
+/*************************************************************************
+ * function: ej_arena_begin
+ *
+ * Starts a message scope on the calling thread. Every json object made
+ * until the matching ej_arena_end() is carved from the thread's arena, so
+ * none of them may be kept after the scope ends. Scopes can be nested.
+ */
+void ej_arena_begin(void)
+{
+	if (ArenaEnabled)
+		Arena.depth++;
+}
+
+/*************************************************************************
+ * function: ej_arena_end
+ *
+ * Ends a message scope. When the outermost scope ends, all blocks of the
+ * message are released at once and the arena is rewound for the next one.
+ */
+void ej_arena_end(void)
+{
+	struct ej_chunk *chunk;
+
+	if (!ArenaEnabled || (Arena.depth == 0))
+		return;
+
+	if (--Arena.depth > 0)
+		return;
+
+	if (Arena.first == NULL)
+		return;
+
+	/* keep a few chunks around so steady state needs no malloc */
+	chunk = Arena.first;
+	while ((chunk->next != NULL) && (Arena.nchunks > EJ_ARENA_KEEP)) {
+		struct ej_chunk *next = chunk->next;
+
+		chunk->next = next->next;
+		free(next);
+		Arena.nchunks--;
+	}
+	Arena.cur = Arena.first;
+	Arena.pos = Arena.first->data;
+}
+
+/*************************************************************************
+ * function: ej_alloc_stats
+ *
+ * This function reports the number of json allocations done so far
+ */
+void ej_alloc_stats(struct ej_alloc_stats *stats)
+{
+	stats->heap = __atomic_load_n(&AllocStats.heap, __ATOMIC_RELAXED);
+	stats->arena = __atomic_load_n(&AllocStats.arena, __ATOMIC_RELAXED);
+	stats->chunks = __atomic_load_n(&AllocStats.chunks, __ATOMIC_RELAXED);
 }
@@ -14,6 +14,13 @@
 #define BUFF_SIZE	(4*1024)
 #define NAME_SIZE	(256)
 
+/* json allocation counters, see ej_alloc_stats() */
+struct ej_alloc_stats {
+	unsigned long heap;	/* blocks from malloc */
+	unsigned long arena;	/* blocks carved from a message arena */
+	unsigned long chunks;	/* arena chunks from malloc */
+};
+
 /*    E A S Y   J S O N   A P I ' S   */
 int ej_load_buf(char *buf, json_t ** root);
 int ej_store_buf(json_t * root, char *buf, int max);
@@ -25,5 +32,28 @@ int ej_set_int(json_t * root, char *name, int value);
 int ej_set_string(json_t * root, char *name, char *value);
 int ej_add_int(json_t ** root, char *name, int value);
 int ej_add_string(json_t ** root, char *name, char *value);
+int ej_frame_len(const char *buf, int len);
+
+/*    T E X T   W R I T E R   */
+/* writes json text straight into a buffer, no json_t in between */
+struct ej_out {
+	char *buf;
+	int max;
+	int len;	/* -1 once buf was too small */
+};
+
+void ej_out_init(struct ej_out *out, char *buf, int max);
+void ej_out_open(struct ej_out *out, char c);
+void ej_out_close(struct ej_out *out, char c);
+void ej_out_key(struct ej_out *out, const char *name);
+void ej_out_string(struct ej_out *out, const char *value);
+void ej_out_int(struct ej_out *out, long long value);
+int ej_out_end(struct ej_out *out);
+
+/*    M E S S A G E   A R E N A   */
+int ej_arena_init(int enable);
+void ej_arena_begin(void);
+void ej_arena_end(void);
+void ej_alloc_stats(struct ej_alloc_stats *stats);
 
 #endif
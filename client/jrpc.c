@@ -5,13 +5,19 @@
  * Description: This is the main file that implements the functions for 
  *              libjrpc.so
  *****************************************************************************/
+#define _GNU_SOURCE		/* struct ucred */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
 
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/ip.h>
 #include <arpa/inet.h>
 #include <pthread.h>
@@ -21,605 +27,4173 @@
 #include "ejson.h"
 #include "debug.h"
 
+#define MAX_CALLS		64	/* calls in flight at a time */
+#define CALL_TIMEOUT_MS		5000
+#define INIT_TIMEOUT_MS		1000	/* calls wait so long for a context */
+					/* being opened on another thread */
+#define RECONNECT_MIN_MS	10	/* pause before connecting again to */
+#define RECONNECT_MAX_MS	100	/* jrpcd, doubles up to max */
+#define SETTLE_MS		1000	/* a call sent again after a */
+					/* reconnect may find its node not */
+					/* registered again yet, see call_args */
+#define MAX_IDEMPOTENT		32	/* see jrpc_ctx_set_idempotent */
+#define MAX_CACHEABLE		32	/* see jrpc_ctx_set_cacheable */
+#define MAX_TOPICS		16	/* topics a node can subscribe to */
+#define MAX_LINKS		16	/* direct links, to and from other nodes */
+#define MAX_ARGS		16	/* args of a call */
+#define EMBED_FD		INT_MAX	/* SockFd when jrpcd is in process */
+#define MAX_NODES		32	/* logical nodes sharing the connection */
+#define TX_BUFF_SIZE		(4 * BUFF_SIZE)	/* output a polled context */
+						/* batches till it is flushed */
+#define OUTBOX_SIZE		(64 * BUFF_SIZE)	/* default cap of the */
+							/* outbox, see */
+							/* jrpc_ctx_set_outbox */
+#define MAX_IOV			64	/* messages written at once */
+#define JRPC_DEFERRED		1	/* local_call left the return to */
+						/* jrpc_reply */
+#define JRPC_EDROPPED		-3	/* the connection to jrpcd broke */
+						/* before the return came */
+#define LOCAL_FD		-2	/* slot fd of a call of this process */
+
 struct node_details {
 	char name[NAME_SIZE];
+	int grouped;			/* calls to name are spread by jrpcd */
+	enum jrpc_group group;
+	int key;
 	int n_if;
 	struct if_details *ifl;
+	int n_topics;
+	char topics[MAX_TOPICS][NAME_SIZE];
+};
+
+/* a call waiting for its return(s), matched by the id sent with the call */
+struct call_slot {
+	int id;				/* 0 when the slot is free */
+	int done;			/* all returns are in */
+	int status;			/* JRPC_OK or JRPC_EFAIL */
+	void *ret;			/* return value of a single call */
+	struct jrpc_result *res;	/* results of a fan-out call */
+	int max_res;
+	int n_res;			/* targets listed in res */
+	int waiting;			/* targets yet to return, -1 till ack */
+	int fd;				/* direct link the call went over, -1 */
+					/* for jrpcd or LOCAL_FD */
+	pthread_cond_t cond;
+	jrpc_done_fn done_fn;		/* async call, nobody waits on cond */
+	void *done_arg;
+	long long dl;			/* the async call times out then */
+	char node[NAME_SIZE];		/* node the async call went to */
+};
+
+/* a call answered later, see jrpc_defer */
+struct jrpc_deferred {
+	struct jrpc_ctx *ctx;
+	int fd;				/* the return goes back over it, -1 */
+					/* for a call of this process */
+	int xid;
+	int id;				/* id of the call, of its slot if it */
+					/* is a call of this process */
+	int deferred;			/* jrpc_defer was called */
+	char caller[NAME_SIZE];
+	char callee[NAME_SIZE];
+	char if_name[NAME_SIZE];
+	char rfmt[NAME_SIZE];
+	void *ret;			/* call of this process: where the */
+	int timeout_ms;			/* caller wants the return and how */
+	jrpc_done_fn done_fn;		/* long it waits, done_fn if it */
+	void *done_arg;			/* does not */
+};
+
+/* a connection between two nodes that bypasses jrpcd, see jrpc_direct */
+struct direct_link {
+	int fd;				/* -1 when the entry is free */
+	char node[NAME_SIZE];		/* node called over it, "" if it is */
+					/* a link another node calls us over */
+	struct jrpc_ctx *ctx;		/* context the link belongs to */
+};
+
+/* a message waiting in the outbox */
+struct out_msg {
+	struct out_msg *next;
+	int len;
+	char data[];
+};
+
+/* messages on their way to jrpcd. Senders push onto head without a lock,
+ * the thread holding the writer token moves them to queue, oldest first,
+ * and writes as many as the socket takes at once, see outbox_drain. */
+struct outbox {
+	struct out_msg *head;		/* pushed, not taken yet, newest first */
+	struct out_msg *queue;		/* taken, owned by the token holder */
+	struct out_msg *tail;
+	int sent;			/* bytes of queue written already */
+	int writing;			/* the writer token */
+	int bytes;			/* queued and not written yet */
+	int max_bytes;			/* 0 for OUTBOX_SIZE */
+	int nonblock;			/* a full outbox fails sends */
+	int failed;			/* the socket broke, nothing is sent */
+	int waiters;			/* threads waiting on room */
+	pthread_mutex_t mutex;
+	pthread_cond_t room;		/* bytes went down */
+	pthread_cond_t kick;		/* handoff or stop for the tx thread */
+	int handoff;			/* the tx thread holds the token */
+	int stop;
+	int thread_on;
+	pthread_t thread;
+};
+
+/* a connection to jrpcd and all that goes with it, see jrpc_ctx_open */
+struct jrpc_ctx {
+	pthread_t recv_thread;
+	int rx_joinable;		/* recv_thread is yet to be joined */
+	enum jrpc_states state;		/* see set_state */
+	pthread_mutex_t init_mutex;	/* state, reconnecting, closing and */
+	pthread_cond_t init_cond;	/* idempotent, see wait_init */
+	int reconnect;			/* reconnect when jrpcd goes away */
+	int reconnecting;
+	int closing;			/* ctx_exit is under way */
+	unsigned int seed;		/* jitter of the reconnect pauses */
+	int sockfd;
+	struct node_details this_node;	/* first node registered, calls are */
+					/* made as this one */
+	struct node_details nodes[MAX_NODES];	/* nodes registered after it, */
+						/* "" names a free slot */
+
+	struct call_slot slots[MAX_CALLS];
+	pthread_mutex_t call_mutex;
+	int call_id_next;
+	pthread_t timer_thread;		/* times async calls out, see */
+	int timer_on;			/* jrpc_timer_thread */
+	pthread_cond_t timer_cond;	/* on the monotonic clock */
+
+	struct direct_link links[MAX_LINKS];
+	pthread_mutex_t link_mutex;
+	pthread_cond_t link_cond;	/* the last link thread is done */
+	int num_links;
+	int listen_fd;
+	pthread_t accept_thread;
+	char endpoint[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+	const struct jrpc_transport *transport;	/* see jrpc_ctx_open_embedded */
+	void *transport_link;
+	pthread_mutex_t rcall_mutex;	/* interfaces run one at a time */
+
+	struct {			/* calls sent again after a reconnect, */
+		char node[NAME_SIZE];	/* see jrpc_ctx_set_idempotent */
+		char if_name[NAME_SIZE];
+	} idempotent[MAX_IDEMPOTENT];
+	int n_idempotent;
+
+	struct {			/* returns jrpcd may cache, see */
+		char node[NAME_SIZE];	/* jrpc_ctx_set_cacheable */
+		char if_name[NAME_SIZE];
+		int ttl_ms;
+	} cacheable[MAX_CACHEABLE];
+	int n_cacheable;
+
+	int polled;			/* no rx thread, see jrpc_ctx_open_polled */
+	char rx_buf[BUFF_SIZE];		/* read and not dispatched yet */
+	int rx_fill;
+	struct outbox out;		/* messages to jrpcd */
 };
 
+
 /******************************************************************************
  *  global variables
  */
-pthread_t RecvThread;
-enum jrpc_states ClientState = JRPC_OFF;
-enum jrpc_states RxThreadState = JRPC_OFF;
-int SockFd;
-struct node_details ThisNode;
-json_t *JMsgCall, *JMsgRcall;
+static struct jrpc_ctx DefaultCtx = {	/* the one jrpc_init opens */
+	.init_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.init_cond = PTHREAD_COND_INITIALIZER
+};
 
-pthread_mutex_t rcall_mutex;
-pthread_cond_t rcall_condvar;
-pthread_mutex_t ret_mutex;
-pthread_cond_t ret_condvar;
+/* the call running on this thread, consumed by jrpc_scanargs() */
+static __thread json_t *JMsgRcall;
+static __thread struct jrpc_arg *LocalArgs;	/* args of a local call */
+static __thread int NLocalArgs;
+static __thread struct jrpc_deferred *Rcall;	/* see jrpc_defer */
 
 /******************************************************************************
  * static functions
  */
-static int get_sockfd(void)
+/* a context is opened on one thread while others may call on it already,
+ * they wait in wait_init till it is up or failed */
+static void set_state(struct jrpc_ctx *ctx, enum jrpc_states state)
+{
+	pthread_mutex_lock(&ctx->init_mutex);
+	ctx->state = state;
+	pthread_cond_broadcast(&ctx->init_cond);
+	pthread_mutex_unlock(&ctx->init_mutex);
+}
+
+
+static int get_sockfd(struct jrpc_ctx *ctx)
 {
-	if (ClientState < JRPC_CONNECTED)
+	if (ctx->state < JRPC_CONNECTED)
 		return -1;
 	else
-		return SockFd;
+		return ctx->sockfd;
 }
 
 
-static json_t* get_rcalljson(void)
+/* sends all of buffer on a blocking socket */
+static int write_all(int fd, const char *buffer, int len)
 {
-	return JMsgRcall;
+	int n, pos = 0;
+
+	while (pos < len) {
+		n = send(fd, buffer + pos, len - pos, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		pos += n;
+	}
+
+	return len;
 }
 
 
-static json_t* get_calljson(void)
+static int take_token(struct outbox *ob)
 {
-	return JMsgCall;
+	int free_token = 0;
+
+	return __atomic_compare_exchange_n(&ob->writing, &free_token, 1, 0,
+					   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
 }
 
 
+/* the written bytes leave the queue, senders waiting for room wake up */
+static void outbox_consume(struct outbox *ob, int n)
+{
+	struct out_msg *msg;
+	int left;
 
-/******************************************************************************
- * jrpc_scanargs
- *
- * This is a jrpc standard to get arguments for executing a remote procedural
- * call.
- */
-int jrpc_scanargs(const char *fmt, ...)
+	while ((n > 0) && (ob->queue != NULL)) {
+		msg = ob->queue;
+		left = msg->len - ob->sent;
+		if (n < left) {
+			ob->sent += n;
+			break;
+		}
+		n -= left;
+		ob->sent = 0;
+		ob->queue = msg->next;
+		if (ob->queue == NULL)
+			ob->tail = NULL;
+		__atomic_sub_fetch(&ob->bytes, msg->len, __ATOMIC_SEQ_CST);
+		free(msg);
+	}
+
+	if (__atomic_load_n(&ob->waiters, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&ob->mutex);
+		pthread_cond_broadcast(&ob->room);
+		pthread_mutex_unlock(&ob->mutex);
+	}
+}
+
+
+/* drops all that is queued, the socket is gone */
+static void outbox_discard(struct outbox *ob)
 {
-	json_t *jmsg, *jarray, *jrow;
-	const char *p;
-	int argc, retval = 0, i, c;
-	va_list ap; /* var argument pointer */
-	char type[16];
+	struct out_msg *msg;
 
-	/* parse the argument secion of incoming message */
-	jmsg = get_rcalljson();
-	jarray = json_object_get(jmsg, "args");
-	if ((jarray == NULL) || (0 == (argc = json_array_size(jarray))))
-	{
-		LOG_ERR("%s", "no array element \'ecus\' found");
-		return -1;
+	msg = __atomic_exchange_n(&ob->head, NULL, __ATOMIC_ACQUIRE);
+	if (ob->tail != NULL)
+		ob->tail->next = msg;
+	else
+		ob->queue = msg;
+	ob->tail = NULL;
+	while (ob->queue != NULL) {
+		msg = ob->queue;
+		ob->queue = msg->next;
+		__atomic_sub_fetch(&ob->bytes, msg->len, __ATOMIC_SEQ_CST);
+		free(msg);
 	}
+	ob->sent = 0;
+	outbox_consume(ob, 0);
+}
 
 
-	va_start(ap, fmt); /* make ap to point 1st unamed arg */
-	for (i = c = 0, p = fmt; *p; p++, c++) {
-		if (*p != '%') {
-			LOG_ERR("%s %d", "check format string @", c);
-			continue;
-		}
+static int outbox_drain(struct jrpc_ctx *ctx, int wait);
 
-		jrow = json_array_get(jarray, i++);
-		if (!json_is_object(jrow)) {
-			LOG_ERR("%s", "json array access failure");
-			return -1;
-		}
-		ej_get_string(jrow, "type", type);
+static void *jrpc_tx_thread(void *arg)
+{
+	struct jrpc_ctx *ctx = (struct jrpc_ctx *)arg;
+	struct outbox *ob = &ctx->out;
 
-		switch (*++p) {
-		case 'd':
-			/* check if types requested and received are matching */
-			if ((type[0] != '%') || (type[1] != 'd')) {
-			       LOG_ERR("%s%d", "type error with arg ", i);
-			       return -1;
-			}
-			ej_get_int(jrow, "val", va_arg(ap, int *));
-			break;
-		case 's':
-			/* check if types requested and received are matching */
-			if ((type[0] != '%') || (type[1] != 's')) {
-			       LOG_ERR("%s%d", "type error with arg ", i);
-			       return -1;
-			}
-			ej_get_string(jrow, "val", va_arg(ap, char *));
-			break;
-		default:
-			LOG_ERR("%s", "Error: unsupported argument type");
-			retval = -1;
+	pthread_mutex_lock(&ob->mutex);
+	for (;;) {
+		while (!ob->handoff && !ob->stop)
+			pthread_cond_wait(&ob->kick, &ob->mutex);
+		if (!ob->handoff)
 			break;
-		}
+		ob->handoff = 0;
+		pthread_mutex_unlock(&ob->mutex);
+		outbox_drain(ctx, 1);
+		pthread_mutex_lock(&ob->mutex);
+	}
+	pthread_mutex_unlock(&ob->mutex);
 
-		json_decref(jrow);
+	return NULL;
+}
+
+
+/* the socket is full, the tx thread takes over the token and the rest so
+ * the sender need not wait. Without one it is written here after all. */
+static int outbox_handoff(struct jrpc_ctx *ctx)
+{
+	struct outbox *ob = &ctx->out;
+
+	pthread_mutex_lock(&ob->mutex);
+	if (!ob->thread_on && !ob->stop &&
+	    (pthread_create(&ob->thread, NULL, jrpc_tx_thread, ctx) == 0))
+		ob->thread_on = 1;
+	if (ob->thread_on && !ob->stop) {
+		ob->handoff = 1;
+		pthread_cond_signal(&ob->kick);
+		pthread_mutex_unlock(&ob->mutex);
+		return 0;
 	}
-	json_decref(jarray);
-	va_end(ap);
+	pthread_mutex_unlock(&ob->mutex);
 
-	return retval;
+	return outbox_drain(ctx, 1);
 }
 
 
 /******************************************************************************
- * jrpc_exit
+ * outbox_drain
  *
- * This function informs daemon to destroy all the interfaces published and 
- * destroys any local memory
+ * Writes what is queued till the outbox is empty, by the holder of the
+ * writer token, which lets go of it at the end. Messages pushed meanwhile
+ * go out in the same sendmsg, so under load many messages are written per
+ * system call. A sender (wait 0) does not wait for the socket: what it does
+ * not take right away is left to the tx thread. The tx thread and polled
+ * contexts (wait 1) wait till it is all written.
  */
-int jrpc_exit(void)
+static int outbox_drain(struct jrpc_ctx *ctx, int wait)
 {
-	char buffer[BUFF_SIZE];
-	int retval, sockfd;
-	json_t *jroot;
+	struct outbox *ob = &ctx->out;
+	struct iovec iov[MAX_IOV];
+	struct msghdr mh;
+	struct out_msg *msg, *next, *batch, *last;
+	int n;
 
-	retval = 0;
+	for (;;) {
+		/* what was pushed since goes behind the queue, oldest first */
+		batch = __atomic_exchange_n(&ob->head, NULL, __ATOMIC_ACQUIRE);
+		for (last = batch, msg = NULL; batch != NULL; batch = next) {
+			next = batch->next;
+			batch->next = msg;
+			msg = batch;
+		}
+		if (msg != NULL) {
+			if (ob->tail != NULL)
+				ob->tail->next = msg;
+			else
+				ob->queue = msg;
+			ob->tail = last;
+		}
 
-	/* translate the call info to json format */
-	jroot = json_object();
-	ej_add_string(&jroot, "api", "exit");
-	ej_add_string(&jroot, "snode", ThisNode.name);
+		if (ob->failed)
+			outbox_discard(ob);
 
-	memset(buffer, 0x0, BUFF_SIZE);
-	ej_store_buf(jroot, buffer, BUFF_SIZE);
-	json_decref(jroot);
+		/* let go of the token. A message pushed while we had it, by
+		 * a sender that found it taken, is still ours to write. */
+		if (ob->queue == NULL) {
+			__atomic_store_n(&ob->writing, 0, __ATOMIC_RELEASE);
+			if ((__atomic_load_n(&ob->head, __ATOMIC_ACQUIRE) ==
+			     NULL) || !take_token(ob))
+				return ob->failed ? -1 : 0;
+			continue;
+		}
 
-	/* send the return info to jrpcd */
-	sockfd = get_sockfd();
-	if(sockfd < 0) {
-		LOG_ERR("%s", "Error: jrpc_exit cannot be completed!");
-		/* proceed and cleanup anyway */
-	} else {
-		write(sockfd, buffer, strlen(buffer));
+		memset(&mh, 0, sizeof(mh));
+		for (n = 0, msg = ob->queue; (msg != NULL) && (n < MAX_IOV);
+		     msg = msg->next, n++) {
+			iov[n].iov_base = msg->data + (n ? 0 : ob->sent);
+			iov[n].iov_len = msg->len - (n ? 0 : ob->sent);
+		}
+		mh.msg_iov = iov;
+		mh.msg_iovlen = n;
+		n = sendmsg(ctx->sockfd, &mh,
+			    MSG_NOSIGNAL | (wait ? 0 : MSG_DONTWAIT));
+		if (n >= 0) {
+			outbox_consume(ob, n);
+		} else if (errno == EINTR) {
+			continue;
+		} else if (!wait && ((errno == EAGAIN) ||
+				     (errno == EWOULDBLOCK))) {
+			return outbox_handoff(ctx);
+		} else {
+			LOG_ERR("%s", "Error: write to jrpcd failed");
+			ob->failed = 1;
+		}
 	}
-
-	close(get_sockfd());
-	ClientState = JRPC_OFF;
-	usleep(10000); /* give 10ms deadline for the rx thread to exit */
-
-	if(ThisNode.ifl != NULL)
-		free(ThisNode.ifl);
-
-	pthread_mutex_destroy(&rcall_mutex);
-	pthread_cond_destroy(&rcall_condvar);
-	pthread_mutex_destroy(&ret_mutex);
-	pthread_cond_destroy(&ret_condvar);
-
-	return retval;
 }
 
 
 /******************************************************************************
- * jrpc_rcall
+ * outbox_put
  *
- * This function does a reverse call by translating the json text received from
- * the socket connection to a function call.
+ * Queues a message for jrpcd. If nothing is queued and nobody is writing it
+ * is sent right away, from buffer. Otherwise it is copied to the outbox
+ * and written by whoever holds the writer token, this thread if it can get
+ * it. A polled context only batches, till jrpc_ctx_flush or till
+ * TX_BUFF_SIZE is queued. When the outbox is full the sender waits for
+ * room or fails, see jrpc_ctx_set_outbox.
  */
-int jrpc_rcall(char *buffer)
+static int outbox_put(struct jrpc_ctx *ctx, char *buffer, int len)
 {
-	json_t *jroot;
-	json_t *jobj;
-        void *result;
-	char *rfmt, *afmt;
-	int i, sockfd, retval;
-	char interface[NAME_SIZE];
-	char caller[NAME_SIZE];
-	char sendbuf[BUFF_SIZE], resultbuf[BUFF_SIZE];
-	int (*fnptr)(void*, char*);
+	struct outbox *ob = &ctx->out;
+	struct out_msg *msg;
+	int max, queued, n = 0, have_token = 0, queue_first = 0;
 
-	result = (void *)resultbuf;
+	if (ob->failed)
+		return -1;
 
-	/* load buffer */
-	jroot = json_object();
-	ej_load_buf(buffer, &jroot);
+	max = (ob->max_bytes > 0) ? ob->max_bytes : OUTBOX_SIZE;
+	if (__atomic_load_n(&ob->bytes, __ATOMIC_SEQ_CST) + len > max) {
+		if (ctx->polled) {
+			if (take_token(ob) && (outbox_drain(ctx, 1) < 0))
+				return -1;
+		} else if (ob->nonblock) {
+			LOG_ERR("%s", "Error: outbox to jrpcd is full");
+			errno = EAGAIN;
+			return -1;
+		} else {
+			pthread_mutex_lock(&ob->mutex);
+			__atomic_add_fetch(&ob->waiters, 1, __ATOMIC_SEQ_CST);
+			while (!ob->failed && !ob->stop) {
+				queued = __atomic_load_n(&ob->bytes,
+							 __ATOMIC_SEQ_CST);
+				if ((queued == 0) || (queued + len <= max))
+					break;
+				pthread_cond_wait(&ob->room, &ob->mutex);
+			}
+			__atomic_sub_fetch(&ob->waiters, 1, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&ob->mutex);
+		}
+	}
 
-	/* decode the interface name */
-	ej_get_string(jroot, "if", interface);
-	ej_get_string(jroot, "snode", caller);
-	for (i = 0; i < ThisNode.n_if; i++) {
-		if (strcmp(interface, ThisNode.ifl[i].if_name) == 0) {
-			fnptr = ThisNode.ifl[i].fnptr;
-			afmt = ThisNode.ifl[i].afmt;
-			JMsgRcall = jroot; // note: consumed by jrpc_scanargs()
-			LOG_VERBOSE("%s(void*, %s)", interface, afmt);
-			retval = fnptr(result, afmt);
-			JMsgRcall = NULL;
-			rfmt = ThisNode.ifl[i].rfmt;
-			break;
+	/* nothing ahead of it, straight to the socket without a copy */
+	if (!ctx->polled &&
+	    (__atomic_load_n(&ob->head, __ATOMIC_ACQUIRE) == NULL) &&
+	    take_token(ob)) {
+		have_token = 1;
+		if ((ob->queue == NULL) &&
+		    (__atomic_load_n(&ob->head, __ATOMIC_ACQUIRE) == NULL)) {
+			do {
+				n = send(ctx->sockfd, buffer, len,
+					 MSG_NOSIGNAL | MSG_DONTWAIT);
+			} while ((n < 0) && (errno == EINTR));
+			if ((n < 0) && (errno != EAGAIN) &&
+			    (errno != EWOULDBLOCK)) {
+				LOG_ERR("%s", "Error: write to jrpcd failed");
+				ob->failed = 1;
+			}
+			if (n == len)
+				return (outbox_drain(ctx, 0) < 0) ? -1 : len;
+			/* the socket is full, the rest is queued. Messages
+			 * pushed meanwhile go behind it. */
+			if (n > 0) {
+				buffer += n;
+				len -= n;
+				n = 0;
+				queue_first = 1;
+			} else if (!ob->failed) {
+				queue_first = 1;
+			}
 		}
 	}
-	json_decref(jroot);
 
-	if (i >= ThisNode.n_if) {
-		LOG_ERR("%s: %s()", "invalid interface", interface);
-		return -1;
+	msg = malloc(sizeof(*msg) + len);
+	if (msg == NULL) {
+		LOG_ERR("%s", "Error: out of memory");
+		ob->failed = 1;
+	} else {
+		msg->len = len;
+		memcpy(msg->data, buffer, len);
+		__atomic_add_fetch(&ob->bytes, len, __ATOMIC_SEQ_CST);
+	}
+	if ((msg != NULL) && queue_first) {
+		msg->next = NULL;
+		ob->queue = ob->tail = msg;
+		ob->sent = 0;
+	} else if (msg != NULL) {
+		msg->next = __atomic_load_n(&ob->head, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&ob->head, &msg->next, msg,
+						    1, __ATOMIC_RELEASE,
+						    __ATOMIC_RELAXED))
+			;
 	}
 
-	if ((retval < 0) || (result == NULL)) {
-		LOG_ERR("%s", "rcall failed!");
-		LOG_INFO("retval %d, result %p", retval, result);
-		return -1;
+	if (ctx->polled) {
+		if ((__atomic_load_n(&ob->bytes, __ATOMIC_SEQ_CST) >
+		     TX_BUFF_SIZE) && take_token(ob) &&
+		    (outbox_drain(ctx, 1) < 0))
+			return -1;
+	} else if (have_token || take_token(ob)) {
+		outbox_drain(ctx, 0);
 	}
 
-	// populate the result and send it back to the caller
-	jroot = json_object();
-	ej_add_string(&jroot, "api", "return");
-	ej_add_string(&jroot, "snode", ThisNode.name);
-	ej_add_string(&jroot, "dnode", caller);
-	ej_add_string(&jroot, "if", interface);
+	return ((msg != NULL) && !ob->failed) ? len : -1;
+}
 
-	jobj = json_object();
-	json_object_set(jroot, "ret", jobj);
 
-	ej_add_string(&jobj, "type", rfmt);
-	if ((rfmt[0] == '%') && (rfmt[1] == 'd'))
-		ej_add_int(&jobj, "val", *((int*)result));
-	else
-		ej_add_string(&jobj, "val", ((char*)result));
+/* writes out what a polled context has batched, or waits up to timeout_ms
+ * for the tx thread and senders of a threaded one to get it all out */
+static int outbox_flush(struct jrpc_ctx *ctx, int timeout_ms)
+{
+	struct outbox *ob = &ctx->out;
+	struct timespec ts;
 
-	memset(sendbuf, 0x0, BUFF_SIZE);
-	ej_store_buf(jroot, sendbuf, BUFF_SIZE);
-	json_decref(jobj);
-	json_decref(jroot);
+	if (ctx->polled) {
+		if (take_token(ob))
+			return outbox_drain(ctx, 1);
+		return ob->failed ? -1 : 0;
+	}
 
-	/* send the return info to jrpcd */
-	sockfd = get_sockfd();
-	if(sockfd < 0) {
-		LOG_ERR("%s", "Error: jrpc_rcall cannot be completed!");
-		return -1;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&ob->mutex);
+	__atomic_add_fetch(&ob->waiters, 1, __ATOMIC_SEQ_CST);
+	while (!ob->failed &&
+	       (__atomic_load_n(&ob->bytes, __ATOMIC_SEQ_CST) > 0)) {
+		if (pthread_cond_timedwait(&ob->room, &ob->mutex, &ts) ==
+		    ETIMEDOUT)
+			break;
 	}
-	write(sockfd, sendbuf, strlen(sendbuf));
+	__atomic_sub_fetch(&ob->waiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&ob->mutex);
 
-	return 0;
+	return (ob->failed || (ob->bytes > 0)) ? -1 : 0;
 }
 
 
-/******************************************************************************
- * jrpc_call
- *
- * This function converts local function call into a remote call by translating
- * the information into a json formatted buffer and transmit the same to jrpc
- * daemon process.
- */
-int jrpc_call(char *node, char *if_name, void *ret, char *afmt, ...)
+static void outbox_init(struct outbox *ob)
 {
-	int retval, sockfd;
-	va_list ap; /* var argument pointer */
-	char *p;
-	char buffer[BUFF_SIZE];
-	char rfmt[NAME_SIZE];
-	int retry_cnt;
+	ob->head = NULL;
+	ob->queue = NULL;
+	ob->tail = NULL;
+	ob->sent = 0;
+	ob->writing = 0;
+	ob->bytes = 0;
+	ob->failed = 0;
+	ob->waiters = 0;
+	ob->handoff = 0;
+	ob->stop = 0;
+	ob->thread_on = 0;
+	pthread_mutex_init(&ob->mutex, NULL);
+	pthread_cond_init(&ob->room, NULL);
+	pthread_cond_init(&ob->kick, NULL);
+}
 
-	json_t *jroot;
-	json_t *jarray;
-	json_t *jrow;
 
-	struct timespec ts;
+/* stops the tx thread and drops what could not be sent. The socket must
+ * be shut down first, so a write stuck on it returns. */
+static void outbox_close(struct jrpc_ctx *ctx)
+{
+	struct outbox *ob = &ctx->out;
 
-	/* wait till libjrpc is initialized */
-	retry_cnt = 10;
-	while (ClientState != JRPC_INITIALISED) {
-		usleep(100*1000);
-		if (retry_cnt-- <= 0)
-			break;
+	pthread_mutex_lock(&ob->mutex);
+	ob->stop = 1;
+	ob->failed = 1;
+	pthread_cond_broadcast(&ob->kick);
+	pthread_cond_broadcast(&ob->room);
+	pthread_mutex_unlock(&ob->mutex);
+	if (ob->thread_on) {
+		pthread_join(ob->thread, NULL);
+		ob->thread_on = 0;
 	}
 
-	/* translate the call info to json format */
-	jroot = json_object();
-	ej_add_string(&jroot, "api", "call");
-	ej_add_string(&jroot, "snode", ThisNode.name);
-	ej_add_string(&jroot, "dnode", node);
-	ej_add_string(&jroot, "if", if_name);
-	jarray = json_array();
-	json_object_set(jroot, "args", jarray);
+	/* a sender may still hold the token, it lets go soon after */
+	while (!take_token(ob))
+		usleep(1000);
+	outbox_discard(ob);
+	__atomic_store_n(&ob->writing, 0, __ATOMIC_RELEASE);
 
-	retval = 0;
-	va_start(ap, afmt); /* make ap to point 1st unamed arg */
-	for (p = afmt; *p; p++) {
-		if (*p != '%')
-			continue;
+	pthread_cond_destroy(&ob->room);
+	pthread_cond_destroy(&ob->kick);
+	pthread_mutex_destroy(&ob->mutex);
+}
 
-		jrow = json_object();
 
-		switch(*++p) {
-		case 'd':
-			ej_add_string(&jrow, "type", "%d");
-			ej_add_int(&jrow, "val", va_arg(ap, int));
-			break;
-		case 's':
-			ej_add_string(&jrow, "type", "%s");
-			ej_add_string(&jrow, "val", va_arg(ap, char *));
-			break;
-		default:
-			LOG_ERR("%s", "Error: unsupported argument type");
-			retval = -1;
-			break;
-		}
+/* a new connection to jrpcd takes the place of the broken one. What the
+ * old one did not take is dropped, the calls in it were failed already. */
+static void outbox_reset(struct jrpc_ctx *ctx, int sockfd)
+{
+	struct outbox *ob = &ctx->out;
 
-		json_array_append(jarray, jrow);
-		json_decref(jrow);
-	}
-	va_end(ap);
-	memset(buffer, 0x0, BUFF_SIZE);
-	ej_store_buf(jroot, buffer, BUFF_SIZE);
-	json_decref(jarray);
-	json_decref(jroot);
+	/* a writer on the old socket fails soon, it was shut down */
+	while (!take_token(ob))
+		usleep(1000);
+	outbox_discard(ob);
+	close(ctx->sockfd);
+	ctx->sockfd = sockfd;
+	ob->failed = 0;
+	__atomic_store_n(&ob->writing, 0, __ATOMIC_RELEASE);
+}
 
-	/* send the translated call info to jrpcd */
-	sockfd = get_sockfd();
-	if(sockfd < 0) {
-		LOG_ERR("%s", "Error: jrpc_call cannot be completed!");
-		return -1;
-	}
-	write(sockfd, buffer, strlen(buffer));
 
-	/* wait for the call to return and process the ret val */
-	(void) pthread_mutex_lock(&rcall_mutex);
-	clock_gettime(CLOCK_REALTIME, &ts);
-	ts.tv_sec += 5;
-	pthread_cond_timedwait(&rcall_condvar, &rcall_mutex, &ts);
-	(void) pthread_mutex_unlock(&rcall_mutex);
-
-	/* get the json structure from remote node and check for errors */
-	jroot = get_calljson();
-	if (jroot == NULL) {
-		LOG_ERR("%s", "call-json pointer is NULL");
-		goto error;
-	}
-	jrow = json_object_get(jroot, "ret");
-	if (jrow == NULL) {
-		LOG_ERR("%s", "can't get return structure");
-		goto error;
-	}
+/* messages to jrpcd go through the outbox, or straight to it if it is
+ * linked into this process. Direct links take one writer at a time. */
+static int send_msg(struct jrpc_ctx *ctx, int fd, char *buffer)
+{
+	int len = strlen(buffer);
 
-	/* get return value from json and check for errors */
-	ej_get_string(jrow, "type", rfmt);
-	if ((retval == -1) || (rfmt == NULL) || (rfmt[0] != '%')) {
-		LOG_ERR("%s", "error! check arg and ret formats");
-		LOG_VERBOSE("if_name: %s, afmt = %s, rfmt = %s", if_name, afmt,
-			    rfmt);
-		*((int*)ret) = 0;
-		json_decref(jrow);
-		goto error;
-	}
+	if ((ctx->transport != NULL) && (fd == EMBED_FD))
+		return ctx->transport->send(ctx->transport_link, buffer, len);
+	if (fd == ctx->sockfd)
+		return outbox_put(ctx, buffer, len);
 
-	/* copy result to return argument from the caller */
-	if ((rfmt[0] == '%') && (rfmt[1] == 'd'))
-		ej_get_int(jrow, "val", ((int*)ret));
-	else
-		ej_get_string(jrow, "val", ((char*)ret));
+	pthread_mutex_lock(&ctx->link_mutex);
+	len = write_all(fd, buffer, len);
+	pthread_mutex_unlock(&ctx->link_mutex);
+	return len;
+}
 
-	/* clean up and notify */
-	json_decref(jrow);
-	pthread_cond_signal(&ret_condvar);
 
-	return 0;
+/* node of this process registered with name, if any */
+static struct node_details *find_node(struct jrpc_ctx *ctx, const char *name)
+{
+	int i;
 
-error:
-	pthread_cond_signal(&ret_condvar);
-	return -1;
+	if ((name == NULL) || (name[0] == '\0'))
+		return NULL;
+	if (strcmp(name, ctx->this_node.name) == 0)
+		return &ctx->this_node;
+	for (i = 0; i < MAX_NODES; i++) {
+		if (strcmp(name, ctx->nodes[i].name) == 0)
+			return &ctx->nodes[i];
+	}
+	return NULL;
 }
 
 
-/****************************************************************************** 
- * jrpc_register
- *
- * This function converts the interface list to json formatted text via socket
- */
-int jrpc_register(char *node, int n_if, struct if_details *ifl, void *cbptr)
+static json_t* get_rcalljson(void)
 {
-	json_t *jroot;
-	json_t *jarray;
-	int size, i, sockfd;
-	char buffer[BUFF_SIZE];
-	int retry_cnt;
+	return JMsgRcall;
+}
 
-	if ( (node == NULL) || ((n_if > 0) && (ifl == NULL))) {
-		LOG_ERR("%s", "Error: input pointers not correct");
-		return -1;
-	}
 
-	/* wait till libjrpc is initialized */
-	retry_cnt = 10;
-	while (ClientState != JRPC_INITIALISED) {
-		usleep(100*1000);
-		if (retry_cnt-- <= 0)
+/* deadlines are on the monotonic clock, the same for jrpcd and all nodes */
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static int pump(struct jrpc_ctx *ctx, int timeout_ms);
+
+
+/* reserve a slot for a call, the id in it goes out with the call */
+static struct call_slot *get_slot(struct jrpc_ctx *ctx, void *ret,
+				  struct jrpc_result *res, int max_res)
+{
+	struct call_slot *slot = NULL;
+	int i;
+
+	pthread_mutex_lock(&ctx->call_mutex);
+	for (i = 0; i < MAX_CALLS; i++) {
+		if (ctx->slots[i].id == 0) {
+			slot = &ctx->slots[i];
 			break;
+		}
+	}
+	if (slot != NULL) {
+		if (++ctx->call_id_next <= 0)
+			ctx->call_id_next = 1;
+		slot->id = ctx->call_id_next;
+		slot->done = 0;
+		slot->status = JRPC_EFAIL;
+		slot->ret = ret;
+		slot->res = res;
+		slot->max_res = max_res;
+		slot->n_res = 0;
+		slot->waiting = -1;
+		slot->fd = -1;
+		slot->done_fn = NULL;
 	}
+	pthread_mutex_unlock(&ctx->call_mutex);
 
-	/* convert if_details to json format */
-	jroot = json_object();
-	ej_add_string(&jroot, "api", "register");
-	ej_add_string(&jroot, "snode", node);
-	jarray = json_array();
-	json_object_set(jroot, "interfaces", jarray);
-	for (i = 0; i < n_if; i++) {
-		json_t *jrow = json_object();
+	if (slot == NULL)
+		LOG_ERR("%s", "Error: too many calls in flight");
+	return slot;
+}
 
-		ej_add_string(&jrow, "if", ifl[i].if_name);
-		ej_add_string(&jrow, "arg", ifl[i].afmt);
-		ej_add_string(&jrow, "ret", ifl[i].rfmt);
 
-		json_array_append(jarray, jrow);
-		json_decref(jrow);
+/* wait till the call is done or timeout_ms passed, then free the slot.
+ * n_res gets the number of fan-out results, -1 if jrpcd never acked. */
+static int wait_slot(struct jrpc_ctx *ctx, struct call_slot *slot,
+		     int timeout_ms, int *n_res)
+{
+	struct timespec ts;
+	long long dl = now_ms() + timeout_ms;
+	int status;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
 	}
-	memset(buffer, 0x0, BUFF_SIZE);
-	ej_store_buf(jroot, buffer, BUFF_SIZE);
-	json_decref(jarray);
-	json_decref(jroot);
 
-	/* send the json data to jrpcd daemon */
-	sockfd = get_sockfd();
-	if(sockfd < 0) {
-		LOG_ERR("%s", "Error: jrpc_call cannot be completed!");
-		return -1;
+	pthread_mutex_lock(&ctx->call_mutex);
+	while (!slot->done) {
+		if (ctx->polled) {
+			/* nobody else reads the connection, the return is
+			 * read and dispatched right here */
+			pthread_mutex_unlock(&ctx->call_mutex);
+			status = (dl > now_ms()) ? pump(ctx, dl - now_ms()) : -1;
+			pthread_mutex_lock(&ctx->call_mutex);
+			if (status < 0)
+				break;
+			continue;
+		}
+		if (pthread_cond_timedwait(&slot->cond, &ctx->call_mutex, &ts) ==
+		    ETIMEDOUT)
+			break;
 	}
+	status = slot->done ? slot->status : JRPC_ETIMEOUT;
+	if (n_res != NULL)
+		*n_res = (slot->waiting < 0) ? -1 : slot->n_res;
+	slot->id = 0;
+	pthread_mutex_unlock(&ctx->call_mutex);
 
-	write(sockfd, buffer, strlen(buffer));
+	return status;
+}
 
-	/* take a copy of if_details to realize jrpc_rcall */
-	size = n_if * sizeof(struct if_details);
-	strcpy(ThisNode.name, node);
-	ThisNode.n_if = n_if;
-	if (n_if > 0)
-		ThisNode.ifl = malloc(size);
-	else
-		ThisNode.ifl = NULL;
-	memcpy(ThisNode.ifl, ifl, size);
 
-	return 0;
+static struct call_slot *find_slot(struct jrpc_ctx *ctx, int id)
+{
+	int i;
+
+	for (i = 0; i < MAX_CALLS; i++) {
+		if ((id != 0) && (ctx->slots[i].id == id))
+			return &ctx->slots[i];
+	}
+	return NULL;
+}
+
+
+/* hands the result of an async call to its done function and frees the
+ * slot. call_mutex is held on entry and let go. */
+static void finish_async(struct jrpc_ctx *ctx, struct call_slot *slot,
+			 struct jrpc_result *r)
+{
+	jrpc_done_fn done = slot->done_fn;
+	void *arg = slot->done_arg;
+
+	strcpy(r->node, slot->node);
+	slot->done_fn = NULL;
+	slot->id = 0;
+	pthread_mutex_unlock(&ctx->call_mutex);
+
+	done(r, arg);
+}
+
+
+/* completes async calls past their deadline or failed by a broken link,
+ * with all set every one of them. call_mutex is held, it is let go while
+ * done functions run.
+ *
+ * return: deadline of the next async call, 0 if there is none */
+static long long expire_calls(struct jrpc_ctx *ctx, int all)
+{
+	struct jrpc_result r;
+	struct call_slot *slot;
+	long long now, next;
+	int i;
+
+restart:
+	now = now_ms();
+	next = 0;
+	for (i = 0; i < MAX_CALLS; i++) {
+		slot = &ctx->slots[i];
+		if ((slot->id == 0) || (slot->done_fn == NULL))
+			continue;
+		if (all || slot->done || (slot->dl <= now)) {
+			if (slot->done)
+				r.status = slot->status;
+			else
+				r.status = all ? JRPC_EFAIL : JRPC_ETIMEOUT;
+			r.ival = 0;
+			r.sval[0] = '\0';
+			finish_async(ctx, slot, &r);
+			pthread_mutex_lock(&ctx->call_mutex);
+			goto restart;
+		}
+		if ((next == 0) || (slot->dl < next))
+			next = slot->dl;
+	}
+
+	return next;
 }
 
 
 /******************************************************************************
- * jrpc_rx_thread
+ * jrpc_timer_thread
  *
- * This function is created after init. Will send and receive messages from or
- * to jrpc server / daemon
+ * Fails async calls whose return did not come in time. The first async call
+ * of a context starts it, a polled context has none and times its calls out
+ * in jrpc_ctx_process_ready and jrpc_ctx_poll.
  */
-void * jrpc_rx_thread(void *arg)
+static void *jrpc_timer_thread(void *arg)
 {
-	json_t *jroot;
-	int sockfd, len;
-	char buffer[BUFF_SIZE];
-	char token[NAME_SIZE];
-
+	struct jrpc_ctx *ctx = (struct jrpc_ctx *)arg;
 	struct timespec ts;
+	long long next;
 
-	sockfd = *((int *)arg);
-	LOG_VERBOSE("%s %d", "wait for messages from server socket ", sockfd);
-	RxThreadState = JRPC_INITIALISED;
-	while (ClientState >= JRPC_CONNECTED) {
-		memset(buffer, 0x0, BUFF_SIZE);
-		len = read(sockfd, buffer, BUFF_SIZE);
-		if (len < 0) {
-			LOG_ERR("%s", "received error message, retrying...");
-			continue;
-		} 
-		else if (len == 0) {
-			LOG_VERBOSE("%s", "Connection closed by server");
+	pthread_mutex_lock(&ctx->call_mutex);
+	while (ctx->timer_on) {
+		next = expire_calls(ctx, 0);
+		if (!ctx->timer_on)
 			break;
+		if (next == 0) {
+			pthread_cond_wait(&ctx->timer_cond, &ctx->call_mutex);
+			continue;
 		}
-		LOG_VERBOSE("received a message...%d bytes", len);
+		ts.tv_sec = next / 1000;
+		ts.tv_nsec = (next % 1000) * 1000000L;
+		pthread_cond_timedwait(&ctx->timer_cond, &ctx->call_mutex, &ts);
+	}
+	pthread_mutex_unlock(&ctx->call_mutex);
+
+	return NULL;
+}
+
+
+/* reserve a slot for an async call, done gets its return */
+static struct call_slot *get_async_slot(struct jrpc_ctx *ctx, char *node,
+					int timeout_ms, jrpc_done_fn done,
+					void *arg)
+{
+	struct call_slot *slot;
+
+	slot = get_slot(ctx, NULL, NULL, 0);
+	if (slot == NULL)
+		return NULL;
 
-		/* at this point it is expected that the buffer contains a valid
-		 * message from jrpcd in json format */
-		jroot = json_object();
-		ej_load_buf(buffer, &jroot);
-		ej_get_string(jroot, "api", token);
+	pthread_mutex_lock(&ctx->call_mutex);
+	slot->done_fn = done;
+	slot->done_arg = arg;
+	slot->dl = now_ms() + timeout_ms;
+	strncpy(slot->node, node, NAME_SIZE - 1);
+	slot->node[NAME_SIZE - 1] = '\0';
+	if (!ctx->polled && !ctx->timer_on) {
+		ctx->timer_on = 1;
+		if (pthread_create(&ctx->timer_thread, NULL, jrpc_timer_thread,
+				   ctx) != 0) {
+			LOG_ERR("%s", "Error: can't create timer thread");
+			ctx->timer_on = 0;
+		}
+	}
+	pthread_cond_signal(&ctx->timer_cond);
+	pthread_mutex_unlock(&ctx->call_mutex);
+
+	return slot;
+}
+
+
+static void read_msgs(struct jrpc_ctx *ctx, int fd);
+
+
+/* endpoints starting with '@' are in the abstract namespace: nothing shows
+ * up in the file system and the name goes away with the process */
+static socklen_t unix_addr(struct sockaddr_un *addr, const char *path)
+{
+	int len = strlen(path);
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	if (len >= (int)sizeof(addr->sun_path))
+		len = sizeof(addr->sun_path) - 1;
+	memcpy(addr->sun_path, path, len);
+	if (path[0] == '@')
+		addr->sun_path[0] = '\0';
+
+	return offsetof(struct sockaddr_un, sun_path) + len;
+}
+
+
+static struct direct_link *find_link(struct jrpc_ctx *ctx, char *node)
+{
+	int i;
+
+	for (i = 0; i < MAX_LINKS; i++) {
+		if ((ctx->links[i].fd >= 0) && (ctx->links[i].node[0] != '\0') &&
+		    (strcmp(ctx->links[i].node, node) == 0))
+			return &ctx->links[i];
+	}
+	return NULL;
+}
+
+
+/* reads the link till it is closed, then fails the calls still waiting for
+ * a return over it. Later calls to the node go through jrpcd again. */
+static void *jrpc_link_thread(void *arg)
+{
+	struct direct_link *link = (struct direct_link *)arg;
+	struct jrpc_ctx *ctx = link->ctx;
+	int fd, i;
+
+	fd = link->fd;
+	read_msgs(ctx, fd);
+
+	pthread_mutex_lock(&ctx->link_mutex);
+	if (link->node[0] != '\0')
+		LOG_INFO("direct link to %s closed", link->node);
+	link->node[0] = '\0';
+	link->fd = -1;
+	if (--ctx->num_links == 0)
+		pthread_cond_broadcast(&ctx->link_cond);
 
-		/* check for valid api */
-		if (strcmp(token, "call") == 0) {
-			LOG_VERBOSE("%s", "invoking remote call");
-			jrpc_rcall(buffer);
+	pthread_mutex_lock(&ctx->call_mutex);
+	for (i = 0; i < MAX_CALLS; i++) {
+		if ((ctx->slots[i].id != 0) && (ctx->slots[i].fd == fd) &&
+		    !ctx->slots[i].done) {
+			ctx->slots[i].status = JRPC_EFAIL;
+			ctx->slots[i].done = 1;
+			pthread_cond_signal(&ctx->slots[i].cond);
 		}
-		else if (strcmp(token, "return") == 0) {
-			JMsgCall = jroot; // jrpc_call will use this!!
-			LOG_VERBOSE("%s", "handling return of prev call\n");
-			pthread_cond_signal(&rcall_condvar);
+	}
+	/* async calls over the link fail on the timer thread */
+	pthread_cond_signal(&ctx->timer_cond);
+	pthread_mutex_unlock(&ctx->call_mutex);
+	pthread_mutex_unlock(&ctx->link_mutex);
+
+	close(fd);
+	return NULL;
+}
 
-			/* wait for the caller to read the return value */
-			(void) pthread_mutex_lock(&ret_mutex);
-			clock_gettime(CLOCK_REALTIME, &ts);
-			ts.tv_sec += 5;
-			pthread_cond_timedwait(&ret_condvar, &ret_mutex, &ts);
-			(void) pthread_mutex_unlock(&ret_mutex);
-			JMsgCall = NULL;
+
+/* node is "" for a link another node calls us over */
+static int add_link(struct jrpc_ctx *ctx, int fd, char *node)
+{
+	struct direct_link *link = NULL;
+	pthread_t tid;
+	int i, retval = -1;
+
+	pthread_mutex_lock(&ctx->link_mutex);
+	for (i = 0; i < MAX_LINKS; i++) {
+		if (ctx->links[i].fd < 0) {
+			link = &ctx->links[i];
+			break;
 		}
-		else if (strcmp(token, "ack") == 0) {
-			LOG_VERBOSE("%s", "acknowledgment for prev message");
+	}
+	if (link != NULL) {
+		link->fd = fd;
+		link->ctx = ctx;
+		strcpy(link->node, node);
+		if (pthread_create(&tid, NULL, jrpc_link_thread, link) == 0) {
+			pthread_detach(tid);
+			ctx->num_links++;
+			retval = 0;
+		} else {
+			link->fd = -1;
 		}
-		else {
-			LOG_ERR("%s", "received an invalid message");
+	}
+	pthread_mutex_unlock(&ctx->link_mutex);
+
+	if (retval < 0)
+		LOG_ERR("%s", "Error: no room for another direct link");
+	return retval;
+}
+
+
+/* send a call over the direct link to node. Fails if there is none or the
+ * link broke, then the caller sends it to jrpcd instead. */
+static int direct_write(struct jrpc_ctx *ctx, char *node,
+			struct call_slot *slot, char *buffer)
+{
+	struct direct_link *link;
+	int len, retval = -1;
+
+	if (ctx->num_links == 0)
+		return -1;
+
+	pthread_mutex_lock(&ctx->link_mutex);
+	link = find_link(ctx, node);
+	if (link != NULL) {
+		len = strlen(buffer);
+		if (write_all(link->fd, buffer, len) == len) {
+			pthread_mutex_lock(&ctx->call_mutex);
+			slot->fd = link->fd;
+			pthread_mutex_unlock(&ctx->call_mutex);
+			retval = 0;
+		} else {
+			/* wakes up the link thread, which drops the link */
+			LOG_ERR("direct link to %s failed", node);
+			shutdown(link->fd, SHUT_RDWR);
 		}
+	}
+	pthread_mutex_unlock(&ctx->link_mutex);
+
+	return retval;
+}
+
 
-		json_decref(jroot);
+/* abstract sockets have no file permissions, links are only taken from
+ * processes of the same user */
+static int peer_allowed(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+		return 0;
+	return (cred.uid == geteuid());
+}
+
+
+static void *jrpc_accept_thread(void *arg)
+{
+	struct jrpc_ctx *ctx = (struct jrpc_ctx *)arg;
+	int fd;
+
+	for (;;) {
+		fd = accept(ctx->listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (!peer_allowed(fd)) {
+			LOG_ERR("%s", "Error: direct link of another user");
+			close(fd);
+			continue;
+		}
+		if (add_link(ctx, fd, "") < 0)
+			close(fd);
 	}
-	close(sockfd);
-	ClientState = JRPC_OFF;
-	RxThreadState = JRPC_OFF;
 
 	return NULL;
 }
 
 
-/****************************************************************************** 
- * jrpc_init
- *
- * This function initializes local variables and establish connection with 
- * jrpc daemon process.
- */
-int jrpc_init(void)
+/* listen for direct links on an endpoint named after the node and pid,
+ * jrpcd hands it to nodes asking for it with jrpc_direct */
+static int open_endpoint(struct jrpc_ctx *ctx, char *node)
 {
-	int sockfd, status;
-	struct sockaddr_in servaddr;
-	pthread_attr_t attr;
-	int port;
-	char ip[64];
-	int retry_cnt;
+	struct sockaddr_un addr;
+	socklen_t len;
+	int fd;
 
-	if (ClientState != JRPC_OFF) {
-		LOG_ERR("%s", "Error: jrpc_init shall be called only once");
-		return -1;
-	}
-	ClientState = JRPC_CONNECTING;
+	snprintf(ctx->endpoint, sizeof(ctx->endpoint), "@jrpc.%s.%d", node,
+		 getpid());
+	len = unix_addr(&addr, ctx->endpoint);
 
-	/* create a TCP socket for connecting to jrpcd */
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	if (sockfd < 0) {
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
 		LOG_ERR("%s", "Socket error");
 		goto error;
 	}
-
-	SockFd = sockfd;
-	port = DEFAULT_PORT;
-	strcpy(ip, DEFAULT_IP);
-
-        bzero(&servaddr, sizeof(servaddr));
-	servaddr.sin_family = AF_INET;
-	servaddr.sin_port = htons(port);
-	status = inet_pton(AF_INET, ip, &servaddr.sin_addr);
-	if (status <= 0) {
-		LOG_ERR("%s", "inet_pton error");
+	if ((bind(fd, (struct sockaddr *)&addr, len) < 0) ||
+	    (listen(fd, MAX_LINKS) < 0)) {
+		LOG_ERR("%s", "Error: can't listen for direct links");
+		close(fd);
 		goto error;
 	}
+	ctx->listen_fd = fd;
 
-	/* Connect to jrpcd */
-	status = connect(sockfd, (const struct sockaddr *) &servaddr,
-			 sizeof(servaddr));
-	if (status < 0) {
-		LOG_ERR("%s", "Error: connect failed!");
+	/* joined when the context closes, see ctx_exit */
+	if (pthread_create(&ctx->accept_thread, NULL, jrpc_accept_thread,
+			   ctx) != 0) {
+		LOG_ERR("%s", "Error: can't create accept thread!");
+		close(fd);
+		ctx->listen_fd = -1;
 		goto error;
 	}
-	ClientState = JRPC_CONNECTED;
 
-	/* Initialize mutex and condition variable objects */
-	pthread_mutex_init(&rcall_mutex, NULL);
-	pthread_cond_init(&rcall_condvar, NULL);
+	return 0;
+error:
+	ctx->endpoint[0] = '\0';
+	return -1;
+}
 
-	/* Create a thread to manage the connection */
-	status = pthread_attr_init(&attr);
-	if (status != 0) {
-		LOG_ERR("%s", "Error: unable to init thread attr");
-		goto error;
+
+/* stop taking direct links, the ones up already stay */
+static void close_endpoint(struct jrpc_ctx *ctx)
+{
+	if (ctx->listen_fd < 0)
+		return;
+	shutdown(ctx->listen_fd, SHUT_RDWR);
+	pthread_join(ctx->accept_thread, NULL);
+	close(ctx->listen_fd);
+	ctx->listen_fd = -1;
+	ctx->endpoint[0] = '\0';
+}
+
+
+/* copy the "ret" object of a return, fails if the call did not succeed */
+static int decode_ret(json_t *jret, int *ival, char *sval, int size)
+{
+	json_t *jtype, *jval;
+	const char *rfmt, *str;
+	int len;
+
+	jtype = json_object_get(jret, "type");
+	jval = json_object_get(jret, "val");
+	if (!json_is_string(jtype) || (jval == NULL))
+		return -1;
+
+	rfmt = json_string_value(jtype);
+	if ((rfmt[0] == '%') && (rfmt[1] == 'd')) {
+		*ival = json_integer_value(jval);
+		return 0;
+	}
+	if ((rfmt[0] == '%') && (rfmt[1] == 's') && json_is_string(jval)) {
+		str = json_string_value(jval);
+		len = strlen(str);
+		if (len >= size)
+			len = size - 1;
+		memcpy(sval, str, len);
+		sval[len] = '\0';
+		return 0;
 	}
 
-	status = pthread_create(&RecvThread, &attr, jrpc_rx_thread, &sockfd);
-	pthread_attr_destroy(&attr);
-	if (status != 0) {
-		LOG_ERR("%s", "Error: can't create receive thread!");
-		goto error;
+	/* jrpcd reports failed calls with a plain "int" type */
+	return -1;
+}
+
+
+
+/* jrpc_scanargs for a local_call, types are checked the same way */
+static int scan_local_args(const char *fmt, va_list ap)
+{
+	const char *p;
+	int i, c;
+
+	for (i = c = 0, p = fmt; *p; p++, c++) {
+		if (*p != '%') {
+			LOG_ERR("%s %d", "check format string @", c);
+			continue;
+		}
+		if (i >= NLocalArgs) {
+			LOG_ERR("%s", "too few arguments");
+			return -1;
+		}
+
+		switch (*++p) {
+		case 'd':
+		case 's':
+			if (LocalArgs[i].type != *p) {
+				LOG_ERR("%s%d", "type error with arg ", i + 1);
+				return -1;
+			}
+			if (*p == 'd')
+				*va_arg(ap, int *) = LocalArgs[i].ival;
+			else
+				strcpy(va_arg(ap, char *), LocalArgs[i].sval);
+			break;
+		default:
+			LOG_ERR("%s", "Error: unsupported argument type");
+			return -1;
+		}
+		i++;
+	}
+
+	return 0;
+}
+
+
+/******************************************************************************
+ * jrpc_scanargs
+ *
+ * This is a jrpc standard to get arguments for executing a remote procedural
+ * call.
+ */
+int jrpc_scanargs(const char *fmt, ...)
+{
+	json_t *jmsg, *jarray, *jrow;
+	const char *p;
+	int argc, retval = 0, i, c;
+	va_list ap; /* var argument pointer */
+	char type[16];
+
+	/* a call from this process has its args at hand */
+	if (LocalArgs != NULL) {
+		va_start(ap, fmt);
+		retval = scan_local_args(fmt, ap);
+		va_end(ap);
+		return retval;
 	}
 
-	/* wait till rx thread is initialized */
-	retry_cnt = 10;
-	while (RxThreadState != JRPC_INITIALISED) {
-		usleep(100*1000);
-		if (retry_cnt-- <= 0)
-			goto error;
+	/* parse the argument secion of incoming message */
+	jmsg = get_rcalljson();
+	jarray = json_object_get(jmsg, "args");
+	if ((jarray == NULL) || (0 == (argc = json_array_size(jarray))))
+	{
+		LOG_ERR("%s", "no array element \'ecus\' found");
+		return -1;
 	}
-	ClientState = JRPC_INITIALISED;
 
 
-	return 0;
-error:
-	SockFd = 0;
-	ClientState = JRPC_OFF;
-	return -1;
+	va_start(ap, fmt); /* make ap to point 1st unamed arg */
+	for (i = c = 0, p = fmt; *p; p++, c++) {
+		if (*p != '%') {
+			LOG_ERR("%s %d", "check format string @", c);
+			continue;
+		}
+
+		jrow = json_array_get(jarray, i++);
+		if (!json_is_object(jrow)) {
+			LOG_ERR("%s", "json array access failure");
+			return -1;
+		}
+		ej_get_string(jrow, "type", type);
+
+		switch (*++p) {
+		case 'd':
+			/* check if types requested and received are matching */
+			if ((type[0] != '%') || (type[1] != 'd')) {
+			       LOG_ERR("%s%d", "type error with arg ", i);
+			       return -1;
+			}
+			ej_get_int(jrow, "val", va_arg(ap, int *));
+			break;
+		case 's':
+			/* check if types requested and received are matching */
+			if ((type[0] != '%') || (type[1] != 's')) {
+			       LOG_ERR("%s%d", "type error with arg ", i);
+			       return -1;
+			}
+			ej_get_string(jrow, "val", va_arg(ap, char *));
+			break;
+		default:
+			LOG_ERR("%s", "Error: unsupported argument type");
+			retval = -1;
+			break;
+		}
+	}
+	va_end(ap);
+
+	return retval;
+}
+
+
+/******************************************************************************
+ * jrpc_getargs
+ *
+ * jrpc_scanargs without a format string: copies the args of the call running
+ * on this thread to args as they came, the interface checks their types. A
+ * string points into the call and is good till the interface returns.
+ *
+ * return: number of args or -1
+ */
+int jrpc_getargs(struct jrpc_arg *args, int max_args)
+{
+	json_t *jarray, *jrow, *jval;
+	const char *type;
+	int i, n;
+
+	/* a call from this process has its args at hand */
+	if (LocalArgs != NULL) {
+		if (NLocalArgs > max_args) {
+			LOG_ERR("%s", "too many arguments");
+			return -1;
+		}
+		memcpy(args, LocalArgs, NLocalArgs * sizeof(*args));
+		return NLocalArgs;
+	}
+
+	jarray = json_object_get(get_rcalljson(), "args");
+	if (!json_is_array(jarray)) {
+		LOG_ERR("%s", "no argument array found");
+		return -1;
+	}
+	n = json_array_size(jarray);
+	if (n > max_args) {
+		LOG_ERR("%s", "too many arguments");
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		jrow = json_array_get(jarray, i);
+		type = json_string_value(json_object_get(jrow, "type"));
+		jval = json_object_get(jrow, "val");
+		if ((type == NULL) || (type[0] != '%') || (jval == NULL)) {
+			LOG_ERR("%s%d", "bad arg ", i + 1);
+			return -1;
+		}
+
+		args[i].type = type[1];
+		args[i].ival = 0;
+		args[i].sval = NULL;
+		if ((type[1] == 'd') && json_is_integer(jval)) {
+			args[i].ival = json_integer_value(jval);
+		} else if ((type[1] == 's') && json_is_string(jval)) {
+			args[i].sval = (char *)json_string_value(jval);
+		} else {
+			LOG_ERR("%s%d", "type error with arg ", i + 1);
+			return -1;
+		}
+	}
+
+	return n;
+}
+
+
+/******************************************************************************
+ * ctx_exit
+ *
+ * This function informs daemon to destroy all the interfaces published and 
+ * destroys any local memory
+ */
+static int ctx_exit(struct jrpc_ctx *ctx)
+{
+	char buffer[BUFF_SIZE];
+	int retval, sockfd, i;
+	struct timespec ts;
+	json_t *jroot;
+
+	retval = 0;
+
+	/* the rx thread stops reconnecting, one that got through first
+	 * is up again and sees the exit like any other */
+	pthread_mutex_lock(&ctx->init_mutex);
+	ctx->closing = 1;
+	pthread_cond_broadcast(&ctx->init_cond);
+	pthread_mutex_unlock(&ctx->init_mutex);
+
+	/* translate the call info to json format */
+	ej_arena_begin();
+	jroot = json_object();
+	ej_add_string(&jroot, "api", "exit");
+	ej_add_string(&jroot, "snode", ctx->this_node.name);
+
+	memset(buffer, 0x0, BUFF_SIZE);
+	ej_store_buf(jroot, buffer, BUFF_SIZE);
+	json_decref(jroot);
+	ej_arena_end();
+
+	/* send the return info to jrpcd */
+	sockfd = get_sockfd(ctx);
+	if(sockfd < 0) {
+		LOG_ERR("%s", "Error: jrpc_exit cannot be completed!");
+		/* proceed and cleanup anyway */
+	} else {
+		send_msg(ctx, sockfd, buffer);
+	}
+
+	/* the rx thread closes the socket once it stops reading, a polled
+	 * context has none */
+	if (ctx->polled && (sockfd >= 0)) {
+		outbox_flush(ctx, 0);
+		close(sockfd);
+	} else if ((ctx->transport == NULL) && (sockfd >= 0)) {
+		outbox_flush(ctx, CALL_TIMEOUT_MS);
+		shutdown(sockfd, SHUT_RDWR);
+	}
+	set_state(ctx, JRPC_OFF);
+
+	/* close direct links, their threads clean up after them */
+	close_endpoint(ctx);
+	pthread_mutex_lock(&ctx->link_mutex);
+	for (i = 0; i < MAX_LINKS; i++) {
+		if (ctx->links[i].fd >= 0)
+			shutdown(ctx->links[i].fd, SHUT_RDWR);
+	}
+	pthread_mutex_unlock(&ctx->link_mutex);
+
+	/* the context may be freed next, nothing may be left running on it.
+	 * jrpcd in process got the exit, the rx thread has nothing more to
+	 * read and the link can go. */
+	if (ctx->rx_joinable) {
+		pthread_join(ctx->recv_thread, NULL);
+		ctx->rx_joinable = 0;
+		/* the rx thread left the socket for the outbox to write on */
+		outbox_close(ctx);
+		if (ctx->transport == NULL)
+			close(ctx->sockfd);
+	} else if (ctx->polled) {
+		outbox_close(ctx);
+	}
+	/* link threads are detached, give them a second to let go of ctx */
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec++;
+	pthread_mutex_lock(&ctx->link_mutex);
+	while (ctx->num_links > 0) {
+		if (pthread_cond_timedwait(&ctx->link_cond, &ctx->link_mutex,
+					   &ts) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&ctx->link_mutex);
+	if (ctx->transport != NULL) {
+		ctx->transport->detach(ctx->transport_link);
+		ctx->transport = NULL;
+		ctx->transport_link = NULL;
+	}
+
+	/* nothing returns the async calls still out anymore, they fail */
+	pthread_mutex_lock(&ctx->call_mutex);
+	if (ctx->timer_on) {
+		ctx->timer_on = 0;
+		pthread_cond_signal(&ctx->timer_cond);
+		pthread_mutex_unlock(&ctx->call_mutex);
+		pthread_join(ctx->timer_thread, NULL);
+		pthread_mutex_lock(&ctx->call_mutex);
+	}
+	expire_calls(ctx, 1);
+	pthread_mutex_unlock(&ctx->call_mutex);
+
+	if(ctx->this_node.ifl != NULL)
+		free(ctx->this_node.ifl);
+	ctx->this_node.ifl = NULL;
+	ctx->this_node.n_if = 0;
+	ctx->this_node.name[0] = '\0';
+	ctx->this_node.n_topics = 0;
+	for (i = 0; i < MAX_NODES; i++) {
+		free(ctx->nodes[i].ifl);
+		memset(&ctx->nodes[i], 0, sizeof(ctx->nodes[i]));
+	}
+
+	for (i = 0; i < MAX_CALLS; i++)
+		pthread_cond_destroy(&ctx->slots[i].cond);
+	pthread_cond_destroy(&ctx->timer_cond);
+	pthread_mutex_destroy(&ctx->call_mutex);
+	pthread_mutex_destroy(&ctx->link_mutex);
+	pthread_mutex_destroy(&ctx->rcall_mutex);
+
+	return retval;
+}
+
+
+/* sends the return of a call back to the caller, over the connection the
+ * call came in on. The caller may be gone. */
+static int send_return(struct jrpc_ctx *ctx, struct jrpc_deferred *call,
+		       void *result)
+{
+	struct ej_out out;
+	char sendbuf[BUFF_SIZE];
+
+	// populate the result and send it back to the caller
+	ej_out_init(&out, sendbuf, BUFF_SIZE);
+	ej_out_open(&out, '{');
+	ej_out_key(&out, "api");
+	ej_out_string(&out, "return");
+	ej_out_key(&out, "snode");
+	ej_out_string(&out, call->callee);
+	ej_out_key(&out, "dnode");
+	ej_out_string(&out, call->caller);
+	ej_out_key(&out, "if");
+	ej_out_string(&out, call->if_name);
+	if (call->xid != 0) {
+		ej_out_key(&out, "xid");
+		ej_out_int(&out, call->xid);
+	} else if (call->id != 0) {
+		ej_out_key(&out, "id");
+		ej_out_int(&out, call->id);
+	}
+
+	ej_out_key(&out, "ret");
+	ej_out_open(&out, '{');
+	ej_out_key(&out, "type");
+	ej_out_string(&out, call->rfmt);
+	ej_out_key(&out, "val");
+	if ((call->rfmt[0] == '%') && (call->rfmt[1] == 'd'))
+		ej_out_int(&out, *((int*)result));
+	else
+		ej_out_string(&out, ((char*)result));
+	ej_out_close(&out, '}');
+	ej_out_close(&out, '}');
+
+	/* send the return info to jrpcd or the caller */
+	if ((ej_out_end(&out) < 0) || (get_sockfd(ctx) < 0) ||
+	    (send_msg(ctx, call->fd, sendbuf) < 0)) {
+		LOG_ERR("%s", "Error: jrpc_rcall cannot be completed!");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/******************************************************************************
+ * jrpc_rcall
+ *
+ * This function does a reverse call by translating the json message received
+ * from the socket connection to a function call. A notification gets no
+ * return, the return of a call goes back over fd, the connection the call
+ * came in on. The call is run by the node of this process it names. An
+ * interface that called jrpc_defer sends its return later, with jrpc_reply.
+ */
+static int jrpc_rcall(struct jrpc_ctx *ctx, json_t *jroot, int notify,
+		      int fd)
+{
+	json_t *jobj;
+        void *result;
+	char *rfmt, *afmt;
+	int i, retval;
+	char resultbuf[BUFF_SIZE];
+	int (*fnptr)(void*, char*);
+	struct node_details *node;
+	struct jrpc_deferred call, *saved_call;
+
+	result = (void *)resultbuf;
+
+	/* decode the interface name */
+	ej_get_string(jroot, "if", call.if_name);
+	ej_get_string(jroot, "snode", call.caller);
+	/* nodes of this process share the connection. jrpcd names the one a
+	 * fan-out call is for, its dnode is the spec the caller gave. */
+	if (ej_get_string(jroot, "lnode", call.callee) < 0)
+		ej_get_string(jroot, "dnode", call.callee);
+	/* jrpcd stamps an xid on calls, it routes the return with it. Calls
+	 * over a direct link have none, their return carries the caller's id */
+	if (ej_get_int(jroot, "xid", &call.xid) < 0)
+		call.xid = 0;
+	if ((call.xid != 0) || (ej_get_int(jroot, "id", &call.id) < 0))
+		call.id = 0;
+	call.ctx = ctx;
+	call.fd = fd;
+	call.deferred = 0;
+
+	/* the caller has given up on the call, don't bother running it */
+	jobj = json_object_get(jroot, "dl");
+	if (json_is_integer(jobj) && (json_integer_value(jobj) <= now_ms())) {
+		LOG_INFO("%s() from %s is past its deadline, skipped",
+			 call.if_name, call.caller);
+		return -1;
+	}
+
+	/* calls from jrpcd and from direct links come in on different
+	 * threads, interfaces still run one at a time */
+	rfmt = NULL;
+	pthread_mutex_lock(&ctx->rcall_mutex);
+	node = find_node(ctx, call.callee);
+	if (node == NULL)
+		node = &ctx->this_node;
+	strcpy(call.callee, node->name);
+	for (i = 0; i < node->n_if; i++) {
+		if (strcmp(call.if_name, node->ifl[i].if_name) == 0) {
+			fnptr = node->ifl[i].fnptr;
+			afmt = node->ifl[i].afmt;
+			rfmt = node->ifl[i].rfmt;
+			strcpy(call.rfmt, rfmt);
+			saved_call = Rcall;
+			Rcall = notify ? NULL : &call;
+			JMsgRcall = jroot; // note: consumed by jrpc_scanargs()
+			LOG_VERBOSE("%s(void*, %s)", call.if_name, afmt);
+			retval = fnptr(result, afmt);
+			JMsgRcall = NULL;
+			Rcall = saved_call;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ctx->rcall_mutex);
+
+	if (rfmt == NULL) {
+		LOG_ERR("%s: %s()", "invalid interface", call.if_name);
+		return -1;
+	}
+
+	/* the interface answers with jrpc_reply */
+	if (call.deferred)
+		return 0;
+
+	if ((retval < 0) || (result == NULL)) {
+		LOG_ERR("%s", "rcall failed!");
+		LOG_INFO("retval %d, result %p", retval, result);
+		return -1;
+	}
+
+	/* nobody waits for the result of a notification */
+	if (notify)
+		return 0;
+
+	return send_return(ctx, &call, result);
+}
+
+
+/* the args of afmt, as jrpc_ctx_callv takes them */
+static int parse_args(char *afmt, va_list ap, struct jrpc_arg *args)
+{
+	int n_args;
+	char *p;
+
+	for (n_args = 0, p = afmt; *p; p++) {
+		if (*p != '%')
+			continue;
+		if (n_args >= MAX_ARGS) {
+			LOG_ERR("%s", "Error: too many arguments");
+			return -1;
+		}
+
+		switch(*++p) {
+		case 'd':
+			args[n_args].type = 'd';
+			args[n_args].ival = va_arg(ap, int);
+			args[n_args].sval = NULL;
+			break;
+		case 's':
+			args[n_args].type = 's';
+			args[n_args].ival = 0;
+			args[n_args].sval = va_arg(ap, char *);
+			break;
+		default:
+			LOG_ERR("%s", "Error: unsupported argument type");
+			return -1;
+		}
+		n_args++;
+	}
+
+	return n_args;
+}
+
+
+/******************************************************************************
+ * encode_args
+ *
+ * Translates a call into a json formatted buffer. api is "call", "mcall",
+ * "notify" or "publish" (node is NULL, if_name is the topic). id lets the
+ * rx thread match the return(s) with the call. Steps in chain
+ * are run by jrpcd after the call, each with the return of the one before.
+ * Nobody waits for the call after timeout_ms, so it carries that deadline.
+ * The text is written straight from the args, no json_t is built for it.
+ */
+static int encode_args(struct jrpc_ctx *ctx, char *api, char *node,
+		       char *if_name, int id, int timeout_ms,
+		       struct jrpc_step *chain, int n_chain, char *buffer,
+		       struct jrpc_arg *args, int n_args)
+{
+	struct ej_out out;
+	int i;
+
+	/* translate the call info to json format */
+	ej_out_init(&out, buffer, BUFF_SIZE);
+	ej_out_open(&out, '{');
+	ej_out_key(&out, "api");
+	ej_out_string(&out, api);
+	ej_out_key(&out, "snode");
+	ej_out_string(&out, ctx->this_node.name);
+	if (node != NULL) {
+		ej_out_key(&out, "dnode");
+		ej_out_string(&out, node);
+	}
+	ej_out_key(&out, "if");
+	ej_out_string(&out, if_name);
+	if (id != 0) {
+		ej_out_key(&out, "id");
+		ej_out_int(&out, id);
+	}
+	if (timeout_ms > 0) {
+		ej_out_key(&out, "dl");
+		ej_out_int(&out, now_ms() + timeout_ms);
+	}
+	if (n_chain > 0) {
+		ej_out_key(&out, "chain");
+		ej_out_open(&out, '[');
+		for (i = 0; i < n_chain; i++) {
+			ej_out_open(&out, '{');
+			ej_out_key(&out, "dnode");
+			ej_out_string(&out, chain[i].node);
+			ej_out_key(&out, "if");
+			ej_out_string(&out, chain[i].if_name);
+			ej_out_close(&out, '}');
+		}
+		ej_out_close(&out, ']');
+	}
+
+	ej_out_key(&out, "args");
+	ej_out_open(&out, '[');
+	for (i = 0; i < n_args; i++) {
+		ej_out_open(&out, '{');
+		switch(args[i].type) {
+		case 'd':
+			ej_out_key(&out, "type");
+			ej_out_string(&out, "%d");
+			ej_out_key(&out, "val");
+			ej_out_int(&out, args[i].ival);
+			break;
+		case 's':
+			ej_out_key(&out, "type");
+			ej_out_string(&out, "%s");
+			ej_out_key(&out, "val");
+			ej_out_string(&out, args[i].sval);
+			break;
+		default:
+			LOG_ERR("%s", "Error: unsupported argument type");
+			return -1;
+		}
+		ej_out_close(&out, '}');
+	}
+	ej_out_close(&out, ']');
+	ej_out_close(&out, '}');
+
+	if (ej_out_end(&out) < 0) {
+		LOG_ERR("%s: %s() %s", node ? node : "", if_name,
+			"does not fit in a message");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* encode_args with the args given by afmt */
+static int encode_call(struct jrpc_ctx *ctx, char *api, char *node,
+		       char *if_name, int id, int timeout_ms,
+		       struct jrpc_step *chain, int n_chain, char *buffer,
+		       char *afmt, va_list ap)
+{
+	struct jrpc_arg args[MAX_ARGS];
+	int n_args;
+
+	n_args = parse_args(afmt, ap, args);
+	if (n_args < 0)
+		return -1;
+
+	return encode_args(ctx, api, node, if_name, id, timeout_ms, chain,
+			   n_chain, buffer, args, n_args);
+}
+
+
+/******************************************************************************
+ * wait_init
+ *
+ * Calls made on a context another thread is opening wait for it to come up,
+ * INIT_TIMEOUT_MS at most. Calls on a context that is up, off, or trying to
+ * reconnect go ahead right away.
+ */
+static void wait_init(struct jrpc_ctx *ctx)
+{
+	struct timespec ts;
+
+	if (ctx->state == JRPC_INITIALISED)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += INIT_TIMEOUT_MS / 1000;
+	ts.tv_nsec += (INIT_TIMEOUT_MS % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+	pthread_mutex_lock(&ctx->init_mutex);
+	while (((ctx->state == JRPC_CONNECTING) ||
+		(ctx->state == JRPC_CONNECTED)) && !ctx->reconnecting) {
+		if (pthread_cond_timedwait(&ctx->init_cond,
+					   &ctx->init_mutex, &ts) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&ctx->init_mutex);
+}
+
+
+/* the return of a call of this process as a jrpc_result, ret is NULL if
+ * the call failed. r->node is left to the caller. */
+static void local_result(struct jrpc_result *r, const char *rfmt, void *ret)
+{
+	r->status = JRPC_EFAIL;
+	r->ival = 0;
+	r->sval[0] = '\0';
+	if ((ret == NULL) || (rfmt[0] != '%'))
+		return;
+
+	if (rfmt[1] == 'd') {
+		r->ival = *((int *)ret);
+		r->status = JRPC_OK;
+	} else if (rfmt[1] == 's') {
+		strncpy(r->sval, (char *)ret, JRPC_RESULT_SIZE - 1);
+		r->sval[JRPC_RESULT_SIZE - 1] = '\0';
+		r->status = JRPC_OK;
+	}
+}
+
+
+/******************************************************************************
+ * local_call
+ *
+ * Runs a call to an interface of a node of this process right away, no json
+ * and no round trip through jrpcd. The args are handed to jrpc_scanargs as
+ * given and the return is copied to ret the way a return from jrpcd would be.
+ * For an async call (done is set) done gets the return instead, unless the
+ * interface defers it: then JRPC_DEFERRED is returned and jrpc_reply calls
+ * done. A sync caller waits up to timeout_ms for a deferred return.
+ */
+static int local_call(struct jrpc_ctx *ctx, struct node_details *node,
+		      char *if_name, void *ret, int timeout_ms,
+		      jrpc_done_fn done, void *done_arg, struct jrpc_arg *args,
+		      int n_args)
+{
+	struct jrpc_arg *saved_args;
+	struct jrpc_deferred call, *saved_call;
+	struct call_slot *slot;
+	struct jrpc_result r;
+	json_t *saved_json;
+	char result[BUFF_SIZE];
+	int i, saved_n, found = 0, retval = -1;
+
+	/* what jrpc_defer needs to answer the call later */
+	call.ctx = ctx;
+	call.fd = -1;
+	call.xid = 0;
+	call.id = 0;
+	call.deferred = 0;
+	strcpy(call.caller, ctx->this_node.name);
+	strcpy(call.callee, node->name);
+	strncpy(call.if_name, if_name, NAME_SIZE - 1);
+	call.if_name[NAME_SIZE - 1] = '\0';
+	call.ret = result;
+	call.timeout_ms = timeout_ms;
+	call.done_fn = done;
+	call.done_arg = done_arg;
+
+	/* an interface may call another one of this process, so the state
+	 * of the one running is put back afterwards */
+	pthread_mutex_lock(&ctx->rcall_mutex);
+	saved_args = LocalArgs;
+	saved_n = NLocalArgs;
+	saved_json = JMsgRcall;
+	saved_call = Rcall;
+	for (i = 0; i < node->n_if; i++) {
+		if (strcmp(if_name, node->ifl[i].if_name) == 0) {
+			strcpy(call.rfmt, node->ifl[i].rfmt);
+			LocalArgs = args;
+			NLocalArgs = n_args;
+			JMsgRcall = NULL;
+			Rcall = &call;
+			retval = node->ifl[i].fnptr(result, node->ifl[i].afmt);
+			found = 1;
+			break;
+		}
+	}
+	LocalArgs = saved_args;
+	NLocalArgs = saved_n;
+	JMsgRcall = saved_json;
+	Rcall = saved_call;
+	pthread_mutex_unlock(&ctx->rcall_mutex);
+
+	if (!found) {
+		LOG_ERR("%s: %s()", "invalid interface", if_name);
+		return -1;
+	}
+
+	/* the interface answers with jrpc_reply, to the slot jrpc_defer
+	 * took for the call */
+	if (call.deferred) {
+		if (done != NULL)
+			return JRPC_DEFERRED;
+		pthread_mutex_lock(&ctx->call_mutex);
+		slot = find_slot(ctx, call.id);
+		pthread_mutex_unlock(&ctx->call_mutex);
+		retval = ((slot != NULL) &&
+			  (wait_slot(ctx, slot, timeout_ms, NULL) == JRPC_OK)) ?
+			 0 : -1;
+	}
+
+	if ((retval < 0) || (call.rfmt[0] != '%') ||
+	    ((call.rfmt[1] != 'd') && (call.rfmt[1] != 's'))) {
+		LOG_ERR("%s: %s() failed", node->name, if_name);
+		retval = -1;
+	}
+	if (done != NULL) {
+		local_result(&r, call.rfmt, (retval < 0) ? NULL : result);
+		strcpy(r.node, node->name);
+		done(&r, done_arg);
+		return 0;
+	}
+	if (retval < 0)
+		return -1;
+
+	if (call.rfmt[1] == 'd') {
+		*((int *)ret) = *((int *)result);
+	} else {
+		result[BUFF_SIZE - 1] = '\0';
+		strcpy((char *)ret, result);
+	}
+
+	return 0;
+}
+
+
+/* if_name of node may be sent again, see jrpc_ctx_set_idempotent */
+static int is_idempotent(struct jrpc_ctx *ctx, char *node, char *if_name)
+{
+	int i, found = 0;
+
+	pthread_mutex_lock(&ctx->init_mutex);
+	for (i = 0; (i < ctx->n_idempotent) && !found; i++)
+		found = (strcmp(ctx->idempotent[i].node, node) == 0) &&
+			(strcmp(ctx->idempotent[i].if_name, if_name) == 0);
+	pthread_mutex_unlock(&ctx->init_mutex);
+
+	return found;
+}
+
+
+/* ms jrpcd may cache returns of if_name of node, see jrpc_ctx_set_cacheable */
+static int cache_ttl(struct jrpc_ctx *ctx, char *node, char *if_name)
+{
+	int i, ttl_ms = 0;
+
+	pthread_mutex_lock(&ctx->init_mutex);
+	for (i = 0; i < ctx->n_cacheable; i++)
+		if ((strcmp(ctx->cacheable[i].node, node) == 0) &&
+		    (strcmp(ctx->cacheable[i].if_name, if_name) == 0)) {
+			ttl_ms = ctx->cacheable[i].ttl_ms;
+			break;
+		}
+	pthread_mutex_unlock(&ctx->init_mutex);
+
+	return ttl_ms;
+}
+
+
+/* waits till a context that lost jrpcd is connected again, up to dl */
+static int wait_reconnect(struct jrpc_ctx *ctx, long long dl)
+{
+	struct timespec ts;
+	long long left = dl - now_ms();
+	int retval;
+
+	if (left <= 0)
+		return -1;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += left / 1000;
+	ts.tv_nsec += (left % 1000) * 1000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000L;
+	}
+
+	pthread_mutex_lock(&ctx->init_mutex);
+	while (ctx->reconnecting && !ctx->closing) {
+		if (pthread_cond_timedwait(&ctx->init_cond,
+					   &ctx->init_mutex, &ts) == ETIMEDOUT)
+			break;
+	}
+	retval = (ctx->state == JRPC_INITIALISED) ? 0 : -1;
+	pthread_mutex_unlock(&ctx->init_mutex);
+
+	return retval;
+}
+
+
+/* common part of jrpc_call, jrpc_calltm and jrpc_callv */
+static int call_args(struct jrpc_ctx *ctx, char *node, char *if_name,
+		     int timeout_ms, void *ret, struct jrpc_arg *args,
+		     int n_args)
+{
+	int retval, sockfd, left = timeout_ms;
+	long long dl = now_ms() + timeout_ms, settle = 0;
+	char buffer[BUFF_SIZE];
+	struct call_slot *slot;
+	struct node_details *local;
+
+	/* wait till libjrpc is initialized */
+	wait_init(ctx);
+
+	/* this process is the node, no need to go through jrpcd */
+	local = find_node(ctx, node);
+	if ((local != NULL) && !local->grouped)
+		return local_call(ctx, local, if_name, ret, timeout_ms, NULL,
+				  NULL, args, n_args);
+
+retry:
+	slot = get_slot(ctx, ret, NULL, 0);
+	if (slot == NULL)
+		return -1;
+
+	retval = encode_args(ctx, "call", node, if_name, slot->id, left,
+			     NULL, 0, buffer, args, n_args);
+
+	/* send the translated call info to jrpcd */
+	sockfd = get_sockfd(ctx);
+	if((sockfd < 0) || (retval < 0)) {
+		LOG_ERR("%s", "Error: jrpc_call cannot be completed!");
+		wait_slot(ctx, slot, 0, NULL);
+		return -1;
+	}
+	/* unless there is a direct link to the node */
+	if ((direct_write(ctx, node, slot, buffer) < 0) &&
+	    (send_msg(ctx, sockfd, buffer) < 0)) {
+		LOG_ERR("%s", "Error: jrpc_call cannot be completed!");
+		wait_slot(ctx, slot, 0, NULL);
+		return -1;
+	}
+
+	/* the rx thread copies the return value to ret and wakes us up */
+	retval = wait_slot(ctx, slot, left, NULL);
+
+	/* jrpcd went away with the call. One that may run twice is sent
+	 * again once the context is back, if that is within its timeout. The
+	 * node called lost jrpcd too and may register again a little later,
+	 * jrpcd fails the call till then. */
+	if ((retval == JRPC_EDROPPED) && is_idempotent(ctx, node, if_name) &&
+	    (wait_reconnect(ctx, dl) == 0)) {
+		settle = now_ms() + SETTLE_MS;
+		left = dl - now_ms();
+		if (left > 0)
+			goto retry;
+	}
+	if ((retval == JRPC_EFAIL) && (now_ms() < settle)) {
+		usleep(RECONNECT_MIN_MS * 1000);
+		left = dl - now_ms();
+		if (left > 0)
+			goto retry;
+	}
+	if (retval != JRPC_OK) {
+		LOG_ERR("%s: %s() %s", node, if_name,
+			(retval == JRPC_ETIMEOUT) ? "timed out" : "failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int vcall(struct jrpc_ctx *ctx, char *node, char *if_name,
+		 int timeout_ms, void *ret, char *afmt, va_list ap)
+{
+	struct jrpc_arg args[MAX_ARGS];
+	int n_args;
+
+	n_args = parse_args(afmt, ap, args);
+	if (n_args < 0)
+		return -1;
+
+	return call_args(ctx, node, if_name, timeout_ms, ret, args, n_args);
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_call
+ *
+ * This function converts local function call into a remote call by translating
+ * the information into a json formatted buffer and transmit the same to jrpc
+ * daemon process. A call to the node registered by this process itself
+ * skips all that and runs the interface right away, on the calling thread.
+ */
+int jrpc_ctx_call(jrpc_ctx_t *ctx, char *node, char *if_name, void *ret,
+		  char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vcall(ctx, node, if_name, CALL_TIMEOUT_MS, ret, afmt, ap);
+	va_end(ap);
+
+	return retval;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_calltm
+ *
+ * Same as jrpc_ctx_call, but waits timeout_ms for the return. The deadline goes
+ * with the call, so jrpcd and the called node drop it once it has passed
+ * instead of doing work nobody waits for.
+ */
+int jrpc_ctx_calltm(jrpc_ctx_t *ctx, char *node, char *if_name,
+		    int timeout_ms, void *ret, char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vcall(ctx, node, if_name, timeout_ms, ret, afmt, ap);
+	va_end(ap);
+
+	return retval;
+}
+
+
+/* common part of jrpc_call_async and jrpc_call_asyncv */
+static int call_async_args(struct jrpc_ctx *ctx, char *node, char *if_name,
+			   int timeout_ms, jrpc_done_fn done, void *arg,
+			   struct jrpc_arg *args, int n_args)
+{
+	int retval, sockfd, id;
+	char buffer[BUFF_SIZE], result[BUFF_SIZE];
+	struct call_slot *slot;
+	struct node_details *local;
+
+	if (done == NULL) {
+		LOG_ERR("%s", "Error: input pointers not correct");
+		return -1;
+	}
+
+	/* wait till libjrpc is initialized */
+	wait_init(ctx);
+
+	/* this process is the node, done gets the return right away unless
+	 * the interface defers it */
+	local = find_node(ctx, node);
+	if ((local != NULL) && !local->grouped) {
+		retval = local_call(ctx, local, if_name, result, timeout_ms,
+				    done, arg, args, n_args);
+		return (retval < 0) ? -1 : 0;
+	}
+
+	slot = get_async_slot(ctx, node, timeout_ms, done, arg);
+	if (slot == NULL)
+		return -1;
+
+	retval = encode_args(ctx, "call", node, if_name, slot->id, timeout_ms,
+			     NULL, 0, buffer, args, n_args);
+
+	sockfd = get_sockfd(ctx);
+	if((sockfd < 0) || (retval < 0)) {
+		LOG_ERR("%s", "Error: jrpc_call_async cannot be completed!");
+		pthread_mutex_lock(&ctx->call_mutex);
+		slot->done_fn = NULL;
+		slot->id = 0;
+		pthread_mutex_unlock(&ctx->call_mutex);
+		return -1;
+	}
+	/* the rx thread hands the return to done, the call may be done by
+	 * the time the send is */
+	id = slot->id;
+	if ((direct_write(ctx, node, slot, buffer) < 0) &&
+	    (send_msg(ctx, sockfd, buffer) < 0)) {
+		LOG_ERR("%s", "Error: jrpc_call_async cannot be completed!");
+		pthread_mutex_lock(&ctx->call_mutex);
+		if (slot->id == id) {
+			slot->done_fn = NULL;
+			slot->id = 0;
+		}
+		pthread_mutex_unlock(&ctx->call_mutex);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+static int vcall_async(struct jrpc_ctx *ctx, char *node, char *if_name,
+		       int timeout_ms, jrpc_done_fn done, void *arg,
+		       char *afmt, va_list ap)
+{
+	struct jrpc_arg args[MAX_ARGS];
+	int n_args;
+
+	n_args = parse_args(afmt, ap, args);
+	if (n_args < 0)
+		return -1;
+
+	return call_async_args(ctx, node, if_name, timeout_ms, done, arg, args,
+			       n_args);
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_call_async
+ *
+ * Same as jrpc_ctx_calltm, but does not wait: done gets the return once it
+ * is in, or JRPC_ETIMEOUT in res->status once timeout_ms passed. done runs
+ * on the thread that read the return, so it must not wait for a call on
+ * the same context. For a call to a node of this process it runs before
+ * jrpc_ctx_call_async returns, unless the interface used jrpc_defer.
+ *
+ * return: 0 once the call is out, -1 if it is not and done won't be called
+ */
+int jrpc_ctx_call_async(jrpc_ctx_t *ctx, char *node, char *if_name,
+			int timeout_ms, jrpc_done_fn done, void *arg,
+			char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vcall_async(ctx, node, if_name, timeout_ms, done, arg, afmt,
+			     ap);
+	va_end(ap);
+
+	return retval;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_callv
+ *
+ * jrpc_ctx_calltm with args typed by the caller instead of an afmt string,
+ * for code that knows the types when it is compiled, see jrpc.hpp. The call
+ * goes out the same.
+ */
+int jrpc_ctx_callv(jrpc_ctx_t *ctx, char *node, char *if_name, int timeout_ms,
+		   void *ret, struct jrpc_arg *args, int n_args)
+{
+	return call_args(ctx, node, if_name, timeout_ms, ret, args, n_args);
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_call_asyncv
+ *
+ * jrpc_ctx_call_async with args typed by the caller, see jrpc_ctx_callv.
+ */
+int jrpc_ctx_call_asyncv(jrpc_ctx_t *ctx, char *node, char *if_name,
+			 int timeout_ms, jrpc_done_fn done, void *arg,
+			 struct jrpc_arg *args, int n_args)
+{
+	return call_async_args(ctx, node, if_name, timeout_ms, done, arg, args,
+			       n_args);
+}
+
+
+/******************************************************************************
+ * jrpc_defer
+ *
+ * Called by an interface that can't answer its call right away, say as it
+ * waits for an async call of its own. Then the return value of the
+ * interface is ignored and the caller gets what is passed to jrpc_reply
+ * later, from any thread. Returns NULL for a notification, nobody waits for
+ * its return.
+ *
+ * return: the call to pass to jrpc_reply or NULL
+ */
+jrpc_deferred_t *jrpc_defer(void)
+{
+	struct jrpc_deferred *call;
+	struct call_slot *slot;
+
+	if ((Rcall == NULL) || Rcall->deferred)
+		return NULL;
+
+	call = malloc(sizeof(*call));
+	if (call == NULL) {
+		LOG_ERR("%s", "Error: out of memory");
+		return NULL;
+	}
+	memcpy(call, Rcall, sizeof(*call));
+
+	/* the caller of a call of this process waits on a slot */
+	if (call->fd < 0) {
+		if (call->done_fn != NULL)
+			slot = get_async_slot(call->ctx, call->callee,
+					      call->timeout_ms, call->done_fn,
+					      call->done_arg);
+		else
+			slot = get_slot(call->ctx, call->ret, NULL, 0);
+		if (slot == NULL) {
+			free(call);
+			return NULL;
+		}
+		/* its return does not go through jrpcd */
+		pthread_mutex_lock(&call->ctx->call_mutex);
+		slot->fd = LOCAL_FD;
+		pthread_mutex_unlock(&call->ctx->call_mutex);
+		call->id = Rcall->id = slot->id;
+	}
+	Rcall->deferred = 1;
+
+	return call;
+}
+
+
+/* jrpc_reply to a call of this process, the return goes to the slot the
+ * caller waits on */
+static int local_reply(struct jrpc_ctx *ctx, struct jrpc_deferred *call,
+		       void *ret)
+{
+	struct call_slot *slot;
+	struct jrpc_result r;
+
+	pthread_mutex_lock(&ctx->call_mutex);
+	slot = find_slot(ctx, call->id);
+	if (slot == NULL) {
+		pthread_mutex_unlock(&ctx->call_mutex);
+		LOG_VERBOSE("late return for call %d, dropped", call->id);
+		return -1;
+	}
+
+	if (slot->done_fn != NULL) {
+		local_result(&r, call->rfmt, ret);
+		finish_async(ctx, slot, &r);
+		return 0;
+	}
+
+	if ((ret != NULL) && (call->rfmt[0] == '%')) {
+		if (call->rfmt[1] == 'd') {
+			*((int *)slot->ret) = *((int *)ret);
+			slot->status = JRPC_OK;
+		} else if (call->rfmt[1] == 's') {
+			strncpy((char *)slot->ret, (char *)ret, BUFF_SIZE - 1);
+			((char *)slot->ret)[BUFF_SIZE - 1] = '\0';
+			slot->status = JRPC_OK;
+		}
+	}
+	slot->done = 1;
+	pthread_cond_signal(&slot->cond);
+	pthread_mutex_unlock(&ctx->call_mutex);
+
+	return 0;
+}
+
+
+/******************************************************************************
+ * jrpc_reply
+ *
+ * Answers a call deferred with jrpc_defer. ret is what the interface would
+ * have filled in, NULL fails the call the way an interface returning -1
+ * does. call is freed.
+ */
+int jrpc_reply(jrpc_deferred_t *call, void *ret)
+{
+	int retval;
+
+	if (call == NULL)
+		return -1;
+
+	if (call->fd < 0) {
+		retval = local_reply(call->ctx, call, ret);
+	} else if (ret == NULL) {
+		LOG_ERR("%s: %s() failed", call->callee, call->if_name);
+		retval = -1;
+	} else {
+		retval = send_return(call->ctx, call, ret);
+	}
+	free(call);
+
+	return retval;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_direct
+ *
+ * Asks jrpcd where node takes calls directly and links up with it. Later
+ * jrpc_call and jrpc_calltm to node go over the link, skipping jrpcd both
+ * ways. Worth it for pairs of nodes with heavy traffic. Other kinds of
+ * calls still go through jrpcd. If the link breaks, calls waiting on it
+ * fail and later ones go through jrpcd again, jrpc_direct may be called
+ * again to relink. Fails if node is remote, a group or has no endpoint, or
+ * if the context is polled. A node has an endpoint if its process set
+ * JRPC_DIRECT=1, links are taken from processes of the same user only.
+ */
+int jrpc_ctx_direct(jrpc_ctx_t *ctx, char *node)
+{
+	char path[BUFF_SIZE];
+	struct sockaddr_un addr;
+	socklen_t len;
+	int fd, linked;
+
+	if (ctx->polled) {
+		LOG_ERR("%s", "Error: no direct links on a polled context");
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->link_mutex);
+	linked = (find_link(ctx, node) != NULL);
+	pthread_mutex_unlock(&ctx->link_mutex);
+	if (linked)
+		return 0;
+
+	if (jrpc_ctx_call(ctx, "jrpcd", "endpoint", path, "%s", node) < 0)
+		return -1;
+
+	len = unix_addr(&addr, path);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		LOG_ERR("%s", "Socket error");
+		return -1;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, len) < 0) {
+		LOG_ERR("Error: can't link to %s at %s", node, path);
+		close(fd);
+		return -1;
+	}
+
+	if (add_link(ctx, fd, node) < 0) {
+		close(fd);
+		return -1;
+	}
+	LOG_INFO("direct link to %s at %s", node, path);
+
+	return 0;
+}
+
+
+/* common part of notifications and publishing, nobody waits for either */
+static int vnotify(struct jrpc_ctx *ctx, char *api, char *node, char *if_name,
+		   char *afmt, va_list ap)
+{
+	int retval, sockfd;
+	char buffer[BUFF_SIZE];
+
+	/* wait till libjrpc is initialized */
+	wait_init(ctx);
+
+	retval = encode_call(ctx, api, node, if_name, 0, 0, NULL, 0, buffer,
+			     afmt, ap);
+
+	sockfd = get_sockfd(ctx);
+	if((sockfd < 0) || (retval < 0)) {
+		LOG_ERR("Error: %s cannot be completed!", api);
+		return -1;
+	}
+
+	return (send_msg(ctx, sockfd, buffer) < 0) ? -1 : 0;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_notify
+ *
+ * One way call. if_name runs on node like with jrpc_call, but there is no
+ * return: the call is sent and jrpc_notify returns right away. Use it for
+ * events where the caller has no use for a result. Delivery is not
+ * confirmed: a notification to a node that does not exist is dropped, and
+ * so is one that finds the node over its jrpcd output budget.
+ */
+int jrpc_ctx_notify(jrpc_ctx_t *ctx, char *node, char *if_name, char *afmt,
+		    ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vnotify(ctx, "notify", node, if_name, afmt, ap);
+	va_end(ap);
+
+	return retval;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_publish
+ *
+ * Sends the arguments to every node subscribed to topic, except this one.
+ * Subscribers get it like a jrpc_notify of the interface named topic, so
+ * the same delivery rules apply. jrpcd sends one copy of the message to
+ * all subscribers, publishing costs the same however many there are.
+ */
+int jrpc_ctx_publish(jrpc_ctx_t *ctx, char *topic, char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vnotify(ctx, "publish", NULL, topic, afmt, ap);
+	va_end(ap);
+
+	return retval;
+}
+
+
+/******************************************************************************
+ * send_topic
+ *
+ * Tells jrpcd about a topic subscribed or unsubscribed after registration.
+ */
+static int send_topic(struct jrpc_ctx *ctx, char *api, char *topic)
+{
+	char buffer[BUFF_SIZE];
+	json_t *jroot;
+	int sockfd;
+
+	ej_arena_begin();
+	jroot = json_object();
+	ej_add_string(&jroot, "api", api);
+	ej_add_string(&jroot, "snode", ctx->this_node.name);
+	ej_add_string(&jroot, "if", topic);
+	memset(buffer, 0x0, BUFF_SIZE);
+	ej_store_buf(jroot, buffer, BUFF_SIZE);
+	json_decref(jroot);
+	ej_arena_end();
+
+	sockfd = get_sockfd(ctx);
+	if(sockfd < 0) {
+		LOG_ERR("Error: %s cannot be completed!", api);
+		return -1;
+	}
+
+	return (send_msg(ctx, sockfd, buffer) < 0) ? -1 : 0;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_subscribe
+ *
+ * Subscribes this node to topic. Messages published to it call the
+ * interface of the node named topic, which must be in the list given to
+ * jrpc_register. Topics subscribed before jrpc_register are sent along with
+ * the registration. Not thread safe, subscribe from one thread.
+ */
+int jrpc_ctx_subscribe(jrpc_ctx_t *ctx, char *topic)
+{
+	int i;
+
+	if ((topic == NULL) || (strlen(topic) >= NAME_SIZE)) {
+		LOG_ERR("%s", "Error: invalid topic");
+		return -1;
+	}
+	for (i = 0; i < ctx->this_node.n_topics; i++) {
+		if (strcmp(ctx->this_node.topics[i], topic) == 0)
+			return 0;
+	}
+	if (ctx->this_node.n_topics >= MAX_TOPICS) {
+		LOG_ERR("%s", "Error: too many topics");
+		return -1;
+	}
+	strcpy(ctx->this_node.topics[ctx->this_node.n_topics++], topic);
+
+	if (ctx->this_node.name[0] == '\0')
+		return 0;
+	return send_topic(ctx, "subscribe", topic);
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_unsubscribe
+ *
+ * Stops delivery of messages published to topic.
+ */
+int jrpc_ctx_unsubscribe(jrpc_ctx_t *ctx, char *topic)
+{
+	int i;
+
+	for (i = 0; i < ctx->this_node.n_topics; i++) {
+		if (strcmp(ctx->this_node.topics[i], topic) == 0)
+			break;
+	}
+	if (i >= ctx->this_node.n_topics)
+		return -1;
+
+	ctx->this_node.n_topics--;
+	memmove(ctx->this_node.topics[i], ctx->this_node.topics[i + 1],
+		(ctx->this_node.n_topics - i) * NAME_SIZE);
+
+	if (ctx->this_node.name[0] == '\0')
+		return 0;
+	return send_topic(ctx, "unsubscribe", topic);
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_call_many
+ *
+ * Calls if_name on many nodes at once. nodes is a comma separated list of
+ * node names or glob patterns like "app_*". jrpcd hands one copy of the call
+ * to every matching node, so the whole fan-out takes as long as the slowest
+ * node. Results are stored in res, one per node, with a status each. Nodes
+ * that have not returned within timeout_ms are marked JRPC_ETIMEOUT.
+ *
+ * return: number of nodes called (at most max_res are stored) or -1
+ */
+static int vcall_many(struct jrpc_ctx *ctx, char *nodes, char *if_name,
+		      struct jrpc_result *res, int max_res, int timeout_ms,
+		      char *afmt, va_list ap)
+{
+	int retval, sockfd, n_res;
+	char buffer[BUFF_SIZE];
+	struct call_slot *slot;
+
+	if ((nodes == NULL) || (res == NULL) || (max_res <= 0)) {
+		LOG_ERR("%s", "Error: input pointers not correct");
+		return -1;
+	}
+
+	/* wait till libjrpc is initialized */
+	wait_init(ctx);
+
+	slot = get_slot(ctx, NULL, res, max_res);
+	if (slot == NULL)
+		return -1;
+
+	retval = encode_call(ctx, "mcall", nodes, if_name, slot->id, timeout_ms,
+			     NULL, 0, buffer, afmt, ap);
+
+	sockfd = get_sockfd(ctx);
+	if((sockfd < 0) || (retval < 0)) {
+		LOG_ERR("%s", "Error: jrpc_call_many cannot be completed!");
+		wait_slot(ctx, slot, 0, NULL);
+		return -1;
+	}
+	if (send_msg(ctx, sockfd, buffer) < 0) {
+		wait_slot(ctx, slot, 0, NULL);
+		return -1;
+	}
+
+	/* results are filled in by the rx thread as the returns come in */
+	retval = wait_slot(ctx, slot, timeout_ms, &n_res);
+	if ((retval == JRPC_EFAIL) || (n_res < 0)) {
+		LOG_ERR("%s: %s() fan-out failed", nodes, if_name);
+		return -1;
+	}
+
+	return n_res;
+}
+
+int jrpc_ctx_call_many(jrpc_ctx_t *ctx, char *nodes, char *if_name,
+		       struct jrpc_result *res, int max_res, int timeout_ms,
+		       char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vcall_many(ctx, nodes, if_name, res, max_res, timeout_ms,
+			    afmt, ap);
+	va_end(ap);
+
+	return retval;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_call_chain
+ *
+ * Runs a pipeline of calls with a single round trip. The first step is called
+ * with the arguments given, every later step gets the value returned by the
+ * step before as its only argument. jrpcd passes the values along and only
+ * the return of the last step comes back, in ret.
+ */
+static int vcall_chain(struct jrpc_ctx *ctx, struct jrpc_step *steps,
+		       int n_steps, void *ret, char *afmt, va_list ap)
+{
+	int retval, sockfd;
+	char buffer[BUFF_SIZE];
+	struct call_slot *slot;
+
+	if ((steps == NULL) || (n_steps <= 0)) {
+		LOG_ERR("%s", "Error: input pointers not correct");
+		return -1;
+	}
+
+	/* wait till libjrpc is initialized */
+	wait_init(ctx);
+
+	slot = get_slot(ctx, ret, NULL, 0);
+	if (slot == NULL)
+		return -1;
+
+	retval = encode_call(ctx, "call", steps[0].node, steps[0].if_name,
+			     slot->id, n_steps * CALL_TIMEOUT_MS, steps + 1,
+			     n_steps - 1, buffer, afmt, ap);
+
+	sockfd = get_sockfd(ctx);
+	if((sockfd < 0) || (retval < 0)) {
+		LOG_ERR("%s", "Error: jrpc_call_chain cannot be completed!");
+		wait_slot(ctx, slot, 0, NULL);
+		return -1;
+	}
+	if (send_msg(ctx, sockfd, buffer) < 0) {
+		wait_slot(ctx, slot, 0, NULL);
+		return -1;
+	}
+
+	/* every step gets the usual time */
+	retval = wait_slot(ctx, slot, n_steps * CALL_TIMEOUT_MS, NULL);
+	if (retval != JRPC_OK) {
+		LOG_ERR("chain of %d calls %s", n_steps,
+			(retval == JRPC_ETIMEOUT) ? "timed out" : "failed");
+		return -1;
+	}
+
+	return 0;
+}
+
+int jrpc_ctx_call_chain(jrpc_ctx_t *ctx, struct jrpc_step *steps,
+			int n_steps, void *ret, char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vcall_chain(ctx, steps, n_steps, ret, afmt, ap);
+	va_end(ap);
+
+	return retval;
+}
+
+
+/******************************************************************************
+ * jrpc_ack
+ *
+ * jrpcd acks a fan-out call with the list of nodes it was sent to, and a
+ * registration with 0 if it took it.
+ */
+static void jrpc_ack(struct jrpc_ctx *ctx, json_t *jroot)
+{
+	struct call_slot *slot;
+	json_t *jtargets;
+	char if_name[NAME_SIZE];
+	int id, i, n, val;
+
+	if ((ej_get_string(jroot, "if", if_name) == 0) &&
+	    (strcmp(if_name, "register") == 0)) {
+		if ((ej_get_int(jroot, "id", &id) < 0) ||
+		    (ej_get_int(json_object_get(jroot, "ret"), "val",
+				&val) < 0))
+			return;
+		/* a replay after a reconnect goes out without an id */
+		if ((id == 0) && (val != 0))
+			LOG_ERR("%s", "registration after the reconnect "
+				"refused, the name was taken meanwhile");
+
+		pthread_mutex_lock(&ctx->call_mutex);
+		slot = find_slot(ctx, id);
+		if ((slot != NULL) && (slot->done_fn == NULL)) {
+			*(int *)slot->ret = val;
+			slot->status = (val == 0) ? JRPC_OK : JRPC_EFAIL;
+			slot->done = 1;
+			pthread_cond_signal(&slot->cond);
+		}
+		pthread_mutex_unlock(&ctx->call_mutex);
+		return;
+	}
+
+	jtargets = json_object_get(jroot, "targets");
+	if (!json_is_array(jtargets) || (ej_get_int(jroot, "id", &id) < 0))
+		return;
+
+	pthread_mutex_lock(&ctx->call_mutex);
+	slot = find_slot(ctx, id);
+	if ((slot != NULL) && (slot->res != NULL)) {
+		n = json_array_size(jtargets);
+		for (i = 0; (i < n) && (i < slot->max_res); i++) {
+			const char *name =
+				json_string_value(json_array_get(jtargets, i));
+
+			memset(&slot->res[i], 0, sizeof(struct jrpc_result));
+			if (name != NULL)
+				strncpy(slot->res[i].node, name, NAME_SIZE - 1);
+			slot->res[i].status = JRPC_ETIMEOUT;
+		}
+		slot->n_res = i;
+		slot->waiting = n;
+		slot->status = JRPC_OK;
+		if (n == 0) {
+			slot->done = 1;
+			pthread_cond_signal(&slot->cond);
+		}
+	}
+	pthread_mutex_unlock(&ctx->call_mutex);
+}
+
+
+/******************************************************************************
+ * jrpc_return
+ *
+ * Stores the return of a call in the slot of the call and wakes up the caller
+ * once all returns are in, or hands it to done of an async call. Returns of
+ * calls that timed out are dropped.
+ */
+static void jrpc_return(struct jrpc_ctx *ctx, json_t *jroot)
+{
+	struct call_slot *slot;
+	struct jrpc_result *r, ares;
+	char node[NAME_SIZE];
+	json_t *jret;
+	int id, i;
+
+	if (ej_get_int(jroot, "id", &id) < 0) {
+		LOG_ERR("%s", "return without id, dropped");
+		return;
+	}
+	jret = json_object_get(jroot, "ret");
+
+	pthread_mutex_lock(&ctx->call_mutex);
+	slot = find_slot(ctx, id);
+	if (slot == NULL) {
+		pthread_mutex_unlock(&ctx->call_mutex);
+		LOG_VERBOSE("late return for call %d, dropped", id);
+		return;
+	}
+
+	if (slot->done_fn != NULL) {
+		ares.ival = 0;
+		ares.sval[0] = '\0';
+		ares.status = (decode_ret(jret, &ares.ival, ares.sval,
+					  JRPC_RESULT_SIZE) == 0) ?
+			      JRPC_OK : JRPC_EFAIL;
+		finish_async(ctx, slot, &ares);
+		return;
+	}
+
+	if (slot->res == NULL) {
+		if (decode_ret(jret, (int *)slot->ret, (char *)slot->ret,
+			       BUFF_SIZE) == 0)
+			slot->status = JRPC_OK;
+		slot->done = 1;
+	} else {
+		/* jrpcd names the node in "tnode" when it fails a call */
+		ej_get_string(jroot, "snode", node);
+		if (strcmp(node, "jrpcd") == 0)
+			ej_get_string(jroot, "tnode", node);
+
+		for (i = 0; i < slot->n_res; i++) {
+			r = &slot->res[i];
+			if ((r->status == JRPC_ETIMEOUT) &&
+			    (strcmp(r->node, node) == 0))
+				break;
+		}
+		if (i < slot->n_res) {
+			r = &slot->res[i];
+			r->status = (decode_ret(jret, &r->ival, r->sval,
+						JRPC_RESULT_SIZE) == 0) ?
+				    JRPC_OK : JRPC_EFAIL;
+		}
+
+		if (slot->waiting < 0) {
+			/* failed before jrpcd could send it anywhere */
+			slot->status = JRPC_EFAIL;
+			slot->done = 1;
+		} else if (--slot->waiting <= 0) {
+			slot->done = 1;
+		}
+	}
+
+	if (slot->done)
+		pthread_cond_signal(&slot->cond);
+	pthread_mutex_unlock(&ctx->call_mutex);
+}
+
+
+/* the registration of a node of the context, from what it holds. Sent by
+ * jrpc_register, and with id 0 for every node again after a reconnect:
+ * jrpcd refuses such a replay if another process took the name meanwhile.
+ * rcall_mutex is held. */
+static int encode_register(struct jrpc_ctx *ctx, struct node_details *this,
+			   int id, char *buffer)
+{
+	static char *group_names[] = { NULL, "rr", "loc", "hash" };
+	json_t *jroot;
+	json_t *jarray;
+	int i, ttl_ms, retval;
+
+	ej_arena_begin();
+	jroot = json_object();
+	ej_add_string(&jroot, "api", "register");
+	ej_add_string(&jroot, "snode", this->name);
+	if (id != 0)
+		ej_add_int(&jroot, "id", id);
+	else
+		ej_add_int(&jroot, "replay", 1);
+	if ((this->group > JRPC_GROUP_NONE) &&
+	    (this->group <= JRPC_GROUP_HASH)) {
+		ej_add_string(&jroot, "group", group_names[this->group]);
+		if (this->group == JRPC_GROUP_HASH)
+			ej_add_int(&jroot, "key", this->key);
+	}
+	if ((this->group == JRPC_GROUP_NONE) && (ctx->endpoint[0] != '\0'))
+		ej_add_string(&jroot, "direct", ctx->endpoint);
+	jarray = json_array();
+	json_object_set(jroot, "interfaces", jarray);
+	for (i = 0; i < this->n_if; i++) {
+		json_t *jrow = json_object();
+
+		ej_add_string(&jrow, "if", this->ifl[i].if_name);
+		ej_add_string(&jrow, "arg", this->ifl[i].afmt);
+		ej_add_string(&jrow, "ret", this->ifl[i].rfmt);
+		ttl_ms = cache_ttl(ctx, this->name, this->ifl[i].if_name);
+		if (ttl_ms > 0)
+			ej_add_int(&jrow, "ttl", ttl_ms);
+
+		json_array_append(jarray, jrow);
+		json_decref(jrow);
+	}
+	if ((this == &ctx->this_node) && (ctx->this_node.n_topics > 0)) {
+		json_t *jtopics = json_array();
+
+		json_object_set_new(jroot, "topics", jtopics);
+		for (i = 0; i < ctx->this_node.n_topics; i++)
+			json_array_append_new(jtopics,
+					      json_string(ctx->this_node.topics[i]));
+	}
+	memset(buffer, 0x0, BUFF_SIZE);
+	retval = ej_store_buf(jroot, buffer, BUFF_SIZE);
+	json_decref(jarray);
+	json_decref(jroot);
+	ej_arena_end();
+
+	return retval;
+}
+
+
+/* undoes what jrpc_ctx_register_group set up for a registration jrpcd did
+ * not take. A name registered before goes back to what it had, a new one
+ * frees its slot. */
+static void register_undo(struct jrpc_ctx *ctx, struct node_details *this,
+			  struct node_details *prev, int opened)
+{
+	pthread_mutex_lock(&ctx->rcall_mutex);
+	if (this->ifl != prev->ifl)
+		free(this->ifl);
+	strcpy(this->name, prev->name);
+	this->grouped = prev->grouped;
+	this->group = prev->group;
+	this->key = prev->key;
+	this->n_if = prev->n_if;
+	this->ifl = prev->ifl;
+	pthread_mutex_unlock(&ctx->rcall_mutex);
+
+	if (opened)
+		close_endpoint(ctx);
+}
+
+
+/****************************************************************************** 
+ * jrpc_ctx_register
+ *
+ * This function converts the interface list to json formatted text via socket
+ */
+int jrpc_ctx_register(jrpc_ctx_t *ctx, char *node, int n_if,
+		      struct if_details *ifl, void *cbptr)
+{
+	return jrpc_ctx_register_group(ctx, node, n_if, ifl, JRPC_GROUP_NONE,
+				       0);
+}
+
+
+/****************************************************************************** 
+ * jrpc_ctx_register_group
+ *
+ * Same as jrpc_ctx_register, but lets several processes register the same node
+ * name. jrpcd spreads the calls to the name over them as per the group
+ * policy. For JRPC_GROUP_HASH, key is the index of the call argument hashed
+ * to pick the process, so calls with the same key land on the same process.
+ *
+ * A context may register up to MAX_NODES more names. They are logical nodes
+ * sharing the connection of the first one, jrpcd routes calls to each over
+ * it and they need no threads of their own, here or in jrpcd. Calls are
+ * always made as the first node.
+ */
+int jrpc_ctx_register_group(jrpc_ctx_t *ctx, char *node, int n_if,
+			    struct if_details *ifl, enum jrpc_group group,
+			    int key)
+{
+	int size, i, sockfd, retval;
+	char *env;
+	char buffer[BUFF_SIZE];
+	int acked, opened = 0;
+	struct node_details *this, prev;
+	struct if_details *copy = NULL;
+	struct call_slot *slot;
+
+	if ( (node == NULL) || ((n_if > 0) && (ifl == NULL))) {
+		LOG_ERR("%s", "Error: input pointers not correct");
+		return -1;
+	}
+	if ((node[0] == '\0') || (strlen(node) >= NAME_SIZE)) {
+		LOG_ERR("%s", "Error: invalid node name");
+		return -1;
+	}
+
+	/* a name registered before is registered again, a new one takes the
+	 * first free slot */
+	pthread_mutex_lock(&ctx->rcall_mutex);
+	this = find_node(ctx, node);
+	if ((this == NULL) && (ctx->this_node.name[0] == '\0'))
+		this = &ctx->this_node;
+	for (i = 0; (this == NULL) && (i < MAX_NODES); i++) {
+		if (ctx->nodes[i].name[0] == '\0')
+			this = &ctx->nodes[i];
+	}
+	if (this != NULL) {
+		prev = *this;
+		strcpy(this->name, node);
+	}
+	pthread_mutex_unlock(&ctx->rcall_mutex);
+	if (this == NULL) {
+		LOG_ERR("%s", "Error: too many nodes in this process");
+		return -1;
+	}
+
+	/* wait till libjrpc is initialized */
+	wait_init(ctx);
+
+	/* with JRPC_DIRECT=1 other nodes may link up with this one to call it
+	 * without jrpcd. Calls to groups are spread by jrpcd, so their members
+	 * take none. Links are read by threads of their own, a polled context
+	 * takes none either. */
+	env = getenv("JRPC_DIRECT");
+	if ((n_if > 0) && (group == JRPC_GROUP_NONE) && (ctx->listen_fd < 0) &&
+	    !ctx->polled && (env != NULL) && (strcmp(env, "1") == 0))
+		opened = (open_endpoint(ctx, node) == 0);
+
+	/* take a copy of if_details to realize jrpc_rcall, the registration
+	 * is sent from it, again after a reconnect. The previous one is
+	 * kept till jrpcd took this one. */
+	size = n_if * sizeof(struct if_details);
+	if (n_if > 0) {
+		copy = malloc(size);
+		if (copy == NULL) {
+			LOG_ERR("%s", "Error: out of memory");
+			register_undo(ctx, this, &prev, opened);
+			return -1;
+		}
+		memcpy(copy, ifl, size);
+	}
+	pthread_mutex_lock(&ctx->rcall_mutex);
+	this->grouped = (group != JRPC_GROUP_NONE);
+	this->group = group;
+	this->key = key;
+	this->n_if = n_if;
+	this->ifl = copy;
+	pthread_mutex_unlock(&ctx->rcall_mutex);
+
+	/* jrpcd acks the registration under the id of a call slot */
+	slot = get_slot(ctx, &acked, NULL, 0);
+	if (slot == NULL) {
+		register_undo(ctx, this, &prev, opened);
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->rcall_mutex);
+	retval = encode_register(ctx, this, slot->id, buffer);
+	pthread_mutex_unlock(&ctx->rcall_mutex);
+
+	/* send the json data to jrpcd daemon */
+	sockfd = get_sockfd(ctx);
+	if((sockfd < 0) || (retval < 0)) {
+		LOG_ERR("%s", "Error: jrpc_register cannot be completed!");
+		wait_slot(ctx, slot, 0, NULL);
+		goto error;
+	}
+
+	if (send_msg(ctx, sockfd, buffer) < 0) {
+		LOG_ERR("%s: registration could not be sent", node);
+		wait_slot(ctx, slot, 0, NULL);
+		goto error;
+	}
+
+	/* calls to the node may come as soon as jrpcd has it. An interface
+	 * registering from the rx thread can't wait, the ack comes on it. */
+	if (ctx->rx_joinable && pthread_equal(pthread_self(), ctx->recv_thread))
+		wait_slot(ctx, slot, 0, NULL);
+	else if (wait_slot(ctx, slot, CALL_TIMEOUT_MS, NULL) != JRPC_OK) {
+		LOG_ERR("%s: registration not acked by jrpcd", node);
+		goto error;
+	}
+
+	/* an interface running on the old copy holds rcall_mutex */
+	pthread_mutex_lock(&ctx->rcall_mutex);
+	if (prev.ifl != this->ifl)
+		free(prev.ifl);
+	pthread_mutex_unlock(&ctx->rcall_mutex);
+
+	return 0;
+error:
+	/* a node jrpcd refused is neither called locally nor replayed */
+	register_undo(ctx, this, &prev, opened);
+	return -1;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_unregister
+ *
+ * Removes a logical node of the context, see jrpc_ctx_register_group. The
+ * connection stays up for the others, the first node goes with
+ * jrpc_ctx_close.
+ */
+int jrpc_ctx_unregister(jrpc_ctx_t *ctx, char *node)
+{
+	char buffer[BUFF_SIZE];
+	struct node_details *this;
+	json_t *jroot;
+	int sockfd, retval = -1;
+
+	/* register and the rx thread change the nodes under rcall_mutex too */
+	pthread_mutex_lock(&ctx->rcall_mutex);
+	this = find_node(ctx, node);
+	if ((this == NULL) || (this == &ctx->this_node)) {
+		LOG_ERR("%s", "Error: not a logical node of this process");
+		goto exit;
+	}
+
+	ej_arena_begin();
+	jroot = json_object();
+	ej_add_string(&jroot, "api", "exit");
+	ej_add_string(&jroot, "snode", node);
+
+	memset(buffer, 0x0, BUFF_SIZE);
+	ej_store_buf(jroot, buffer, BUFF_SIZE);
+	json_decref(jroot);
+	ej_arena_end();
+
+	sockfd = get_sockfd(ctx);
+	if ((sockfd < 0) || (send_msg(ctx, sockfd, buffer) < 0)) {
+		LOG_ERR("%s", "Error: jrpc_unregister cannot be completed!");
+		goto exit;
+	}
+
+	/* a call in flight to the node finds no interface and fails */
+	free(this->ifl);
+	memset(this, 0, sizeof(*this));
+	retval = 0;
+exit:
+	pthread_mutex_unlock(&ctx->rcall_mutex);
+	return retval;
+}
+
+
+/******************************************************************************
+ * jrpc_dispatch
+ *
+ * Handles one message from jrpcd or a direct link, fd is where it came
+ * from. All json objects of the message are released together at the end.
+ */
+static void jrpc_dispatch(struct jrpc_ctx *ctx, char *msg, int fd)
+{
+	json_t *jroot;
+	char token[NAME_SIZE];
+
+	ej_arena_begin();
+	if (ej_load_buf(msg, &jroot) < 0) {
+		ej_arena_end();
+		return;
+	}
+	ej_get_string(jroot, "api", token);
+
+	/* check for valid api */
+	if ((strcmp(token, "call") == 0) || (strcmp(token, "mcall") == 0)) {
+		LOG_VERBOSE("%s", "invoking remote call");
+		jrpc_rcall(ctx, jroot, 0, fd);
+	}
+	else if ((strcmp(token, "notify") == 0) ||
+		 (strcmp(token, "publish") == 0)) {
+		LOG_VERBOSE("%s", "invoking remote notification");
+		jrpc_rcall(ctx, jroot, 1, fd);
+	}
+	else if (strcmp(token, "return") == 0) {
+		LOG_VERBOSE("%s", "handling return of prev call");
+		jrpc_return(ctx, jroot);
+	}
+	else if (strcmp(token, "ack") == 0) {
+		LOG_VERBOSE("%s", "acknowledgment for prev message");
+		jrpc_ack(ctx, jroot);
+	}
+	else {
+		LOG_ERR("%s", "received an invalid message");
+	}
+
+	json_decref(jroot);
+	ej_arena_end();
+}
+
+
+/******************************************************************************
+ * read_msgs
+ *
+ * Reads messages from a connection and dispatches them till it is closed.
+ * The connection to jrpcd and direct links are read alike.
+ */
+static void read_msgs(struct jrpc_ctx *ctx, int fd)
+{
+	int len, pos, fill;
+	char buffer[BUFF_SIZE];
+	char save;
+
+	fill = 0;
+	while (ctx->state >= JRPC_CONNECTED) {
+		/* read after any partial message left by the previous read */
+		len = read(fd, buffer + fill, BUFF_SIZE - 1 - fill);
+		if (len < 0) {
+			if (errno != EINTR)
+				break;
+			LOG_ERR("%s", "received error message, retrying...");
+			continue;
+		} 
+		else if (len == 0) {
+			LOG_VERBOSE("%s", "Connection closed by peer");
+			break;
+		}
+		LOG_VERBOSE("received a message...%d bytes", len);
+		fill += len;
+
+		/* one read may carry several messages, handle the complete
+		 * ones and keep the rest for the next read */
+		pos = 0;
+		while ((len = ej_frame_len(buffer + pos, fill - pos)) > 0) {
+			save = buffer[pos + len];
+			buffer[pos + len] = '\0';
+			jrpc_dispatch(ctx, buffer + pos, fd);
+			buffer[pos + len] = save;
+			pos += len;
+		}
+		if (len < 0) {
+			LOG_ERR("%s", "received garbage, dropped");
+			pos = fill;
+		}
+		fill -= pos;
+		memmove(buffer, buffer + pos, fill);
+		if (fill >= BUFF_SIZE - 1) {
+			LOG_ERR("%s", "message too large, dropped");
+			fill = 0;
+		}
+	}
+}
+
+
+/******************************************************************************
+ * process_ready
+ *
+ * read_msgs for a polled context: takes what the connection has without
+ * waiting and dispatches the complete messages. Each message is taken out
+ * of rx_buf before it is dispatched, an interface making a call reads the
+ * connection again from in here. What was sent meanwhile is flushed.
+ *
+ * return: number of messages dispatched or -1 once jrpcd is gone
+ */
+static int process_ready(struct jrpc_ctx *ctx)
+{
+	char msg[BUFF_SIZE];
+	int len, n = 0;
+
+	while (ctx->state >= JRPC_CONNECTED) {
+		while ((len = ej_frame_len(ctx->rx_buf, ctx->rx_fill)) > 0) {
+			memcpy(msg, ctx->rx_buf, len);
+			msg[len] = '\0';
+			ctx->rx_fill -= len;
+			memmove(ctx->rx_buf, ctx->rx_buf + len, ctx->rx_fill);
+			jrpc_dispatch(ctx, msg, ctx->sockfd);
+			n++;
+		}
+		if (len < 0) {
+			LOG_ERR("%s", "received garbage, dropped");
+			ctx->rx_fill = 0;
+		} else if (ctx->rx_fill >= BUFF_SIZE - 1) {
+			LOG_ERR("%s", "message too large, dropped");
+			ctx->rx_fill = 0;
+		}
+
+		len = recv(ctx->sockfd, ctx->rx_buf + ctx->rx_fill,
+			   BUFF_SIZE - 1 - ctx->rx_fill, MSG_DONTWAIT);
+		if (len > 0) {
+			ctx->rx_fill += len;
+			continue;
+		}
+		if ((len < 0) && (errno == EINTR))
+			continue;
+		if ((len < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+			break;
+
+		LOG_VERBOSE("%s", "Connection closed by peer");
+		close(ctx->sockfd);
+		ctx->state = JRPC_OFF;
+	}
+
+	/* no timer thread here */
+	pthread_mutex_lock(&ctx->call_mutex);
+	expire_calls(ctx, 0);
+	pthread_mutex_unlock(&ctx->call_mutex);
+
+	if (ctx->state < JRPC_CONNECTED)
+		return -1;
+	if (outbox_flush(ctx, 0) < 0)
+		return -1;
+	return n;
+}
+
+
+/* flush, wait up to timeout_ms for the connection to have something to
+ * read and process it */
+static int pump(struct jrpc_ctx *ctx, int timeout_ms)
+{
+	struct pollfd pfd;
+	int status;
+
+	if (!ctx->polled || (get_sockfd(ctx) < 0))
+		return -1;
+	if (outbox_flush(ctx, 0) < 0)
+		return -1;
+
+	pfd.fd = ctx->sockfd;
+	pfd.events = POLLIN;
+	status = poll(&pfd, 1, timeout_ms);
+	if (status < 0)
+		return (errno == EINTR) ? 0 : -1;
+	if (status == 0) {
+		pthread_mutex_lock(&ctx->call_mutex);
+		expire_calls(ctx, 0);
+		pthread_mutex_unlock(&ctx->call_mutex);
+		return 0;
+	}
+
+	return process_ready(ctx);
+}
+
+
+/* a new connection to jrpcd, -1 if it can't be had */
+static int connect_jrpcd(void)
+{
+	struct sockaddr_in servaddr;
+	int sockfd, port;
+	char *env;
+
+	/* create a TCP socket for connecting to jrpcd */
+	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sockfd < 0) {
+		LOG_ERR("%s", "Socket error");
+		return -1;
+	}
+
+	/* with several daemons on a host, JRPC_PORT picks the one to use */
+	port = DEFAULT_PORT;
+	env = getenv("JRPC_PORT");
+	if ((env != NULL) && (atoi(env) > 0))
+		port = atoi(env);
+
+	bzero(&servaddr, sizeof(servaddr));
+	servaddr.sin_family = AF_INET;
+	servaddr.sin_port = htons(port);
+	if (inet_pton(AF_INET, DEFAULT_IP, &servaddr.sin_addr) <= 0) {
+		LOG_ERR("%s", "inet_pton error");
+		close(sockfd);
+		return -1;
+	}
+
+	if (connect(sockfd, (const struct sockaddr *) &servaddr,
+		    sizeof(servaddr)) < 0) {
+		close(sockfd);
+		return -1;
+	}
+
+	return sockfd;
+}
+
+
+/* the connection to jrpcd broke. Calls that went through it will not
+ * return: async ones fail now, callers waiting on the others are woken
+ * with JRPC_EDROPPED, see call_args. Calls over direct links and to this
+ * process go on. call_mutex is held. */
+static void drop_calls(struct jrpc_ctx *ctx)
+{
+	struct call_slot *slot;
+	int i;
+
+	for (i = 0; i < MAX_CALLS; i++) {
+		slot = &ctx->slots[i];
+		if ((slot->id == 0) || (slot->fd != -1) || slot->done)
+			continue;
+		slot->done = 1;
+		if (slot->done_fn != NULL) {
+			slot->status = JRPC_EFAIL;
+		} else {
+			slot->status = JRPC_EDROPPED;
+			pthread_cond_signal(&slot->cond);
+		}
+	}
+	expire_calls(ctx, 0);
+}
+
+
+/******************************************************************************
+ * reconnect
+ *
+ * jrpcd went away, or the connection to it broke. Connects again after a
+ * pause of RECONNECT_MIN_MS, doubling up to RECONNECT_MAX_MS, each cut short
+ * by a random part so processes that lost jrpcd together come back spread
+ * out. Once connected the nodes of the context are registered again, then
+ * calls may go out. Meanwhile calls fail right away. Off with
+ * JRPC_RECONNECT=0.
+ *
+ * return: 0 once connected again, -1 if the context is closed
+ */
+static int reconnect(struct jrpc_ctx *ctx)
+{
+	char buffer[BUFF_SIZE];
+	struct node_details *node;
+	struct timespec ts;
+	int backoff = RECONNECT_MIN_MS, pause_ms, attempts = 0, closing, i;
+	int sockfd = -1;
+
+	pthread_mutex_lock(&ctx->init_mutex);
+	closing = ctx->closing || !ctx->reconnect;
+	if (!closing) {
+		ctx->reconnecting = 1;
+		ctx->state = JRPC_CONNECTING;
+		pthread_cond_broadcast(&ctx->init_cond);
+	}
+	pthread_mutex_unlock(&ctx->init_mutex);
+	if (closing)
+		return -1;
+
+	pthread_mutex_lock(&ctx->call_mutex);
+	drop_calls(ctx);
+	pthread_mutex_unlock(&ctx->call_mutex);
+	LOG_INFO("%s", "connection to jrpcd lost, reconnecting");
+
+	while (sockfd < 0) {
+		pause_ms = backoff / 2 + rand_r(&ctx->seed) % (backoff / 2 + 1);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += pause_ms * 1000000L;
+		ts.tv_sec += ts.tv_nsec / 1000000000L;
+		ts.tv_nsec %= 1000000000L;
+
+		/* ctx_exit cuts the pause short */
+		pthread_mutex_lock(&ctx->init_mutex);
+		while (!ctx->closing &&
+		       (pthread_cond_timedwait(&ctx->init_cond,
+					       &ctx->init_mutex, &ts) !=
+			ETIMEDOUT))
+			;
+		closing = ctx->closing;
+		pthread_mutex_unlock(&ctx->init_mutex);
+		if (closing)
+			return -1;
+
+		sockfd = connect_jrpcd();
+		attempts++;
+		if (backoff < RECONNECT_MAX_MS)
+			backoff = (2 * backoff < RECONNECT_MAX_MS) ?
+				  2 * backoff : RECONNECT_MAX_MS;
+	}
+	outbox_reset(ctx, sockfd);
+
+	/* jrpcd knows nothing of the nodes anymore */
+	pthread_mutex_lock(&ctx->rcall_mutex);
+	for (i = -1; i < MAX_NODES; i++) {
+		node = (i < 0) ? &ctx->this_node : &ctx->nodes[i];
+		if ((node->name[0] != '\0') &&
+		    (encode_register(ctx, node, 0, buffer) == 0))
+			send_msg(ctx, sockfd, buffer);
+	}
+	pthread_mutex_unlock(&ctx->rcall_mutex);
+
+	/* the socket is left to ctx_exit to close if it came first */
+	pthread_mutex_lock(&ctx->init_mutex);
+	closing = ctx->closing;
+	if (!closing) {
+		ctx->reconnecting = 0;
+		ctx->state = JRPC_INITIALISED;
+		pthread_cond_broadcast(&ctx->init_cond);
+	}
+	pthread_mutex_unlock(&ctx->init_mutex);
+	if (closing)
+		return -1;
+
+	LOG_INFO("reconnected to jrpcd after %d attempts", attempts);
+	return 0;
+}
+
+
+/******************************************************************************
+ * jrpc_rx_thread
+ *
+ * This function is created after init. Will send and receive messages from or
+ * to jrpc server / daemon
+ */
+static void *jrpc_rx_thread(void *arg)
+{
+	struct jrpc_ctx *ctx = (struct jrpc_ctx *)arg;
+	int sockfd;
+
+	do {
+		sockfd = ctx->sockfd;
+		LOG_VERBOSE("%s %d", "wait for messages from server socket ",
+			    sockfd);
+		read_msgs(ctx, sockfd);
+		/* ctx_exit closes the socket, once the outbox is done with
+		 * it */
+		shutdown(sockfd, SHUT_RDWR);
+	} while (reconnect(ctx) == 0);
+	set_state(ctx, JRPC_OFF);
+
+	return NULL;
+}
+
+
+/******************************************************************************
+ * start_rx
+ *
+ * Sets up what calls need and starts the thread receiving from jrpcd.
+ */
+static int start_rx(struct jrpc_ctx *ctx, void *(*rx_fn)(void *))
+{
+	pthread_attr_t attr;
+	pthread_mutexattr_t mattr;
+	pthread_condattr_t cattr;
+	int status, i;
+
+	/* Initialize mutex and condition variable objects */
+	pthread_mutex_init(&ctx->call_mutex, NULL);
+	for (i = 0; i < MAX_CALLS; i++) {
+		ctx->slots[i].id = 0;
+		pthread_cond_init(&ctx->slots[i].cond, NULL);
+	}
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&ctx->timer_cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+	ctx->timer_on = 0;
+	pthread_mutex_init(&ctx->link_mutex, NULL);
+	pthread_cond_init(&ctx->link_cond, NULL);
+	/* an interface calling another one of this process runs it right
+	 * away, on the same thread */
+	pthread_mutexattr_init(&mattr);
+	pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&ctx->rcall_mutex, &mattr);
+	pthread_mutexattr_destroy(&mattr);
+	for (i = 0; i < MAX_LINKS; i++)
+		ctx->links[i].fd = -1;
+	ctx->num_links = 0;
+	outbox_init(&ctx->out);
+
+	/* a polled context is read by the application */
+	if (rx_fn == NULL)
+		return 0;
+
+	/* Create a thread to manage the connection */
+	status = pthread_attr_init(&attr);
+	if (status != 0) {
+		LOG_ERR("%s", "Error: unable to init thread attr");
+		return -1;
+	}
+
+	status = pthread_create(&ctx->recv_thread, &attr, rx_fn, ctx);
+	pthread_attr_destroy(&attr);
+	if (status != 0) {
+		LOG_ERR("%s", "Error: can't create receive thread!");
+		return -1;
+	}
+	/* no need to wait for it to run, what comes meanwhile waits in the
+	 * socket for it */
+	ctx->rx_joinable = 1;
+
+	return 0;
+}
+
+
+/****************************************************************************** 
+ * ctx_init
+ *
+ * This function initializes local variables and establish connection with 
+ * jrpc daemon process.
+ */
+static int ctx_init(struct jrpc_ctx *ctx)
+{
+	int sockfd;
+	char *arena, *env;
+
+	if (ctx->state != JRPC_OFF) {
+		LOG_ERR("%s", "Error: jrpc_init shall be called only once");
+		return -1;
+	}
+	ctx->listen_fd = -1;
+	ctx->rx_fill = 0;
+	set_state(ctx, JRPC_CONNECTING);
+
+	/* carve json objects of each message from a per thread arena with
+	 * JRPC_ARENA=1. It replaces the jansson allocator of the whole
+	 * process, so only on request. JRPC_ARENA=0 hooks it just to count
+	 * allocations. */
+	arena = getenv("JRPC_ARENA");
+	if (arena != NULL)
+		ej_arena_init(strcmp(arena, "0") != 0);
+
+	sockfd = connect_jrpcd();
+	if (sockfd < 0) {
+		LOG_ERR("%s", "Error: connect failed!");
+		goto error;
+	}
+	ctx->sockfd = sockfd;
+
+	/* the rx thread connects again when jrpcd goes away, unless disabled
+	 * with JRPC_RECONNECT=0. A polled context leaves it to the
+	 * application, its fd would change under it. */
+	env = getenv("JRPC_RECONNECT");
+	ctx->reconnect = !ctx->polled &&
+			 ((env == NULL) || (strcmp(env, "0") != 0));
+	ctx->reconnecting = 0;
+	ctx->closing = 0;
+	ctx->seed = getpid() ^ (unsigned int)now_ms();
+
+	set_state(ctx, JRPC_CONNECTED);
+
+	if (start_rx(ctx, ctx->polled ? NULL : jrpc_rx_thread) < 0)
+		goto error;
+	set_state(ctx, JRPC_INITIALISED);
+
+
+	return 0;
+error:
+	ctx->sockfd = 0;
+	set_state(ctx, JRPC_OFF);
+	return -1;
+}
+
+
+/******************************************************************************
+ * embed_rx_thread
+ *
+ * Receives the messages jrpcd in this process queued for us, till jrpcd lets
+ * go of the link.
+ */
+static void *embed_rx_thread(void *arg)
+{
+	struct jrpc_ctx *ctx = (struct jrpc_ctx *)arg;
+	char buffer[BUFF_SIZE];
+	char *msg;
+	int len;
+
+	while (ctx->state >= JRPC_CONNECTED) {
+		len = ctx->transport->recv(ctx->transport_link, &msg);
+		if (msg == NULL) {
+			LOG_VERBOSE("%s", "Link closed by jrpcd");
+			break;
+		}
+		if (len < BUFF_SIZE) {
+			memcpy(buffer, msg, len);
+			buffer[len] = '\0';
+			jrpc_dispatch(ctx, buffer, EMBED_FD);
+		} else {
+			LOG_ERR("%s", "message too large, dropped");
+		}
+		ctx->transport->release(msg);
+	}
+	set_state(ctx, JRPC_OFF);
+
+	return NULL;
+}
+
+
+/******************************************************************************
+ * ctx_init_embedded
+ *
+ * Same as ctx_init, for a process that links jrpcd in as libjrpcd. The
+ * process attaches to it over tp, jrpcd_transport of libjrpcd, instead of a
+ * socket. Messages pass to jrpcd and back through queues in memory, the
+ * rest works the same. jrpcd must have been started by the process.
+ */
+static int ctx_init_embedded(struct jrpc_ctx *ctx,
+			     const struct jrpc_transport *tp)
+{
+	char *arena;
+
+	if (ctx->state != JRPC_OFF) {
+		LOG_ERR("%s", "Error: jrpc_init shall be called only once");
+		return -1;
+	}
+	ctx->listen_fd = -1;
+	if (tp == NULL) {
+		LOG_ERR("%s", "Error: input pointers not correct");
+		return -1;
+	}
+	set_state(ctx, JRPC_CONNECTING);
+
+	arena = getenv("JRPC_ARENA");
+	if (arena != NULL)
+		ej_arena_init(strcmp(arena, "0") != 0);
+
+	ctx->transport_link = tp->attach();
+	if (ctx->transport_link == NULL) {
+		LOG_ERR("%s", "Error: can't attach to jrpcd");
+		goto error;
+	}
+	ctx->transport = tp;
+	ctx->sockfd = EMBED_FD;
+	set_state(ctx, JRPC_CONNECTED);
+
+	if (start_rx(ctx, embed_rx_thread) < 0)
+		goto error;
+	set_state(ctx, JRPC_INITIALISED);
+
+	return 0;
+error:
+	if (ctx->transport_link != NULL)
+		tp->detach(ctx->transport_link);
+	ctx->transport = NULL;
+	ctx->transport_link = NULL;
+	ctx->sockfd = 0;
+	set_state(ctx, JRPC_OFF);
+	return -1;
+}
+
+
+/* a context of its own, closed. DefaultCtx is set up statically. */
+static struct jrpc_ctx *ctx_alloc(void)
+{
+	struct jrpc_ctx *ctx;
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (ctx == NULL) {
+		LOG_ERR("%s", "Error: out of memory");
+		return NULL;
+	}
+	pthread_mutex_init(&ctx->init_mutex, NULL);
+	pthread_cond_init(&ctx->init_cond, NULL);
+
+	return ctx;
+}
+
+
+static void ctx_free(struct jrpc_ctx *ctx)
+{
+	pthread_cond_destroy(&ctx->init_cond);
+	pthread_mutex_destroy(&ctx->init_mutex);
+	free(ctx);
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_open
+ *
+ * Opens a connection to jrpcd of its own, like jrpc_init does for the
+ * process. Each context has its own socket, calls in flight, nodes and
+ * receive thread, and takes no lock another context takes. Threads may
+ * share a context or have one each. Nodes registered on a context are
+ * called on its receive thread.
+ *
+ * return: the context or NULL
+ */
+jrpc_ctx_t *jrpc_ctx_open(void)
+{
+	struct jrpc_ctx *ctx;
+
+	ctx = ctx_alloc();
+	if (ctx == NULL)
+		return NULL;
+	if (ctx_init(ctx) < 0) {
+		ctx_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_open_embedded
+ *
+ * Same as jrpc_ctx_open, attached to jrpcd in this process over tp, see
+ * jrpc_init_embedded.
+ */
+jrpc_ctx_t *jrpc_ctx_open_embedded(const struct jrpc_transport *tp)
+{
+	struct jrpc_ctx *ctx;
+
+	ctx = ctx_alloc();
+	if (ctx == NULL)
+		return NULL;
+	if (ctx_init_embedded(ctx, tp) < 0) {
+		ctx_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_open_polled
+ *
+ * Same as jrpc_ctx_open, but libjrpc starts no thread to read the
+ * connection. The application watches jrpc_ctx_fd in its own event loop
+ * and calls jrpc_ctx_process_ready when it is readable, interfaces and
+ * returns are handled on that thread. Messages to jrpcd are batched till
+ * jrpc_ctx_flush, which process_ready and poll do on their way out, so
+ * flush before waiting on the loop if something was sent outside of them.
+ * A call waiting for its return reads the connection itself meanwhile.
+ * Use a polled context from one thread only. It takes no direct links.
+ */
+jrpc_ctx_t *jrpc_ctx_open_polled(void)
+{
+	struct jrpc_ctx *ctx;
+
+	ctx = ctx_alloc();
+	if (ctx == NULL)
+		return NULL;
+	ctx->polled = 1;
+	if (ctx_init(ctx) < 0) {
+		ctx_free(ctx);
+		return NULL;
+	}
+
+	return ctx;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_fd
+ *
+ * Connection of a polled context, readable when jrpcd sent something.
+ *
+ * return: the fd or -1
+ */
+int jrpc_ctx_fd(jrpc_ctx_t *ctx)
+{
+	if (!ctx->polled)
+		return -1;
+	return get_sockfd(ctx);
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_process_ready
+ *
+ * Dispatches what can be read from a polled context without waiting, then
+ * flushes.
+ *
+ * return: number of messages handled or -1 once the connection is gone
+ */
+int jrpc_ctx_process_ready(jrpc_ctx_t *ctx)
+{
+	if (!ctx->polled || (get_sockfd(ctx) < 0))
+		return -1;
+	return process_ready(ctx);
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_poll
+ *
+ * Flushes, waits up to timeout_ms for a polled context to be readable and
+ * processes it. A loop of its own for applications without one.
+ *
+ * return: number of messages handled or -1 once the connection is gone
+ */
+int jrpc_ctx_poll(jrpc_ctx_t *ctx, int timeout_ms)
+{
+	return pump(ctx, timeout_ms);
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_flush
+ *
+ * Sends what a polled context has batched for jrpcd. On a threaded context
+ * waits up to CALL_TIMEOUT_MS for what its outbox holds to go out.
+ */
+int jrpc_ctx_flush(jrpc_ctx_t *ctx)
+{
+	if (get_sockfd(ctx) < 0)
+		return -1;
+	return outbox_flush(ctx, ctx->polled ? 0 : CALL_TIMEOUT_MS);
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_set_outbox
+ *
+ * Messages to jrpcd queue up in an outbox of the context when the socket
+ * does not take them right away, so a sender need not wait for it. Senders
+ * write what is queued, several messages at a time, and leave what the
+ * socket can't take yet to a tx thread. max_bytes caps what may be queued,
+ * 0 for the default (OUTBOX_SIZE). When the outbox is full a send waits for
+ * room if block is set, otherwise it fails at once. May be called before
+ * the context is opened for the one of jrpc_init.
+ */
+int jrpc_ctx_set_outbox(jrpc_ctx_t *ctx, int max_bytes, int block)
+{
+	if ((ctx == NULL) || (max_bytes < 0)) {
+		LOG_ERR("%s", "Error: input pointers not correct");
+		return -1;
+	}
+	ctx->out.max_bytes = max_bytes;
+	ctx->out.nonblock = !block;
+
+	return 0;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_set_idempotent
+ *
+ * Marks if_name of node as safe to run more than once. When the connection
+ * to jrpcd breaks, a call to it still waiting for its return is sent again
+ * once the context has reconnected, within the timeout of the call. Other
+ * calls that went through jrpcd fail right away. May be called before the
+ * context is opened for the one of jrpc_init.
+ */
+int jrpc_ctx_set_idempotent(jrpc_ctx_t *ctx, char *node, char *if_name)
+{
+	int retval = -1;
+
+	if ((ctx == NULL) || (node == NULL) || (if_name == NULL) ||
+	    (strlen(node) >= NAME_SIZE) || (strlen(if_name) >= NAME_SIZE)) {
+		LOG_ERR("%s", "Error: input pointers not correct");
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->init_mutex);
+	if (ctx->n_idempotent < MAX_IDEMPOTENT) {
+		strcpy(ctx->idempotent[ctx->n_idempotent].node, node);
+		strcpy(ctx->idempotent[ctx->n_idempotent].if_name, if_name);
+		ctx->n_idempotent++;
+		retval = 0;
+	}
+	pthread_mutex_unlock(&ctx->init_mutex);
+
+	if (retval < 0)
+		LOG_ERR("%s", "Error: too many idempotent interfaces");
+	return retval;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_set_cacheable
+ *
+ * Lets jrpcd answer calls to if_name of node with the same args from its
+ * cache for ttl_ms after a return, 0 stops it. Sent with the interfaces of
+ * node, so it takes effect from the next jrpc_ctx_register of node. May be
+ * called before the context is opened for the one of jrpc_init.
+ */
+int jrpc_ctx_set_cacheable(jrpc_ctx_t *ctx, char *node, char *if_name,
+			   int ttl_ms)
+{
+	int i, retval = -1;
+
+	if ((ctx == NULL) || (node == NULL) || (if_name == NULL) ||
+	    (ttl_ms < 0) || (strlen(node) >= NAME_SIZE) ||
+	    (strlen(if_name) >= NAME_SIZE)) {
+		LOG_ERR("%s", "Error: input pointers not correct");
+		return -1;
+	}
+
+	pthread_mutex_lock(&ctx->init_mutex);
+	for (i = 0; i < ctx->n_cacheable; i++)
+		if ((strcmp(ctx->cacheable[i].node, node) == 0) &&
+		    (strcmp(ctx->cacheable[i].if_name, if_name) == 0))
+			break;
+	if (i < MAX_CACHEABLE) {
+		strcpy(ctx->cacheable[i].node, node);
+		strcpy(ctx->cacheable[i].if_name, if_name);
+		ctx->cacheable[i].ttl_ms = ttl_ms;
+		if (i == ctx->n_cacheable)
+			ctx->n_cacheable++;
+		retval = 0;
+	}
+	pthread_mutex_unlock(&ctx->init_mutex);
+
+	if (retval < 0)
+		LOG_ERR("%s", "Error: too many cacheable interfaces");
+	return retval;
+}
+
+
+/******************************************************************************
+ * jrpc_ctx_close
+ *
+ * Unregisters the nodes of the context, closes it and frees it.
+ */
+int jrpc_ctx_close(jrpc_ctx_t *ctx)
+{
+	int retval;
+
+	if (ctx == NULL)
+		return -1;
+	retval = ctx_exit(ctx);
+	ctx_free(ctx);
+
+	return retval;
+}
+
+
+/******************************************************************************
+ * jrpc_init, jrpc_register, jrpc_call, ...
+ *
+ * The API from before contexts. Each does what its jrpc_ctx_ counterpart
+ * does, on the context jrpc_init opens for the process.
+ */
+int jrpc_init(void)
+{
+	return ctx_init(&DefaultCtx);
+}
+
+int jrpc_init_embedded(const struct jrpc_transport *tp)
+{
+	return ctx_init_embedded(&DefaultCtx, tp);
+}
+
+int jrpc_init_polled(void)
+{
+	if (DefaultCtx.state != JRPC_OFF) {
+		LOG_ERR("%s", "Error: jrpc_init shall be called only once");
+		return -1;
+	}
+	DefaultCtx.polled = 1;
+	if (ctx_init(&DefaultCtx) < 0) {
+		DefaultCtx.polled = 0;
+		return -1;
+	}
+	return 0;
+}
+
+int jrpc_fd(void)
+{
+	return jrpc_ctx_fd(&DefaultCtx);
+}
+
+int jrpc_process_ready(void)
+{
+	return jrpc_ctx_process_ready(&DefaultCtx);
+}
+
+int jrpc_poll(int timeout_ms)
+{
+	return jrpc_ctx_poll(&DefaultCtx, timeout_ms);
+}
+
+int jrpc_flush(void)
+{
+	return jrpc_ctx_flush(&DefaultCtx);
+}
+
+int jrpc_set_outbox(int max_bytes, int block)
+{
+	return jrpc_ctx_set_outbox(&DefaultCtx, max_bytes, block);
+}
+
+int jrpc_set_idempotent(char *node, char *if_name)
+{
+	return jrpc_ctx_set_idempotent(&DefaultCtx, node, if_name);
+}
+
+int jrpc_set_cacheable(char *node, char *if_name, int ttl_ms)
+{
+	return jrpc_ctx_set_cacheable(&DefaultCtx, node, if_name, ttl_ms);
+}
+
+int jrpc_register(char *node, int n_if, struct if_details *ifl, void *cbptr)
+{
+	return jrpc_ctx_register(&DefaultCtx, node, n_if, ifl, cbptr);
+}
+
+int jrpc_register_group(char *node, int n_if, struct if_details *ifl,
+			enum jrpc_group group, int key)
+{
+	return jrpc_ctx_register_group(&DefaultCtx, node, n_if, ifl, group,
+				       key);
+}
+
+int jrpc_unregister(char *node)
+{
+	return jrpc_ctx_unregister(&DefaultCtx, node);
+}
+
+int jrpc_call(char *node, char *if_name, void *ret, char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vcall(&DefaultCtx, node, if_name, CALL_TIMEOUT_MS, ret, afmt,
+		       ap);
+	va_end(ap);
+
+	return retval;
+}
+
+int jrpc_calltm(char *node, char *if_name, int timeout_ms, void *ret,
+		char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vcall(&DefaultCtx, node, if_name, timeout_ms, ret, afmt, ap);
+	va_end(ap);
+
+	return retval;
+}
+
+int jrpc_call_async(char *node, char *if_name, int timeout_ms,
+		    jrpc_done_fn done, void *arg, char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vcall_async(&DefaultCtx, node, if_name, timeout_ms, done, arg,
+			     afmt, ap);
+	va_end(ap);
+
+	return retval;
+}
+
+int jrpc_callv(char *node, char *if_name, int timeout_ms, void *ret,
+	       struct jrpc_arg *args, int n_args)
+{
+	return call_args(&DefaultCtx, node, if_name, timeout_ms, ret, args,
+			 n_args);
+}
+
+int jrpc_call_asyncv(char *node, char *if_name, int timeout_ms,
+		     jrpc_done_fn done, void *arg, struct jrpc_arg *args,
+		     int n_args)
+{
+	return call_async_args(&DefaultCtx, node, if_name, timeout_ms, done,
+			       arg, args, n_args);
+}
+
+int jrpc_direct(char *node)
+{
+	return jrpc_ctx_direct(&DefaultCtx, node);
+}
+
+int jrpc_notify(char *node, char *if_name, char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vnotify(&DefaultCtx, "notify", node, if_name, afmt, ap);
+	va_end(ap);
+
+	return retval;
+}
+
+int jrpc_publish(char *topic, char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vnotify(&DefaultCtx, "publish", NULL, topic, afmt, ap);
+	va_end(ap);
+
+	return retval;
+}
+
+int jrpc_subscribe(char *topic)
+{
+	return jrpc_ctx_subscribe(&DefaultCtx, topic);
+}
+
+int jrpc_unsubscribe(char *topic)
+{
+	return jrpc_ctx_unsubscribe(&DefaultCtx, topic);
+}
+
+int jrpc_call_many(char *nodes, char *if_name, struct jrpc_result *res,
+		   int max_res, int timeout_ms, char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vcall_many(&DefaultCtx, nodes, if_name, res, max_res,
+			    timeout_ms, afmt, ap);
+	va_end(ap);
+
+	return retval;
+}
+
+int jrpc_call_chain(struct jrpc_step *steps, int n_steps, void *ret,
+		    char *afmt, ...)
+{
+	int retval;
+	va_list ap; /* var argument pointer */
+
+	va_start(ap, afmt); /* make ap to point 1st unamed arg */
+	retval = vcall_chain(&DefaultCtx, steps, n_steps, ret, afmt, ap);
+	va_end(ap);
+
+	return retval;
+}
+
+int jrpc_exit(void)
+{
+	int retval;
+
+	retval = ctx_exit(&DefaultCtx);
+	DefaultCtx.polled = 0;
+	return retval;
 }
@@ -17,6 +17,21 @@ enum jrpc_states {
 	JRPC_INITIALISED
 };
 
+/* how jrpcd spreads calls over processes registered with one node name */
+enum jrpc_group {
+	JRPC_GROUP_NONE,	/* node name is owned by one process */
+	JRPC_GROUP_RR,		/* round robin */
+	JRPC_GROUP_LOC,		/* least outstanding calls */
+	JRPC_GROUP_HASH		/* consistent hashing on a key argument */
+};
+
+/* status of a call, see struct jrpc_result */
+#define JRPC_OK			0
+#define JRPC_EFAIL		-1
+#define JRPC_ETIMEOUT		-2
+
+#define JRPC_RESULT_SIZE	1024
+
 #define DEFAULT_IP		"127.0.0.1"
 #define DEFAULT_PORT		5000
 #define RETURN_POINTER(p, t)	((t*)p)
@@ -28,12 +43,138 @@ struct if_details {
 	char rfmt[NAME_SIZE];			/* return format */
 };
 
+/* result of one node of a jrpc_call_many */
+struct jrpc_result {
+	char node[NAME_SIZE];		/* node that was called */
+	int status;			/* JRPC_OK, JRPC_EFAIL or JRPC_ETIMEOUT */
+	int ival;			/* return value of "%d" interfaces */
+	char sval[JRPC_RESULT_SIZE];	/* return value of "%s" interfaces */
+};
+
+/* transport to jrpcd linked into the process, libjrpcd has one */
+struct jrpc_transport {
+	void *(*attach)(void);			/* returns the link */
+	int (*send)(void *link, char *msg, int len);
+	int (*recv)(void *link, char **msg);	/* waits, msg NULL once the */
+						/* link is closed */
+	void (*release)(char *msg);		/* msg of recv is done with */
+	void (*detach)(void *link);
+};
+
+/* an arg of a call, typed by the caller, see jrpc_callv and jrpc_getargs */
+struct jrpc_arg {
+	char type;			/* 'd' or 's' */
+	int ival;
+	char *sval;
+};
+
+/* one step of a jrpc_call_chain */
+struct jrpc_step {
+	char *node;
+	char *if_name;
+};
+
+/* a connection to jrpcd, see jrpc_ctx_open */
+typedef struct jrpc_ctx jrpc_ctx_t;
+
+/* a call an interface answers later, see jrpc_defer */
+typedef struct jrpc_deferred jrpc_deferred_t;
+
+/* gets the return of a jrpc_call_async, res->status tells how it went */
+typedef void (*jrpc_done_fn)(struct jrpc_result *res, void *arg);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 int jrpc_init(void);
+int jrpc_init_embedded(const struct jrpc_transport *tp);
 int jrpc_register(char *node, int n_if, struct if_details *ifl, void *cbptr);
+int jrpc_register_group(char *node, int n_if, struct if_details *ifl,
+			enum jrpc_group group, int key);
+int jrpc_unregister(char *node);
 int jrpc_call(char *node, char *ifname, void *ret, char *afmt, ...);
+int jrpc_calltm(char *node, char *ifname, int timeout_ms, void *ret,
+		char *afmt, ...);
+int jrpc_call_async(char *node, char *ifname, int timeout_ms,
+		    jrpc_done_fn done, void *arg, char *afmt, ...);
+int jrpc_callv(char *node, char *ifname, int timeout_ms, void *ret,
+	       struct jrpc_arg *args, int n_args);
+int jrpc_call_asyncv(char *node, char *ifname, int timeout_ms,
+		     jrpc_done_fn done, void *arg, struct jrpc_arg *args,
+		     int n_args);
+int jrpc_direct(char *node);
+int jrpc_notify(char *node, char *ifname, char *afmt, ...);
+int jrpc_publish(char *topic, char *afmt, ...);
+int jrpc_subscribe(char *topic);
+int jrpc_unsubscribe(char *topic);
+int jrpc_call_many(char *nodes, char *ifname, struct jrpc_result *res,
+		   int max_res, int timeout_ms, char *afmt, ...);
+int jrpc_call_chain(struct jrpc_step *steps, int n_steps, void *ret,
+		    char *afmt, ...);
 int jrpc_scanargs(const char *fmt, ...);
+int jrpc_getargs(struct jrpc_arg *args, int max_args);
+jrpc_deferred_t *jrpc_defer(void);
+int jrpc_reply(jrpc_deferred_t *call, void *ret);
+int jrpc_set_outbox(int max_bytes, int block);
+int jrpc_set_idempotent(char *node, char *if_name);
+int jrpc_set_cacheable(char *node, char *if_name, int ttl_ms);
 int jrpc_exit(void);
 
+/* no library thread, the application reads the connection, see
+ * jrpc_ctx_open_polled */
+int jrpc_init_polled(void);
+int jrpc_fd(void);
+int jrpc_process_ready(void);
+int jrpc_poll(int timeout_ms);
+int jrpc_flush(void);
+
+/* the same on a context of its own, the calls above use the one of
+ * jrpc_init */
+jrpc_ctx_t *jrpc_ctx_open(void);
+jrpc_ctx_t *jrpc_ctx_open_embedded(const struct jrpc_transport *tp);
+jrpc_ctx_t *jrpc_ctx_open_polled(void);
+int jrpc_ctx_fd(jrpc_ctx_t *ctx);
+int jrpc_ctx_process_ready(jrpc_ctx_t *ctx);
+int jrpc_ctx_poll(jrpc_ctx_t *ctx, int timeout_ms);
+int jrpc_ctx_flush(jrpc_ctx_t *ctx);
+int jrpc_ctx_register(jrpc_ctx_t *ctx, char *node, int n_if,
+		      struct if_details *ifl, void *cbptr);
+int jrpc_ctx_register_group(jrpc_ctx_t *ctx, char *node, int n_if,
+			    struct if_details *ifl, enum jrpc_group group,
+			    int key);
+int jrpc_ctx_unregister(jrpc_ctx_t *ctx, char *node);
+int jrpc_ctx_call(jrpc_ctx_t *ctx, char *node, char *ifname, void *ret,
+		  char *afmt, ...);
+int jrpc_ctx_calltm(jrpc_ctx_t *ctx, char *node, char *ifname,
+		    int timeout_ms, void *ret, char *afmt, ...);
+int jrpc_ctx_call_async(jrpc_ctx_t *ctx, char *node, char *ifname,
+			int timeout_ms, jrpc_done_fn done, void *arg,
+			char *afmt, ...);
+int jrpc_ctx_callv(jrpc_ctx_t *ctx, char *node, char *ifname, int timeout_ms,
+		   void *ret, struct jrpc_arg *args, int n_args);
+int jrpc_ctx_call_asyncv(jrpc_ctx_t *ctx, char *node, char *ifname,
+			 int timeout_ms, jrpc_done_fn done, void *arg,
+			 struct jrpc_arg *args, int n_args);
+int jrpc_ctx_direct(jrpc_ctx_t *ctx, char *node);
+int jrpc_ctx_notify(jrpc_ctx_t *ctx, char *node, char *ifname, char *afmt,
+		    ...);
+int jrpc_ctx_publish(jrpc_ctx_t *ctx, char *topic, char *afmt, ...);
+int jrpc_ctx_subscribe(jrpc_ctx_t *ctx, char *topic);
+int jrpc_ctx_unsubscribe(jrpc_ctx_t *ctx, char *topic);
+int jrpc_ctx_call_many(jrpc_ctx_t *ctx, char *nodes, char *ifname,
+		       struct jrpc_result *res, int max_res, int timeout_ms,
+		       char *afmt, ...);
+int jrpc_ctx_call_chain(jrpc_ctx_t *ctx, struct jrpc_step *steps,
+			int n_steps, void *ret, char *afmt, ...);
+int jrpc_ctx_set_outbox(jrpc_ctx_t *ctx, int max_bytes, int block);
+int jrpc_ctx_set_idempotent(jrpc_ctx_t *ctx, char *node, char *if_name);
+int jrpc_ctx_set_cacheable(jrpc_ctx_t *ctx, char *node, char *if_name,
+			   int ttl_ms);
+int jrpc_ctx_close(jrpc_ctx_t *ctx);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
@@ -0,0 +1,556 @@
+/******************************************************************************
+ * Author: Aananth C N <caananth@visteon.com>
+ * Date: 06 Jun 2016
+ *
+ * Description: C++ interface to libjrpc.so, header only. Calls and
+ *              interfaces are typed by the compiler, int goes as "%d" and
+ *              strings as "%s", no afmt string is read at run time:
+ *
+ *                  int sum = jrpc::call<int>("app_sum", "add2", a, b);
+ *
+ *              blocks for the return, in a C++20 coroutine
+ *
+ *                  int sum = co_await jrpc::call<int>("app_sum", "add2", a, b);
+ *
+ *              does not. Interfaces are plain functions or coroutines, see
+ *              jrpc::bind. A coroutine resumes on the thread its call
+ *              returned on, so it must not make blocking calls.
+ *****************************************************************************/
+#ifndef JRPC_HPP
+#define JRPC_HPP
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "jrpc.h"
+
+namespace jrpc {
+
+/* what jrpc_call waits for a return */
+inline constexpr int call_timeout_ms = 5000;
+
+/* a call that failed, status is JRPC_EFAIL or JRPC_ETIMEOUT */
+class error : public std::runtime_error {
+public:
+	error(int status, const std::string &what)
+		: std::runtime_error(what), status(status) {}
+
+	int status;
+};
+
+template <typename T = void> class task;
+
+namespace detail {
+
+template <typename T> inline constexpr bool unsupported = false;
+
+/* how a type goes over the wire and how libjrpc takes it */
+template <typename T> struct wire {
+	static_assert(unsupported<T>, "jrpc: only int and strings go over "
+				      "the wire");
+};
+
+template <> struct wire<int> {
+	static constexpr char code = 'd';
+	using stored = int;		/* kept by a call till it is sent */
+
+	static jrpc_arg to_arg(int v) { return {'d', v, nullptr}; }
+	static int from_arg(const jrpc_arg &a) { return a.ival; }
+	static int get(jrpc_result *res) { return res->ival; }
+};
+
+template <> struct wire<std::string> {
+	static constexpr char code = 's';
+	using stored = std::string;
+
+	static jrpc_arg to_arg(const std::string &v)
+	{
+		return {'s', 0, const_cast<char *>(v.c_str())};
+	}
+	static std::string from_arg(const jrpc_arg &a) { return a.sval; }
+	static std::string get(jrpc_result *res) { return res->sval; }
+	static const char *c_str(const std::string &v) { return v.c_str(); }
+};
+
+/* good till the interface returns, so not for coroutine interfaces */
+template <> struct wire<const char *> : wire<std::string> {
+	static const char *from_arg(const jrpc_arg &a) { return a.sval; }
+	static const char *c_str(const char *v) { return v; }
+};
+
+template <> struct wire<char *> : wire<std::string> {};
+
+template <typename T> using wire_t = wire<std::remove_cv_t<std::decay_t<T>>>;
+
+/* the afmt string of args A, "%d%s" for (int, std::string) */
+template <typename... A>
+constexpr std::array<char, 2 * sizeof...(A) + 1> make_afmt()
+{
+	std::array<char, 2 * sizeof...(A) + 1> fmt{};
+	std::size_t i = 0;
+
+	((fmt[i++] = '%', fmt[i++] = wire_t<A>::code), ...);
+	return fmt;
+}
+
+template <typename... A> inline constexpr auto afmt = make_afmt<A...>();
+
+/* a coroutine nobody awaits, its frame goes once it is done */
+struct detached {
+	struct promise_type {
+		detached get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+	};
+};
+
+/* resumes whoever awaits the task once it is done */
+struct final_awaiter {
+	bool await_ready() noexcept { return false; }
+
+	template <typename P>
+	std::coroutine_handle<> await_suspend(
+		std::coroutine_handle<P> h) noexcept
+	{
+		return h.promise().continuation;
+	}
+
+	void await_resume() noexcept {}
+};
+
+struct promise_base {
+	std::coroutine_handle<> continuation = std::noop_coroutine();
+	std::exception_ptr error;
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	final_awaiter final_suspend() noexcept { return {}; }
+	void unhandled_exception() noexcept
+	{
+		error = std::current_exception();
+	}
+};
+
+template <typename T> struct promise : promise_base {
+	std::optional<T> value;
+
+	task<T> get_return_object() noexcept;
+	void return_value(T v) { value.emplace(std::move(v)); }
+};
+
+template <> struct promise<void> : promise_base {
+	task<void> get_return_object() noexcept;
+	void return_void() noexcept {}
+};
+
+} /* namespace detail */
+
+
+/******************************************************************************
+ * task
+ *
+ * A coroutine returning T. It starts once it is co_awaited, or handed to
+ * jrpc::spawn or jrpc::sync_wait.
+ */
+template <typename T> class task {
+public:
+	using promise_type = detail::promise<T>;
+	using handle = std::coroutine_handle<promise_type>;
+
+	explicit task(handle h) noexcept : h_(h) {}
+	task(task &&t) noexcept : h_(std::exchange(t.h_, {})) {}
+	task(const task &) = delete;
+	task &operator=(const task &) = delete;
+	~task()
+	{
+		if (h_)
+			h_.destroy();
+	}
+
+	bool await_ready() const noexcept { return !h_ || h_.done(); }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller)
+	{
+		h_.promise().continuation = caller;
+		return h_;
+	}
+
+	T await_resume()
+	{
+		if (h_.promise().error)
+			std::rethrow_exception(h_.promise().error);
+		if constexpr (!std::is_void_v<T>)
+			return std::move(*h_.promise().value);
+	}
+
+private:
+	handle h_;
+};
+
+namespace detail {
+
+template <typename T> task<T> promise<T>::get_return_object() noexcept
+{
+	return task<T>(task<T>::handle::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() noexcept
+{
+	return task<void>(task<void>::handle::from_promise(*this));
+}
+
+/* a call, made when it is co_awaited or converted to R. The return of a
+ * co_awaited call comes to done on the thread reading the connection,
+ * whichever of await_suspend and done comes second resumes. */
+template <typename R, typename... A> class call_op {
+public:
+	call_op(jrpc_ctx_t *ctx, const char *node, const char *if_name,
+		int timeout_ms, const A &...args)
+		: ctx_(ctx), node_(node), if_name_(if_name),
+		  timeout_ms_(timeout_ms), args_(args...) {}
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		h_ = h;
+		if (std::apply([this](auto &...a) { return send(a...); },
+			       args_) < 0) {
+			status_ = JRPC_EFAIL;
+			return false;
+		}
+		return !arrived_.exchange(true);
+	}
+
+	R await_resume()
+	{
+		if (status_ != JRPC_OK)
+			fail();
+		return std::move(*value_);
+	}
+
+	/* a call not co_awaited blocks for its return */
+	operator R() && { return std::move(*this).get(); }
+
+	R get() &&
+	{
+		std::array<jrpc_arg, sizeof...(A) + 1> in;
+		int ival = 0, retval;
+		char sval[BUFF_SIZE];
+		void *ret = std::is_same_v<R, int> ? (void *)&ival :
+			    (void *)sval;
+
+		sval[0] = '\0';
+		std::apply([&in](auto &...a) {
+			std::size_t i = 0;
+			((in[i++] = wire_t<A>::to_arg(a)), ...);
+		}, args_);
+		if (ctx_ == nullptr)
+			retval = jrpc_callv(node_.data(), if_name_.data(),
+					    timeout_ms_, ret, in.data(),
+					    sizeof...(A));
+		else
+			retval = jrpc_ctx_callv(ctx_, node_.data(),
+						if_name_.data(), timeout_ms_,
+						ret, in.data(), sizeof...(A));
+		if (retval < 0) {
+			status_ = JRPC_EFAIL;
+			fail();
+		}
+		if constexpr (std::is_same_v<R, int>)
+			return ival;
+		else
+			return R(sval);
+	}
+
+private:
+	template <typename... S> int send(S &...a)
+	{
+		std::array<jrpc_arg, sizeof...(A) + 1> in = {
+			wire_t<A>::to_arg(a)...
+		};
+
+		if (ctx_ == nullptr)
+			return jrpc_call_asyncv(node_.data(), if_name_.data(),
+						timeout_ms_, done, this,
+						in.data(), sizeof...(A));
+		return jrpc_ctx_call_asyncv(ctx_, node_.data(),
+					    if_name_.data(), timeout_ms_, done,
+					    this, in.data(), sizeof...(A));
+	}
+
+	[[noreturn]] void fail()
+	{
+		throw error(status_, node_ + ": " + if_name_ + "() " +
+			    ((status_ == JRPC_ETIMEOUT) ? "timed out" :
+			     "failed"));
+	}
+
+	static void done(jrpc_result *res, void *arg)
+	{
+		call_op *op = static_cast<call_op *>(arg);
+
+		op->status_ = res->status;
+		if (res->status == JRPC_OK)
+			op->value_.emplace(wire_t<R>::get(res));
+		if (op->arrived_.exchange(true))
+			op->h_.resume();
+	}
+
+	jrpc_ctx_t *ctx_;
+	std::string node_;
+	std::string if_name_;
+	int timeout_ms_;
+	std::tuple<typename wire_t<A>::stored...> args_;
+	std::coroutine_handle<> h_;
+	std::atomic<bool> arrived_{false};
+	int status_ = JRPC_EFAIL;
+	std::optional<R> value_;
+};
+
+/* lets a thread wait for a task */
+template <typename T> struct waiter {
+	std::mutex m;
+	std::condition_variable cv;
+	bool finished = false;
+	std::exception_ptr error;
+	std::optional<std::conditional_t<std::is_void_v<T>, char, T>> value;
+
+	static detached run(waiter *w, task<T> t)
+	{
+		try {
+			if constexpr (std::is_void_v<T>)
+				co_await t;
+			else
+				w->value.emplace(co_await t);
+		} catch (...) {
+			w->error = std::current_exception();
+		}
+		std::lock_guard<std::mutex> lock(w->m);
+		w->finished = true;
+		w->cv.notify_one();
+	}
+};
+
+/* the args of the call running on this thread, if they are of types A */
+template <typename... A>
+bool get_args(std::array<jrpc_arg, sizeof...(A) + 1> &in)
+{
+	std::size_t i = 0;
+
+	if (jrpc_getargs(in.data(), sizeof...(A)) != (int)sizeof...(A))
+		return false;
+	return ((in[i++].type == wire_t<A>::code) && ...);
+}
+
+/* puts the return of an interface where libjrpc wants it */
+template <typename R> void put_ret(void *ret, const R &r)
+{
+	if constexpr (std::is_same_v<R, int>) {
+		*RETURN_POINTER(ret, int) = r;
+	} else {
+		std::strncpy((char *)ret, wire_t<R>::c_str(r), BUFF_SIZE - 1);
+		((char *)ret)[BUFF_SIZE - 1] = '\0';
+	}
+}
+
+/* if_details::fnptr of a plain function Fn */
+template <typename F> struct fn_traits;
+
+template <typename R, typename... A> struct fn_traits<R (*)(A...)> {
+	static constexpr auto args_fmt = afmt<A...>;
+	static constexpr auto ret_fmt = afmt<R>;
+
+	template <auto Fn, std::size_t... I>
+	static R invoke(std::array<jrpc_arg, sizeof...(A) + 1> &in,
+			std::index_sequence<I...>)
+	{
+		return Fn(wire_t<A>::from_arg(in[I])...);
+	}
+
+	template <auto Fn> static int run(void *ret, char *)
+	{
+		std::array<jrpc_arg, sizeof...(A) + 1> in;
+
+		if (!get_args<A...>(in))
+			return -1;
+		try {
+			put_ret<R>(ret, invoke<Fn>(in,
+					std::index_sequence_for<A...>{}));
+		} catch (...) {
+			return -1;
+		}
+		return 0;
+	}
+};
+
+/* the same for coroutine Fn. The call is deferred, the task answers it
+ * once it is done. */
+template <typename R, typename... A> struct fn_traits<task<R> (*)(A...)> {
+	static_assert(((!std::is_reference_v<A> && !std::is_pointer_v<A>) &&
+		       ...),
+		      "jrpc: a coroutine interface takes its args by value, "
+		      "the call is gone when it resumes");
+	static constexpr auto args_fmt = afmt<A...>;
+	static constexpr auto ret_fmt = afmt<R>;
+
+	template <auto Fn, std::size_t... I>
+	static task<R> invoke(std::array<jrpc_arg, sizeof...(A) + 1> &in,
+			      std::index_sequence<I...>)
+	{
+		return Fn(wire_t<A>::from_arg(in[I])...);
+	}
+
+	template <auto Fn> static int run(void *ret, char *)
+	{
+		std::array<jrpc_arg, sizeof...(A) + 1> in;
+
+		if (!get_args<A...>(in))
+			return -1;
+		serve(jrpc_defer(),
+		      invoke<Fn>(in, std::index_sequence_for<A...>{}));
+		return 0;
+	}
+
+	static detached serve(jrpc_deferred_t *call, task<R> t)
+	{
+		char ret[BUFF_SIZE];
+		bool ok = false;
+
+		try {
+			put_ret<R>(ret, co_await t);
+			ok = true;
+		} catch (...) {
+		}
+		/* a notification has nobody to answer */
+		if (call != nullptr)
+			jrpc_reply(call, ok ? ret : nullptr);
+	}
+};
+
+} /* namespace detail */
+
+
+/******************************************************************************
+ * call
+ *
+ * call<R>(node, if_name, args...) is a call returning R, int or std::string.
+ * Converted to R or get() it blocks for the return like jrpc_call, co_awaited
+ * it resumes with it. A failed call throws jrpc::error. The call goes over the
+ * context of jrpc_init, or over ctx.
+ */
+template <typename R, typename... A>
+detail::call_op<R, std::decay_t<A>...> call(const char *node,
+					    const char *if_name, A &&...args)
+{
+	return {nullptr, node, if_name, call_timeout_ms, args...};
+}
+
+template <typename R, typename... A>
+detail::call_op<R, std::decay_t<A>...> call(jrpc_ctx_t *ctx, const char *node,
+					    const char *if_name, A &&...args)
+{
+	return {ctx, node, if_name, call_timeout_ms, args...};
+}
+
+/* the same, failing with JRPC_ETIMEOUT after timeout_ms */
+template <typename R, typename... A>
+detail::call_op<R, std::decay_t<A>...> calltm(const char *node,
+					      const char *if_name,
+					      int timeout_ms, A &&...args)
+{
+	return {nullptr, node, if_name, timeout_ms, args...};
+}
+
+
+/******************************************************************************
+ * spawn
+ *
+ * Starts t without waiting for it. It runs till its first co_await right
+ * away, the rest runs on the threads its calls return on.
+ */
+template <typename T> void spawn(task<T> t)
+{
+	[](task<T> t) -> detail::detached {
+		try {
+			co_await t;
+		} catch (...) {
+		}
+	}(std::move(t));
+}
+
+
+/******************************************************************************
+ * sync_wait
+ *
+ * Runs t and blocks till it is done, for threads that are no coroutine like
+ * main(). Not on the receive thread of a context t makes calls over, see
+ * jrpc_ctx_call_async.
+ */
+template <typename T> T sync_wait(task<T> t)
+{
+	detail::waiter<T> w;
+
+	detail::waiter<T>::run(&w, std::move(t));
+	std::unique_lock<std::mutex> lock(w.m);
+	w.cv.wait(lock, [&w] { return w.finished; });
+	if (w.error)
+		std::rethrow_exception(w.error);
+	if constexpr (!std::is_void_v<T>)
+		return std::move(*w.value);
+}
+
+
+/******************************************************************************
+ * bind
+ *
+ * if_details of interface Fn for jrpc_register, afmt and rfmt come from the
+ * types of Fn. Fn is a plain function or a coroutine:
+ *
+ *     int add2(int a, int b)
+ *     {
+ *             return a + b;
+ *     }
+ *
+ *     jrpc::task<int> add3(int a, int b, int c)
+ *     {
+ *             int ab = co_await jrpc::call<int>("app_sum", "add2", a, b);
+ *             co_return co_await jrpc::call<int>("app_sum", "add2", ab, c);
+ *     }
+ *
+ *     struct if_details ifs[] = {
+ *             jrpc::bind<add2>("add2"),
+ *             jrpc::bind<add3>("add3")
+ *     };
+ *
+ * A call with args of other types fails, so does one whose Fn throws. The
+ * call of a coroutine is answered once it co_returns, while it waits the
+ * thread that ran it serves other calls.
+ */
+template <auto Fn> if_details bind(const char *if_name)
+{
+	using fn = detail::fn_traits<decltype(Fn)>;
+	if_details ifd{};
+
+	std::strncpy(ifd.if_name, if_name, NAME_SIZE - 1);
+	ifd.fnptr = &fn::template run<Fn>;
+	std::strcpy(ifd.afmt, fn::args_fmt.data());
+	std::strcpy(ifd.rfmt, fn::ret_fmt.data());
+	return ifd;
+}
+
+} /* namespace jrpc */
+
+#endif
@@ -0,0 +1,574 @@
+/******************************************************************************
+ * Author: Aananth C N <caananth@visteon.com>
+ * Date: 06 Jun 2016
+ *
+ * Description: jrpcgen, makes the C code of a set of interfaces from their
+ *              interface definition (idl) file:
+ *
+ *                  jrpcgen [-o dir] calc.idl
+ *
+ *              writes calc_jrpc.h, calc_client.c and calc_server.c. Each
+ *              line of the idl declares one interface, C style:
+ *
+ *                  int add(int a, int b);
+ *                  string greet(string who, int times) cache 1000;
+ *
+ *              types are int ("%d") and string ("%s"), cache lets jrpcd
+ *              answer repeats from its cache for so many ms, see
+ *              jrpc_set_cacheable. Comments are C and C++ style.
+ *
+ *              The client stub calc_add(node, a, b, &ret) hands its args
+ *              to jrpc_callv as they are typed, no format string is read.
+ *              The server skeleton of add takes them with jrpc_getargs,
+ *              checks their types and calls calc_add_impl(a, b, &ret),
+ *              which the application implements. calc_ifs is the table of
+ *              the skeletons for jrpc_register, calc_register registers it
+ *              along with the cache times of the interfaces.
+ *****************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#define MAX_IFS		64	/* interfaces of a file */
+#define MAX_PARAMS	16	/* args of an interface, MAX_ARGS of libjrpc */
+#define NAME_LEN	64
+#define PATH_LEN	1024
+
+enum tok {
+	TOK_END,
+	TOK_NAME,
+	TOK_NUMBER,
+	TOK_PUNCT
+};
+
+struct idl_param {
+	char type;			/* 'd' or 's' */
+	char name[NAME_LEN];
+};
+
+struct idl_if {
+	char name[NAME_LEN];
+	char rtype;			/* 'd' or 's' */
+	int n_params;
+	struct idl_param params[MAX_PARAMS];
+	int cache_ms;
+};
+
+/* the idl file being read */
+static const char *File;
+static char *Text;
+static char *Pos;
+static int Line = 1;
+static enum tok Tok;
+static char TokText[NAME_LEN];
+
+static struct idl_if Ifs[MAX_IFS];
+static int NIfs;
+
+static char Base[NAME_LEN];	/* "calc" of calc.idl, prefix of all names */
+static char Guard[NAME_LEN];	/* CALC */
+
+/* names the generated code uses itself */
+static const char *Reserved[] = { "ctx", "node", "ret", "args", NULL };
+
+
+static void fail(const char *msg, const char *what)
+{
+	fprintf(stderr, "%s:%d: %s%s%s\n", File, Line, msg,
+		what ? " " : "", what ? what : "");
+	exit(1);
+}
+
+
+/******************************************************************************
+ * reading the idl
+ */
+static void skip_space(void)
+{
+	for (;;) {
+		while (isspace((unsigned char)*Pos)) {
+			if (*Pos == '\n')
+				Line++;
+			Pos++;
+		}
+		if ((Pos[0] == '/') && (Pos[1] == '/')) {
+			while (*Pos && (*Pos != '\n'))
+				Pos++;
+		} else if ((Pos[0] == '/') && (Pos[1] == '*')) {
+			for (Pos += 2; *Pos && !((Pos[0] == '*') &&
+						 (Pos[1] == '/')); Pos++) {
+				if (*Pos == '\n')
+					Line++;
+			}
+			if (*Pos == '\0')
+				fail("unterminated comment", NULL);
+			Pos += 2;
+		} else {
+			return;
+		}
+	}
+}
+
+
+static void next(void)
+{
+	int len = 0;
+
+	skip_space();
+	if (*Pos == '\0') {
+		Tok = TOK_END;
+		TokText[0] = '\0';
+		return;
+	}
+
+	if (isalpha((unsigned char)*Pos) || (*Pos == '_')) {
+		Tok = TOK_NAME;
+		while (isalnum((unsigned char)*Pos) || (*Pos == '_')) {
+			if (len >= NAME_LEN - 1)
+				fail("name too long", NULL);
+			TokText[len++] = *Pos++;
+		}
+	} else if (isdigit((unsigned char)*Pos)) {
+		Tok = TOK_NUMBER;
+		while (isdigit((unsigned char)*Pos)) {
+			if (len >= 9)
+				fail("number too big", NULL);
+			TokText[len++] = *Pos++;
+		}
+	} else {
+		Tok = TOK_PUNCT;
+		TokText[len++] = *Pos++;
+	}
+	TokText[len] = '\0';
+}
+
+
+static void expect(const char *punct)
+{
+	if ((Tok != TOK_PUNCT) || (strcmp(TokText, punct) != 0))
+		fail("expected", punct);
+	next();
+}
+
+
+static char parse_type(void)
+{
+	char type;
+
+	if ((Tok == TOK_NAME) && (strcmp(TokText, "int") == 0))
+		type = 'd';
+	else if ((Tok == TOK_NAME) && (strcmp(TokText, "string") == 0))
+		type = 's';
+	else
+		fail("expected int or string, got", TokText);
+	next();
+
+	return type;
+}
+
+
+static void parse_name(char *name)
+{
+	if (Tok != TOK_NAME)
+		fail("expected a name, got", TokText);
+	strcpy(name, TokText);
+	next();
+}
+
+
+/* type name(type name, ...) [cache ms]; */
+static void parse_if(struct idl_if *ifp)
+{
+	struct idl_param *p;
+	int i, j;
+
+	ifp->rtype = parse_type();
+	parse_name(ifp->name);
+	for (i = 0; i < NIfs; i++) {
+		if (strcmp(Ifs[i].name, ifp->name) == 0)
+			fail("interface declared twice:", ifp->name);
+	}
+
+	expect("(");
+	while ((Tok != TOK_PUNCT) || (strcmp(TokText, ")") != 0)) {
+		if (ifp->n_params > 0)
+			expect(",");
+		if (ifp->n_params >= MAX_PARAMS)
+			fail("too many args of", ifp->name);
+		p = &ifp->params[ifp->n_params];
+		p->type = parse_type();
+		parse_name(p->name);
+		for (j = 0; Reserved[j] != NULL; j++) {
+			if (strcmp(p->name, Reserved[j]) == 0)
+				fail("reserved arg name", p->name);
+		}
+		for (j = 0; j < ifp->n_params; j++) {
+			if (strcmp(ifp->params[j].name, p->name) == 0)
+				fail("arg declared twice:", p->name);
+		}
+		ifp->n_params++;
+	}
+	expect(")");
+
+	if ((Tok == TOK_NAME) && (strcmp(TokText, "cache") == 0)) {
+		next();
+		if (Tok != TOK_NUMBER)
+			fail("expected the cache time in ms, got", TokText);
+		ifp->cache_ms = atoi(TokText);
+		next();
+	}
+	expect(";");
+}
+
+
+static void parse(void)
+{
+	next();
+	while (Tok != TOK_END) {
+		if (NIfs >= MAX_IFS)
+			fail("too many interfaces", NULL);
+		parse_if(&Ifs[NIfs]);
+		NIfs++;
+	}
+	if (NIfs == 0)
+		fail("no interfaces", NULL);
+}
+
+
+static void load(const char *path)
+{
+	FILE *f;
+	long size;
+
+	f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	Text = malloc(size + 1);
+	if ((Text == NULL) || (fread(Text, 1, size, f) != (size_t)size)) {
+		perror(path);
+		exit(1);
+	}
+	Text[size] = '\0';
+	fclose(f);
+	Pos = Text;
+}
+
+
+/******************************************************************************
+ * writing the C code
+ */
+static FILE *create(const char *dir, const char *suffix)
+{
+	char path[PATH_LEN];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s%s", dir, Base, suffix);
+	f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		exit(1);
+	}
+	fprintf(f, "/* Generated by jrpcgen from %s, do not edit */\n", File);
+
+	return f;
+}
+
+
+static const char *c_type(char type)
+{
+	return (type == 'd') ? "int " : "const char *";
+}
+
+
+/* "int a, const char *who, ", ret comes after the args */
+static void emit_params(FILE *f, struct idl_if *ifp)
+{
+	int i;
+
+	for (i = 0; i < ifp->n_params; i++)
+		fprintf(f, "%s%s, ", c_type(ifp->params[i].type),
+			ifp->params[i].name);
+}
+
+
+/* the C type of ret, a string return needs BUFF_SIZE bytes */
+static const char *ret_type(struct idl_if *ifp)
+{
+	return (ifp->rtype == 'd') ? "int *" : "char *";
+}
+
+
+/* "int calc_add(char *node, int a, int b, int *ret)" */
+static void emit_stub_head(FILE *f, struct idl_if *ifp, int ctx)
+{
+	if (ctx)
+		fprintf(f, "int %s_ctx_%s(jrpc_ctx_t *ctx, char *node, ", Base,
+			ifp->name);
+	else
+		fprintf(f, "int %s_%s(char *node, ", Base, ifp->name);
+	emit_params(f, ifp);
+	fprintf(f, "%sret)", ret_type(ifp));
+}
+
+
+static void emit_impl_head(FILE *f, struct idl_if *ifp)
+{
+	fprintf(f, "int %s_%s_impl(", Base, ifp->name);
+	emit_params(f, ifp);
+	fprintf(f, "%sret)", ret_type(ifp));
+}
+
+
+static void emit_header(const char *dir)
+{
+	FILE *f = create(dir, "_jrpc.h");
+	int i;
+
+	fprintf(f, "#ifndef %s_JRPC_H\n", Guard);
+	fprintf(f, "#define %s_JRPC_H\n\n", Guard);
+	fprintf(f, "#include \"jrpc.h\"\n\n");
+	fprintf(f, "#define %s_N_IFS\t\t%d\n\n", Guard, NIfs);
+	fprintf(f, "/* the stubs wait this long for a return */\n");
+	fprintf(f, "#ifndef %s_TIMEOUT_MS\n", Guard);
+	fprintf(f, "#define %s_TIMEOUT_MS\t5000\n", Guard);
+	fprintf(f, "#endif\n\n");
+	fprintf(f, "#ifdef __cplusplus\n");
+	fprintf(f, "extern \"C\" {\n");
+	fprintf(f, "#endif\n\n");
+
+	fprintf(f, "/* client stubs, in %s_client.c. They call the interface "
+		"of node and copy\n * its return to ret, a string needs "
+		"BUFF_SIZE bytes. 0, or -1 if the call\n * failed. */\n", Base);
+	for (i = 0; i < NIfs; i++) {
+		emit_stub_head(f, &Ifs[i], 0);
+		fprintf(f, ";\n");
+		emit_stub_head(f, &Ifs[i], 1);
+		fprintf(f, ";\n");
+	}
+
+	fprintf(f, "\n/* the server skeletons, in %s_server.c, call these with "
+		"the args of a\n * call. The application implements them, they "
+		"return 0, or -1 if the call\n * failed. They may jrpc_defer the "
+		"return. */\n", Base);
+	for (i = 0; i < NIfs; i++) {
+		emit_impl_head(f, &Ifs[i]);
+		fprintf(f, ";\n");
+	}
+
+	fprintf(f, "\n/* the skeletons, for jrpc_register */\n");
+	fprintf(f, "extern struct if_details %s_ifs[%s_N_IFS];\n", Base, Guard);
+	fprintf(f, "int %s_register(char *node);\n", Base);
+	fprintf(f, "int %s_ctx_register(jrpc_ctx_t *ctx, char *node);\n\n",
+		Base);
+
+	fprintf(f, "#ifdef __cplusplus\n");
+	fprintf(f, "}\n");
+	fprintf(f, "#endif\n\n");
+	fprintf(f, "#endif\n");
+	fclose(f);
+}
+
+
+/* "args[1].type = 's';" and so on, args[] as jrpc_callv takes them */
+static void emit_args(FILE *f, struct idl_if *ifp)
+{
+	struct idl_param *p;
+	int i;
+
+	if (ifp->n_params == 0)
+		return;
+	fprintf(f, "\tstruct jrpc_arg args[%d];\n\n", ifp->n_params);
+	for (i = 0; i < ifp->n_params; i++) {
+		p = &ifp->params[i];
+		fprintf(f, "\targs[%d].type = '%c';\n", i, p->type);
+		if (p->type == 'd') {
+			fprintf(f, "\targs[%d].ival = %s;\n", i, p->name);
+			fprintf(f, "\targs[%d].sval = NULL;\n", i);
+		} else {
+			fprintf(f, "\targs[%d].ival = 0;\n", i);
+			fprintf(f, "\targs[%d].sval = (char *)%s;\n", i,
+				p->name);
+		}
+	}
+	fprintf(f, "\n");
+}
+
+
+static void emit_client(const char *dir)
+{
+	FILE *f = create(dir, "_client.c");
+	struct idl_if *ifp;
+	const char *args;
+	int i;
+
+	fprintf(f, "#include <stddef.h>\n\n");
+	fprintf(f, "#include \"%s_jrpc.h\"\n", Base);
+
+	for (i = 0; i < NIfs; i++) {
+		ifp = &Ifs[i];
+		args = (ifp->n_params > 0) ? "args" : "NULL";
+
+		fprintf(f, "\n\n");
+		emit_stub_head(f, ifp, 1);
+		fprintf(f, "\n{\n");
+		emit_args(f, ifp);
+		fprintf(f, "\treturn jrpc_ctx_callv(ctx, node, \"%s\", "
+			"%s_TIMEOUT_MS, ret, %s,\n\t\t\t      %d);\n}\n",
+			ifp->name, Guard, args, ifp->n_params);
+
+		fprintf(f, "\n");
+		emit_stub_head(f, ifp, 0);
+		fprintf(f, "\n{\n");
+		emit_args(f, ifp);
+		fprintf(f, "\treturn jrpc_callv(node, \"%s\", %s_TIMEOUT_MS, "
+			"ret, %s, %d);\n}\n", ifp->name, Guard, args,
+			ifp->n_params);
+	}
+	fclose(f);
+}
+
+
+/* the cache times of the idl go to jrpcd with the interfaces, set through
+ * fn, "jrpc_set_cacheable(" or its ctx variant, before they register */
+static void emit_cacheable(FILE *f, const char *fn)
+{
+	int i;
+
+	for (i = 0; i < NIfs; i++) {
+		if (Ifs[i].cache_ms == 0)
+			continue;
+		fprintf(f, "	if (%snode, \"%s\", %d) < 0)\n", fn,
+			Ifs[i].name, Ifs[i].cache_ms);
+		fprintf(f, "\t\treturn -1;\n");
+	}
+}
+
+
+static void emit_server(const char *dir)
+{
+	FILE *f = create(dir, "_server.c");
+	struct idl_if *ifp;
+	struct idl_param *p;
+	int i, j, n;
+
+	fprintf(f, "#include <stddef.h>\n\n");
+	fprintf(f, "#include \"%s_jrpc.h\"\n", Base);
+
+	/* the skeleton takes the args as they came and checks them against
+	 * the idl, the afmt jrpcd hands in is not looked at */
+	for (i = 0; i < NIfs; i++) {
+		ifp = &Ifs[i];
+		n = ifp->n_params;
+
+		fprintf(f, "\n\nstatic int %s_%s_skel(void *ret, char *afmt)\n",
+			Base, ifp->name);
+		fprintf(f, "{\n");
+		fprintf(f, "\tstruct jrpc_arg args[%d];\n\n", n ? n : 1);
+		fprintf(f, "\tif (jrpc_getargs(args, %d) != %d)\n", n ? n : 1, n);
+		fprintf(f, "\t\treturn -1;\n");
+		for (j = 0; j < n; j++) {
+			fprintf(f, "\tif (args[%d].type != '%c')\n", j,
+				ifp->params[j].type);
+			fprintf(f, "\t\treturn -1;\n");
+		}
+		fprintf(f, "\n\treturn %s_%s_impl(", Base, ifp->name);
+		for (j = 0; j < n; j++) {
+			p = &ifp->params[j];
+			fprintf(f, "args[%d].%s, ", j,
+				(p->type == 'd') ? "ival" : "sval");
+		}
+		fprintf(f, "(%s)ret);\n}\n", (ifp->rtype == 'd') ?
+			"int *" : "char *");
+	}
+
+	fprintf(f, "\n\nstruct if_details %s_ifs[%s_N_IFS] = {\n", Base, Guard);
+	for (i = 0; i < NIfs; i++) {
+		ifp = &Ifs[i];
+		fprintf(f, "\t{\"%s\", %s_%s_skel, \"", ifp->name, Base,
+			ifp->name);
+		for (j = 0; j < ifp->n_params; j++)
+			fprintf(f, "%%%c", ifp->params[j].type);
+		fprintf(f, "\", \"%%%c\"}%s\n", ifp->rtype,
+			(i < NIfs - 1) ? "," : "");
+	}
+	fprintf(f, "};\n");
+
+	fprintf(f, "\n\nint %s_ctx_register(jrpc_ctx_t *ctx, char *node)\n",
+		Base);
+	fprintf(f, "{\n");
+	emit_cacheable(f, "jrpc_ctx_set_cacheable(ctx, ");
+	fprintf(f, "\treturn jrpc_ctx_register(ctx, node, %s_N_IFS, %s_ifs, "
+		"NULL);\n", Guard, Base);
+	fprintf(f, "}\n");
+	fprintf(f, "\nint %s_register(char *node)\n", Base);
+	fprintf(f, "{\n");
+	emit_cacheable(f, "jrpc_set_cacheable(");
+	fprintf(f, "\treturn jrpc_register(node, %s_N_IFS, %s_ifs, NULL);\n",
+		Guard, Base);
+	fprintf(f, "}\n");
+	fclose(f);
+}
+
+
+/* Base and Guard from the name of the idl file */
+static void set_base(const char *path)
+{
+	const char *name, *dot;
+	int i, len;
+
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	dot = strrchr(name, '.');
+	len = dot ? dot - name : (int)strlen(name);
+	if ((len == 0) || (len >= NAME_LEN - 8) ||
+	    isdigit((unsigned char)name[0]))
+		fail("file name is not a C name", NULL);
+	for (i = 0; i < len; i++) {
+		if (!isalnum((unsigned char)name[i]) && (name[i] != '_'))
+			fail("file name is not a C name", NULL);
+		Base[i] = name[i];
+		Guard[i] = toupper((unsigned char)name[i]);
+	}
+	Base[len] = Guard[len] = '\0';
+}
+
+
+int main(int argc, char *argv[])
+{
+	const char *dir = ".";
+	int opt;
+
+	while ((opt = getopt(argc, argv, "o:")) != -1) {
+		switch (opt) {
+		case 'o':
+			dir = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-o dir] file.idl\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-o dir] file.idl\n", argv[0]);
+		return 1;
+	}
+
+	File = argv[optind];
+	set_base(File);
+	load(File);
+	parse();
+
+	emit_header(dir);
+	emit_client(dir);
+	emit_server(dir);
+
+	return 0;
+}
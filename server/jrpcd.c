@@ -11,33 +11,74 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <signal.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <time.h>
 
 #include <sys/queue.h>
+#include <sys/socket.h>
 
 #include "jrpcd.h"
 #include "jrpcd_server.h"
 #include "jrpcd_client.h"
 #include "jrpcd_parser.h"
 #include "jrpcd_queue.h"
+#include "jrpcd_pool.h"
+#include "jrpcd_pending.h"
+#include "jrpcd_cache.h"
+#include "jrpcd_topic.h"
+#include "jrpcd_peer.h"
 #include "debug.h"
 
+#define JRPCD_NODE_NAME		"jrpcd"
+#define STATS_MAX_SZ			(3 * 1024)
+
 #define NODE_NAME_MAX_SZ		32
 #define INTF_NAME_MAX_SZ		32
 #define INTF_ARG_MAX_SZ			32
 #define INTF_RET_MAX_SZ			 4
-
-#define REGISTER_RESP_FMT		"{\"api\":\"ack\",\"snode\":\"jrpcd\",\"dnode\":\"%s\",\"if\":\"register\",\"ret\":{\"type\":\"int\",\"val\":%d}}"
-#define CALL_ERR_RESP_FMT		"{\"api\":\"call\",\"snode\":\"jrpcd\",\"dnode\":\"%s\",\"if\":\"%s\",\"ret\":{\"type\":\"int\",\"val\":%d}}"
+#define GROUP_KEY_MAX_SZ		64
+#define MCALL_SPEC_MAX_SZ		256
+#define MCALL_MAX_TARGETS		64
+#define JRPCD_PEERS_MAX			8
+#define PEER_HOST_MAX_SZ		64
+#define DIRECT_MAX_SZ			108
+
+#define REGISTER_RESP_FMT		"{\"api\":\"ack\",\"snode\":\"jrpcd\",\"dnode\":\"%s\",\"if\":\"register\",\"id\":%u,\"ret\":{\"type\":\"int\",\"val\":%d}}"
+#define CALL_ERR_RESP_FMT		"{\"api\":\"return\",\"snode\":\"jrpcd\",\"dnode\":\"%s\",\"tnode\":\"%s\",\"if\":\"%s\",\"id\":%u,\"ret\":{\"type\":\"int\",\"val\":%d}}"
+#define CALL_ERR_PEER_FMT		"{\"api\":\"return\",\"snode\":\"jrpcd\",\"dnode\":\"%s\",\"tnode\":\"%s\",\"if\":\"%s\",\"pxid\":%u,\"ret\":{\"type\":\"int\",\"val\":%d}}"
+#define MCALL_ACK_FMT			"{\"api\":\"ack\",\"snode\":\"jrpcd\",\"dnode\":\"%s\",\"if\":\"%s\",\"id\":%u,\"targets\":["
+#define CALL_XID_FMT			",\"xid\":%u}"
+#define RETURN_ID_FMT			",\"id\":%u}"
+#define PEER_XID_FMT			",\"pxid\":%u}"
+#define LNODE_FMT			",\"lnode\":\"%s\"}"
+#define CACHE_RESP_FMT			"{\"api\":\"return\",\"snode\":\"%s\",\"dnode\":\"%s\",\"if\":\"%s\",\"id\":%u,\"ret\":%s}"
+#define CACHE_PEER_FMT			"{\"api\":\"return\",\"snode\":\"%s\",\"dnode\":\"%s\",\"if\":\"%s\",\"pxid\":%u,\"ret\":%s}"
+
+/* Hot restart, see jrpcd_handoff() */
+#define HANDOFF_MAX_SZ			(8 * JRPCD_MAX_MSG_SZ)
+#define HANDOFF_KIND_MAX_SZ		8
+#define HANDOFF_PAUSE_MS		1000
+#define HANDOFF_DRAIN_MS		1000
+#define HANDOFF_ACK_MS			5000
 
 static uint8_t exit_pending;
+static uint32_t tx_budget = JRPCD_TX_BUDGET_DEF;
+static uint8_t tx_policy = JRPCD_Q_SHED_NEWEST;
+static bool pool_hugepages;
+static bool json_arena;
+static char *upgrade_path;
 
 /* Structure to hold the interface definitions */
 struct jrpcd_intf_desc {
 	char name[INTF_NAME_MAX_SZ];	/* Interface name */
 	char arg[INTF_ARG_MAX_SZ];	/* Interface arguments string */
 	char ret[INTF_RET_MAX_SZ];	/* Interface return type string */
+	uint32_t ttl;		/* Time returns may be cached in ms, 0 never */
 
 	LIST_ENTRY(jrpcd_intf_desc) entries;
 };
@@ -48,6 +89,20 @@ struct jrpcd_node_desc {
 	uint32_t csock;		/* Socket to communicate to the node */
 	uint32_t cid;		/* Client ID for the node */
 	uint16_t num_intf;	/* Number of interfaces in the node */
+	uint32_t tx_budget;	/* Output bytes allowed to queue up for node */
+	uint8_t group;		/* Group policy when the name is shared */
+	uint16_t key;		/* Call argument to hash on for hash groups */
+	uint32_t outstanding;	/* Calls forwarded and not yet returned */
+	uint32_t picks;		/* Calls forwarded to the node */
+	uint64_t last_pick;	/* Pick sequence of the last call forwarded */
+	uint32_t expired;	/* Calls to the node dropped past deadline */
+	bool peer;		/* Link to a peer daemon, not a node */
+	char direct[DIRECT_MAX_SZ];	/* Endpoint of the node, "" if none */
+	bool embedded;		/* Component in this process, no socket */
+	struct jrpcd_node_desc *conn;	/* Node owning the connection this */
+					/* logical node shares, else NULL */
+	bool handed;		/* Connection goes to a successor, see */
+				/* jrpcd_handoff() */
 	pthread_t tid;		/* Transmit thread id */
 	pthread_t rid;		/* Receive thread id */
 	void *tx_q;		/* Transmit data queue instance */
@@ -59,9 +114,65 @@ struct jrpcd_node_desc {
 LIST_HEAD(node_head, jrpcd_node_desc) node_list =
 LIST_HEAD_INITIALIZER(node_list);
 static int cid_next;
+static uint64_t pick_seq;
+static uint64_t coalesced;
+static uint64_t published;
+static uint64_t delivered;
+
+/* Peer daemons to link up with, see jrpcd_set_peer() */
+struct jrpcd_peer_addr {
+	char host[PEER_HOST_MAX_SZ];
+	uint32_t port;
+	uint32_t cid;		/* Client id of the link while it is up */
+};
+static struct jrpcd_peer_addr peers[JRPCD_PEERS_MAX];
+static uint8_t num_peers;
+static char self_name[NODE_NAME_MAX_SZ];
+
+/* Component attached to jrpcd linked into its process. Its transmit */
+/* queue is read by the component itself and outlives the node. */
+struct jrpcd_embed_desc {
+	uint32_t cid;
+	void *tx_q;
+};
 
+/* Receive threads of all nodes share the node list and pending calls */
+static pthread_mutex_t node_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void jrpcd_peer_advertise(struct jrpcd_node_desc *peer);
+
+/* Called with node_lock held. If the caller is the receive thread of the */
+/* node, the lock is released and the call does not return. */
 void jrpcd_destroy_node(struct jrpcd_node_desc *node)
 {
+	bool self = !node->embedded && (node->conn == NULL) &&
+	    (pthread_self() == node->rid);
+	struct jrpcd_node_desc *lnode, *next;
+
+	/* Logical nodes go down with the connection they share */
+	if (node->conn == NULL) {
+		for (lnode = LIST_FIRST(&node_list); lnode != NULL; lnode = next) {
+			next = LIST_NEXT(lnode, entries);
+			if (lnode->conn == node) {
+				jrpcd_destroy_node(lnode);
+			}
+		}
+	}
+
+	/* Remove node from node list, then fail calls it still owes */
+	LIST_REMOVE(node, entries);
+	jrpcd_pending_purge(node->cid);
+	jrpcd_topic_purge(node->cid);
+	if (node->peer) {
+		/* Nodes behind the peer are out of reach */
+		jrpcd_peer_purge(node->cid);
+	} else if (node->name[0] != '\0') {
+		jrpcd_cache_purge(node->name);
+		if (!exit_pending) {
+			jrpcd_peer_advertise(NULL);
+		}
+	}
+
 	/* Free up interfaces */
 	while (!LIST_EMPTY(&(node->intf_list))) {
 		struct jrpcd_intf_desc *intf = LIST_FIRST(&(node->intf_list));
@@ -69,6 +180,20 @@ void jrpcd_destroy_node(struct jrpcd_node_desc *node)
 		free(intf);
 	}
 
+	/* Threads, queue and socket belong to the owner of the connection */
+	if (node->conn != NULL) {
+		free(node);
+		return;
+	}
+
+	/* An attached component has no threads here, it reads what is */
+	/* left in the queue and frees it on detach */
+	if (node->embedded) {
+		jrpcd_queue_close(node->tx_q);
+		free(node);
+		return;
+	}
+
 	/* Cancel Transmit thread */
 	pthread_cancel(node->tid);
 
@@ -76,20 +201,18 @@ void jrpcd_destroy_node(struct jrpcd_node_desc *node)
 	jrpcd_queue_destroy(node->tx_q);
 
 	/* Can't cancel if called from the receive thread */
-	if (pthread_self() != node->rid) {
+	if (!self) {
 		pthread_cancel(node->rid);
 	}
 
 	/* Close the connection socket */
 	close(node->csock);
-
-	/* Remove node from node list */
-	LIST_REMOVE(node, entries);
 	free(node);
 
 	/* Terminate execution if requested */
-	if (pthread_self() == node->rid) {
+	if (self) {
 		/* Process sent exit message, exit receive thread */
+		pthread_mutex_unlock(&node_lock);
 		pthread_exit(0);
 		/* Should not come here */
 	}
@@ -100,34 +223,82 @@ void jrpcd_cleanup(void)
 	LOG_VERBOSE("%s", "jrpcd_cleanup");
 
 	/* Destroy all the nodes */
+	pthread_mutex_lock(&node_lock);
 	while (!LIST_EMPTY(&node_list)) {
 		struct jrpcd_node_desc *node = LIST_FIRST(&node_list);
 		jrpcd_destroy_node(node);
 	}
+	jrpcd_pending_cleanup();
+	jrpcd_cache_cleanup();
+	jrpcd_topic_cleanup();
+	jrpcd_peer_cleanup();
+	pthread_mutex_unlock(&node_lock);
+
+	/* Cancelled threads still free their buffers on the way out */
+	jrpcd_client_wait();
 
 	/* Cleanup queues */
 	jrpcd_queue_cleanup();
+
+	/* Release buffer pool memory */
+	jrpcd_pool_cleanup();
 }
 
 void jrpcd_dump(void)
 {
 	struct jrpcd_node_desc *node;
 	struct jrpcd_intf_desc *intf;
+	struct jrpcd_queue_stats stats;
+	struct jrpcd_cache_stats cstats;
 
 	LOG_VERBOSE("%s", "jrpcd_dump");
 
+	pthread_mutex_lock(&node_lock);
 	LIST_FOREACH(node, &node_list, entries) {
 		LOG_VERBOSE("Node name : %s", node->name);
 		LOG_VERBOSE("CID : %d", node->cid);
 		LOG_VERBOSE("Socket : %d", node->csock);
 		LOG_VERBOSE("Num Interfaces : %d", node->num_intf);
+		LOG_VERBOSE("Group : %d, Picks : %d, Outstanding : %d",
+			    node->group, node->picks, node->outstanding);
+
+		jrpcd_queue_stats(node->tx_q, &stats);
+		LOG_VERBOSE("Tx queued : %d items, %d / %d bytes", stats.len,
+			    stats.bytes, stats.budget);
+		LOG_VERBOSE("Tx peak : %d bytes", stats.peak_bytes);
+		LOG_VERBOSE("Tx shed : %d items, %d bytes", stats.shed,
+			    stats.shed_bytes);
+		LOG_VERBOSE("Expired calls : %d",
+			    node->expired + stats.expired);
+		if (node->peer) {
+			LOG_VERBOSE("Peer link, %d remote nodes",
+				    jrpcd_peer_count(node->cid));
+		}
 
 		LIST_FOREACH(intf, &(node->intf_list), entries) {
 			LOG_VERBOSE("\tInfterface name : %s", intf->name);
 			LOG_VERBOSE("\targ : %s", intf->arg);
 			LOG_VERBOSE("\tret : %s", intf->ret);
+			LOG_VERBOSE("\tttl : %d", intf->ttl);
 		}
 	}
+	LOG_VERBOSE("Pending calls : %d", jrpcd_pending_count());
+	LOG_VERBOSE("Coalesced calls : %llu", (unsigned long long)coalesced);
+	jrpcd_cache_stats(&cstats);
+	LOG_VERBOSE("Cache : %d entries, %llu hits, %llu misses",
+		    cstats.entries, (unsigned long long)cstats.hits,
+		    (unsigned long long)cstats.misses);
+	LOG_VERBOSE("Cache : %llu evicted, %llu purged",
+		    (unsigned long long)cstats.evicted,
+		    (unsigned long long)cstats.purged);
+	LOG_VERBOSE("Published : %llu, delivered : %llu",
+		    (unsigned long long)published,
+		    (unsigned long long)delivered);
+	jrpcd_topic_dump();
+	pthread_mutex_unlock(&node_lock);
+
+	jrpcd_pool_dump();
+	jrpcd_parser_dump();
 }
 
 struct jrpcd_node_desc *jrpcd_get_node(uint32_t cid)
@@ -147,57 +318,453 @@ struct jrpcd_node_desc *jrpcd_get_node_by_name(char *name)
 {
 	struct jrpcd_node_desc *node;
 
-	/* Find matching node by node name */
+	/* Find matching node by node name, links to peers have none */
 	LIST_FOREACH(node, &node_list, entries) {
-		if (strcmp(name, node->name) == 0) {
+		if (!node->peer && (strcmp(name, node->name) == 0)) {
 			return node;
 		}
 	}
 	return NULL;
 }
 
-void jrpcd_call_send_err_resp(void *queue, char *dnode, char *intf)
+struct jrpcd_intf_desc *jrpcd_get_intf(struct jrpcd_node_desc *node,
+				       char *name)
+{
+	struct jrpcd_intf_desc *intf;
+
+	/* Find matching interface of the node by name */
+	LIST_FOREACH(intf, &(node->intf_list), entries) {
+		if (strcmp(name, intf->name) == 0) {
+			return intf;
+		}
+	}
+	return NULL;
+}
+
+/* Finds another node registered with the name */
+struct jrpcd_node_desc *jrpcd_get_dup_node(struct jrpcd_node_desc *node,
+					   char *name)
+{
+	struct jrpcd_node_desc *dup_node;
+
+	LIST_FOREACH(dup_node, &node_list, entries) {
+		if ((dup_node != node) && !dup_node->peer &&
+		    (strcmp(name, dup_node->name) == 0)) {
+			return dup_node;
+		}
+	}
+	return NULL;
+}
+
+/* FNV-1a hash of the key argument of a call */
+static uint64_t jrpcd_hash_key(char *key)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (*key != '\0') {
+		hash ^= (uint8_t) * key++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/* Scrambles key and node into a well spread score */
+static uint64_t jrpcd_hash_score(uint64_t hash, uint32_t cid)
+{
+	hash ^= (uint64_t) cid *0x9e3779b97f4a7c15ULL;
+	hash ^= hash >> 30;
+	hash *= 0xbf58476d1ce4e5b9ULL;
+	hash ^= hash >> 27;
+	hash *= 0x94d049bb133111ebULL;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+/* Picks the node to serve a call to name. A node owning its name alone is */
+/* returned as is, calls to a group are spread over its members. */
+struct jrpcd_node_desc *jrpcd_pick_node(char *name, void *json_obj)
+{
+	struct jrpcd_node_desc *node;
+	struct jrpcd_node_desc *best = NULL;
+	char key[GROUP_KEY_MAX_SZ];
+	uint8_t group = JRPCD_GROUP_NONE;
+	uint64_t hash = 0;
+	uint64_t score;
+	uint64_t best_score = 0;
+
+	LIST_FOREACH(node, &node_list, entries) {
+		if (node->peer || (strcmp(name, node->name) != 0)) {
+			continue;
+		}
+		if (node->group == JRPCD_GROUP_NONE) {
+			return node;
+		}
+		if (group == JRPCD_GROUP_NONE) {
+			/* All members of a group share its policy */
+			group = node->group;
+			memset(key, 0, GROUP_KEY_MAX_SZ);
+			if ((group == JRPCD_GROUP_HASH) &&
+			    (jrpcd_parser_call_get_arg
+			     (json_obj, node->key, key,
+			      GROUP_KEY_MAX_SZ - 1) < 0)) {
+				/* Nothing to hash on, fall back to round robin */
+				group = JRPCD_GROUP_RR;
+			}
+			hash = jrpcd_hash_key(key);
+		}
+
+		if (group == JRPCD_GROUP_HASH) {
+			/* Rendezvous hashing, the member with the highest */
+			/* score owns the key. Keys only move when their */
+			/* owner leaves or a new member outscores it. */
+			score = jrpcd_hash_score(hash, node->cid);
+			if ((best == NULL) || (score > best_score)) {
+				best = node;
+				best_score = score;
+			}
+		} else if (group == JRPCD_GROUP_LOC) {
+			/* Least outstanding calls, round robin among equals */
+			if ((best == NULL) ||
+			    (node->outstanding < best->outstanding) ||
+			    ((node->outstanding == best->outstanding) &&
+			     (node->last_pick < best->last_pick))) {
+				best = node;
+			}
+		} else {
+			/* Round robin, the member waiting longest goes next */
+			if ((best == NULL) ||
+			    (node->last_pick < best->last_pick)) {
+				best = node;
+			}
+		}
+	}
+
+	if (best != NULL) {
+		best->last_pick = ++pick_seq;
+		best->picks++;
+	}
+	return best;
+}
+
+static uint64_t jrpcd_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Same as jrpcd_node_put, but the data is dropped if still queued at */
+/* deadline dl */
+void jrpcd_node_put_dl(struct jrpcd_node_desc *node, uint8_t *data,
+		       uint32_t size, uint64_t dl)
+{
+	if (jrpcd_queue_put_dl(node->tx_q, data, size, dl) ==
+	    JRPCD_Q_OVERFLOW) {
+		/* Node is not reading, disconnect it. Its receive thread */
+		/* will notice and tear down the node. */
+		LOG_ERR("disconnecting %s, output budget exceeded", node->name);
+		if (!node->embedded) {
+			shutdown(node->csock, SHUT_RDWR);
+		}
+	}
+}
+
+/* Queue data to a node, the buffer is owned by the queue after this call */
+void jrpcd_node_put(struct jrpcd_node_desc *node, uint8_t *data, uint32_t size)
+{
+	jrpcd_node_put_dl(node, data, size, 0);
+}
+
+/* Tells peer daemons the names of the nodes served here, peer or all of */
+/* them if NULL. The whole list is sent after every change, a peer never */
+/* passes on what it learns, so calls cross at most one peer link. */
+void jrpcd_peer_advertise(struct jrpcd_node_desc *peer)
+{
+	struct jrpcd_node_desc *node;
+	char **names;
+	uint16_t num = 0;
+	uint16_t i;
+	uint32_t size;
+	uint8_t *msg;
+
+	LIST_FOREACH(node, &node_list, entries) {
+		num++;
+	}
+	names = (char **)malloc((num + 1) * sizeof(char *));
+	if (names == NULL) {
+		LOG_ERR("%s", "malloc failed");
+		goto exit_0;
+	}
+
+	/* Group members share a name, list it once */
+	num = 0;
+	LIST_FOREACH(node, &node_list, entries) {
+		if (node->peer || (node->name[0] == '\0')) {
+			continue;
+		}
+		for (i = 0; i < num; i++) {
+			if (strcmp(names[i], node->name) == 0) {
+				break;
+			}
+		}
+		if (i == num) {
+			names[num++] = node->name;
+		}
+	}
+	msg = jrpcd_parser_peer_hello(self_name, names, num, &size);
+	free(names);
+	if (msg == NULL) {
+		goto exit_0;
+	}
+
+	LIST_FOREACH(node, &node_list, entries) {
+		if (node->peer && ((peer == NULL) || (peer == node))) {
+			jrpcd_node_put(node, jrpcd_pool_ref(msg), size);
+		}
+	}
+	jrpcd_pool_free(msg);
+ exit_0:
+	return;
+}
+
+/* Picks a local node to serve a call to name, else the link to the peer */
+/* daemon serving it. Calls that came over a peer link stay local. */
+struct jrpcd_node_desc *jrpcd_route(char *name, void *json_obj,
+				    struct jrpcd_node_desc *snode)
+{
+	struct jrpcd_node_desc *node;
+
+	node = jrpcd_pick_node(name, json_obj);
+	if ((node == NULL) && !snode->peer) {
+		node = jrpcd_get_node(jrpcd_peer_lookup(name));
+		if (node != NULL) {
+			node->picks++;
+		}
+	}
+	return node;
+}
+
+/* Deadline of a call. One from a peer daemon carries the ms left till */
+/* it instead, clocks of daemons on different hosts differ. */
+void jrpcd_call_get_dl(struct jrpcd_node_desc *snode, void *json_obj,
+		       uint64_t *dl)
+{
+	uint64_t tmo;
+
+	if (!snode->peer) {
+		jrpcd_parser_get_dl(json_obj, dl);
+		return;
+	}
+	*dl = 0;
+	if (jrpcd_parser_get_tmo(json_obj, &tmo) == 0) {
+		*dl = jrpcd_now() + tmo;
+	}
+}
+
+/* True if the caller of a call with deadline dl has given up on it. The */
+/* call is counted against the node it was meant for. */
+bool jrpcd_call_expired(uint64_t dl, char *dnode_name)
+{
+	struct jrpcd_node_desc *node;
+
+	if ((dl == 0) || (dl > jrpcd_now())) {
+		return false;
+	}
+	node = jrpcd_get_node_by_name(dnode_name);
+	if (node != NULL) {
+		node->expired++;
+	}
+	LOG_INFO("call to %s past its deadline, dropped", dnode_name);
+	return true;
+}
+
+/* Fails a call made by node. tnode is the node that was called and id */
+/* the id the node gave the call. */
+void jrpcd_call_send_err_resp(struct jrpcd_node_desc *node, char *tnode,
+			      char *intf, uint32_t id)
 {
+	const char *fmt = node->peer ? CALL_ERR_PEER_FMT : CALL_ERR_RESP_FMT;
 	char *buffer = NULL;
+	int len;
 
-	buffer = (char *)malloc(JRPCD_MAX_MSG_SZ);
+	/* Size the buffer to the response, not to the largest message */
+	len = snprintf(NULL, 0, fmt, node->name, tnode, intf, id, -1);
+	buffer = (char *)jrpcd_pool_alloc(len + 1);
 	if (buffer == NULL) {
-		LOG_ERR("%s", "malloc failed");
+		LOG_ERR("%s", "pool alloc failed");
 		goto exit_0;
 	}
-	memset(buffer, 0, JRPCD_MAX_MSG_SZ);
-	snprintf(buffer, JRPCD_MAX_MSG_SZ, CALL_ERR_RESP_FMT, dnode, intf, -1);
+	snprintf(buffer, len + 1, fmt, node->name, tnode, intf, id, -1);
 
-	jrpcd_queue_put(queue, buffer, strlen(buffer));
+	jrpcd_node_put(node, (uint8_t *)buffer, len);
 
  exit_0:
 	return;
 }
 
-void jrpcd_register_send_resp(void *queue, char *dnode, uint8_t val)
+/* The ack hands back the id of the register message, the client waits */
+/* for it */
+void jrpcd_register_send_resp(struct jrpcd_node_desc *node, uint32_t id,
+			      uint8_t val)
 {
 	char *buffer = NULL;
+	int len;
 
-	buffer = (char *)malloc(JRPCD_MAX_MSG_SZ);
+	len = snprintf(NULL, 0, REGISTER_RESP_FMT, node->name, id, val);
+	buffer = (char *)jrpcd_pool_alloc(len + 1);
 	if (buffer == NULL) {
-		LOG_ERR("%s", "malloc failed");
+		LOG_ERR("%s", "pool alloc failed");
 		goto exit_0;
 	}
-	memset(buffer, 0, JRPCD_MAX_MSG_SZ);
-	snprintf(buffer, JRPCD_MAX_MSG_SZ, REGISTER_RESP_FMT, dnode, val);
+	snprintf(buffer, len + 1, REGISTER_RESP_FMT, node->name, id, val);
 
-	jrpcd_queue_put(queue, buffer, strlen(buffer));
+	jrpcd_node_put(node, (uint8_t *)buffer, len);
 
  exit_0:
 	return;
 }
 
-void jrpcd_process_register(void *json_obj, uint32_t cid)
+/* Copies a message into a new buffer with tail after its members, tail */
+/* closes the object. The members stamped by jrpcd come last, so a key */
+/* the sender put in the message as well cannot override them. size is */
+/* updated to the new size. */
+static uint8_t *jrpcd_append_msg(const char *tail, uint8_t *data,
+				 uint32_t *size)
+{
+	uint8_t *buffer;
+	uint8_t *body;
+	uint8_t *end;
+	uint32_t len;
+	uint32_t tlen = strlen(tail);
+
+	/* end is the brace closing the object, tail goes in its place */
+	body = (uint8_t *) memchr(data, '{', *size);
+	end = (*size > 0) ? data + *size - 1 : data;
+	while ((end > data) && (*end != '}')) {
+		end--;
+	}
+	if ((body == NULL) || (end <= body)) {
+		LOG_ERR("%s", "message is not an object");
+		goto exit_0;
+	}
+	len = end - data;
+
+	/* An empty object has no member for tail to follow */
+	for (body++; (body < end) && isspace(*body); body++) {
+	}
+	if (body == end) {
+		tail++;
+		tlen--;
+	}
+
+	/* Allocate buffer to copy the data, this will free'd in the */
+	/* transmit thread of the destination node once the data is sent */
+	buffer = (uint8_t *) jrpcd_pool_alloc(len + tlen + 1);
+	if (buffer == NULL) {
+		LOG_ERR("%s", "pool alloc failed");
+		goto exit_0;
+	}
+	memcpy(buffer, data, len);
+	memcpy(buffer + len, tail, tlen);
+	*size = len + tlen;
+
+	return buffer;
+ exit_0:
+	return NULL;
+}
+
+/* Copies a message into a new buffer with a number stamped after its */
+/* members, fmt closes the object. size is updated to the new size. */
+uint8_t *jrpcd_stamp_msg(const char *fmt, uint32_t val, uint8_t *data,
+			 uint32_t *size)
+{
+	char tail[32];
+
+	snprintf(tail, sizeof(tail), fmt, val);
+	return jrpcd_append_msg(tail, data, size);
+}
+
+/* Names the logical node a message is for. Its connection is shared with */
+/* other nodes, and the dnode of a multi call is only the spec. */
+uint8_t *jrpcd_stamp_lnode(struct jrpcd_node_desc *node, uint8_t *data,
+			   uint32_t *size)
+{
+	char tail[NODE_NAME_MAX_SZ + 16];
+
+	snprintf(tail, sizeof(tail), LNODE_FMT, node->name);
+	return jrpcd_append_msg(tail, data, size);
+}
+
+/* Message to queue to dnode for a call under xid, or a notify if xid is */
+/* 0. The xid is stamped after the members of the message, unless */
+/* the message crosses a peer link and has its deadline re-encoded. */
+uint8_t *jrpcd_call_msg(struct jrpcd_node_desc *snode,
+			struct jrpcd_node_desc *dnode, void *json_obj,
+			uint32_t xid, uint64_t dl, uint8_t *data,
+			uint32_t *size)
+{
+	uint64_t now = jrpcd_now();
+	uint8_t *buffer;
+
+	if (dnode->peer) {
+		return jrpcd_parser_restamp(json_obj, xid ? "pxid" : NULL, xid,
+					    "tmo", (dl > now) ? dl - now : 0,
+					    size);
+	}
+	if (snode->peer) {
+		return jrpcd_parser_restamp(json_obj, xid ? "xid" : NULL, xid,
+					    "dl", dl, size);
+	}
+	if (xid != 0) {
+		return jrpcd_stamp_msg(CALL_XID_FMT, xid, data, size);
+	}
+
+	/* Allocate buffer to copy the data, this will free'd in the */
+	/* transmit thread of the destination node once data is sent */
+	buffer = (uint8_t *) jrpcd_pool_alloc(*size);
+	if (buffer == NULL) {
+		LOG_ERR("%s", "pool alloc failed");
+		return NULL;
+	}
+	memcpy(buffer, data, *size);
+	return buffer;
+}
+
+/* A forwarded call will never be returned, settle it */
+void jrpcd_call_lost(struct jrpcd_pending_call *call, bool expired)
+{
+	struct jrpcd_node_desc *node;
+
+	/* Callers coalesced into a call were not forwarded themselves */
+	node = jrpcd_get_node(call->callee);
+	if (!call->coalesced && (node != NULL) && (node->outstanding > 0)) {
+		node->outstanding--;
+	}
+
+	/* Caller has stopped waiting for an expired call long ago */
+	if (expired) {
+		return;
+	}
+	node = jrpcd_get_node(call->caller);
+	if (node != NULL) {
+		jrpcd_call_send_err_resp(node, call->dnode, call->intf,
+					 call->id);
+	}
+}
+
+static int8_t jrpcd_node_describe(struct jrpcd_node_desc *node,
+				  void *json_obj);
+
+int8_t jrpcd_process_register(void *json_obj, uint32_t cid)
 {
 	char snode_name[NODE_NAME_MAX_SZ];
 	struct jrpcd_node_desc *node;
 	struct jrpcd_node_desc *dup_node;
-	uint16_t intf_index = 0;
+	uint8_t group;
+	uint16_t key;
+	uint32_t id = 0;
+	bool replay;
 
 	memset(snode_name, 0, NODE_NAME_MAX_SZ);
 
@@ -208,19 +775,81 @@ void jrpcd_process_register(void *json_obj, uint32_t cid)
 		LOG_ERR("No matching node found for %d", cid);
 		goto exit_0;
 	}
+	/* Id is optional, it is handed back with the ack */
+	jrpcd_parser_get_id(json_obj, &id);
 	if (jrpcd_parser_get_snode(json_obj, snode_name, NODE_NAME_MAX_SZ) < 0) {
 		LOG_ERR("%s", "parser failed");
 		goto exit_1;
 	}
 
+	if (jrpcd_parser_register_get_group(json_obj, &group, &key) < 0) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_1;
+	}
+	if (jrpcd_parser_register_get_replay(json_obj, &replay) < 0) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_1;
+	}
+
 	/* Check if the node is already registered */
-	dup_node = jrpcd_get_node_by_name(snode_name);
-	if ((dup_node != NULL) && (node->cid != dup_node->cid)) {
+	while ((dup_node = jrpcd_get_dup_node(node, snode_name)) != NULL) {
+		if ((group != JRPCD_GROUP_NONE) && (group == dup_node->group)) {
+			/* Join the group, members share the name */
+			LOG_INFO("cid %d joins group %s", cid, snode_name);
+			break;
+		}
+		if ((group != JRPCD_GROUP_NONE) &&
+		    (dup_node->group != JRPCD_GROUP_NONE)) {
+			LOG_ERR("group policy mismatch for %s", snode_name);
+			goto exit_1;
+		}
+		/* A client back after losing its connection does not take */
+		/* the name from whoever registered it meanwhile, or the two */
+		/* would drop each other's connection over and over */
+		if (replay) {
+			LOG_INFO("%s is taken, replayed registration refused",
+				 snode_name);
+			goto exit_1;
+		}
 		/* Duplicate registration, free previous registration */
 		LOG_INFO("removing previous connection %d", dup_node->cid);
 		jrpcd_destroy_node(dup_node);
 	}
 	strcpy(node->name, snode_name);
+	node->group = group;
+	node->key = key;
+
+	if (jrpcd_node_describe(node, json_obj) < 0) {
+		goto exit_1;
+	}
+	/* Send response to the client indicating registration is successfull */
+	jrpcd_register_send_resp(node, id, 0);
+	jrpcd_peer_advertise(NULL);
+	return 0;
+ exit_1:
+	/* Send response to the client indicating registration is failed */
+	/* Missing mandatory fields or malformed json or invaid values */
+	jrpcd_register_send_resp(node, id, -1);
+ exit_0:
+	return -1;
+}
+
+/* Takes the endpoint, interfaces and topics of a node from its */
+/* registration */
+static int8_t jrpcd_node_describe(struct jrpcd_node_desc *node,
+				  void *json_obj)
+{
+	char topic[JRPCD_TOPIC_NAME_SZ];
+	uint16_t intf_index = 0;
+
+	if (jrpcd_parser_register_get_direct(json_obj, node->direct,
+					     DIRECT_MAX_SZ) < 0) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_0;
+	}
+
+	/* Interfaces may have changed, forget what the name returned */
+	jrpcd_cache_purge(node->name);
 
 	/* Parse supported interfaces in the register api */
 	if (jrpcd_parser_register_get_num_intf(json_obj, &(node->num_intf)) < 0) {
@@ -239,36 +868,45 @@ void jrpcd_process_register(void *json_obj, uint32_t cid)
 			    malloc(sizeof(struct jrpcd_intf_desc));
 			if (intf_desc == NULL) {
 				LOG_ERR("%s", "malloc failed");
-				goto exit_1;
+				goto exit_0;
 			}
 			if (jrpcd_parser_register_intf_get_name
 			    (intf, intf_desc->name, INTF_NAME_MAX_SZ) < 0) {
 				LOG_ERR("%s", "parser failed");
-				goto exit_1;
+				goto exit_0;
 			}
 			if (jrpcd_parser_register_intf_get_arg
 			    (intf, intf_desc->arg, INTF_ARG_MAX_SZ) < 0) {
 				LOG_ERR("%s", "parser failed");
-				goto exit_1;
+				goto exit_0;
 			}
 			if (jrpcd_parser_register_intf_get_ret
 			    (intf, intf_desc->ret, INTF_RET_MAX_SZ) < 0) {
 				LOG_ERR("%s", "parser failed");
-				goto exit_1;
+				goto exit_0;
+			}
+			if (jrpcd_parser_register_intf_get_ttl
+			    (intf, &(intf_desc->ttl)) < 0) {
+				LOG_ERR("%s", "parser failed");
+				goto exit_0;
 			}
 			LIST_INSERT_HEAD(&(node->intf_list), intf_desc,
 					 entries);
 		}
 	}
-	/* Send response to the client indicating registration is successfull */
-	jrpcd_register_send_resp(node->tx_q, node->name, 0);
-	return;
- exit_1:
-	/* Send response to the client indicating registration is failed */
-	/* Missing mandatory fields or malformed json or invaid values */
-	jrpcd_register_send_resp(node->tx_q, node->name, -1);
+
+	/* Topics the node wants published messages of */
+	for (intf_index = 0;
+	     jrpcd_parser_register_get_topic(json_obj, intf_index, topic,
+					     JRPCD_TOPIC_NAME_SZ) == 0;
+	     intf_index++) {
+		if (jrpcd_topic_subscribe(topic, node->cid, node) < 0) {
+			goto exit_0;
+		}
+	}
+	return 0;
  exit_0:
-	return;
+	return -1;
 }
 
 void jrpcd_process_exit(void *json_obj, uint32_t cid)
@@ -284,8 +922,9 @@ void jrpcd_process_exit(void *json_obj, uint32_t cid)
 	}
 	//TODO: Do we need to validate the snode string??
 
-	/* Since we won't be returning to the callee free up parser */
-	if(json_obj != NULL) {
+	/* Since we won't be returning to the callee free up parser. An */
+	/* attached component is not a thread of ours, the call returns. */
+	if ((json_obj != NULL) && !snode->embedded && (snode->conn == NULL)) {
 		jrpcd_parser_cleanup(json_obj);
 	}
 
@@ -296,88 +935,262 @@ void jrpcd_process_exit(void *json_obj, uint32_t cid)
 	return;
 }
 
-void jrpcd_process_call(void *json_obj, uint32_t cid, uint8_t *data,
-			uint32_t size)
+/* Interfaces of jrpcd itself. stats returns one line of counters per */
+/* node. endpoint returns where the node named in the argument takes calls */
+/* directly, so heavy pairs of nodes can skip jrpcd for their calls. */
+/* Groups have none, calls to them are spread by jrpcd. */
+void jrpcd_process_self_call(struct jrpcd_node_desc *snode, void *json_obj,
+			     char *intf, uint32_t id)
 {
-	char dnode_name[NODE_NAME_MAX_SZ];
-	char snode_name[NODE_NAME_MAX_SZ];
-	char intf_name[INTF_NAME_MAX_SZ];
-	struct jrpcd_node_desc *snode;
-	struct jrpcd_node_desc *dnode;
+	struct jrpcd_node_desc *node;
+	struct jrpcd_queue_stats stats;
+	char text[STATS_MAX_SZ];
+	char name[NODE_NAME_MAX_SZ];
 	uint8_t *buffer;
-
-	memset(dnode_name, 0, NODE_NAME_MAX_SZ);
-	memset(snode_name, 0, NODE_NAME_MAX_SZ);
-	memset(intf_name, 0, INTF_NAME_MAX_SZ);
-
-	/* API service call has been received for an node */
-	/* Find out node using the client id */
-	snode = jrpcd_get_node(cid);
-	if (snode == NULL) {
-		LOG_ERR("No matching snode found for %d", cid);
-		goto exit_0;
-	}
-	/* Read the source node, destination node */
-	if (jrpcd_parser_get_snode(json_obj, snode_name, NODE_NAME_MAX_SZ) < 0) {
-		LOG_ERR("%s", "parser failed");
+	uint32_t size;
+	int len = 0;
+
+	text[0] = '\0';
+	if (strcmp(intf, "stats") == 0) {
+		LIST_FOREACH(node, &node_list, entries) {
+			if ((node->name[0] == '\0') ||
+			    (len >= STATS_MAX_SZ)) {
+				continue;
+			}
+			jrpcd_queue_stats(node->tx_q, &stats);
+			len += snprintf(text + len, STATS_MAX_SZ - len,
+					"%s cid=%d picks=%d outstanding=%d "
+					"expired=%d shed=%d queued=%d\n",
+					node->name, node->cid, node->picks,
+					node->outstanding,
+					node->expired + stats.expired,
+					stats.shed, stats.bytes);
+		}
+	} else if (strcmp(intf, "endpoint") == 0) {
+		if (jrpcd_parser_call_get_arg(json_obj, 0, name,
+					      NODE_NAME_MAX_SZ) < 0) {
+			goto exit_1;
+		}
+		name[NODE_NAME_MAX_SZ - 1] = '\0';
+		node = jrpcd_get_node_by_name(name);
+		if ((node == NULL) || (node->direct[0] == '\0') ||
+		    (node->group != JRPCD_GROUP_NONE)) {
+			LOG_INFO("no direct endpoint for %s", name);
+			goto exit_1;
+		}
+		strcpy(text, node->direct);
+	} else {
+		LOG_ERR("jrpcd has no interface %s", intf);
 		goto exit_1;
 	}
-	if (jrpcd_parser_call_get_intf(json_obj, intf_name, INTF_NAME_MAX_SZ) <
-	    0) {
-		LOG_ERR("%s", "parser failed");
+
+	buffer = jrpcd_parser_return_str(JRPCD_NODE_NAME, snode->name, intf,
+					 id, text, &size);
+	if (buffer == NULL) {
 		goto exit_1;
 	}
-	if (strcmp(snode_name, snode->name) != 0) {
-		LOG_ERR("%s", "snode name mismatch");
-		goto exit_1;
+	jrpcd_node_put(snode, buffer, size);
+	return;
+ exit_1:
+	jrpcd_call_send_err_resp(snode, JRPCD_NODE_NAME, intf, id);
+}
+
+/* Answers a call to a cacheable interface from the cache. On a miss the */
+/* args of the call are kept in call, its return is cached under them. */
+int8_t jrpcd_call_from_cache(struct jrpcd_node_desc *snode, void *json_obj,
+			     char *dnode_name, char *intf_name,
+			     struct jrpcd_pending_call *call)
+{
+	struct jrpcd_node_desc *node;
+	struct jrpcd_intf_desc *intf;
+	const char *fmt;
+	char *buffer;
+	char *ret;
+	int len;
+
+	node = jrpcd_get_node_by_name(dnode_name);
+	if (node == NULL) {
+		goto exit_0;
+	}
+	intf = jrpcd_get_intf(node, intf_name);
+	if ((intf == NULL) || (intf->ttl == 0)) {
+		goto exit_0;
+	}
+	call->args = jrpcd_parser_call_get_args(json_obj);
+	if (call->args == NULL) {
+		goto exit_0;
+	}
+	call->ttl = intf->ttl;
+
+	ret = jrpcd_cache_get(dnode_name, intf_name, call->args);
+	if (ret == NULL) {
+		goto exit_0;
+	}
+	fmt = snode->peer ? CACHE_PEER_FMT : CACHE_RESP_FMT;
+	len = snprintf(NULL, 0, fmt, dnode_name, snode->name, intf_name,
+		       call->id, ret);
+	buffer = (char *)jrpcd_pool_alloc(len + 1);
+	if (buffer == NULL) {
+		LOG_ERR("%s", "pool alloc failed");
+		goto exit_0;
+	}
+	snprintf(buffer, len + 1, fmt, dnode_name, snode->name, intf_name,
+		 call->id, ret);
+
+	jrpcd_node_put(snode, (uint8_t *)buffer, len);
+	jrpcd_pool_free(call->args);
+	call->args = NULL;
+	return 0;
+ exit_0:
+	return -1;
+}
+
+void jrpcd_process_call(void *json_obj, uint32_t cid, uint8_t *data,
+			uint32_t size)
+{
+	char dnode_name[NODE_NAME_MAX_SZ];
+	char snode_name[NODE_NAME_MAX_SZ];
+	char intf_name[INTF_NAME_MAX_SZ];
+	struct jrpcd_node_desc *snode;
+	struct jrpcd_node_desc *dnode;
+	struct jrpcd_pending_call call;
+	uint8_t *buffer;
+	uint32_t xid;
+	uint32_t id = 0;
+
+	memset(dnode_name, 0, NODE_NAME_MAX_SZ);
+	memset(snode_name, 0, NODE_NAME_MAX_SZ);
+	memset(intf_name, 0, INTF_NAME_MAX_SZ);
+	memset(&call, 0, sizeof(call));
+
+	/* API service call has been received for an node */
+	/* Find out node using the client id */
+	snode = jrpcd_get_node(cid);
+	if (snode == NULL) {
+		LOG_ERR("No matching snode found for %d", cid);
+		goto exit_0;
+	}
+	/* Id is optional, it is handed back with the return. A call from a */
+	/* peer daemon is handed back under the xid the peer gave it. */
+	if (snode->peer) {
+		jrpcd_parser_get_pxid(json_obj, &id);
+	} else {
+		jrpcd_parser_get_id(json_obj, &id);
+	}
+
+	/* Read the source node, destination node */
+	if (jrpcd_parser_get_snode(json_obj, snode_name, NODE_NAME_MAX_SZ) < 0) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_1;
+	}
+	if (jrpcd_parser_call_get_intf(json_obj, intf_name, INTF_NAME_MAX_SZ) <
+	    0) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_1;
+	}
+	if (!snode->peer && (strcmp(snode_name, snode->name) != 0)) {
+		LOG_ERR("%s", "snode name mismatch");
+		goto exit_1;
 	}
 	if (jrpcd_parser_get_dnode(json_obj, dnode_name, NODE_NAME_MAX_SZ) < 0) {
 		LOG_ERR("%s", "parser failed");
 		goto exit_1;
 	}
+	call.caller = snode->cid;
+	call.id = id;
+
+	if (strcmp(dnode_name, JRPCD_NODE_NAME) == 0) {
+		jrpcd_process_self_call(snode, json_obj, intf_name, id);
+		return;
+	}
+
+	/* Caller has given up already, don't load the node with it */
+	jrpcd_call_get_dl(snode, json_obj, &call.dl);
+	if (jrpcd_call_expired(call.dl, dnode_name)) {
+		return;
+	}
+
+	/* A chained call carries the steps to run with its return. The */
+	/* daemon the chain started on runs them. */
+	if (!snode->peer &&
+	    (jrpcd_parser_chain_get(json_obj, &call.chain) < 0)) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_1;
+	}
+	if ((call.chain == NULL) &&
+	    (jrpcd_call_from_cache(snode, json_obj, dnode_name, intf_name,
+				   &call) == 0)) {
+		return;
+	}
+	strncpy(call.dnode, dnode_name, JRPCD_PENDING_NAME_SZ - 1);
+	strncpy(call.intf, intf_name, JRPCD_PENDING_NAME_SZ - 1);
+
+	/* Same cacheable call already on its way, share its return */
+	if (call.args != NULL) {
+		xid = jrpcd_pending_find(call.dnode, call.intf, call.args,
+					 &call.callee);
+		if (xid != 0) {
+			jrpcd_pool_free(call.args);
+			call.args = NULL;
+			call.coalesced = true;
+			if (jrpcd_pending_add(&call, xid) == 0) {
+				goto exit_1;
+			}
+			coalesced++;
+			return;
+		}
+	}
+
 	/* Get the node instance of the destination node by name */
-	dnode = jrpcd_get_node_by_name(dnode_name);
+	dnode = jrpcd_route(dnode_name, json_obj, snode);
 	if (dnode == NULL) {
 		LOG_ERR("No matching dnode found for %s", dnode_name);
 		goto exit_1;
 	}
 	//TODO: Add Validation
 
-	/* Allocate buffer to copy the data, this will free'd in the */
-	/* transmit thread of the destination node once the data is sent */
-	buffer = (uint8_t *) malloc(size);
+	/* Remember the call, so the return finds its way back to snode */
+	call.callee = dnode->cid;
+	xid = jrpcd_pending_add(&call, 0);
+	if (xid == 0) {
+		goto exit_1;
+	}
+
+	buffer = jrpcd_call_msg(snode, dnode, json_obj, xid, call.dl, data,
+				&size);
 	if (buffer == NULL) {
-		LOG_ERR("%s", "malloc failed");
+		jrpcd_pending_take(xid, dnode->cid, &call);
 		goto exit_1;
 	}
-	memcpy(buffer, data, size);
 
 	/* put the data into the transmit queue of the destination node */
-	jrpcd_queue_put(dnode->tx_q, buffer, size);
+	dnode->outstanding++;
+	jrpcd_node_put_dl(dnode, buffer, size, call.dl);
 	return;
  exit_1:
 	/* Something went wrong, indicate failure to the source node */
-	jrpcd_call_send_err_resp(snode->tx_q, snode->name, intf_name);
+	jrpcd_pool_free(call.chain);
+	jrpcd_pool_free(call.args);
+	jrpcd_call_send_err_resp(snode, dnode_name, intf_name, id);
  exit_0:
 	return;
 }
 
-void jrpcd_process_return(void *json_obj, uint32_t cid, uint8_t *data,
+/* One way call, forwarded as is. There is no return to wait for, so it */
+/* is not tracked and failures are only logged. */
+void jrpcd_process_notify(void *json_obj, uint32_t cid, uint8_t *data,
 			  uint32_t size)
 {
 	char dnode_name[NODE_NAME_MAX_SZ];
 	char snode_name[NODE_NAME_MAX_SZ];
-	char intf_name[INTF_NAME_MAX_SZ];
 	struct jrpcd_node_desc *snode;
 	struct jrpcd_node_desc *dnode;
 	uint8_t *buffer;
+	uint64_t dl;
 
 	memset(dnode_name, 0, NODE_NAME_MAX_SZ);
 	memset(snode_name, 0, NODE_NAME_MAX_SZ);
-	memset(intf_name, 0, INTF_NAME_MAX_SZ);
 
-	/* Return call has been received for an node */
-	/* Find out node using the client id */
 	snode = jrpcd_get_node(cid);
 	if (snode == NULL) {
 		LOG_ERR("No matching snode found for %d", cid);
@@ -387,12 +1200,7 @@ void jrpcd_process_return(void *json_obj, uint32_t cid, uint8_t *data,
 		LOG_ERR("%s", "parser failed");
 		goto exit_0;
 	}
-	if (jrpcd_parser_call_get_intf(json_obj, intf_name, INTF_NAME_MAX_SZ) <
-	    0) {
-		LOG_ERR("%s", "parser failed");
-		goto exit_0;
-	}
-	if (strcmp(snode_name, snode->name) != 0) {
+	if (!snode->peer && (strcmp(snode_name, snode->name) != 0)) {
 		LOG_ERR("%s", "snode name mismatch");
 		goto exit_0;
 	}
@@ -400,149 +1208,1453 @@ void jrpcd_process_return(void *json_obj, uint32_t cid, uint8_t *data,
 		LOG_ERR("%s", "parser failed");
 		goto exit_0;
 	}
-	dnode = jrpcd_get_node_by_name(dnode_name);
-	if (dnode == NULL) {
-		LOG_ERR("No matching dnode found for %s", dnode_name);
+	jrpcd_call_get_dl(snode, json_obj, &dl);
+	if (jrpcd_call_expired(dl, dnode_name)) {
 		goto exit_0;
 	}
-	if (strcmp(dnode_name, dnode->name) != 0) {
-		LOG_ERR("%s", "dnode name mismatch");
+	dnode = jrpcd_route(dnode_name, json_obj, snode);
+	if (dnode == NULL) {
+		LOG_ERR("No matching dnode found for %s", dnode_name);
 		goto exit_0;
 	}
 
-	/* Allocate buffer to copy the data, this will free'd in the */
-	/* transmit thread of the destination node once the data is sent */
-	buffer = (uint8_t *) malloc(size);
+	buffer = jrpcd_call_msg(snode, dnode, json_obj, 0, dl, data, &size);
 	if (buffer == NULL) {
-		LOG_ERR("%s", "malloc failed");
 		goto exit_0;
 	}
-	memcpy(buffer, data, size);
-
-	/* put the data into the transmit queue of the destination node */
-	jrpcd_queue_put(dnode->tx_q, buffer, size);
-	return;
+	jrpcd_node_put_dl(dnode, buffer, size, dl);
  exit_0:
 	return;
 }
 
-int8_t jrpcd_process_recv(uint32_t cid, uint8_t *data, uint32_t size)
+/* Subscribe or unsubscribe the node to a topic at runtime */
+void jrpcd_process_subscribe(void *json_obj, uint32_t cid, bool subscribe)
 {
-	void *json_obj = NULL;
-	uint8_t api_type;
-	int8_t ret = -1;
+	char topic[JRPCD_TOPIC_NAME_SZ];
+	struct jrpcd_node_desc *snode;
 
-	/* Initialize JSON parser */
-	jrpcd_parser_init(&json_obj, (char *)data);
-	if (json_obj == NULL) {
-		LOG_INFO("%s ==> \"%s\"", "Invalid json message", (char *)data);
+	memset(topic, 0, JRPCD_TOPIC_NAME_SZ);
+
+	snode = jrpcd_get_node(cid);
+	if (snode == NULL) {
+		LOG_ERR("No matching snode found for %d", cid);
 		goto exit_0;
 	}
-
-	/* Find out the API */
-	if (jrpcd_parser_get_api(json_obj, &api_type)) {
+	if (jrpcd_parser_call_get_intf(json_obj, topic, JRPCD_TOPIC_NAME_SZ) <
+	    0) {
 		LOG_ERR("%s", "parser failed");
-		goto exit_1;
+		goto exit_0;
 	}
-
-	/* Process API request */
-	if (JRPCD_API_REGISTER == api_type) {
-		LOG_INFO("cid: %d, Recvd Register", cid);
-		jrpcd_process_register(json_obj, cid);
-	} else if (JRPCD_API_CALL == api_type) {
-		LOG_INFO("cid: %d, Recvd Call", cid);
-		jrpcd_process_call(json_obj, cid, data, size);
-	} else if (JRPCD_API_RETURN == api_type) {
-		LOG_INFO("cid: %d, Recvd Return", cid);
-		jrpcd_process_return(json_obj, cid, data, size);
-	} else if (JRPCD_API_EXIT == api_type) {
-		LOG_INFO("cid: %d, Recvd Exit", cid);
-		/* !!! Special Handling !!! */
-		/* !!! Below call will not return !!! */
-		jrpcd_process_exit(json_obj, cid);
+	if (subscribe) {
+		jrpcd_topic_subscribe(topic, cid, snode);
+	} else {
+		jrpcd_topic_unsubscribe(topic, cid);
 	}
-	ret = 0;
- exit_1:
-	/* Cleanup parser to free up resources */
-	jrpcd_parser_cleanup(json_obj);
  exit_0:
-	return ret;
+	return;
 }
 
-void jrpcd_exit(void)
-{
-	exit_pending = 1;
-}
+struct jrpcd_publish_buf {
+	uint8_t *data;
+	uint32_t size;
+};
 
-bool jrpcd_exit_pending(void)
+static void jrpcd_publish_deliver(void *node, void *arg)
 {
-	return exit_pending;
+	struct jrpcd_publish_buf *buf = (struct jrpcd_publish_buf *)arg;
+
+	jrpcd_node_put((struct jrpcd_node_desc *)node,
+		       jrpcd_pool_ref(buf->data), buf->size);
 }
 
-int8_t jrpcd_main(char *host, uint32_t port)
+/* Publish is a notify to every subscriber of the topic. The message is */
+/* copied once and the copy is shared by all subscriber queues, a topic */
+/* is delivered as a call of the interface with the same name. */
+void jrpcd_process_publish(void *json_obj, uint32_t cid, uint8_t *data,
+			   uint32_t size)
 {
-	LOG_VERBOSE("%s", "jrpcd_main");
+	char topic[JRPCD_TOPIC_NAME_SZ];
+	struct jrpcd_publish_buf buf;
+	struct jrpcd_node_desc *snode;
 
-	/* Initialize Variables */
-	cid_next = 100;
-	LIST_INIT(&node_list);
+	memset(topic, 0, JRPCD_TOPIC_NAME_SZ);
 
-	/* Initialize Queues */
-	jrpcd_queue_init();
+	snode = jrpcd_get_node(cid);
+	if (snode == NULL) {
+		LOG_ERR("No matching snode found for %d", cid);
+		goto exit_0;
+	}
+	if (jrpcd_parser_call_get_intf(json_obj, topic, JRPCD_TOPIC_NAME_SZ) <
+	    0) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_0;
+	}
 
-	/* Initialize Server to accept incoming connections */
-	if (0 == jrpcd_server_init(host, port)) {
-		exit_pending = 0;
-		jrpcd_server_loop();
+	buf.size = size;
+	buf.data = (uint8_t *) jrpcd_pool_alloc(size);
+	if (buf.data == NULL) {
+		LOG_ERR("%s", "pool alloc failed");
+		goto exit_0;
 	}
-	jrpcd_dump();
-	jrpcd_cleanup();
+	memcpy(buf.data, data, size);
 
-	return 0;
+	published++;
+	delivered += jrpcd_topic_publish(topic, cid, jrpcd_publish_deliver,
+					 &buf);
+	jrpcd_pool_free(buf.data);
+ exit_0:
+	return;
 }
 
-int8_t jrpcd_new_client(uint32_t csock)
+/* A peer daemon tells which nodes it serves, first when the link comes */
+/* up and then after every change. The first time, the link is taken as */
+/* a peer link and told the nodes served here in turn. */
+void jrpcd_process_peer(void *json_obj, uint32_t cid)
 {
+	char name[NODE_NAME_MAX_SZ];
 	struct jrpcd_node_desc *node;
+	bool first;
+	uint16_t i;
 
-	/* Allocate memory for node instance */
-	node = (struct jrpcd_node_desc *)malloc(sizeof(struct jrpcd_node_desc));
+	memset(name, 0, NODE_NAME_MAX_SZ);
+
+	node = jrpcd_get_node(cid);
 	if (node == NULL) {
-		LOG_ERR("%s", "malloc failed");
+		LOG_ERR("No matching node found for %d", cid);
+		goto exit_0;
+	}
+	if (!node->peer && (node->name[0] != '\0')) {
+		LOG_ERR("node %s cannot become a peer", node->name);
+		goto exit_0;
+	}
+	if (jrpcd_parser_get_snode(json_obj, name, NODE_NAME_MAX_SZ) < 0) {
+		LOG_ERR("%s", "parser failed");
 		goto exit_0;
 	}
+	first = !node->peer;
+	node->peer = true;
+	strcpy(node->name, name);
+
+	jrpcd_peer_purge(cid);
+	for (i = 0; jrpcd_parser_peer_get_node(json_obj, i, name,
+					       NODE_NAME_MAX_SZ) == 0; i++) {
+		jrpcd_peer_add(name, cid);
+	}
+	LOG_INFO("peer %s serves %d nodes", node->name, i);
 
-	/* Create the transmit queue for the node */
-	node->tx_q = jrpcd_queue_create(cid_next);
-	if (node->tx_q == NULL) {
-		LOG_ERR("%s", "queue creation failed");
-		goto exit_1;
+	if (first) {
+		jrpcd_peer_advertise(node);
 	}
+ exit_0:
+	return;
+}
 
-	/* Create client handing threads */
-	if (jrpcd_client_create
-	    (csock, cid_next, &node->tid, &node->rid, node->tx_q) < 0) {
-		LOG_ERR("%s", "client creation failed");
-		goto exit_2;
+/* Resolves the targets of a fan-out call. spec is a comma separated list */
+/* of node names or glob patterns. Every matching name is called once, a */
+/* group through one of its members. The caller is never a target. */
+uint16_t jrpcd_mcall_targets(struct jrpcd_node_desc *snode, char *spec,
+			     void *json_obj, struct jrpcd_node_desc **targets,
+			     uint16_t max)
+{
+	struct jrpcd_node_desc *node;
+	char *pattern;
+	char *save;
+	uint16_t num = 0;
+	uint16_t i;
+
+	for (pattern = strtok_r(spec, ",", &save); pattern != NULL;
+	     pattern = strtok_r(NULL, ",", &save)) {
+		LIST_FOREACH(node, &node_list, entries) {
+			if ((node->name[0] == '\0') || node->peer ||
+			    (strcmp(node->name, snode->name) == 0) ||
+			    (fnmatch(pattern, node->name, 0) != 0)) {
+				continue;
+			}
+			for (i = 0; i < num; i++) {
+				if (strcmp(targets[i]->name, node->name) == 0) {
+					break;
+				}
+			}
+			if (i < num) {
+				continue;
+			}
+			if (num == max) {
+				LOG_ERR("more than %d targets, rest dropped",
+					max);
+				return num;
+			}
+			targets[num++] = jrpcd_pick_node(node->name, json_obj);
+		}
 	}
+	return num;
+}
 
-	/* Initialize node variables */
-	memset(node->name, 0, NODE_NAME_MAX_SZ);
-	node->csock = csock;
-	node->cid = cid_next;
-	node->num_intf = 0;
-	LIST_INIT(&(node->intf_list));
+/* Tells the caller of a fan-out call which nodes got the call */
+void jrpcd_mcall_send_ack(struct jrpcd_node_desc *node, char *intf,
+			  uint32_t id, struct jrpcd_node_desc **targets,
+			  uint16_t num)
+{
+	char *buffer = NULL;
+	uint16_t i;
+	int len;
+	int pos;
 
-	/* Insert node into the node list */
-	LIST_INSERT_HEAD(&node_list, node, entries);
+	len = snprintf(NULL, 0, MCALL_ACK_FMT, node->name, intf, id) + 2;
+	for (i = 0; i < num; i++) {
+		len += strlen(targets[i]->name) + 3;
+	}
+	buffer = (char *)jrpcd_pool_alloc(len + 1);
+	if (buffer == NULL) {
+		LOG_ERR("%s", "pool alloc failed");
+		goto exit_0;
+	}
+
+	pos = snprintf(buffer, len + 1, MCALL_ACK_FMT, node->name, intf, id);
+	for (i = 0; i < num; i++) {
+		pos += snprintf(buffer + pos, len + 1 - pos, "%s\"%s\"",
+				(i > 0) ? "," : "", targets[i]->name);
+	}
+	pos += snprintf(buffer + pos, len + 1 - pos, "]}");
+
+	jrpcd_node_put(node, (uint8_t *) buffer, pos);
 
-	cid_next++;
-	return 0;
- exit_2:
-	jrpcd_queue_destroy(node->tx_q);
- exit_1:
-	free(node);
  exit_0:
-	close(csock);
-	return -1;
+	return;
+}
+
+void jrpcd_process_mcall(void *json_obj, uint32_t cid, uint8_t *data,
+			 uint32_t size)
+{
+	char spec[MCALL_SPEC_MAX_SZ];
+	char snode_name[NODE_NAME_MAX_SZ];
+	char intf_name[INTF_NAME_MAX_SZ];
+	struct jrpcd_node_desc *targets[MCALL_MAX_TARGETS];
+	struct jrpcd_node_desc *snode;
+	struct jrpcd_pending_call call;
+	uint8_t *buffer = NULL;
+	uint8_t *lbuffer;
+	uint32_t lsize;
+	uint32_t xid = 0;
+	uint32_t id = 0;
+	uint16_t num;
+	uint16_t i;
+
+	memset(spec, 0, MCALL_SPEC_MAX_SZ);
+	memset(snode_name, 0, NODE_NAME_MAX_SZ);
+	memset(intf_name, 0, INTF_NAME_MAX_SZ);
+
+	/* Fan-out call has been received for a set of nodes */
+	snode = jrpcd_get_node(cid);
+	if (snode == NULL) {
+		LOG_ERR("No matching snode found for %d", cid);
+		goto exit_0;
+	}
+	jrpcd_parser_get_id(json_obj, &id);
+
+	if (jrpcd_parser_get_snode(json_obj, snode_name, NODE_NAME_MAX_SZ) < 0) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_1;
+	}
+	if (jrpcd_parser_call_get_intf(json_obj, intf_name, INTF_NAME_MAX_SZ) <
+	    0) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_1;
+	}
+	if (strcmp(snode_name, snode->name) != 0) {
+		LOG_ERR("%s", "snode name mismatch");
+		goto exit_1;
+	}
+	if (jrpcd_parser_get_dnode(json_obj, spec, MCALL_SPEC_MAX_SZ - 1) < 0) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_1;
+	}
+	num = jrpcd_mcall_targets(snode, spec, json_obj, targets,
+				  MCALL_MAX_TARGETS);
+
+	/* All targets share one xid, each returns under its own cid */
+	memset(&call, 0, sizeof(call));
+	jrpcd_parser_get_dl(json_obj, &call.dl);
+	if ((call.dl != 0) && (call.dl <= jrpcd_now())) {
+		/* Caller has given up already */
+		for (i = 0; i < num; i++) {
+			targets[i]->expired++;
+		}
+		return;
+	}
+	call.caller = snode->cid;
+	call.id = id;
+	strncpy(call.intf, intf_name, JRPCD_PENDING_NAME_SZ - 1);
+	for (i = 0; i < num; i++) {
+		call.callee = targets[i]->cid;
+		strncpy(call.dnode, targets[i]->name,
+			JRPCD_PENDING_NAME_SZ - 1);
+		xid = jrpcd_pending_add(&call, xid);
+		if (xid == 0) {
+			goto exit_2;
+		}
+	}
+
+	/* One copy of the call is shared by the queues of all targets */
+	if (num > 0) {
+		buffer = jrpcd_stamp_msg(CALL_XID_FMT, xid, data, &size);
+		if (buffer == NULL) {
+			goto exit_2;
+		}
+	}
+
+	/* Ack goes first, the caller learns whom to wait for before any */
+	/* of the returns arrive */
+	jrpcd_mcall_send_ack(snode, intf_name, id, targets, num);
+	if (num == 0) {
+		return;
+	}
+
+	for (i = 0; i < num; i++) {
+		targets[i]->outstanding++;
+		if (targets[i]->conn != NULL) {
+			/* A logical node gets its own copy naming it */
+			lsize = size;
+			lbuffer = jrpcd_stamp_lnode(targets[i], buffer, &lsize);
+			if (lbuffer != NULL) {
+				jrpcd_node_put_dl(targets[i], lbuffer, lsize,
+						  call.dl);
+			}
+			continue;
+		}
+		jrpcd_node_put_dl(targets[i], jrpcd_pool_ref(buffer), size,
+				  call.dl);
+	}
+	jrpcd_pool_free(buffer);
+	return;
+ exit_2:
+	/* Forget the targets recorded so far */
+	while (i-- > 0) {
+		jrpcd_pending_take(xid, targets[i]->cid, &call);
+	}
+ exit_1:
+	jrpcd_call_send_err_resp(snode, spec, intf_name, id);
+ exit_0:
+	return;
+}
+
+/* Runs the next step of a chain with the value returned by the last one. */
+/* prev is the call that returned, its chain is consumed. */
+void jrpcd_chain_next(void *json_obj, struct jrpcd_pending_call *prev)
+{
+	char dnode_name[NODE_NAME_MAX_SZ];
+	char intf_name[INTF_NAME_MAX_SZ];
+	struct jrpcd_node_desc *onode;
+	struct jrpcd_node_desc *dnode;
+	struct jrpcd_pending_call call;
+	uint8_t *buffer;
+	uint8_t *msg;
+	uint32_t size;
+	uint32_t xid;
+
+	memset(dnode_name, 0, NODE_NAME_MAX_SZ);
+	memset(intf_name, 0, INTF_NAME_MAX_SZ);
+	memset(&call, 0, sizeof(call));
+
+	/* Node that started the chain */
+	onode = jrpcd_get_node(prev->caller);
+	if (onode == NULL) {
+		LOG_INFO("chain caller %d is gone", prev->caller);
+		goto exit_0;
+	}
+
+	if (jrpcd_parser_chain_step(prev->chain, dnode_name,
+				    NODE_NAME_MAX_SZ - 1, intf_name,
+				    INTF_NAME_MAX_SZ - 1, &call.chain) < 0) {
+		goto exit_1;
+	}
+	if (jrpcd_call_expired(prev->dl, dnode_name)) {
+		jrpcd_pool_free(call.chain);
+		goto exit_0;
+	}
+	dnode = jrpcd_route(dnode_name, json_obj, onode);
+	if (dnode == NULL) {
+		LOG_ERR("No matching dnode found for %s", dnode_name);
+		goto exit_1;
+	}
+	/* A step on a peer daemon goes without deadline, the local pending */
+	/* call still expires with it */
+	msg = jrpcd_parser_chain_call(json_obj, onode->name, dnode_name,
+				      intf_name, dnode->peer ? 0 : prev->dl,
+				      &size);
+	if (msg == NULL) {
+		goto exit_1;
+	}
+
+	call.caller = onode->cid;
+	call.callee = dnode->cid;
+	call.id = prev->id;
+	call.dl = prev->dl;
+	strncpy(call.dnode, dnode_name, JRPCD_PENDING_NAME_SZ - 1);
+	strncpy(call.intf, intf_name, JRPCD_PENDING_NAME_SZ - 1);
+	xid = jrpcd_pending_add(&call, 0);
+	if (xid == 0) {
+		jrpcd_pool_free(msg);
+		goto exit_1;
+	}
+	buffer = jrpcd_stamp_msg(dnode->peer ? PEER_XID_FMT : CALL_XID_FMT, xid,
+				 msg, &size);
+	jrpcd_pool_free(msg);
+	if (buffer == NULL) {
+		jrpcd_pending_take(xid, dnode->cid, &call);
+		goto exit_1;
+	}
+
+	dnode->outstanding++;
+	jrpcd_node_put_dl(dnode, buffer, size, call.dl);
+	jrpcd_pool_free(prev->chain);
+	return;
+ exit_1:
+	/* Chain is broken, the caller gets the failure of this step */
+	jrpcd_call_send_err_resp(onode, dnode_name[0] ? dnode_name :
+				 prev->dnode, intf_name[0] ? intf_name :
+				 prev->intf, prev->id);
+	jrpcd_pool_free(call.chain);
+ exit_0:
+	jrpcd_pool_free(prev->chain);
+	return;
+}
+
+/* Counts a returned call off the node that served it. Calls coalesced */
+/* into one share its xid and were forwarded once, only the forwarded one */
+/* counts, whichever order they are taken in. If it was lost before, */
+/* jrpcd_call_lost() counted it off already. */
+void jrpcd_return_settle(struct jrpcd_node_desc *snode,
+			 struct jrpcd_pending_call *call)
+{
+	if (!call->coalesced && (snode->outstanding > 0)) {
+		snode->outstanding--;
+	}
+}
+
+/* Keeps the return of a call to a cacheable interface. Of calls coalesced */
+/* into one, only the first carries the args. */
+void jrpcd_return_cache(void *json_obj, struct jrpcd_pending_call *call)
+{
+	char *ret;
+
+	if (call->args == NULL) {
+		return;
+	}
+	ret = jrpcd_parser_return_get_ret(json_obj);
+	if (ret != NULL) {
+		jrpcd_cache_put(call->dnode, call->intf, call->args, ret,
+				call->ttl);
+		jrpcd_pool_free(ret);
+	}
+	jrpcd_pool_free(call->args);
+	call->args = NULL;
+}
+
+/* Forwards a return to the caller, with the id the caller gave the call */
+void jrpcd_return_send(struct jrpcd_node_desc *dnode, uint32_t id,
+		       uint8_t *data, uint32_t size)
+{
+	uint8_t *buffer;
+
+	if (id != 0) {
+		/* Hand the caller its id back, it matches the return with. */
+		/* A peer daemon gets the xid it sent the call with. */
+		buffer = jrpcd_stamp_msg(dnode->peer ? PEER_XID_FMT :
+					 RETURN_ID_FMT, id, data, &size);
+		if (buffer == NULL) {
+			goto exit_0;
+		}
+	} else {
+		/* Allocate buffer to copy the data, this will free'd in the */
+		/* transmit thread of the destination node once data is sent */
+		buffer = (uint8_t *) jrpcd_pool_alloc(size);
+		if (buffer == NULL) {
+			LOG_ERR("%s", "pool alloc failed");
+			goto exit_0;
+		}
+		memcpy(buffer, data, size);
+	}
+
+	/* put the data into the transmit queue of the destination node */
+	jrpcd_node_put(dnode, buffer, size);
+ exit_0:
+	return;
+}
+
+void jrpcd_process_return(void *json_obj, uint32_t cid, uint8_t *data,
+			  uint32_t size)
+{
+	char dnode_name[NODE_NAME_MAX_SZ];
+	char snode_name[NODE_NAME_MAX_SZ];
+	char intf_name[INTF_NAME_MAX_SZ];
+	struct jrpcd_node_desc *snode;
+	struct jrpcd_node_desc *dnode;
+	struct jrpcd_pending_call call;
+	uint32_t xid = 0;
+
+	memset(dnode_name, 0, NODE_NAME_MAX_SZ);
+	memset(snode_name, 0, NODE_NAME_MAX_SZ);
+	memset(intf_name, 0, INTF_NAME_MAX_SZ);
+
+	/* Return call has been received for an node */
+	/* Find out node using the client id */
+	snode = jrpcd_get_node(cid);
+	if (snode == NULL) {
+		LOG_ERR("No matching snode found for %d", cid);
+		goto exit_0;
+	}
+	if (jrpcd_parser_get_snode(json_obj, snode_name, NODE_NAME_MAX_SZ) < 0) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_0;
+	}
+	if (jrpcd_parser_call_get_intf(json_obj, intf_name, INTF_NAME_MAX_SZ) <
+	    0) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_0;
+	}
+	if (!snode->peer && (strcmp(snode_name, snode->name) != 0)) {
+		LOG_ERR("%s", "snode name mismatch");
+		goto exit_0;
+	}
+	if (jrpcd_parser_get_dnode(json_obj, dnode_name, NODE_NAME_MAX_SZ) < 0) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_0;
+	}
+	/* A peer daemon returns calls forwarded to it under their pxid */
+	if ((snode->peer && (jrpcd_parser_get_pxid(json_obj, &xid) == 0)) ||
+	    (!snode->peer && (jrpcd_parser_get_xid(json_obj, &xid) == 0))) {
+		/* Send it to the very node that made the call, the name */
+		/* alone is ambiguous when the caller is a group member */
+		if (jrpcd_pending_take(xid, snode->cid, &call) < 0) {
+			LOG_INFO("No pending call %d for cid %d", xid, cid);
+			goto exit_0;
+		}
+		jrpcd_return_settle(snode, &call);
+		jrpcd_return_cache(json_obj, &call);
+		if (call.chain != NULL) {
+			/* Middle of a chain, the caller waits for the end */
+			jrpcd_chain_next(json_obj, &call);
+			return;
+		}
+		dnode = jrpcd_get_node(call.caller);
+	} else {
+		call.id = 0;
+		dnode = jrpcd_get_node_by_name(dnode_name);
+	}
+	if (dnode == NULL) {
+		LOG_ERR("No matching dnode found for %s", dnode_name);
+	} else if (!snode->peer && !dnode->peer &&
+		   (strcmp(dnode_name, dnode->name) != 0)) {
+		LOG_ERR("%s", "dnode name mismatch");
+	} else {
+		jrpcd_return_send(dnode, call.id, data, size);
+	}
+
+	/* Callers coalesced into the call get the same return */
+	while ((xid != 0) && (jrpcd_pending_take(xid, cid, &call) == 0)) {
+		jrpcd_return_settle(snode, &call);
+		jrpcd_return_cache(json_obj, &call);
+		dnode = jrpcd_get_node(call.caller);
+		if (dnode != NULL) {
+			jrpcd_return_send(dnode, call.id, data, size);
+		}
+	}
+	return;
+ exit_0:
+	return;
+}
+
+static void jrpcd_node_init(struct jrpcd_node_desc *node, uint32_t csock);
+
+/* Sets up a logical node on the connection of conn and lists it */
+static void jrpcd_node_share(struct jrpcd_node_desc *node,
+			     struct jrpcd_node_desc *conn)
+{
+	jrpcd_node_init(node, conn->csock);
+	node->tx_budget = conn->tx_budget;
+	node->tx_q = conn->tx_q;
+	node->tid = conn->tid;
+	node->rid = conn->rid;
+	node->embedded = conn->embedded;
+	node->conn = conn;
+}
+
+/* One connection carries any number of logical nodes, each message names */
+/* the one it is from. Returns the client id of that node, a new name */
+/* registering gets a node of its own sharing the connection, created is */
+/* set then. Called with node_lock held. */
+static uint32_t jrpcd_logical_cid(void *json_obj, uint32_t cid,
+				  uint8_t api_type, bool *created)
+{
+	char name[NODE_NAME_MAX_SZ];
+	struct jrpcd_node_desc *conn, *node;
+
+	*created = false;
+	conn = jrpcd_get_node(cid);
+	if ((conn == NULL) || conn->peer || (conn->name[0] == '\0') ||
+	    (jrpcd_parser_get_snode(json_obj, name, NODE_NAME_MAX_SZ) < 0) ||
+	    (strcmp(name, conn->name) == 0)) {
+		return cid;
+	}
+
+	LIST_FOREACH(node, &node_list, entries) {
+		if ((node->conn == conn) && (strcmp(node->name, name) == 0)) {
+			return node->cid;
+		}
+	}
+	if (api_type != JRPCD_API_REGISTER) {
+		return cid;
+	}
+
+	node = (struct jrpcd_node_desc *)malloc(sizeof(struct jrpcd_node_desc));
+	if (node == NULL) {
+		LOG_ERR("%s", "malloc failed");
+		return cid;
+	}
+	jrpcd_node_share(node, conn);
+	*created = true;
+	LOG_INFO("cid %d adds logical node %d", cid, cid_next);
+	return cid_next++;
+}
+
+int8_t jrpcd_process_recv(uint32_t cid, uint8_t *data, uint32_t size)
+{
+	void *json_obj = NULL;
+	uint8_t api_type;
+	int8_t ret = -1;
+	bool created;
+
+	/* Initialize JSON parser */
+	jrpcd_parser_init(&json_obj, (char *)data);
+	if (json_obj == NULL) {
+		LOG_INFO("%s ==> \"%s\"", "Invalid json message", (char *)data);
+		goto exit_0;
+	}
+
+	/* Find out the API */
+	if (jrpcd_parser_get_api(json_obj, &api_type)) {
+		LOG_ERR("%s", "parser failed");
+		goto exit_1;
+	}
+
+	/* Process API request */
+	pthread_mutex_lock(&node_lock);
+	cid = jrpcd_logical_cid(json_obj, cid, api_type, &created);
+	if (JRPCD_API_REGISTER == api_type) {
+		LOG_INFO("cid: %d, Recvd Register", cid);
+		/* A refused name leaves no node behind on the connection */
+		if ((jrpcd_process_register(json_obj, cid) < 0) && created) {
+			jrpcd_destroy_node(jrpcd_get_node(cid));
+		}
+	} else if (JRPCD_API_CALL == api_type) {
+		LOG_INFO("cid: %d, Recvd Call", cid);
+		jrpcd_process_call(json_obj, cid, data, size);
+	} else if (JRPCD_API_MCALL == api_type) {
+		LOG_INFO("cid: %d, Recvd Mcall", cid);
+		jrpcd_process_mcall(json_obj, cid, data, size);
+	} else if (JRPCD_API_NOTIFY == api_type) {
+		LOG_INFO("cid: %d, Recvd Notify", cid);
+		jrpcd_process_notify(json_obj, cid, data, size);
+	} else if (JRPCD_API_PUBLISH == api_type) {
+		LOG_INFO("cid: %d, Recvd Publish", cid);
+		jrpcd_process_publish(json_obj, cid, data, size);
+	} else if (JRPCD_API_SUBSCRIBE == api_type) {
+		LOG_INFO("cid: %d, Recvd Subscribe", cid);
+		jrpcd_process_subscribe(json_obj, cid, true);
+	} else if (JRPCD_API_UNSUBSCRIBE == api_type) {
+		LOG_INFO("cid: %d, Recvd Unsubscribe", cid);
+		jrpcd_process_subscribe(json_obj, cid, false);
+	} else if (JRPCD_API_PEER == api_type) {
+		LOG_INFO("cid: %d, Recvd Peer", cid);
+		jrpcd_process_peer(json_obj, cid);
+	} else if (JRPCD_API_RETURN == api_type) {
+		LOG_INFO("cid: %d, Recvd Return", cid);
+		jrpcd_process_return(json_obj, cid, data, size);
+	} else if (JRPCD_API_EXIT == api_type) {
+		LOG_INFO("cid: %d, Recvd Exit", cid);
+		/* !!! Special Handling !!! */
+		/* !!! Below call will not return !!! */
+		jrpcd_process_exit(json_obj, cid);
+	}
+	pthread_mutex_unlock(&node_lock);
+	ret = 0;
+ exit_1:
+	/* Cleanup parser to free up resources */
+	jrpcd_parser_cleanup(json_obj);
+ exit_0:
+	return ret;
+}
+
+void jrpcd_close_client(uint32_t cid)
+{
+	/* Connection is gone without an exit message, clean up the same way */
+	pthread_mutex_lock(&node_lock);
+	jrpcd_process_exit(NULL, cid);
+	pthread_mutex_unlock(&node_lock);
+}
+
+void jrpcd_set_tx_budget(uint32_t budget, uint8_t policy)
+{
+	tx_budget = budget;
+	tx_policy = policy;
+}
+
+void jrpcd_set_hugepages(bool enable)
+{
+	pool_hugepages = enable;
+}
+
+/* Off unless asked for, the allocator hook is process wide and libjrpcd */
+/* shares the process with its host */
+void jrpcd_set_arena(bool enable)
+{
+	json_arena = enable;
+}
+
+/* Unix socket path a newer jrpcd takes over on, see jrpcd_handoff() */
+void jrpcd_set_upgrade(char *path)
+{
+	upgrade_path = path;
+}
+
+void jrpcd_exit(void)
+{
+	exit_pending = 1;
+}
+
+bool jrpcd_exit_pending(void)
+{
+	return exit_pending;
+}
+
+/* Sets up routing, port only names this daemon to its peers */
+void jrpcd_init(uint32_t port)
+{
+	LOG_VERBOSE("%s", "jrpcd_init");
+
+	/* Initialize Variables */
+	cid_next = 100;
+	LIST_INIT(&node_list);
+
+	/* Initialize buffer pool, json parser, client threads, queues, */
+	/* pending calls, the return cache, topics and the registry of peer */
+	/* daemons */
+	jrpcd_pool_init(pool_hugepages);
+	jrpcd_parser_setup(json_arena);
+	jrpcd_client_init();
+	jrpcd_queue_init();
+	jrpcd_pending_init(jrpcd_call_lost);
+	jrpcd_cache_init(JRPCD_CACHE_MAX_ENTRIES);
+	jrpcd_topic_init();
+	jrpcd_peer_init();
+	snprintf(self_name, NODE_NAME_MAX_SZ, "%s:%d", JRPCD_NODE_NAME, port);
+	exit_pending = 0;
+}
+
+void jrpcd_fini(void)
+{
+	jrpcd_dump();
+	jrpcd_cleanup();
+}
+
+static int8_t jrpcd_takeover(char *path);
+
+int8_t jrpcd_main(char *host, uint32_t port)
+{
+	int8_t rc = -1;
+
+	LOG_VERBOSE("%s", "jrpcd_main");
+
+	jrpcd_init(port);
+
+	/* Take over from a daemon running on the upgrade path, if any */
+	if (upgrade_path != NULL) {
+		rc = jrpcd_takeover(upgrade_path);
+		if (rc == -2) {
+			/* Previous daemon carries on, leave all it handed */
+			/* over as it is */
+			LOG_ERR("%s", "take over failed");
+			return -1;
+		}
+	}
+
+	/* Initialize Server to accept incoming connections */
+	if ((rc == 0) || (0 == jrpcd_server_init(host, port))) {
+		if (upgrade_path != NULL) {
+			jrpcd_server_upgrade_init(upgrade_path);
+		}
+		jrpcd_idle();
+		jrpcd_server_loop();
+	}
+
+	/* Nodes handed over are the successor's, this daemon just exits */
+	if (!jrpcd_server_handed_off()) {
+		jrpcd_fini();
+	}
+
+	return 0;
+}
+
+/* Called with node_lock held */
+static void jrpcd_node_init(struct jrpcd_node_desc *node, uint32_t csock)
+{
+	memset(node->name, 0, NODE_NAME_MAX_SZ);
+	node->csock = csock;
+	node->cid = cid_next;
+	node->num_intf = 0;
+	node->group = JRPCD_GROUP_NONE;
+	node->key = 0;
+	node->outstanding = 0;
+	node->picks = 0;
+	node->last_pick = 0;
+	node->expired = 0;
+	node->peer = false;
+	node->direct[0] = '\0';
+	node->embedded = false;
+	node->conn = NULL;
+	node->handed = false;
+	LIST_INIT(&(node->intf_list));
+
+	/* Insert node into the node list */
+	LIST_INSERT_HEAD(&node_list, node, entries);
+}
+
+/* Sets up a node for a new connection, cid is set to its client id */
+static int8_t jrpcd_add_client(uint32_t csock, uint32_t *cid)
+{
+	struct jrpcd_node_desc *node;
+
+	/* Allocate memory for node instance */
+	node = (struct jrpcd_node_desc *)malloc(sizeof(struct jrpcd_node_desc));
+	if (node == NULL) {
+		LOG_ERR("%s", "malloc failed");
+		goto exit_0;
+	}
+
+	/* Node is listed before its receive thread can look it up, and */
+	/* logical nodes take client ids under the same lock */
+	pthread_mutex_lock(&node_lock);
+
+	/* Create the transmit queue for the node */
+	node->tx_budget = tx_budget;
+	node->tx_q = jrpcd_queue_create(cid_next, node->tx_budget, tx_policy);
+	if (node->tx_q == NULL) {
+		LOG_ERR("%s", "queue creation failed");
+		goto exit_1;
+	}
+
+	/* Create client handing threads */
+	if (jrpcd_client_create
+	    (csock, cid_next, &node->tid, &node->rid, node->tx_q, NULL, 0) < 0) {
+		LOG_ERR("%s", "client creation failed");
+		goto exit_2;
+	}
+
+	/* Initialize node variables and list it */
+	jrpcd_node_init(node, csock);
+	cid_next++;
+	*cid = node->cid;
+	pthread_mutex_unlock(&node_lock);
+
+	return 0;
+ exit_2:
+	jrpcd_queue_destroy(node->tx_q);
+ exit_1:
+	pthread_mutex_unlock(&node_lock);
+	free(node);
+ exit_0:
+	close(csock);
+	return -1;
+}
+
+int8_t jrpcd_new_client(uint32_t csock)
+{
+	uint32_t cid;
+
+	return jrpcd_add_client(csock, &cid);
+}
+
+/* Adds a peer daemon as host:port, the daemon keeps a link to it up */
+int8_t jrpcd_set_peer(char *addr)
+{
+	struct jrpcd_peer_addr *peer;
+	char *port;
+
+	if (num_peers == JRPCD_PEERS_MAX) {
+		LOG_ERR("more than %d peers", JRPCD_PEERS_MAX);
+		goto exit_0;
+	}
+	port = strrchr(addr, ':');
+	if ((port == NULL) || (port - addr >= PEER_HOST_MAX_SZ)) {
+		LOG_ERR("invalid peer %s", addr);
+		goto exit_0;
+	}
+
+	peer = &peers[num_peers];
+	memset(peer->host, 0, PEER_HOST_MAX_SZ);
+	memcpy(peer->host, addr, port - addr);
+	peer->port = atoi(port + 1);
+	peer->cid = 0;
+	num_peers++;
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* Called by the server loop when it has nothing else to do. Links to */
+/* peer daemons that are down are brought up again. */
+void jrpcd_idle(void)
+{
+	struct jrpcd_node_desc *node;
+	int32_t csock;
+	uint32_t cid;
+	uint8_t i;
+
+	for (i = 0; i < num_peers; i++) {
+		pthread_mutex_lock(&node_lock);
+		node = jrpcd_get_node(peers[i].cid);
+		pthread_mutex_unlock(&node_lock);
+		if (node != NULL) {
+			continue;
+		}
+
+		/* Connect without the lock, the peer may be slow to answer */
+		csock = jrpcd_server_connect(peers[i].host, peers[i].port);
+		if ((csock < 0) || (jrpcd_add_client(csock, &cid) < 0)) {
+			continue;
+		}
+
+		/* Peer takes the link as such once told what is served here */
+		pthread_mutex_lock(&node_lock);
+		node = jrpcd_get_node(cid);
+		if (node != NULL) {
+			node->peer = true;
+			/* Named after the address till the peer names itself */
+			snprintf(node->name, NODE_NAME_MAX_SZ, "%.20s:%u",
+				 peers[i].host, peers[i].port);
+			peers[i].cid = cid;
+			jrpcd_peer_advertise(node);
+			LOG_INFO("linked to peer %s", node->name);
+		}
+		pthread_mutex_unlock(&node_lock);
+	}
+}
+
+/* Attaches a component of this process. It hands its messages to */
+/* jrpcd_embed_send() and takes the ones for it from jrpcd_embed_recv(), */
+/* no socket and no thread of jrpcd is involved. Returns the link. */
+void *jrpcd_embed_attach(void)
+{
+	struct jrpcd_embed_desc *embed;
+	struct jrpcd_node_desc *node;
+
+	embed = (struct jrpcd_embed_desc *)
+	    malloc(sizeof(struct jrpcd_embed_desc));
+	if (embed == NULL) {
+		LOG_ERR("%s", "malloc failed");
+		goto exit_0;
+	}
+	node = (struct jrpcd_node_desc *)malloc(sizeof(struct jrpcd_node_desc));
+	if (node == NULL) {
+		LOG_ERR("%s", "malloc failed");
+		goto exit_1;
+	}
+
+	pthread_mutex_lock(&node_lock);
+	node->tx_budget = tx_budget;
+	node->tx_q = jrpcd_queue_create(cid_next, node->tx_budget, tx_policy);
+	if (node->tx_q == NULL) {
+		LOG_ERR("%s", "queue creation failed");
+		pthread_mutex_unlock(&node_lock);
+		goto exit_2;
+	}
+	jrpcd_node_init(node, (uint32_t)-1);
+	node->embedded = true;
+	embed->cid = node->cid;
+	embed->tx_q = node->tx_q;
+	cid_next++;
+	pthread_mutex_unlock(&node_lock);
+
+	LOG_INFO("component attached as cid %d", embed->cid);
+	return embed;
+ exit_2:
+	free(node);
+ exit_1:
+	free(embed);
+ exit_0:
+	return NULL;
+}
+
+/* Routes one message of the component, on the thread of the caller */
+int8_t jrpcd_embed_send(void *link, uint8_t *data, uint32_t size)
+{
+	struct jrpcd_embed_desc *embed = (struct jrpcd_embed_desc *)link;
+
+	return jrpcd_process_recv(embed->cid, data, size);
+}
+
+/* Waits for a message to the component. Returns its size, data is NULL */
+/* once the node is gone. data is released with jrpcd_embed_release(). */
+uint32_t jrpcd_embed_recv(void *link, void **data)
+{
+	struct jrpcd_embed_desc *embed = (struct jrpcd_embed_desc *)link;
+
+	return jrpcd_queue_get(embed->tx_q, data);
+}
+
+void jrpcd_embed_release(void *data)
+{
+	jrpcd_pool_free(data);
+}
+
+/* Tears down the node if still there. No jrpcd_embed_recv() may be */
+/* waiting on the link anymore. */
+void jrpcd_embed_detach(void *link)
+{
+	struct jrpcd_embed_desc *embed = (struct jrpcd_embed_desc *)link;
+	struct jrpcd_node_desc *node;
+
+	pthread_mutex_lock(&node_lock);
+	node = jrpcd_get_node(embed->cid);
+	if (node != NULL) {
+		jrpcd_destroy_node(node);
+	}
+	pthread_mutex_unlock(&node_lock);
+
+	jrpcd_queue_destroy(embed->tx_q);
+	free(embed);
+}
+
+/* Group policy as named in registrations, NULL for none */
+static char *jrpcd_group_name(uint8_t group)
+{
+	switch (group) {
+	case JRPCD_GROUP_RR:
+		return "rr";
+	case JRPCD_GROUP_LOC:
+		return "loc";
+	case JRPCD_GROUP_HASH:
+		return "hash";
+	}
+	return NULL;
+}
+
+/* Records going to a successor, see jrpcd_handoff() */
+struct jrpcd_handoff_out {
+	int32_t usock;		/* Connection to the successor */
+	uint8_t *buff;		/* Record being sent */
+	uint32_t nodes;		/* Records sent of each kind */
+	uint32_t calls;
+	int8_t ret;		/* -1 once a record failed */
+};
+
+/* Sends the record rec, with socket fd unless it is -1. A node record is */
+/* followed by what was read of the node and not processed yet. */
+static void jrpcd_handoff_put(struct jrpcd_handoff_out *out, void *rec,
+			      int32_t fd, uint32_t cid)
+{
+	int32_t len;
+	int32_t left = 0;
+
+	len = jrpcd_parser_handoff_dump(rec, (char *)out->buff,
+					HANDOFF_MAX_SZ - JRPCD_MAX_MSG_SZ);
+	if ((len > 0) && (cid != 0)) {
+		left = jrpcd_client_leftover(cid, out->buff + len,
+					     JRPCD_MAX_MSG_SZ);
+	}
+	if ((len < 0) || (left < 0) ||
+	    (jrpcd_server_send_fd(out->usock, out->buff, len + left, fd) <
+	     0)) {
+		out->ret = -1;
+	}
+}
+
+/* A node goes as its registration, with its socket if it owns it */
+static void jrpcd_handoff_put_node(struct jrpcd_handoff_out *out,
+				   struct jrpcd_node_desc *node)
+{
+	char topic[JRPCD_TOPIC_NAME_SZ];
+	struct jrpcd_intf_desc *intf;
+	void *rec;
+	uint16_t i;
+
+	rec = jrpcd_parser_handoff_new("node");
+	jrpcd_parser_handoff_set_int(rec, "cid", node->cid);
+	jrpcd_parser_handoff_set_int(rec, "conn",
+				     node->conn ? node->conn->cid : 0);
+	jrpcd_parser_handoff_set_str(rec, "snode", node->name);
+	if (jrpcd_group_name(node->group) != NULL) {
+		jrpcd_parser_handoff_set_str(rec, "group",
+					     jrpcd_group_name(node->group));
+		jrpcd_parser_handoff_set_int(rec, "key", node->key);
+	}
+	if (node->direct[0] != '\0') {
+		jrpcd_parser_handoff_set_str(rec, "direct", node->direct);
+	}
+	jrpcd_parser_handoff_set_int(rec, "outstanding", node->outstanding);
+	jrpcd_parser_handoff_set_int(rec, "picks", node->picks);
+	jrpcd_parser_handoff_set_int(rec, "expired", node->expired);
+	LIST_FOREACH(intf, &(node->intf_list), entries) {
+		jrpcd_parser_handoff_add_intf(rec, intf->name, intf->arg,
+					      intf->ret, intf->ttl);
+	}
+	for (i = 0; jrpcd_topic_get(node->cid, i, topic) == 0; i++) {
+		jrpcd_parser_handoff_add_topic(rec, topic);
+	}
+
+	if (node->conn == NULL) {
+		jrpcd_handoff_put(out, rec, node->csock, node->cid);
+	} else {
+		jrpcd_handoff_put(out, rec, -1, 0);
+	}
+	out->nodes++;
+}
+
+static void jrpcd_handoff_put_call(struct jrpcd_pending_call *call,
+				   uint32_t xid, void *arg)
+{
+	struct jrpcd_handoff_out *out = (struct jrpcd_handoff_out *)arg;
+	void *rec;
+
+	if (out->ret < 0) {
+		return;
+	}
+	rec = jrpcd_parser_handoff_new("call");
+	jrpcd_parser_handoff_set_int(rec, "xid", xid);
+	jrpcd_parser_handoff_set_int(rec, "caller", call->caller);
+	jrpcd_parser_handoff_set_int(rec, "callee", call->callee);
+	jrpcd_parser_handoff_set_int(rec, "id", call->id);
+	jrpcd_parser_handoff_set_str(rec, "dnode", call->dnode);
+	jrpcd_parser_handoff_set_str(rec, "if", call->intf);
+	if (call->chain != NULL) {
+		jrpcd_parser_handoff_set_str(rec, "chain", call->chain);
+	}
+	if (call->args != NULL) {
+		jrpcd_parser_handoff_set_str(rec, "args", call->args);
+	}
+	jrpcd_parser_handoff_set_int(rec, "ttl", call->ttl);
+	jrpcd_parser_handoff_set_int(rec, "dl", call->dl);
+	jrpcd_parser_handoff_set_int(rec, "coalesced", call->coalesced);
+	jrpcd_handoff_put(out, rec, -1, 0);
+	out->calls++;
+}
+
+/* Hands this daemon over to a newer one connected on usock, which is */
+/* closed on return. The successor gets the listening socket, the sockets */
+/* of the nodes with what was read of them and not processed yet, their */
+/* registrations and the calls pending, so nodes go on without noticing. */
+/* Nothing is read meanwhile, and what was queued for nodes is sent first. */
+/* A node that does not take it is left behind and reconnects, so do */
+/* links to peer daemons. Returns 0 once the successor took over, this */
+/* daemon has nothing left to do then, else it carries on. */
+int8_t jrpcd_handoff(int32_t usock)
+{
+	struct jrpcd_handoff_out out;
+	struct jrpcd_node_desc *node;
+	struct pollfd pfd;
+	uint64_t drain_end;
+	uint64_t now;
+	uint8_t ack;
+	void *rec;
+
+	LOG_INFO("%s", "handing over to a new jrpcd");
+	memset(&out, 0, sizeof(out));
+	out.usock = usock;
+	out.buff = (uint8_t *) malloc(HANDOFF_MAX_SZ);
+	if (out.buff == NULL) {
+		LOG_ERR("%s", "malloc failed");
+		goto exit_0;
+	}
+
+	/* Nothing comes in from here on */
+	if (jrpcd_client_pause(HANDOFF_PAUSE_MS) < 0) {
+		goto exit_1;
+	}
+	pthread_mutex_lock(&node_lock);
+
+	/* Successor starts with empty queues */
+	drain_end = jrpcd_now() + HANDOFF_DRAIN_MS;
+	LIST_FOREACH(node, &node_list, entries) {
+		node->handed = false;
+		if (node->peer || node->embedded || (node->conn != NULL)) {
+			continue;
+		}
+		now = jrpcd_now();
+		node->handed = (jrpcd_queue_drain(node->tx_q,
+						  (now < drain_end) ?
+						  drain_end - now : 0) == 0);
+		if (!node->handed) {
+			LOG_ERR("%s is not reading, left behind", node->name);
+		}
+	}
+
+	/* Listening socket first, then connections before the logical */
+	/* nodes sharing them, then the calls pending */
+	rec = jrpcd_parser_handoff_new("listen");
+	jrpcd_parser_handoff_set_int(rec, "cid_next", cid_next);
+	jrpcd_handoff_put(&out, rec, jrpcd_server_sock(), 0);
+	LIST_FOREACH(node, &node_list, entries) {
+		if (node->handed) {
+			jrpcd_handoff_put_node(&out, node);
+		}
+	}
+	LIST_FOREACH(node, &node_list, entries) {
+		if ((node->conn != NULL) && node->conn->handed) {
+			jrpcd_handoff_put_node(&out, node);
+		}
+	}
+	jrpcd_pending_walk(jrpcd_handoff_put_call, &out);
+	jrpcd_handoff_put(&out, jrpcd_parser_handoff_new("done"), -1, 0);
+	if (out.ret < 0) {
+		goto exit_2;
+	}
+
+	/* Successor says when all is in place */
+	pfd.fd = usock;
+	pfd.events = POLLIN;
+	if ((poll(&pfd, 1, HANDOFF_ACK_MS) != 1) ||
+	    (recv(usock, &ack, 1, 0) != 1)) {
+		LOG_ERR("%s", "new jrpcd did not take over");
+		goto exit_2;
+	}
+	pthread_mutex_unlock(&node_lock);
+
+	LOG_INFO("new jrpcd took over %d nodes, %d pending calls", out.nodes,
+		 out.calls);
+	free(out.buff);
+	close(usock);
+	return 0;
+ exit_2:
+	pthread_mutex_unlock(&node_lock);
+	jrpcd_client_resume();
+ exit_1:
+	free(out.buff);
+ exit_0:
+	close(usock);
+	return -1;
+}
+
+/* Sets up a node handed over, with the socket fd if it owns one */
+static int8_t jrpcd_takeover_node(void *json_obj, int32_t fd, uint8_t *left,
+				  uint32_t left_size)
+{
+	struct jrpcd_node_desc *node;
+	struct jrpcd_node_desc *conn = NULL;
+	uint32_t cid;
+
+	cid = jrpcd_parser_handoff_get_int(json_obj, "cid");
+	if ((cid == 0) || (jrpcd_get_node(cid) != NULL)) {
+		LOG_ERR("invalid cid %d", cid);
+		goto exit_0;
+	}
+	if (jrpcd_parser_handoff_get_int(json_obj, "conn") != 0) {
+		conn = jrpcd_get_node(jrpcd_parser_handoff_get_int(json_obj,
+								   "conn"));
+		if (conn == NULL) {
+			LOG_ERR("no connection for cid %d", cid);
+			goto exit_0;
+		}
+	} else if (fd < 0) {
+		LOG_ERR("no socket for cid %d", cid);
+		goto exit_0;
+	}
+
+	node = (struct jrpcd_node_desc *)malloc(sizeof(struct jrpcd_node_desc));
+	if (node == NULL) {
+		LOG_ERR("%s", "malloc failed");
+		goto exit_0;
+	}
+	if (conn != NULL) {
+		jrpcd_node_share(node, conn);
+	} else {
+		node->tx_budget = tx_budget;
+		node->tx_q = jrpcd_queue_create(cid, node->tx_budget,
+						tx_policy);
+		if (node->tx_q == NULL) {
+			LOG_ERR("%s", "queue creation failed");
+			goto exit_1;
+		}
+		if (jrpcd_client_create(fd, cid, &node->tid, &node->rid,
+					node->tx_q, left, left_size) < 0) {
+			LOG_ERR("%s", "client creation failed");
+			jrpcd_queue_destroy(node->tx_q);
+			goto exit_1;
+		}
+		jrpcd_node_init(node, fd);
+	}
+	node->cid = cid;
+
+	/* Same registration as before */
+	if ((jrpcd_parser_get_snode(json_obj, node->name,
+				    NODE_NAME_MAX_SZ - 1) < 0) ||
+	    (jrpcd_parser_register_get_group(json_obj, &node->group,
+					     &node->key) < 0) ||
+	    (jrpcd_node_describe(node, json_obj) < 0)) {
+		LOG_ERR("invalid registration of cid %d", cid);
+		return -1;
+	}
+	node->outstanding = jrpcd_parser_handoff_get_int(json_obj,
+							 "outstanding");
+	node->picks = jrpcd_parser_handoff_get_int(json_obj, "picks");
+	node->expired = jrpcd_parser_handoff_get_int(json_obj, "expired");
+	LOG_INFO("took over cid %d %s", cid, node->name);
+	return 0;
+ exit_1:
+	free(node);
+ exit_0:
+	if (fd >= 0) {
+		close(fd);
+	}
+	return -1;
+}
+
+/* Calls of nodes left behind are dropped, calls to them are lost */
+static void jrpcd_takeover_call(void *json_obj)
+{
+	struct jrpcd_pending_call call;
+	uint32_t xid;
+
+	memset(&call, 0, sizeof(call));
+	xid = jrpcd_parser_handoff_get_int(json_obj, "xid");
+	call.caller = jrpcd_parser_handoff_get_int(json_obj, "caller");
+	call.callee = jrpcd_parser_handoff_get_int(json_obj, "callee");
+	call.id = jrpcd_parser_handoff_get_int(json_obj, "id");
+	call.ttl = jrpcd_parser_handoff_get_int(json_obj, "ttl");
+	call.dl = jrpcd_parser_handoff_get_int(json_obj, "dl");
+	call.coalesced = jrpcd_parser_handoff_get_int(json_obj, "coalesced");
+	jrpcd_parser_get_dnode(json_obj, call.dnode,
+			       JRPCD_PENDING_NAME_SZ - 1);
+	jrpcd_parser_call_get_intf(json_obj, call.intf,
+				   JRPCD_PENDING_NAME_SZ - 1);
+	call.chain = jrpcd_parser_handoff_get_str(json_obj, "chain");
+	call.args = jrpcd_parser_handoff_get_str(json_obj, "args");
+
+	if (jrpcd_get_node(call.caller) == NULL) {
+		goto exit_0;
+	}
+	if (jrpcd_get_node(call.callee) == NULL) {
+		jrpcd_call_lost(&call, false);
+		goto exit_0;
+	}
+	if (jrpcd_pending_add(&call, xid) == 0) {
+		jrpcd_call_lost(&call, false);
+		goto exit_0;
+	}
+	return;
+ exit_0:
+	jrpcd_pool_free(call.chain);
+	jrpcd_pool_free(call.args);
+}
+
+/* Takes one record of the previous daemon, see jrpcd_handoff(). done is */
+/* set by the last one. Called with node_lock held. */
+static int8_t jrpcd_takeover_record(uint8_t *buff, int32_t size, int32_t fd,
+				    bool *done)
+{
+	char kind[HANDOFF_KIND_MAX_SZ];
+	void *json_obj = NULL;
+	int32_t len;
+	int8_t ret = -1;
+
+	/* What was read of a node follows the json text and its terminator */
+	len = strnlen((char *)buff, size);
+	if (len == size) {
+		LOG_ERR("%s", "invalid handoff record");
+		goto exit_0;
+	}
+	jrpcd_parser_init(&json_obj, (char *)buff);
+	if ((json_obj == NULL) ||
+	    (jrpcd_parser_handoff_get_kind(json_obj, kind, sizeof(kind)) < 0)) {
+		LOG_ERR("%s", "invalid handoff record");
+		goto exit_1;
+	}
+
+	if ((strcmp(kind, "listen") == 0) && (fd >= 0)) {
+		jrpcd_server_adopt(fd);
+		fd = -1;
+		cid_next = jrpcd_parser_handoff_get_int(json_obj, "cid_next");
+		ret = 0;
+	} else if (strcmp(kind, "node") == 0) {
+		ret = jrpcd_takeover_node(json_obj, fd, buff + len + 1,
+					  size - len - 1);
+		fd = -1;
+	} else if (strcmp(kind, "call") == 0) {
+		jrpcd_takeover_call(json_obj);
+		ret = 0;
+	} else if (strcmp(kind, "done") == 0) {
+		*done = true;
+		ret = 0;
+	} else {
+		LOG_ERR("unexpected handoff record %s", kind);
+	}
+ exit_1:
+	if (json_obj != NULL) {
+		jrpcd_parser_cleanup(json_obj);
+	}
+ exit_0:
+	if (fd >= 0) {
+		close(fd);
+	}
+	return ret;
+}
+
+/* Takes over from the daemon listening on path, see jrpcd_handoff(). */
+/* Returns -1 if there is none, -2 if taking over failed on the way. */
+static int8_t jrpcd_takeover(char *path)
+{
+	struct jrpcd_node_desc *node;
+	uint32_t nodes = 0;
+	uint8_t *buff;
+	int32_t usock;
+	int32_t size;
+	int32_t fd;
+	bool done = false;
+	uint8_t ack = 1;
+
+	usock = jrpcd_server_upgrade_connect(path);
+	if (usock < 0) {
+		return -1;
+	}
+	LOG_INFO("taking over from the jrpcd on %s", path);
+	buff = (uint8_t *) malloc(HANDOFF_MAX_SZ);
+	if (buff == NULL) {
+		LOG_ERR("%s", "malloc failed");
+		goto exit_0;
+	}
+
+	/* Nodes are served once all is in place and the previous daemon */
+	/* has let go */
+	jrpcd_client_pause(0);
+	pthread_mutex_lock(&node_lock);
+	while (!done) {
+		size = jrpcd_server_recv_fd(usock, buff, HANDOFF_MAX_SZ, &fd);
+		if (size <= 0) {
+			LOG_ERR("%s", "previous jrpcd went away");
+			goto exit_1;
+		}
+		if (jrpcd_takeover_record(buff, size, fd, &done) < 0) {
+			goto exit_1;
+		}
+	}
+	if (send(usock, &ack, 1, MSG_NOSIGNAL) != 1) {
+		LOG_ERR("%s", "previous jrpcd went away");
+		goto exit_1;
+	}
+	LIST_FOREACH(node, &node_list, entries) {
+		nodes++;
+	}
+	LOG_INFO("took over %d nodes, %d pending calls", nodes,
+		 jrpcd_pending_count());
+	pthread_mutex_unlock(&node_lock);
+	jrpcd_client_resume();
+
+	free(buff);
+	close(usock);
+	return 0;
+ exit_1:
+	pthread_mutex_unlock(&node_lock);
+	free(buff);
+ exit_0:
+	close(usock);
+	return -2;
 }
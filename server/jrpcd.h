@@ -14,11 +14,29 @@
 #include <stdbool.h>
 
 #define JRPCD_MAX_MSG_SZ		(4 * 1024u)
+#define JRPCD_TX_BUDGET_DEF		(64 * JRPCD_MAX_MSG_SZ)
 
 int8_t jrpcd_main(char *host, uint32_t port);
+void jrpcd_init(uint32_t port);
+void jrpcd_fini(void);
 int8_t jrpcd_new_client(uint32_t csock);
 int8_t jrpcd_process_recv(uint32_t cid, uint8_t *data, uint32_t size);
+void jrpcd_close_client(uint32_t cid);
+void jrpcd_set_tx_budget(uint32_t budget, uint8_t policy);
+void jrpcd_set_hugepages(bool enable);
+void jrpcd_set_arena(bool enable);
+void jrpcd_set_upgrade(char *path);
+int8_t jrpcd_set_peer(char *addr);
+int8_t jrpcd_handoff(int32_t usock);
+void jrpcd_idle(void);
 void jrpcd_exit(void);
 bool jrpcd_exit_pending(void);
 
+/* jrpcd linked into a process as libjrpcd, see jrpcd_embed.c */
+void *jrpcd_embed_attach(void);
+int8_t jrpcd_embed_send(void *link, uint8_t *data, uint32_t size);
+uint32_t jrpcd_embed_recv(void *link, void **data);
+void jrpcd_embed_release(void *data);
+void jrpcd_embed_detach(void *link);
+
 #endif				//JRPCD_H
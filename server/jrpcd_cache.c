@@ -0,0 +1,207 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#include "jrpcd_cache.h"
+#include "jrpcd_pool.h"
+#include "debug.h"
+
+#define CACHE_HASH_SZ			256
+
+/* Structure to hold the return of a call. The args and ret text follow */
+/* the structure in the same buffer. */
+struct jrpcd_cache_entry {
+	char dnode[JRPCD_CACHE_NAME_SZ];	/* Node that returned */
+	char intf[JRPCD_CACHE_NAME_SZ];	/* Interface called */
+	char *args;		/* Arguments of the call as json text */
+	char *ret;		/* Returned value as json text */
+	uint32_t hash;		/* Hash of dnode, intf and args */
+	uint64_t expiry;	/* Time the entry goes stale in ms */
+
+	TAILQ_ENTRY(jrpcd_cache_entry) lru;	/* Most recently used first */
+	LIST_ENTRY(jrpcd_cache_entry) hash_entry;	/* Lookup by key */
+};
+
+static TAILQ_HEAD(lru_head, jrpcd_cache_entry) cache_lru;
+static LIST_HEAD(chash_head, jrpcd_cache_entry) cache_hash[CACHE_HASH_SZ];
+static struct jrpcd_cache_stats cache_stats;
+static uint32_t cache_max;
+
+static uint64_t jrpcd_cache_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* FNV-1a over the parts of the key, each one with its terminator */
+uint32_t jrpcd_cache_key(char *dnode, char *intf, char *args)
+{
+	char *parts[] = { dnode, intf, args };
+	uint32_t hash = 2166136261u;
+	uint8_t i;
+	char *p;
+
+	for (i = 0; i < 3; i++) {
+		p = parts[i];
+		do {
+			hash ^= (uint8_t) *p;
+			hash *= 16777619u;
+		} while (*p++ != '\0');
+	}
+	return hash;
+}
+
+static void jrpcd_cache_remove(struct jrpcd_cache_entry *entry)
+{
+	TAILQ_REMOVE(&cache_lru, entry, lru);
+	LIST_REMOVE(entry, hash_entry);
+	jrpcd_pool_free(entry);
+	cache_stats.entries--;
+}
+
+static struct jrpcd_cache_entry *jrpcd_cache_find(char *dnode, char *intf,
+						 char *args, uint32_t hash)
+{
+	struct jrpcd_cache_entry *entry;
+
+	LIST_FOREACH(entry, &cache_hash[hash % CACHE_HASH_SZ], hash_entry) {
+		if ((entry->hash == hash) &&
+		    (strcmp(entry->dnode, dnode) == 0) &&
+		    (strcmp(entry->intf, intf) == 0) &&
+		    (strcmp(entry->args, args) == 0)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+int8_t jrpcd_cache_init(uint32_t max_entries)
+{
+	uint16_t i;
+
+	LOG_VERBOSE("%s", "jrpcd_cache_init");
+
+	TAILQ_INIT(&cache_lru);
+	for (i = 0; i < CACHE_HASH_SZ; i++) {
+		LIST_INIT(&cache_hash[i]);
+	}
+	memset(&cache_stats, 0, sizeof(cache_stats));
+	cache_max = max_entries;
+
+	return 0;
+}
+
+void jrpcd_cache_cleanup(void)
+{
+	LOG_VERBOSE("%s", "jrpcd_cache_cleanup");
+
+	while (!TAILQ_EMPTY(&cache_lru)) {
+		jrpcd_cache_remove(TAILQ_FIRST(&cache_lru));
+	}
+}
+
+/* Returns the cached ret text of a call or NULL. The text stays valid */
+/* till the next call into the cache. */
+char *jrpcd_cache_get(char *dnode, char *intf, char *args)
+{
+	struct jrpcd_cache_entry *entry;
+
+	entry = jrpcd_cache_find(dnode, intf, args,
+				 jrpcd_cache_key(dnode, intf, args));
+	if ((entry != NULL) && (entry->expiry <= jrpcd_cache_now())) {
+		jrpcd_cache_remove(entry);
+		entry = NULL;
+	}
+	if (entry == NULL) {
+		cache_stats.misses++;
+		return NULL;
+	}
+
+	TAILQ_REMOVE(&cache_lru, entry, lru);
+	TAILQ_INSERT_HEAD(&cache_lru, entry, lru);
+	cache_stats.hits++;
+
+	return entry->ret;
+}
+
+/* Remembers the return of a call for ttl_ms, replacing an older one */
+int8_t jrpcd_cache_put(char *dnode, char *intf, char *args, char *ret,
+		       uint32_t ttl_ms)
+{
+	struct jrpcd_cache_entry *entry;
+	uint32_t hash = jrpcd_cache_key(dnode, intf, args);
+	size_t args_len = strlen(args);
+	size_t ret_len = strlen(ret);
+
+	if ((cache_max == 0) || (strlen(dnode) >= JRPCD_CACHE_NAME_SZ) ||
+	    (strlen(intf) >= JRPCD_CACHE_NAME_SZ)) {
+		goto exit_0;
+	}
+
+	entry = jrpcd_cache_find(dnode, intf, args, hash);
+	if (entry != NULL) {
+		jrpcd_cache_remove(entry);
+	}
+	while (cache_stats.entries >= cache_max) {
+		jrpcd_cache_remove(TAILQ_LAST(&cache_lru, lru_head));
+		cache_stats.evicted++;
+	}
+
+	entry = (struct jrpcd_cache_entry *)
+	    jrpcd_pool_alloc(sizeof(struct jrpcd_cache_entry) + args_len +
+			     ret_len + 2);
+	if (entry == NULL) {
+		LOG_ERR("%s", "pool alloc failed");
+		goto exit_0;
+	}
+	strcpy(entry->dnode, dnode);
+	strcpy(entry->intf, intf);
+	entry->args = (char *)(entry + 1);
+	memcpy(entry->args, args, args_len + 1);
+	entry->ret = entry->args + args_len + 1;
+	memcpy(entry->ret, ret, ret_len + 1);
+	entry->hash = hash;
+	entry->expiry = jrpcd_cache_now() + ttl_ms;
+
+	TAILQ_INSERT_HEAD(&cache_lru, entry, lru);
+	LIST_INSERT_HEAD(&cache_hash[hash % CACHE_HASH_SZ], entry, hash_entry);
+	cache_stats.entries++;
+
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* Node went away or registered again, its returns can't be trusted */
+void jrpcd_cache_purge(char *dnode)
+{
+	struct jrpcd_cache_entry *entry;
+	struct jrpcd_cache_entry *next;
+
+	for (entry = TAILQ_FIRST(&cache_lru); entry != NULL; entry = next) {
+		next = TAILQ_NEXT(entry, lru);
+		if (strcmp(entry->dnode, dnode) == 0) {
+			jrpcd_cache_remove(entry);
+			cache_stats.purged++;
+		}
+	}
+}
+
+void jrpcd_cache_stats(struct jrpcd_cache_stats *stats)
+{
+	*stats = cache_stats;
+}
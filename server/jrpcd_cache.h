@@ -0,0 +1,39 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef JRPCD_CACHE_H
+#define JRPCD_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Returns kept at most, the least recently used one makes room */
+#define JRPCD_CACHE_MAX_ENTRIES		1024
+#define JRPCD_CACHE_NAME_SZ		32
+
+struct jrpcd_cache_stats {
+	uint32_t entries;	/* Returns cached now */
+	uint64_t hits;		/* Calls answered from the cache */
+	uint64_t misses;	/* Calls forwarded to the node */
+	uint64_t evicted;	/* Entries dropped to make room */
+	uint64_t purged;	/* Entries dropped as their node went away */
+};
+
+/* Not thread safe, jrpcd serializes all access under its node lock. */
+/* Entries are keyed by node name, interface and the args of the call. */
+int8_t jrpcd_cache_init(uint32_t max_entries);
+void jrpcd_cache_cleanup(void);
+uint32_t jrpcd_cache_key(char *dnode, char *intf, char *args);
+char *jrpcd_cache_get(char *dnode, char *intf, char *args);
+int8_t jrpcd_cache_put(char *dnode, char *intf, char *args, char *ret,
+		       uint32_t ttl_ms);
+void jrpcd_cache_purge(char *dnode);
+void jrpcd_cache_stats(struct jrpcd_cache_stats *stats);
+
+#endif				//JRPCD_CACHE_H
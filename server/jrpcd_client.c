@@ -12,116 +12,450 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
 #include <pthread.h>
+#include <sys/queue.h>
 #include <netinet/in.h>
 #include <sys/select.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "jrpcd_client.h"
 #include "jrpcd_queue.h"
+#include "jrpcd_pool.h"
 #include "jrpcd.h"
+#include "ejson.h"
 #include "debug.h"
 
 #define RX_BUFF_MAX_SZ			JRPCD_MAX_MSG_SZ
+#define TX_STALL_MS			5000
+#define TX_BATCH_MAX			16
 
 struct th_data {
 	uint32_t cid;
 	uint32_t sock;
 	void *tx_q;
+	uint8_t *buff;		/* Receive buffer, a partial message in front */
+	uint32_t fill;		/* Bytes of the partial message */
+	bool parked;		/* Receive thread is held by a pause */
+
+	LIST_ENTRY(th_data) entries;
 };
 
+/* Receive threads, for jrpcd_client_pause() to hold them all. Paused */
+/* they wait in jrpcd_client_park() with no message half processed. */
+static LIST_HEAD(rx_head, th_data) rx_list = LIST_HEAD_INITIALIZER(rx_list);
+static pthread_mutex_t park_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+static bool paused;
+static uint32_t parked;
+/* Readable while paused, wakes up the receive threads waiting for data */
+static int park_fd[2] = { -1, -1 };
+/* Receive and transmit threads not yet gone, see jrpcd_client_wait() */
+static uint32_t live;
+
+/* Sends without blocking on the socket, so a node that stops reading can only
+ * hold up its own transmit thread, never the receive threads feeding it. All
+ * buffers in iov go out with as few system calls as the socket allows, iov is
+ * used up on the way. */
+int8_t jrpcd_client_send(struct th_data *data, struct iovec *iov, uint16_t cnt)
+{
+	struct msghdr msg;
+	struct pollfd pfd;
+	ssize_t rc;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = cnt;
+
+	while (msg.msg_iovlen > 0) {
+		rc = sendmsg(data->sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rc > 0) {
+			/* Skip what went out, resume a partly sent buffer */
+			while ((msg.msg_iovlen > 0) &&
+			       ((size_t)rc >= msg.msg_iov->iov_len)) {
+				rc -= msg.msg_iov->iov_len;
+				msg.msg_iov++;
+				msg.msg_iovlen--;
+			}
+			if (msg.msg_iovlen > 0) {
+				msg.msg_iov->iov_base =
+				    (uint8_t *) msg.msg_iov->iov_base + rc;
+				msg.msg_iov->iov_len -= rc;
+			}
+			continue;
+		}
+		if ((rc < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) &&
+		    (errno != EINTR)) {
+			LOG_ERR("send failed for cid %d", data->cid);
+			goto exit_0;
+		}
+
+		/* Socket buffer is full, wait for the node to drain it */
+		pfd.fd = data->sock;
+		pfd.events = POLLOUT;
+		rc = poll(&pfd, 1, TX_STALL_MS);
+		if (rc < 0 && errno != EINTR) {
+			LOG_ERR("poll failed for cid %d", data->cid);
+			goto exit_0;
+		}
+		if ((rc == 0) &&
+		    (jrpcd_queue_policy(data->tx_q) == JRPCD_Q_DISCONNECT)) {
+			LOG_ERR("cid %d stalled for %d ms", data->cid,
+				TX_STALL_MS);
+			goto exit_0;
+		}
+	}
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* Hands every complete message in the buffer to jrpcd, a partial message */
+/* at the end is moved to the front to be completed by the next read */
+void jrpcd_client_dispatch(struct th_data *data, uint8_t *buff,
+			   uint32_t *fill)
+{
+	uint32_t pos = 0;
+	uint8_t save;
+	int len;
+
+	while (pos < *fill) {
+		len = ej_frame_len((char *)buff + pos, *fill - pos);
+		if (len == 0) {
+			break;
+		}
+		if (len < 0) {
+			LOG_ERR("cid %d, dropping %d bytes, not json", data->cid,
+				*fill - pos);
+			pos = *fill;
+			break;
+		}
+
+		/* Terminate the message in place for the parser */
+		save = buff[pos + len];
+		buff[pos + len] = '\0';
+		LOG_INFO("Received for cid %d, %d bytes : %s", data->cid, len,
+			 buff + pos);
+		jrpcd_process_recv(data->cid, buff + pos, len);
+		buff[pos + len] = save;
+		pos += len;
+	}
+
+	*fill -= pos;
+	memmove(buff, buff + pos, *fill);
+	if (*fill >= RX_BUFF_MAX_SZ - 1) {
+		LOG_ERR("cid %d, message too large, dropped", data->cid);
+		*fill = 0;
+	}
+}
+
+/* Counts out a thread of a connection, last thing it does with the pool */
+static void jrpcd_client_gone(void)
+{
+	jrpcd_pool_release();
+	pthread_mutex_lock(&park_lock);
+	live--;
+	pthread_cond_broadcast(&park_cond);
+	pthread_mutex_unlock(&park_lock);
+}
+
+/* Transmit thread is gone, by exit or cancel */
+static void jrpcd_client_tx_exit(void *arg)
+{
+	struct th_data *data = (struct th_data *)arg;
+
+	LOG_VERBOSE("Tx thread exited for cid: %d", data->cid);
+	free(data);
+	jrpcd_client_gone();
+}
+
 void *jrpcd_client_transmit_thread(void *arg)
 {
 	struct th_data *data = (struct th_data *)arg;
-	void *buffer = NULL;
+	void *buffer[TX_BATCH_MAX];
+	struct iovec iov[TX_BATCH_MAX];
+	uint16_t cnt;
+	uint16_t i;
+	int8_t rc;
 
 	LOG_VERBOSE("Tx thread created for cid: %d", data->cid);
 
 	/* Setup thread as cancellable */
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+	pthread_cleanup_push(jrpcd_client_tx_exit, data);
 
 	while (0 == jrpcd_exit_pending()) {
 		/* Wait for data to be available in the queue */
 		/* Below call will be blocked until there is some data in */
 		/* in the queue. */
-		uint32_t size = jrpcd_queue_get(data->tx_q, &buffer);
-		if (buffer == NULL) {
+		iov[0].iov_len = jrpcd_queue_get(data->tx_q, &buffer[0]);
+		if (buffer[0] == NULL) {
 			LOG_ERR("Empty item recevied for cid %d", data->cid);
 			continue;
 		}
+		iov[0].iov_base = buffer[0];
+
+		/* Whatever else is queued by now goes out with it, a busy */
+		/* link such as one to a peer daemon sends in batches */
+		for (cnt = 1; cnt < TX_BATCH_MAX; cnt++) {
+			iov[cnt].iov_len =
+			    jrpcd_queue_try_get(data->tx_q, &buffer[cnt]);
+			if (buffer[cnt] == NULL) {
+				break;
+			}
+			iov[cnt].iov_base = buffer[cnt];
+		}
 
-		LOG_VERBOSE("sending %s to cid %d", (char *)buffer, data->cid);
+		LOG_VERBOSE("sending %d messages to cid %d", cnt, data->cid);
 		/* We have adata to send */
-		if (send(data->sock, buffer, size, 0) < 0) {
-			LOG_ERR("%s", "send failed");
-			goto exit_0;
+		rc = jrpcd_client_send(data, iov, cnt);
+
+		/* Free up buffers after sending the data */
+		for (i = 0; i < cnt; i++) {
+			jrpcd_pool_free(buffer[i]);
+		}
+		if (rc < 0) {
+			/* Wake up the receive thread, it will tear down */
+			/* the node */
+			shutdown(data->sock, SHUT_RDWR);
+			break;
 		}
-		/* Free up buffer after sending the data */
-		free(buffer);
 	}
-
- exit_0:
-	LOG_VERBOSE("Tx thread exited for cid: %d", data->cid);
+	pthread_cleanup_pop(1);
 	pthread_exit(NULL);
 }
 
+static void jrpcd_client_unlock(void *arg)
+{
+	pthread_mutex_unlock(&park_lock);
+}
+
+/* Holds the receive thread while paused */
+static void jrpcd_client_park(struct th_data *data)
+{
+	pthread_mutex_lock(&park_lock);
+	pthread_cleanup_push(jrpcd_client_unlock, NULL);
+	if (paused) {
+		data->parked = true;
+		parked++;
+		pthread_cond_broadcast(&park_cond);
+		while (paused) {
+			pthread_cond_wait(&park_cond, &park_lock);
+		}
+	}
+	pthread_cleanup_pop(1);
+}
+
+/* Receive thread is gone, by exit or cancel */
+static void jrpcd_client_rx_exit(void *arg)
+{
+	struct th_data *data = (struct th_data *)arg;
+
+	pthread_mutex_lock(&park_lock);
+	if (data->parked) {
+		parked--;
+	}
+	LIST_REMOVE(data, entries);
+	pthread_cond_broadcast(&park_cond);
+	pthread_mutex_unlock(&park_lock);
+
+	jrpcd_pool_free(data->buff);
+	LOG_VERBOSE("Rx thread exited for cid: %d", data->cid);
+	free(data);
+	jrpcd_client_gone();
+}
+
 void *jrpcd_client_receive_thread(void *arg)
 {
 	struct th_data *data = (struct th_data *)arg;
 	fd_set readfds;
 	int32_t rc;
-	uint32_t recv_bytes;
-	uint8_t *buff;
+	int32_t recv_bytes;
 
 	LOG_VERBOSE("Rx thread created for cid: %d", data->cid);
 
 	/* Setup thread as cancellable */
 	pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
 	pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+	pthread_cleanup_push(jrpcd_client_rx_exit, data);
 
-	/* Allocate memory to receive data */
-	buff = (uint8_t *) malloc(RX_BUFF_MAX_SZ);
-	if (buff == NULL) {
-		LOG_ERR("%s", "malloc failed");
+	/* Allocate memory to receive data, unless it came with what a */
+	/* previous daemon read of the connection */
+	if (data->buff == NULL) {
+		data->buff = (uint8_t *) jrpcd_pool_alloc(RX_BUFF_MAX_SZ);
+	}
+	if (data->buff == NULL) {
+		LOG_ERR("%s", "pool alloc failed");
 		goto exit_0;
 	}
 
 	while (0 == jrpcd_exit_pending()) {
-		/* Wait for data */
+		/* Wait for data, or to be paused */
 		FD_ZERO(&readfds);
 		FD_SET(data->sock, &readfds);
-		rc = select(data->sock + 1, &readfds, NULL, NULL, NULL);
+		FD_SET(park_fd[0], &readfds);
+		rc = select(((int)data->sock > park_fd[0] ? (int)data->sock :
+			     park_fd[0]) + 1, &readfds, NULL, NULL, NULL);
 		if (rc < 0) {
 			goto exit_0;
 		} else if (rc == 0) {
 			continue;
 		}
+		if (FD_ISSET(park_fd[0], &readfds)) {
+			jrpcd_client_park(data);
+			continue;
+		}
 		if ((0 == jrpcd_exit_pending()) &&
 		    FD_ISSET(data->sock, &readfds)) {
 
-			memset(buff, 0, RX_BUFF_MAX_SZ);
-
-			/* Data available. Read now. */
-			recv_bytes = recv(data->sock, buff, RX_BUFF_MAX_SZ, 0);
+			/* Data available. Read now, after any partial */
+			/* message left by the previous read. Leave room */
+			/* for the terminator. */
+			recv_bytes = recv(data->sock, data->buff + data->fill,
+					  RX_BUFF_MAX_SZ - 1 - data->fill, 0);
 			if (recv_bytes > 0) {
-				LOG_INFO("Received for cid %d, %d bytes : %s",
-					  data->cid, recv_bytes, buff);
-				/* Process received data */
-				jrpcd_process_recv(data->cid, buff, recv_bytes);
+				data->fill += recv_bytes;
+				/* Process received data. Not cancellable while */
+				/* it may hold the node lock. */
+				pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,
+						       NULL);
+				jrpcd_client_dispatch(data, data->buff,
+						      &data->fill);
+				pthread_setcancelstate(PTHREAD_CANCEL_ENABLE,
+						       NULL);
 			} else {
 				LOG_ERR("CID : %d, Socket closed", data->cid);
+				/* !!! Below call will not return !!! */
+				pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,
+						       NULL);
+				jrpcd_close_client(data->cid);
 				goto exit_0;
 			}
 		}
 	}
  exit_0:
-	LOG_VERBOSE("Rx thread exited for cid: %d", data->cid);
+	pthread_cleanup_pop(1);
 	pthread_exit(NULL);
 }
 
+int8_t jrpcd_client_init(void)
+{
+	if ((park_fd[0] < 0) && (pipe(park_fd) < 0)) {
+		LOG_ERR("%s", "cannot create pipe");
+		return -1;
+	}
+	return 0;
+}
+
+/* Holds all receive threads with no message half processed, including */
+/* ones created while paused. Fails if they are not all held within */
+/* tmo_ms. Not to be called with the node lock held, the threads may */
+/* need it to finish what they are processing. */
+int8_t jrpcd_client_pause(uint32_t tmo_ms)
+{
+	struct th_data *data;
+	struct timespec ts;
+	uint32_t num;
+	uint8_t byte = 0;
+	int8_t ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += tmo_ms / 1000;
+	ts.tv_nsec += (tmo_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&park_lock);
+	if (!paused) {
+		paused = true;
+		if (write(park_fd[1], &byte, 1) != 1) {
+			LOG_ERR("%s", "cannot wake up receive threads");
+		}
+	}
+	while (ret == 0) {
+		num = 0;
+		LIST_FOREACH(data, &rx_list, entries) {
+			num++;
+		}
+		if (parked == num) {
+			break;
+		}
+		if (pthread_cond_timedwait(&park_cond, &park_lock, &ts) ==
+		    ETIMEDOUT) {
+			LOG_ERR("%d of %d receive threads paused", parked, num);
+			ret = -1;
+		}
+	}
+	pthread_mutex_unlock(&park_lock);
+
+	if (ret < 0) {
+		jrpcd_client_resume();
+	}
+	return ret;
+}
+
+void jrpcd_client_resume(void)
+{
+	struct th_data *data;
+	uint8_t byte;
+
+	pthread_mutex_lock(&park_lock);
+	if (paused) {
+		paused = false;
+		if (read(park_fd[0], &byte, 1) != 1) {
+			LOG_ERR("%s", "cannot read pipe");
+		}
+		LIST_FOREACH(data, &rx_list, entries) {
+			data->parked = false;
+		}
+		parked = 0;
+		pthread_cond_broadcast(&park_cond);
+	}
+	pthread_mutex_unlock(&park_lock);
+}
+
+/* Copies the partial message the paused receive thread of cid has read */
+/* to data. Returns its size, -1 if the thread is not paused. */
+int32_t jrpcd_client_leftover(uint32_t cid, uint8_t *data, uint32_t size)
+{
+	struct th_data *rx;
+	int32_t ret = -1;
+
+	pthread_mutex_lock(&park_lock);
+	LIST_FOREACH(rx, &rx_list, entries) {
+		if ((rx->cid == cid) && rx->parked && (rx->fill <= size)) {
+			memcpy(data, rx->buff, rx->fill);
+			ret = rx->fill;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&park_lock);
+	return ret;
+}
+
+/* Waits for the threads of all connections to be gone, once they are */
+/* cancelled. Not to be called with the node lock held, a receive thread */
+/* may need it to finish what it is processing. */
+void jrpcd_client_wait(void)
+{
+	pthread_mutex_lock(&park_lock);
+	while (live > 0) {
+		pthread_cond_wait(&park_cond, &park_lock);
+	}
+	pthread_mutex_unlock(&park_lock);
+}
+
+/* Starts the threads of a connection. left is a partial message read of */
+/* it by a previous daemon, NULL if none. */
 int8_t jrpcd_client_create(uint32_t csock, uint32_t cid, pthread_t * tid,
-			   pthread_t * rid, void *tx_q)
+			   pthread_t * rid, void *tx_q, uint8_t *left,
+			   uint32_t left_size)
 {
 	struct th_data *tx_data;
 	struct th_data *rx_data;
@@ -155,26 +489,58 @@ int8_t jrpcd_client_create(uint32_t csock, uint32_t cid, pthread_t * tid,
 	tx_data->sock = csock;
 	tx_data->tx_q = tx_q;
 
+	/* Counted before it runs, it counts itself out on its way out */
+	pthread_mutex_lock(&park_lock);
+	live++;
+	pthread_mutex_unlock(&park_lock);
 	if (pthread_create
 	    (tid, &tx_attr, jrpcd_client_transmit_thread,
-	     (void *)tx_data) < 0) {
+	     (void *)tx_data) != 0) {
 		LOG_ERR("%s", "pthread_create failed");
 		goto exit_2;
 	}
 
 	rx_data->cid = cid;
 	rx_data->sock = csock;
+	rx_data->buff = NULL;
+	rx_data->fill = 0;
+	rx_data->parked = false;
+	if (left_size > 0) {
+		rx_data->buff = (uint8_t *) jrpcd_pool_alloc(RX_BUFF_MAX_SZ);
+		if ((rx_data->buff == NULL) || (left_size >= RX_BUFF_MAX_SZ)) {
+			LOG_ERR("cannot take %d bytes read for cid %d",
+				left_size, cid);
+			goto exit_3;
+		}
+		memcpy(rx_data->buff, left, left_size);
+		rx_data->fill = left_size;
+	}
 
+	/* Listed before it runs, a pause holds it from its first wait */
+	pthread_mutex_lock(&park_lock);
+	LIST_INSERT_HEAD(&rx_list, rx_data, entries);
+	live++;
 	if (pthread_create
-	    (rid, &rx_attr, jrpcd_client_receive_thread, (void *)rx_data) < 0) {
+	    (rid, &rx_attr, jrpcd_client_receive_thread, (void *)rx_data) != 0) {
+		LIST_REMOVE(rx_data, entries);
+		live--;
+		pthread_mutex_unlock(&park_lock);
 		LOG_ERR("%s", "pthread_create failed");
 		goto exit_3;
 	}
+	pthread_mutex_unlock(&park_lock);
 
 	return 0;
  exit_3:
+	jrpcd_pool_free(rx_data->buff);
+	free(rx_data);
+	/* Transmit thread frees its data on the way out */
 	pthread_cancel(*tid);
+	return -1;
  exit_2:
+	pthread_mutex_lock(&park_lock);
+	live--;
+	pthread_mutex_unlock(&park_lock);
 	free(rx_data);
  exit_1:
 	free(tx_data);
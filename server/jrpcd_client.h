@@ -13,7 +13,13 @@
 #include <stdint.h>
 #include <pthread.h>
 
+int8_t jrpcd_client_init(void);
 int8_t jrpcd_client_create(uint32_t csock, uint32_t cid, pthread_t * tid,
-			   pthread_t * rid, void *tx_q);
+			   pthread_t * rid, void *tx_q, uint8_t *left,
+			   uint32_t left_size);
+int8_t jrpcd_client_pause(uint32_t tmo_ms);
+void jrpcd_client_resume(void);
+int32_t jrpcd_client_leftover(uint32_t cid, uint8_t *data, uint32_t size);
+void jrpcd_client_wait(void);
 
 #endif				//JRPCD_CLIENT_H
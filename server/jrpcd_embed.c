@@ -0,0 +1,91 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "jrpcd_embed.h"
+#include "jrpcd_server.h"
+#include "jrpcd.h"
+#include "debug.h"
+
+static pthread_t server_tid;
+static bool serving;
+
+static void *jrpcd_embed_server_thread(void *arg)
+{
+	jrpcd_idle();
+	jrpcd_server_loop();
+	return NULL;
+}
+
+int8_t jrpcd_embed_start(char *host, uint32_t port)
+{
+	LOG_VERBOSE("%s", "jrpcd_embed_start");
+
+	jrpcd_init(port);
+	if (port == 0) {
+		return 0;
+	}
+
+	/* Sockets are served by a thread of their own, as by jrpcd_main */
+	if (jrpcd_server_init(host, port) < 0) {
+		goto exit_0;
+	}
+	if (pthread_create(&server_tid, NULL, jrpcd_embed_server_thread,
+			   NULL) != 0) {
+		LOG_ERR("%s", "pthread_create failed");
+		jrpcd_server_cleanup();
+		goto exit_0;
+	}
+	serving = true;
+	return 0;
+ exit_0:
+	jrpcd_fini();
+	return -1;
+}
+
+/* Components should have exited, their links are torn down */
+void jrpcd_embed_stop(void)
+{
+	LOG_VERBOSE("%s", "jrpcd_embed_stop");
+
+	jrpcd_exit();
+	if (serving) {
+		/* Server loop notices on its next idle wake up */
+		pthread_join(server_tid, NULL);
+		serving = false;
+	}
+	jrpcd_fini();
+}
+
+static int jrpcd_transport_send(void *link, char *msg, int len)
+{
+	return jrpcd_embed_send(link, (uint8_t *) msg, len);
+}
+
+static int jrpcd_transport_recv(void *link, char **msg)
+{
+	return jrpcd_embed_recv(link, (void **)msg);
+}
+
+static void jrpcd_transport_release(char *msg)
+{
+	jrpcd_embed_release(msg);
+}
+
+const struct jrpc_transport jrpcd_transport = {
+	.attach = jrpcd_embed_attach,
+	.send = jrpcd_transport_send,
+	.recv = jrpcd_transport_recv,
+	.release = jrpcd_transport_release,
+	.detach = jrpcd_embed_detach,
+};
@@ -0,0 +1,33 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef JRPCD_EMBED_H
+#define JRPCD_EMBED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "jrpc.h"
+
+/* jrpcd linked into a process as libjrpcd. Components of the process */
+/* attach with jrpc_init_embedded(&jrpcd_transport), their messages go */
+/* through queues in memory. With a port other processes may connect as */
+/* they would to jrpcd, port 0 keeps jrpcd to the process. */
+int8_t jrpcd_embed_start(char *host, uint32_t port);
+void jrpcd_embed_stop(void);
+
+/* Before jrpcd_embed_start(), true carves the json of each message from */
+/* a per thread arena. Off by default: it replaces the jansson allocator */
+/* of the whole process, so only for a host that creates no json of its */
+/* own before the call and does not hook the allocator itself. */
+void jrpcd_set_arena(bool enable);
+
+extern const struct jrpc_transport jrpcd_transport;
+
+#endif				//JRPCD_EMBED_H
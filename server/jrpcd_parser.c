@@ -14,18 +14,41 @@
 #include <jansson.h>
 
 #include "jrpcd_parser.h"
+#include "jrpcd_pool.h"
+#include "ejson.h"
 #include "debug.h"
 
+void jrpcd_parser_setup(bool arena)
+{
+	/* Json objects of a message are carved from a per thread arena */
+	ej_arena_init(arena);
+}
+
+void jrpcd_parser_dump(void)
+{
+	struct ej_alloc_stats stats;
+
+	ej_alloc_stats(&stats);
+	LOG_VERBOSE("Json allocs : %lu heap, %lu arena, %lu arena chunks",
+		    stats.heap, stats.arena, stats.chunks);
+}
+
 void jrpcd_parser_init(void **root, char *data)
 {
+	/* Arena scope lasts till jrpcd_parser_cleanup() */
+	ej_arena_begin();
 	*root = NULL;
 	*root = (void *)json_loads(data, 0, NULL);
+	if (*root == NULL) {
+		ej_arena_end();
+	}
 }
 
 void jrpcd_parser_cleanup(void *obj)
 {
 	json_t *root = (json_t *) obj;
 	json_decref(root);
+	ej_arena_end();
 	return;
 }
 
@@ -67,6 +90,18 @@ int8_t jrpcd_parser_get_api(void *obj, uint8_t * api_type)
 				*api_type = JRPCD_API_RETURN;
 			} else if (strcmp("exit", api_str) == 0) {
 				*api_type = JRPCD_API_EXIT;
+			} else if (strcmp("mcall", api_str) == 0) {
+				*api_type = JRPCD_API_MCALL;
+			} else if (strcmp("notify", api_str) == 0) {
+				*api_type = JRPCD_API_NOTIFY;
+			} else if (strcmp("subscribe", api_str) == 0) {
+				*api_type = JRPCD_API_SUBSCRIBE;
+			} else if (strcmp("unsubscribe", api_str) == 0) {
+				*api_type = JRPCD_API_UNSUBSCRIBE;
+			} else if (strcmp("publish", api_str) == 0) {
+				*api_type = JRPCD_API_PUBLISH;
+			} else if (strcmp("peer", api_str) == 0) {
+				*api_type = JRPCD_API_PEER;
 			} else {
 				LOG_ERR("Unknown API : %s", api_str);
 				goto exit_0;
@@ -155,6 +190,168 @@ int8_t jrpcd_parser_get_dnode(void *obj, char *dnode, uint16_t size)
 
 }
 
+/* xid is optional, it is only present on calls forwarded by jrpcd */
+int8_t jrpcd_parser_get_xid(void *obj, uint32_t * xid)
+{
+	json_t *root = (json_t *) obj;
+	json_t *node;
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		goto exit_0;
+	}
+
+	node = json_object_get(root, "xid");
+	if ((node == NULL) || !json_is_integer(node)) {
+		goto exit_0;
+	}
+	*xid = (uint32_t) json_integer_value(node);
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* Calls forwarded over a peer link carry the xid of the peer as pxid */
+int8_t jrpcd_parser_get_pxid(void *obj, uint32_t * pxid)
+{
+	json_t *root = (json_t *) obj;
+	json_t *node;
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		goto exit_0;
+	}
+
+	node = json_object_get(root, "pxid");
+	if ((node == NULL) || !json_is_integer(node)) {
+		goto exit_0;
+	}
+	*pxid = (uint32_t) json_integer_value(node);
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* id is optional, callers that match returns to calls set it */
+int8_t jrpcd_parser_get_id(void *obj, uint32_t * id)
+{
+	json_t *root = (json_t *) obj;
+	json_t *node;
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		goto exit_0;
+	}
+
+	node = json_object_get(root, "id");
+	if ((node == NULL) || !json_is_integer(node)) {
+		goto exit_0;
+	}
+	*id = (uint32_t) json_integer_value(node);
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* Deadline of a call in ms on the monotonic clock, optional */
+int8_t jrpcd_parser_get_dl(void *obj, uint64_t * dl)
+{
+	json_t *root = (json_t *) obj;
+	json_t *node;
+
+	*dl = 0;
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		goto exit_0;
+	}
+
+	node = json_object_get(root, "dl");
+	if ((node == NULL) || !json_is_integer(node) ||
+	    (json_integer_value(node) <= 0)) {
+		goto exit_0;
+	}
+	*dl = (uint64_t) json_integer_value(node);
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* Clocks of peer daemons differ, a deadline crosses a peer link as the */
+/* ms left till it, tmo */
+int8_t jrpcd_parser_get_tmo(void *obj, uint64_t * tmo)
+{
+	json_t *root = (json_t *) obj;
+	json_t *node;
+
+	*tmo = 0;
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		goto exit_0;
+	}
+
+	node = json_object_get(root, "tmo");
+	if ((node == NULL) || !json_is_integer(node) ||
+	    (json_integer_value(node) <= 0)) {
+		goto exit_0;
+	}
+	*tmo = (uint64_t) json_integer_value(node);
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* group is optional, without it the node owns its name alone */
+int8_t jrpcd_parser_register_get_group(void *obj, uint8_t * group,
+				       uint16_t * key)
+{
+	json_t *root = (json_t *) obj;
+	json_t *node;
+	const char *group_str;
+
+	*group = JRPCD_GROUP_NONE;
+	*key = 0;
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		goto exit_0;
+	}
+
+	node = json_object_get(root, "group");
+	if (node == NULL) {
+		return 0;
+	} else if (!json_is_string(node)) {
+		LOG_ERR("%s", "group is not string");
+		goto exit_0;
+	}
+
+	group_str = json_string_value(node);
+	if (strcmp("rr", group_str) == 0) {
+		*group = JRPCD_GROUP_RR;
+	} else if (strcmp("loc", group_str) == 0) {
+		*group = JRPCD_GROUP_LOC;
+	} else if (strcmp("hash", group_str) == 0) {
+		*group = JRPCD_GROUP_HASH;
+	} else {
+		LOG_ERR("Unknown group : %s", group_str);
+		goto exit_0;
+	}
+
+	/* Index of the call argument used as hash key */
+	node = json_object_get(root, "key");
+	if (node != NULL) {
+		if (!json_is_integer(node)) {
+			LOG_ERR("%s", "key is not integer");
+			goto exit_0;
+		}
+		*key = (uint16_t) json_integer_value(node);
+	}
+	return 0;
+ exit_0:
+	return -1;
+}
+
 int8_t jrpcd_parser_register_get_num_intf(void *obj, uint16_t * num_intf)
 {
 	json_t *root = (json_t *) obj;
@@ -225,6 +422,112 @@ void *jrpcd_parser_register_get_intf(void *obj, uint16_t index)
 	return NULL;
 }
 
+/* Item index of the array of strings key, -1 without logging once index */
+/* is past the last one */
+static int8_t jrpcd_parser_get_str_item(void *obj, const char *key,
+					uint16_t index, char *str,
+					uint16_t size)
+{
+	json_t *root = (json_t *) obj;
+	json_t *array;
+	json_t *item;
+	const char *item_str;
+
+	if (root == NULL) {
+		LOG_ERR("%s",
+			"Json root is null, did you call jrpcd_parser_init()?");
+		goto exit_0;
+	}
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		goto exit_0;
+	}
+
+	array = json_object_get(root, key);
+	if ((array == NULL) || !json_is_array(array)) {
+		goto exit_0;
+	}
+	item = json_array_get(array, index);
+	if (item == NULL) {
+		goto exit_0;
+	}
+	item_str = json_string_value(item);
+	if ((item_str == NULL) || (strlen(item_str) >= size)) {
+		LOG_ERR("invalid item in %s", key);
+		goto exit_0;
+	}
+	strcpy(str, item_str);
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* Topics are optional */
+int8_t jrpcd_parser_register_get_topic(void *obj, uint16_t index,
+				       char *topic, uint16_t size)
+{
+	return jrpcd_parser_get_str_item(obj, "topics", index, topic, size);
+}
+
+/* direct is optional, it is where the node takes calls bypassing jrpcd */
+int8_t jrpcd_parser_register_get_direct(void *obj, char *direct, uint16_t size)
+{
+	json_t *root = (json_t *) obj;
+	json_t *node;
+	const char *direct_str;
+
+	direct[0] = '\0';
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		goto exit_0;
+	}
+
+	node = json_object_get(root, "direct");
+	if (node == NULL) {
+		return 0;
+	}
+	direct_str = json_string_value(node);
+	if ((direct_str == NULL) || (strlen(direct_str) >= size)) {
+		LOG_ERR("%s", "invalid direct endpoint");
+		goto exit_0;
+	}
+	strcpy(direct, direct_str);
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* A registration a client sends again after it reconnected, optional */
+int8_t jrpcd_parser_register_get_replay(void *obj, bool * replay)
+{
+	json_t *root = (json_t *) obj;
+	json_t *node;
+
+	*replay = false;
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		goto exit_0;
+	}
+
+	node = json_object_get(root, "replay");
+	if ((node != NULL) && json_is_integer(node)) {
+		*replay = (json_integer_value(node) != 0);
+	}
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* Node names advertised by a peer daemon */
+int8_t jrpcd_parser_peer_get_node(void *obj, uint16_t index, char *name,
+				  uint16_t size)
+{
+	return jrpcd_parser_get_str_item(obj, "nodes", index, name, size);
+}
+
 int8_t jrpcd_parser_register_intf_get_name(void *vintf, char *name,
 					   uint16_t size)
 {
@@ -339,6 +642,32 @@ int8_t jrpcd_parser_register_intf_get_ret(void *vintf, char *ret,
 	return -1;
 }
 
+/* Time the returns of the interface may be cached, 0 when not cacheable */
+int8_t jrpcd_parser_register_intf_get_ttl(void *vintf, uint32_t * ttl)
+{
+	json_t *intf = (json_t *) vintf;
+	json_t *node;
+
+	*ttl = 0;
+
+	if (!json_is_object(intf)) {
+		LOG_ERR("%s", "Interface pointer is not object");
+		goto exit_0;
+	}
+
+	node = json_object_get(intf, "ttl");
+	if (node == NULL) {
+		return 0;
+	} else if (!json_is_integer(node) || (json_integer_value(node) < 0)) {
+		LOG_ERR("%s", "ttl is not a positive integer");
+		goto exit_0;
+	}
+	*ttl = (uint32_t) json_integer_value(node);
+	return 0;
+ exit_0:
+	return -1;
+}
+
 int8_t jrpcd_parser_call_get_intf(void *obj, char *intf, uint16_t size)
 {
 	json_t *root = (json_t *) obj;
@@ -376,3 +705,425 @@ int8_t jrpcd_parser_call_get_intf(void *obj, char *intf, uint16_t size)
  exit_0:
 	return -1;
 }
+
+/* Renders the value of a call argument as text */
+int8_t jrpcd_parser_call_get_arg(void *obj, uint16_t index, char *val,
+				 uint16_t size)
+{
+	json_t *root = (json_t *) obj;
+	json_t *args;
+	json_t *arg;
+	json_t *node;
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		goto exit_0;
+	}
+
+	args = json_object_get(root, "args");
+	if ((args == NULL) && (index == 0)) {
+		/* A return feeding a chained call is its only argument */
+		arg = json_object_get(root, "ret");
+	} else if ((args == NULL) || !json_is_array(args)) {
+		LOG_ERR("%s", "args not found in the JSON");
+		goto exit_0;
+	} else {
+		arg = json_array_get(args, index);
+	}
+	if ((arg == NULL) || !json_is_object(arg)) {
+		LOG_ERR("%s", "index out of bounds");
+		goto exit_0;
+	}
+
+	node = json_object_get(arg, "val");
+	if (json_is_string(node)) {
+		strncpy(val, json_string_value(node), size);
+	} else if (json_is_integer(node)) {
+		snprintf(val, size, "%lld",
+			 (long long)json_integer_value(node));
+	} else {
+		LOG_ERR("%s", "val is not string or integer");
+		goto exit_0;
+	}
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* Copies json text into a pool buffer that outlives the message */
+static char *jrpcd_parser_dump_pool(json_t * obj)
+{
+	char text[BUFF_SIZE];
+	char *buffer = NULL;
+	size_t len;
+
+	text[BUFF_SIZE - 1] = '\0';
+	if ((ej_store_buf(obj, text, BUFF_SIZE) < 0) ||
+	    (text[BUFF_SIZE - 1] != '\0')) {
+		LOG_ERR("%s", "json dump failed");
+		goto exit_0;
+	}
+	len = strlen(text);
+	buffer = (char *)jrpcd_pool_alloc(len + 1);
+	if (buffer == NULL) {
+		LOG_ERR("%s", "pool alloc failed");
+		goto exit_0;
+	}
+	memcpy(buffer, text, len + 1);
+ exit_0:
+	return buffer;
+}
+
+/* Steps to run after the call, a pool buffer or NULL if there are none */
+int8_t jrpcd_parser_chain_get(void *obj, char **chain)
+{
+	json_t *root = (json_t *) obj;
+	json_t *steps;
+
+	*chain = NULL;
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		goto exit_0;
+	}
+
+	steps = json_object_get(root, "chain");
+	if (steps == NULL) {
+		return 0;
+	} else if (!json_is_array(steps)) {
+		LOG_ERR("%s", "chain is not array");
+		goto exit_0;
+	} else if (json_array_size(steps) == 0) {
+		return 0;
+	}
+
+	*chain = jrpcd_parser_dump_pool(steps);
+	if (*chain == NULL) {
+		goto exit_0;
+	}
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* Takes the next step off a chain, the steps after it go to rest */
+int8_t jrpcd_parser_chain_step(char *chain, char *dnode, uint16_t dsize,
+			       char *intf, uint16_t isize, char **rest)
+{
+	json_t *steps;
+	json_t *step;
+	const char *dnode_str;
+	const char *intf_str;
+	int8_t ret = -1;
+
+	*rest = NULL;
+
+	steps = json_loads(chain, 0, NULL);
+	if (!json_is_array(steps) || (json_array_size(steps) == 0)) {
+		LOG_ERR("%s", "chain is not array");
+		goto exit_0;
+	}
+
+	step = json_array_get(steps, 0);
+	dnode_str = json_string_value(json_object_get(step, "dnode"));
+	intf_str = json_string_value(json_object_get(step, "if"));
+	if ((dnode_str == NULL) || (intf_str == NULL)) {
+		LOG_ERR("%s", "chain step needs dnode and if");
+		goto exit_0;
+	}
+	strncpy(dnode, dnode_str, dsize);
+	strncpy(intf, intf_str, isize);
+
+	json_array_remove(steps, 0);
+	if (json_array_size(steps) > 0) {
+		*rest = jrpcd_parser_dump_pool(steps);
+		if (*rest == NULL) {
+			goto exit_0;
+		}
+	}
+	ret = 0;
+ exit_0:
+	json_decref(steps);
+	return ret;
+}
+
+/* Builds the call of a chain step, the value returned by the previous */
+/* step is its argument. Returns a pool buffer, NULL if the step failed. */
+/* The deadline of the chain, if any, goes with every step. */
+uint8_t *jrpcd_parser_chain_call(void *obj, char *snode, char *dnode,
+				 char *intf, uint64_t dl, uint32_t * size)
+{
+	json_t *root = (json_t *) obj;
+	json_t *ret;
+	json_t *type;
+	json_t *call;
+	json_t *args;
+	char *buffer = NULL;
+
+	ret = json_object_get(root, "ret");
+	type = json_object_get(ret, "type");
+	if (!json_is_string(type) || (json_string_value(type)[0] != '%')) {
+		LOG_INFO("%s", "chain step failed");
+		goto exit_0;
+	}
+
+	call = json_object();
+	args = json_array();
+	json_object_set_new(call, "api", json_string("call"));
+	json_object_set_new(call, "snode", json_string(snode));
+	json_object_set_new(call, "dnode", json_string(dnode));
+	json_object_set_new(call, "if", json_string(intf));
+	if (dl != 0) {
+		json_object_set_new(call, "dl", json_integer(dl));
+	}
+	json_array_append(args, ret);
+	json_object_set_new(call, "args", args);
+
+	buffer = jrpcd_parser_dump_pool(call);
+	json_decref(call);
+	if (buffer != NULL) {
+		*size = strlen(buffer);
+	}
+ exit_0:
+	return (uint8_t *) buffer;
+}
+
+/* Tells a peer daemon which nodes are served here */
+uint8_t *jrpcd_parser_peer_hello(char *snode, char **names, uint16_t num,
+				 uint32_t * size)
+{
+	json_t *hello;
+	json_t *nodes;
+	char *buffer;
+	uint16_t i;
+
+	hello = json_object();
+	nodes = json_array();
+	json_object_set_new(hello, "api", json_string("peer"));
+	json_object_set_new(hello, "snode", json_string(snode));
+	for (i = 0; i < num; i++) {
+		json_array_append_new(nodes, json_string(names[i]));
+	}
+	json_object_set_new(hello, "nodes", nodes);
+
+	buffer = jrpcd_parser_dump_pool(hello);
+	json_decref(hello);
+	if (buffer != NULL) {
+		*size = strlen(buffer);
+	}
+	return (uint8_t *) buffer;
+}
+
+/* Re-encodes a call or notify crossing a peer link. The exchange id is */
+/* set as xkey unless it is NULL, the deadline is replaced by dkey unless */
+/* dval is 0. */
+uint8_t *jrpcd_parser_restamp(void *obj, char *xkey, uint32_t xid,
+			      char *dkey, uint64_t dval, uint32_t * size)
+{
+	json_t *root = (json_t *) obj;
+	char *buffer;
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		return NULL;
+	}
+
+	if (xkey != NULL) {
+		json_object_set_new(root, xkey, json_integer(xid));
+	}
+	json_object_del(root, "dl");
+	json_object_del(root, "tmo");
+	if (dval != 0) {
+		json_object_set_new(root, dkey, json_integer(dval));
+	}
+
+	buffer = jrpcd_parser_dump_pool(root);
+	if (buffer != NULL) {
+		*size = strlen(buffer);
+	}
+	return (uint8_t *) buffer;
+}
+
+/* Arguments of a call as json text in a pool buffer, the cache key */
+char *jrpcd_parser_call_get_args(void *obj)
+{
+	json_t *root = (json_t *) obj;
+	json_t *args;
+	char *buffer;
+
+	if (!json_is_object(root)) {
+		LOG_ERR("%s", "Json root is not object");
+		return NULL;
+	}
+
+	args = json_object_get(root, "args");
+	if (args == NULL) {
+		/* No arguments at all is the same as an empty list */
+		args = json_array();
+		buffer = jrpcd_parser_dump_pool(args);
+		json_decref(args);
+		return buffer;
+	}
+	return jrpcd_parser_dump_pool(args);
+}
+
+/* Value returned by a successful call as json text in a pool buffer */
+char *jrpcd_parser_return_get_ret(void *obj)
+{
+	json_t *root = (json_t *) obj;
+	json_t *ret;
+	json_t *type;
+
+	ret = json_object_get(root, "ret");
+	type = json_object_get(ret, "type");
+	if (!json_is_string(type) || (json_string_value(type)[0] != '%')) {
+		return NULL;
+	}
+	return jrpcd_parser_dump_pool(ret);
+}
+
+/* Builds a return of jrpcd with a string value, as a pool buffer */
+uint8_t *jrpcd_parser_return_str(char *snode, char *dnode, char *intf,
+				 uint32_t id, char *val, uint32_t * size)
+{
+	json_t *msg;
+	json_t *ret;
+	char *buffer;
+
+	msg = json_object();
+	ret = json_object();
+	json_object_set_new(msg, "api", json_string("return"));
+	json_object_set_new(msg, "snode", json_string(snode));
+	json_object_set_new(msg, "dnode", json_string(dnode));
+	json_object_set_new(msg, "if", json_string(intf));
+	json_object_set_new(msg, "id", json_integer(id));
+	json_object_set_new(ret, "type", json_string("%s"));
+	json_object_set_new(ret, "val", json_string(val));
+	json_object_set_new(msg, "ret", ret);
+
+	buffer = jrpcd_parser_dump_pool(msg);
+	json_decref(msg);
+	if (buffer != NULL) {
+		*size = strlen(buffer);
+	}
+	return (uint8_t *) buffer;
+}
+
+/* Starts a record a running jrpcd hands its successor, kind tells what */
+/* it holds. Filled by the setters below, then written by */
+/* jrpcd_parser_handoff_dump(). A node record reads as its registration, */
+/* interfaces are listed even if there are none. */
+void *jrpcd_parser_handoff_new(char *kind)
+{
+	json_t *rec;
+
+	rec = json_object();
+	json_object_set_new(rec, "handoff", json_string(kind));
+	if (strcmp(kind, "node") == 0) {
+		json_object_set_new(rec, "interfaces", json_array());
+	}
+	return (void *)rec;
+}
+
+void jrpcd_parser_handoff_set_int(void *obj, char *key, uint64_t val)
+{
+	json_object_set_new((json_t *) obj, key, json_integer(val));
+}
+
+void jrpcd_parser_handoff_set_str(void *obj, char *key, char *val)
+{
+	json_object_set_new((json_t *) obj, key, json_string(val));
+}
+
+/* Interfaces and topics of a node go as in its registration */
+void jrpcd_parser_handoff_add_intf(void *obj, char *name, char *arg,
+				   char *ret, uint32_t ttl)
+{
+	json_t *rec = (json_t *) obj;
+	json_t *intfs;
+	json_t *intf;
+
+	intfs = json_object_get(rec, "interfaces");
+	intf = json_object();
+	json_object_set_new(intf, "if", json_string(name));
+	json_object_set_new(intf, "arg", json_string(arg));
+	json_object_set_new(intf, "ret", json_string(ret));
+	json_object_set_new(intf, "ttl", json_integer(ttl));
+	json_array_append_new(intfs, intf);
+}
+
+void jrpcd_parser_handoff_add_topic(void *obj, char *topic)
+{
+	json_t *rec = (json_t *) obj;
+	json_t *topics;
+
+	topics = json_object_get(rec, "topics");
+	if (topics == NULL) {
+		topics = json_array();
+		json_object_set_new(rec, "topics", topics);
+	}
+	json_array_append_new(topics, json_string(topic));
+}
+
+/* Writes the record to text and frees it. Returns its length with the */
+/* terminator, -1 if it does not fit. */
+int32_t jrpcd_parser_handoff_dump(void *obj, char *text, uint32_t size)
+{
+	json_t *rec = (json_t *) obj;
+	int32_t len = -1;
+
+	text[size - 1] = '\0';
+	if ((ej_store_buf(rec, text, size) < 0) || (text[size - 1] != '\0')) {
+		LOG_ERR("%s", "json dump failed");
+		goto exit_0;
+	}
+	len = strlen(text) + 1;
+ exit_0:
+	json_decref(rec);
+	return len;
+}
+
+int8_t jrpcd_parser_handoff_get_kind(void *obj, char *kind, uint16_t size)
+{
+	const char *kind_str;
+
+	kind_str = json_string_value(json_object_get((json_t *) obj,
+						     "handoff"));
+	if ((kind_str == NULL) || (strlen(kind_str) >= size)) {
+		LOG_ERR("%s", "not a handoff record");
+		return -1;
+	}
+	strcpy(kind, kind_str);
+	return 0;
+}
+
+/* Integers of a record are 0 if missing */
+uint64_t jrpcd_parser_handoff_get_int(void *obj, char *key)
+{
+	json_t *node;
+
+	node = json_object_get((json_t *) obj, key);
+	if ((node == NULL) || !json_is_integer(node)) {
+		return 0;
+	}
+	return (uint64_t) json_integer_value(node);
+}
+
+/* String key of a record as a pool buffer, NULL if it is missing */
+char *jrpcd_parser_handoff_get_str(void *obj, char *key)
+{
+	const char *str;
+	char *buffer;
+
+	str = json_string_value(json_object_get((json_t *) obj, key));
+	if (str == NULL) {
+		return NULL;
+	}
+	buffer = (char *)jrpcd_pool_alloc(strlen(str) + 1);
+	if (buffer == NULL) {
+		LOG_ERR("%s", "pool alloc failed");
+		return NULL;
+	}
+	strcpy(buffer, str);
+	return buffer;
+}
@@ -11,25 +11,79 @@
 #define JRPCD_PARSER_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #define JRPCD_API_REGISTER		0x0
 #define JRPCD_API_CALL			0x1
 #define JRPCD_API_RETURN		0x2
 #define JRPCD_API_EXIT			0x3
+#define JRPCD_API_MCALL			0x4
+#define JRPCD_API_NOTIFY		0x5
+#define JRPCD_API_SUBSCRIBE		0x6
+#define JRPCD_API_UNSUBSCRIBE		0x7
+#define JRPCD_API_PUBLISH		0x8
+#define JRPCD_API_PEER			0x9
 
+/* How calls are spread over nodes registered under one name */
+#define JRPCD_GROUP_NONE		0x0
+#define JRPCD_GROUP_RR			0x1
+#define JRPCD_GROUP_LOC			0x2
+#define JRPCD_GROUP_HASH		0x3
+
+void jrpcd_parser_setup(bool arena);
+void jrpcd_parser_dump(void);
 void jrpcd_parser_init(void ** root, char *data);
 void jrpcd_parser_cleanup(void *obj);
 int8_t jrpcd_parser_get_api(void *obj, uint8_t * api_type);
 int8_t jrpcd_parser_get_snode(void *obj, char *snode, uint16_t size);
 int8_t jrpcd_parser_get_dnode(void *obj, char *dnode, uint16_t size);
+int8_t jrpcd_parser_get_xid(void *obj, uint32_t * xid);
+int8_t jrpcd_parser_get_pxid(void *obj, uint32_t * pxid);
+int8_t jrpcd_parser_get_id(void *obj, uint32_t * id);
+int8_t jrpcd_parser_get_dl(void *obj, uint64_t * dl);
+int8_t jrpcd_parser_get_tmo(void *obj, uint64_t * tmo);
+int8_t jrpcd_parser_register_get_group(void *obj, uint8_t * group,
+				       uint16_t * key);
 int8_t jrpcd_parser_register_get_num_intf(void *obj, uint16_t * num_intf);
 void *jrpcd_parser_register_get_intf(void *obj, uint16_t index);
+int8_t jrpcd_parser_register_get_topic(void *obj, uint16_t index,
+				       char *topic, uint16_t size);
+int8_t jrpcd_parser_register_get_direct(void *obj, char *direct, uint16_t size);
+int8_t jrpcd_parser_register_get_replay(void *obj, bool * replay);
+int8_t jrpcd_parser_peer_get_node(void *obj, uint16_t index, char *name,
+				  uint16_t size);
 int8_t jrpcd_parser_register_intf_get_name(void *vintf, char *name,
 					   uint16_t size);
 int8_t jrpcd_parser_register_intf_get_arg(void *vintf, char *arg,
 					  uint16_t size);
 int8_t jrpcd_parser_register_intf_get_ret(void *vintf, char *ret,
 					  uint16_t size);
+int8_t jrpcd_parser_register_intf_get_ttl(void *vintf, uint32_t * ttl);
 int8_t jrpcd_parser_call_get_intf(void *obj, char *intf, uint16_t size);
+int8_t jrpcd_parser_call_get_arg(void *obj, uint16_t index, char *val,
+				 uint16_t size);
+char *jrpcd_parser_call_get_args(void *obj);
+char *jrpcd_parser_return_get_ret(void *obj);
+int8_t jrpcd_parser_chain_get(void *obj, char **chain);
+int8_t jrpcd_parser_chain_step(char *chain, char *dnode, uint16_t dsize,
+			       char *intf, uint16_t isize, char **rest);
+uint8_t *jrpcd_parser_return_str(char *snode, char *dnode, char *intf,
+				 uint32_t id, char *val, uint32_t * size);
+uint8_t *jrpcd_parser_chain_call(void *obj, char *snode, char *dnode,
+				 char *intf, uint64_t dl, uint32_t * size);
+uint8_t *jrpcd_parser_peer_hello(char *snode, char **names, uint16_t num,
+				 uint32_t * size);
+uint8_t *jrpcd_parser_restamp(void *obj, char *xkey, uint32_t xid,
+			      char *dkey, uint64_t dval, uint32_t * size);
+void *jrpcd_parser_handoff_new(char *kind);
+void jrpcd_parser_handoff_set_int(void *obj, char *key, uint64_t val);
+void jrpcd_parser_handoff_set_str(void *obj, char *key, char *val);
+void jrpcd_parser_handoff_add_intf(void *obj, char *name, char *arg,
+				   char *ret, uint32_t ttl);
+void jrpcd_parser_handoff_add_topic(void *obj, char *topic);
+int32_t jrpcd_parser_handoff_dump(void *obj, char *text, uint32_t size);
+int8_t jrpcd_parser_handoff_get_kind(void *obj, char *kind, uint16_t size);
+uint64_t jrpcd_parser_handoff_get_int(void *obj, char *key);
+char *jrpcd_parser_handoff_get_str(void *obj, char *key);
 
 #endif				//JRPCD_PARSER_H
@@ -0,0 +1,150 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include "jrpcd_peer.h"
+#include "debug.h"
+
+#define PEER_HASH_SZ			64
+
+/* Structure to hold a node name served by a peer daemon */
+struct jrpcd_remote_desc {
+	char name[JRPCD_PEER_NAME_SZ];	/* Node name */
+	uint32_t cid;		/* Client id of the link to the peer */
+
+	LIST_ENTRY(jrpcd_remote_desc) entries;
+};
+
+static LIST_HEAD(remote_head, jrpcd_remote_desc) remote_hash[PEER_HASH_SZ];
+
+static uint32_t jrpcd_peer_hash(char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*name != '\0') {
+		hash ^= (uint8_t) *name++;
+		hash *= 16777619u;
+	}
+	return hash % PEER_HASH_SZ;
+}
+
+int8_t jrpcd_peer_init(void)
+{
+	uint16_t i;
+
+	LOG_VERBOSE("%s", "jrpcd_peer_init");
+
+	for (i = 0; i < PEER_HASH_SZ; i++) {
+		LIST_INIT(&remote_hash[i]);
+	}
+	return 0;
+}
+
+void jrpcd_peer_cleanup(void)
+{
+	struct jrpcd_remote_desc *remote;
+	uint16_t i;
+
+	LOG_VERBOSE("%s", "jrpcd_peer_cleanup");
+
+	for (i = 0; i < PEER_HASH_SZ; i++) {
+		while ((remote = LIST_FIRST(&remote_hash[i])) != NULL) {
+			LIST_REMOVE(remote, entries);
+			free(remote);
+		}
+	}
+}
+
+/* A name served by several peers is reached through the first of them */
+int8_t jrpcd_peer_add(char *name, uint32_t cid)
+{
+	struct jrpcd_remote_desc *remote;
+	uint32_t hash;
+
+	if ((name[0] == '\0') || (strlen(name) >= JRPCD_PEER_NAME_SZ)) {
+		LOG_ERR("invalid remote node name %s", name);
+		goto exit_0;
+	}
+
+	hash = jrpcd_peer_hash(name);
+	LIST_FOREACH(remote, &remote_hash[hash], entries) {
+		if ((remote->cid == cid) && (strcmp(remote->name, name) == 0)) {
+			return 0;
+		}
+	}
+
+	remote = (struct jrpcd_remote_desc *)
+	    malloc(sizeof(struct jrpcd_remote_desc));
+	if (remote == NULL) {
+		LOG_ERR("%s", "malloc failed");
+		goto exit_0;
+	}
+	strcpy(remote->name, name);
+	remote->cid = cid;
+	LIST_INSERT_HEAD(&remote_hash[hash], remote, entries);
+	return 0;
+ exit_0:
+	return -1;
+}
+
+/* Link to the peer is gone or it advertised a new list */
+void jrpcd_peer_purge(uint32_t cid)
+{
+	struct jrpcd_remote_desc *remote;
+	struct jrpcd_remote_desc *next;
+	uint16_t i;
+
+	for (i = 0; i < PEER_HASH_SZ; i++) {
+		for (remote = LIST_FIRST(&remote_hash[i]); remote != NULL;
+		     remote = next) {
+			next = LIST_NEXT(remote, entries);
+			if (remote->cid == cid) {
+				LIST_REMOVE(remote, entries);
+				free(remote);
+			}
+		}
+	}
+}
+
+/* Returns the link to the peer serving name, 0 if no peer does */
+uint32_t jrpcd_peer_lookup(char *name)
+{
+	struct jrpcd_remote_desc *remote;
+	uint32_t cid = 0;
+
+	LIST_FOREACH(remote, &remote_hash[jrpcd_peer_hash(name)], entries) {
+		if (strcmp(remote->name, name) == 0) {
+			/* Entries are added at the head, the oldest is last */
+			cid = remote->cid;
+		}
+	}
+	return cid;
+}
+
+/* Number of names advertised over the link */
+uint32_t jrpcd_peer_count(uint32_t cid)
+{
+	struct jrpcd_remote_desc *remote;
+	uint32_t num = 0;
+	uint16_t i;
+
+	for (i = 0; i < PEER_HASH_SZ; i++) {
+		LIST_FOREACH(remote, &remote_hash[i], entries) {
+			if (remote->cid == cid) {
+				num++;
+			}
+		}
+	}
+	return num;
+}
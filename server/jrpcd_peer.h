@@ -0,0 +1,28 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef JRPCD_PEER_H
+#define JRPCD_PEER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define JRPCD_PEER_NAME_SZ		32
+
+/* Registry of nodes served by peer daemons. Each name maps to the client */
+/* id of the link to the peer that advertised it. Not thread safe, jrpcd */
+/* serializes all access under its node lock. */
+int8_t jrpcd_peer_init(void);
+void jrpcd_peer_cleanup(void);
+int8_t jrpcd_peer_add(char *name, uint32_t cid);
+void jrpcd_peer_purge(uint32_t cid);
+uint32_t jrpcd_peer_lookup(char *name);
+uint32_t jrpcd_peer_count(uint32_t cid);
+
+#endif				//JRPCD_PEER_H
@@ -0,0 +1,242 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/queue.h>
+
+#include "jrpcd_pending.h"
+#include "jrpcd_pool.h"
+#include "jrpcd_cache.h"
+#include "debug.h"
+
+#define PENDING_HASH_SZ			256
+
+/* Structure to hold a call forwarded to a node and not yet returned. */
+/* A call fanned out to many nodes has one entry per node, all sharing */
+/* the same xid, so has a call with callers coalesced into it. */
+struct jrpcd_pending_desc {
+	uint32_t xid;		/* Exchange id stamped on the call */
+	uint64_t expiry;	/* Time the call is given up in ms */
+	uint32_t key;		/* Hash of dnode, intf and args if any */
+	struct jrpcd_pending_call call;
+
+	TAILQ_ENTRY(jrpcd_pending_desc) age;	/* First to expire first */
+	LIST_ENTRY(jrpcd_pending_desc) hash;	/* Lookup by xid */
+	LIST_ENTRY(jrpcd_pending_desc) flight;	/* Lookup by args */
+};
+
+static TAILQ_HEAD(age_head, jrpcd_pending_desc) pending_age;
+static LIST_HEAD(hash_head, jrpcd_pending_desc) pending_hash[PENDING_HASH_SZ];
+static LIST_HEAD(flight_head, jrpcd_pending_desc) pending_flight[PENDING_HASH_SZ];
+static jrpcd_pending_lost_t pending_lost;
+static uint32_t xid_next;
+static uint32_t pending_num;
+
+static uint64_t jrpcd_pending_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void jrpcd_pending_remove(struct jrpcd_pending_desc *pend,
+				 bool drop)
+{
+	if (pend->call.args != NULL) {
+		LIST_REMOVE(pend, flight);
+	}
+	if (drop) {
+		jrpcd_pool_free(pend->call.chain);
+		jrpcd_pool_free(pend->call.args);
+	}
+	TAILQ_REMOVE(&pending_age, pend, age);
+	LIST_REMOVE(pend, hash);
+	jrpcd_pool_free(pend);
+	pending_num--;
+}
+
+/* Calls are kept in expiry order, so expired ones are at the head */
+static void jrpcd_pending_expire(uint64_t now)
+{
+	struct jrpcd_pending_desc *pend;
+
+	while (!TAILQ_EMPTY(&pending_age)) {
+		pend = TAILQ_FIRST(&pending_age);
+		if (pend->expiry > now) {
+			break;
+		}
+		LOG_INFO("call %d to %s of cid %d expired", pend->xid,
+			 pend->call.intf, pend->call.callee);
+		pending_lost(&pend->call, true);
+		jrpcd_pending_remove(pend, true);
+	}
+}
+
+int8_t jrpcd_pending_init(jrpcd_pending_lost_t lost)
+{
+	uint16_t i;
+
+	LOG_VERBOSE("%s", "jrpcd_pending_init");
+
+	TAILQ_INIT(&pending_age);
+	for (i = 0; i < PENDING_HASH_SZ; i++) {
+		LIST_INIT(&pending_hash[i]);
+		LIST_INIT(&pending_flight[i]);
+	}
+	pending_lost = lost;
+	pending_num = 0;
+	xid_next = 1;
+
+	return 0;
+}
+
+void jrpcd_pending_cleanup(void)
+{
+	LOG_VERBOSE("%s", "jrpcd_pending_cleanup");
+
+	while (!TAILQ_EMPTY(&pending_age)) {
+		jrpcd_pending_remove(TAILQ_FIRST(&pending_age), true);
+	}
+}
+
+/* Records a call being forwarded, returns the xid to stamp on it or 0. */
+/* A new xid is handed out unless one is given. */
+uint32_t jrpcd_pending_add(struct jrpcd_pending_call *call, uint32_t xid)
+{
+	struct jrpcd_pending_desc *pend;
+	struct jrpcd_pending_desc *prev;
+	uint64_t now = jrpcd_pending_now();
+
+	jrpcd_pending_expire(now);
+
+	pend = (struct jrpcd_pending_desc *)
+	    jrpcd_pool_alloc(sizeof(struct jrpcd_pending_desc));
+	if (pend == NULL) {
+		LOG_ERR("%s", "pool alloc failed");
+		goto exit_0;
+	}
+
+	/* Zero is never handed out, it means no xid. One given may come */
+	/* from a previous daemon, none handed out later may clash with it. */
+	if (xid == 0) {
+		if (xid_next == 0) {
+			xid_next = 1;
+		}
+		xid = xid_next++;
+	} else if (xid >= xid_next) {
+		xid_next = xid + 1;
+	}
+	pend->xid = xid;
+	pend->expiry = now + JRPCD_PENDING_TMO_MS;
+	if ((call->dl != 0) && (call->dl < pend->expiry)) {
+		/* No point in waiting once the caller has given up */
+		pend->expiry = call->dl;
+	}
+	pend->call = *call;
+
+	/* Deadlines differ, but most calls still go in at the tail */
+	prev = TAILQ_LAST(&pending_age, age_head);
+	while ((prev != NULL) && (prev->expiry > pend->expiry)) {
+		prev = TAILQ_PREV(prev, age_head, age);
+	}
+	if (prev == NULL) {
+		TAILQ_INSERT_HEAD(&pending_age, pend, age);
+	} else {
+		TAILQ_INSERT_AFTER(&pending_age, prev, pend, age);
+	}
+	LIST_INSERT_HEAD(&pending_hash[pend->xid % PENDING_HASH_SZ], pend,
+			 hash);
+	if (call->args != NULL) {
+		pend->key = jrpcd_cache_key(call->dnode, call->intf, call->args);
+		LIST_INSERT_HEAD(&pending_flight[pend->key % PENDING_HASH_SZ],
+				 pend, flight);
+	}
+	pending_num++;
+
+	return pend->xid;
+ exit_0:
+	return 0;
+}
+
+/* Matches a return to its call, only the node that got the call may answer */
+int8_t jrpcd_pending_take(uint32_t xid, uint32_t callee,
+			  struct jrpcd_pending_call *call)
+{
+	struct jrpcd_pending_desc *pend;
+
+	LIST_FOREACH(pend, &pending_hash[xid % PENDING_HASH_SZ], hash) {
+		if ((pend->xid == xid) && (pend->call.callee == callee)) {
+			*call = pend->call;
+			jrpcd_pending_remove(pend, false);
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* Finds a call with the same args on its way to dnode. Returns its xid */
+/* and callee, or 0 if there is none. */
+uint32_t jrpcd_pending_find(char *dnode, char *intf, char *args,
+			    uint32_t *callee)
+{
+	struct jrpcd_pending_desc *pend;
+	uint32_t key = jrpcd_cache_key(dnode, intf, args);
+
+	/* A call about to expire is not worth waiting for */
+	jrpcd_pending_expire(jrpcd_pending_now());
+
+	LIST_FOREACH(pend, &pending_flight[key % PENDING_HASH_SZ], flight) {
+		if ((pend->key == key) &&
+		    (strcmp(pend->call.dnode, dnode) == 0) &&
+		    (strcmp(pend->call.intf, intf) == 0) &&
+		    (strcmp(pend->call.args, args) == 0)) {
+			*callee = pend->call.callee;
+			return pend->xid;
+		}
+	}
+	return 0;
+}
+
+/* Node is gone. Calls made by it are dropped, calls made to it are lost. */
+void jrpcd_pending_purge(uint32_t cid)
+{
+	struct jrpcd_pending_desc *pend;
+	struct jrpcd_pending_desc *next;
+
+	for (pend = TAILQ_FIRST(&pending_age); pend != NULL; pend = next) {
+		next = TAILQ_NEXT(pend, age);
+		if (pend->call.callee == cid) {
+			pending_lost(&pend->call, false);
+			jrpcd_pending_remove(pend, true);
+		} else if (pend->call.caller == cid) {
+			jrpcd_pending_remove(pend, true);
+		}
+	}
+}
+
+uint32_t jrpcd_pending_count(void)
+{
+	return pending_num;
+}
+
+/* Calls are walked first to expire first. The table may not be changed */
+/* by walk. */
+void jrpcd_pending_walk(jrpcd_pending_walk_t walk, void *arg)
+{
+	struct jrpcd_pending_desc *pend;
+
+	TAILQ_FOREACH(pend, &pending_age, age) {
+		walk(&pend->call, pend->xid, arg);
+	}
+}
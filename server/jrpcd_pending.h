@@ -0,0 +1,58 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef JRPCD_PENDING_H
+#define JRPCD_PENDING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Calls not returned within this time or by the deadline of the caller */
+/* are forgotten */
+#define JRPCD_PENDING_TMO_MS		10000
+#define JRPCD_PENDING_NAME_SZ		32
+
+/* A call forwarded to a node */
+struct jrpcd_pending_call {
+	uint32_t caller;	/* Client id of the calling node */
+	uint32_t callee;	/* Client id of the node serving the call */
+	uint32_t id;		/* Id the caller gave the call, 0 if none */
+	char dnode[JRPCD_PENDING_NAME_SZ];	/* Node name called */
+	char intf[JRPCD_PENDING_NAME_SZ];	/* Interface called */
+	char *chain;		/* Steps to run after the call, pool buffer */
+	char *args;		/* Args to cache the return under, pool buffer */
+	uint32_t ttl;		/* Time to cache the return for in ms */
+	uint64_t dl;		/* Deadline of the caller in ms, 0 if none */
+	bool coalesced;		/* Waits on the return of another call */
+};
+
+/* Called for a call that will never see its return. expired is set when */
+/* the call timed out, otherwise the callee went away. */
+typedef void (*jrpcd_pending_lost_t) (struct jrpcd_pending_call * call,
+				      bool expired);
+
+/* Called for every call in the table by jrpcd_pending_walk() */
+typedef void (*jrpcd_pending_walk_t) (struct jrpcd_pending_call * call,
+				      uint32_t xid, void *arg);
+
+/* Not thread safe, jrpcd serializes all access under its node lock. */
+/* The table owns the chain and args of a call from jrpcd_pending_add() */
+/* till they are handed back by jrpcd_pending_take(). */
+int8_t jrpcd_pending_init(jrpcd_pending_lost_t lost);
+void jrpcd_pending_cleanup(void);
+uint32_t jrpcd_pending_add(struct jrpcd_pending_call *call, uint32_t xid);
+int8_t jrpcd_pending_take(uint32_t xid, uint32_t callee,
+			  struct jrpcd_pending_call *call);
+uint32_t jrpcd_pending_find(char *dnode, char *intf, char *args,
+			    uint32_t *callee);
+void jrpcd_pending_purge(uint32_t cid);
+uint32_t jrpcd_pending_count(void);
+void jrpcd_pending_walk(jrpcd_pending_walk_t walk, void *arg);
+
+#endif				//JRPCD_PENDING_H
@@ -0,0 +1,408 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/queue.h>
+
+#include "jrpcd_pool.h"
+#include "debug.h"
+
+#define POOL_SLAB_SZ			(2 * 1024 * 1024u)
+#define POOL_CACHE_MAX			32
+#define POOL_REFILL			16
+#define POOL_HEAP_CLASS			0xFF
+
+/* Header in front of every buffer handed out */
+struct jrpcd_buf_hdr {
+	struct jrpcd_buf_hdr *next;	/* Free list link, valid when free */
+	uint8_t cls;			/* Size class of the buffer */
+	uint32_t refs;			/* Holders of the buffer */
+} __attribute__ ((aligned(16)));
+
+/* Chunk of memory carved into buffers of one class */
+struct jrpcd_slab_desc {
+	void *base;
+	uint32_t size;
+	 LIST_ENTRY(jrpcd_slab_desc) entries;
+};
+
+struct jrpcd_class_desc {
+	/* Mutex to protect the shared free list and the slab carving */
+	pthread_mutex_t mutex;
+	struct jrpcd_buf_hdr *free_list;
+	uint8_t *bump;
+	uint8_t *bump_end;
+	struct jrpcd_pool_stats stats;
+};
+
+/* Per thread cache of free buffers, avoids the class mutex */
+struct jrpcd_cache_desc {
+	struct jrpcd_buf_hdr *head;
+	uint16_t count;
+};
+
+/* Caches of a thread, listed while they may hold buffers */
+struct jrpcd_thread_cache {
+	struct jrpcd_cache_desc cls[JRPCD_POOL_NUM_CLASSES];
+	bool attached;
+	 LIST_ENTRY(jrpcd_thread_cache) entries;
+};
+
+static struct jrpcd_class_desc classes[JRPCD_POOL_NUM_CLASSES];
+static LIST_HEAD(slab_head, jrpcd_slab_desc) slab_list =
+LIST_HEAD_INITIALIZER(slab_list);
+static pthread_mutex_t slab_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(cache_head, jrpcd_thread_cache) cache_list =
+LIST_HEAD_INITIALIZER(cache_list);
+/* Taken before a class mutex, never after */
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cache_key;
+static bool use_hugepages;
+static uint64_t heap_allocs;
+
+static __thread struct jrpcd_thread_cache cache;
+
+static uint8_t jrpcd_pool_class(uint32_t size)
+{
+	uint8_t cls = 0;
+
+	while ((cls < JRPCD_POOL_NUM_CLASSES) &&
+	       (size > (1u << (JRPCD_POOL_MIN_SHIFT + cls)))) {
+		cls++;
+	}
+	return cls;
+}
+
+static void jrpcd_pool_flush(struct jrpcd_cache_desc *c, uint8_t cls,
+			     uint16_t count)
+{
+	struct jrpcd_class_desc *pc = &classes[cls];
+	struct jrpcd_buf_hdr *hdr;
+
+	pthread_mutex_lock(&pc->mutex);
+	while ((count-- > 0) && (c->head != NULL)) {
+		hdr = c->head;
+		c->head = hdr->next;
+		c->count--;
+		hdr->next = pc->free_list;
+		pc->free_list = hdr;
+	}
+	pthread_mutex_unlock(&pc->mutex);
+}
+
+/* Return cached buffers to the shared lists and unlist the caches. */
+/* Called with cache_mutex held. */
+static void jrpcd_pool_cache_detach(struct jrpcd_thread_cache *tc)
+{
+	uint8_t cls;
+
+	if (!tc->attached) {
+		return;
+	}
+	for (cls = 0; cls < JRPCD_POOL_NUM_CLASSES; cls++) {
+		jrpcd_pool_flush(&tc->cls[cls], cls, tc->cls[cls].count);
+	}
+	LIST_REMOVE(tc, entries);
+	tc->attached = false;
+}
+
+/* Thread exit destructor of cache_key */
+static void jrpcd_pool_cache_destroy(void *arg)
+{
+	pthread_mutex_lock(&cache_mutex);
+	jrpcd_pool_cache_detach((struct jrpcd_thread_cache *)arg);
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+/* Returns the buffers cached by the calling thread to the shared free */
+/* lists, for a thread whose exit jrpcd_pool_cleanup() may not wait for */
+void jrpcd_pool_release(void)
+{
+	jrpcd_pool_cache_destroy(&cache);
+}
+
+/* Lists the caches of this thread before they take a buffer */
+static void jrpcd_pool_cache_attach(void)
+{
+	if (cache.attached) {
+		return;
+	}
+	pthread_mutex_lock(&cache_mutex);
+	pthread_setspecific(cache_key, &cache);
+	LIST_INSERT_HEAD(&cache_list, &cache, entries);
+	cache.attached = true;
+	pthread_mutex_unlock(&cache_mutex);
+}
+
+static int8_t jrpcd_pool_new_slab(struct jrpcd_class_desc *pc)
+{
+	struct jrpcd_slab_desc *slab;
+	void *base = MAP_FAILED;
+
+	slab = (struct jrpcd_slab_desc *)malloc(sizeof(struct jrpcd_slab_desc));
+	if (slab == NULL) {
+		LOG_ERR("%s", "malloc failed");
+		goto exit_0;
+	}
+
+	if (use_hugepages) {
+		base = mmap(NULL, POOL_SLAB_SZ, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+	if (base == MAP_FAILED) {
+		base = mmap(NULL, POOL_SLAB_SZ, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if (base == MAP_FAILED) {
+		LOG_ERR("%s", "mmap failed");
+		goto exit_1;
+	}
+
+	slab->base = base;
+	slab->size = POOL_SLAB_SZ;
+	pthread_mutex_lock(&slab_mutex);
+	LIST_INSERT_HEAD(&slab_list, slab, entries);
+	pthread_mutex_unlock(&slab_mutex);
+
+	pc->bump = (uint8_t *)base;
+	pc->bump_end = pc->bump + POOL_SLAB_SZ;
+	pc->stats.slabs++;
+	return 0;
+ exit_1:
+	free(slab);
+ exit_0:
+	return -1;
+}
+
+/* Move a batch of buffers from the shared list or a slab to the cache */
+static void jrpcd_pool_refill(struct jrpcd_cache_desc *c, uint8_t cls)
+{
+	struct jrpcd_class_desc *pc = &classes[cls];
+	uint32_t blk_sz = sizeof(struct jrpcd_buf_hdr) + pc->stats.size;
+	struct jrpcd_buf_hdr *hdr;
+	uint16_t n;
+
+	pthread_mutex_lock(&pc->mutex);
+	pc->stats.refills++;
+	for (n = 0; n < POOL_REFILL; n++) {
+		if (pc->free_list != NULL) {
+			hdr = pc->free_list;
+			pc->free_list = hdr->next;
+		} else {
+			if ((pc->bump + blk_sz > pc->bump_end) &&
+			    (jrpcd_pool_new_slab(pc) < 0)) {
+				break;
+			}
+			hdr = (struct jrpcd_buf_hdr *)pc->bump;
+			hdr->cls = cls;
+			pc->bump += blk_sz;
+		}
+		hdr->next = c->head;
+		c->head = hdr;
+		c->count++;
+	}
+	pthread_mutex_unlock(&pc->mutex);
+}
+
+int8_t jrpcd_pool_init(bool hugepages)
+{
+	uint8_t cls;
+
+	LOG_VERBOSE("jrpcd_pool_init, hugepages %d", hugepages);
+
+	use_hugepages = hugepages;
+	heap_allocs = 0;
+	for (cls = 0; cls < JRPCD_POOL_NUM_CLASSES; cls++) {
+		struct jrpcd_class_desc *pc = &classes[cls];
+
+		memset(pc, 0, sizeof(struct jrpcd_class_desc));
+		pthread_mutex_init(&pc->mutex, NULL);
+		pc->stats.size = 1u << (JRPCD_POOL_MIN_SHIFT + cls);
+	}
+	if (pthread_key_create(&cache_key, jrpcd_pool_cache_destroy) != 0) {
+		LOG_ERR("%s", "pthread_key_create failed");
+		return -1;
+	}
+	return 0;
+}
+
+void jrpcd_pool_cleanup(void)
+{
+	uint8_t cls;
+
+	LOG_VERBOSE("%s", "jrpcd_pool_cleanup");
+
+	/* Buffers cached by any thread go back before the slabs go, no */
+	/* thread may use the pool meanwhile */
+	pthread_mutex_lock(&cache_mutex);
+	while (!LIST_EMPTY(&cache_list)) {
+		jrpcd_pool_cache_detach(LIST_FIRST(&cache_list));
+	}
+	pthread_mutex_unlock(&cache_mutex);
+
+	pthread_mutex_lock(&slab_mutex);
+	while (!LIST_EMPTY(&slab_list)) {
+		struct jrpcd_slab_desc *slab = LIST_FIRST(&slab_list);
+		LIST_REMOVE(slab, entries);
+		munmap(slab->base, slab->size);
+		free(slab);
+	}
+	pthread_mutex_unlock(&slab_mutex);
+
+	for (cls = 0; cls < JRPCD_POOL_NUM_CLASSES; cls++) {
+		pthread_mutex_destroy(&classes[cls].mutex);
+	}
+	pthread_key_delete(cache_key);
+}
+
+void *jrpcd_pool_alloc(uint32_t size)
+{
+	uint8_t cls = jrpcd_pool_class(size);
+	struct jrpcd_pool_stats *stats;
+	struct jrpcd_cache_desc *c;
+	struct jrpcd_buf_hdr *hdr;
+	uint32_t in_use;
+	uint32_t peak;
+
+	if (cls >= JRPCD_POOL_NUM_CLASSES) {
+		/* Too big for the pool, go to the heap */
+		hdr = (struct jrpcd_buf_hdr *)
+		    malloc(sizeof(struct jrpcd_buf_hdr) + size);
+		if (hdr == NULL) {
+			return NULL;
+		}
+		hdr->cls = POOL_HEAP_CLASS;
+		hdr->refs = 1;
+		__atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+		return (void *)(hdr + 1);
+	}
+
+	stats = &classes[cls].stats;
+	c = &cache.cls[cls];
+	if (c->head == NULL) {
+		jrpcd_pool_cache_attach();
+		jrpcd_pool_refill(c, cls);
+		if (c->head == NULL) {
+			LOG_ERR("%s", "pool exhausted");
+			return NULL;
+		}
+	} else {
+		__atomic_fetch_add(&stats->cache_hits, 1, __ATOMIC_RELAXED);
+	}
+	hdr = c->head;
+	c->head = hdr->next;
+	c->count--;
+	hdr->refs = 1;
+
+	__atomic_fetch_add(&stats->allocs, 1, __ATOMIC_RELAXED);
+	in_use = __atomic_add_fetch(&stats->in_use, 1, __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&stats->peak, __ATOMIC_RELAXED);
+	while ((in_use > peak) &&
+	       !__atomic_compare_exchange_n(&stats->peak, &peak, in_use, true,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED)) {
+		/* peak was reloaded, another thread raised it */
+	}
+	return (void *)(hdr + 1);
+}
+
+void jrpcd_pool_free(void *buf)
+{
+	struct jrpcd_buf_hdr *hdr;
+	struct jrpcd_cache_desc *c;
+	struct jrpcd_pool_stats *stats;
+
+	if (buf == NULL) {
+		return;
+	}
+
+	/* Shared buffers go back when the last holder lets go */
+	hdr = (struct jrpcd_buf_hdr *)buf - 1;
+	if (__atomic_sub_fetch(&hdr->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+		return;
+	}
+	if (hdr->cls == POOL_HEAP_CLASS) {
+		free(hdr);
+		return;
+	}
+
+	stats = &classes[hdr->cls].stats;
+	__atomic_fetch_add(&stats->frees, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_sub(&stats->in_use, 1, __ATOMIC_RELAXED);
+
+	/* Buffers are often freed by a different thread (transmit) than */
+	/* the one that allocated them (receive), keep the caches bounded */
+	c = &cache.cls[hdr->cls];
+	jrpcd_pool_cache_attach();
+	hdr->next = c->head;
+	c->head = hdr;
+	c->count++;
+	if (c->count > POOL_CACHE_MAX) {
+		jrpcd_pool_flush(c, hdr->cls, POOL_CACHE_MAX / 2);
+	}
+}
+
+/* Takes another hold on a buffer, each holder calls jrpcd_pool_free() */
+void *jrpcd_pool_ref(void *buf)
+{
+	struct jrpcd_buf_hdr *hdr = (struct jrpcd_buf_hdr *)buf - 1;
+
+	__atomic_fetch_add(&hdr->refs, 1, __ATOMIC_RELAXED);
+	return buf;
+}
+
+void jrpcd_pool_stats(uint8_t cls, struct jrpcd_pool_stats *stats)
+{
+	struct jrpcd_class_desc *pc = &classes[cls];
+
+	pthread_mutex_lock(&pc->mutex);
+	stats->size = pc->stats.size;
+	stats->refills = pc->stats.refills;
+	stats->slabs = pc->stats.slabs;
+	pthread_mutex_unlock(&pc->mutex);
+
+	stats->allocs = __atomic_load_n(&pc->stats.allocs, __ATOMIC_RELAXED);
+	stats->frees = __atomic_load_n(&pc->stats.frees, __ATOMIC_RELAXED);
+	stats->cache_hits =
+	    __atomic_load_n(&pc->stats.cache_hits, __ATOMIC_RELAXED);
+	stats->in_use = __atomic_load_n(&pc->stats.in_use, __ATOMIC_RELAXED);
+	stats->peak = __atomic_load_n(&pc->stats.peak, __ATOMIC_RELAXED);
+}
+
+uint64_t jrpcd_pool_heap_allocs(void)
+{
+	return __atomic_load_n(&heap_allocs, __ATOMIC_RELAXED);
+}
+
+void jrpcd_pool_dump(void)
+{
+	struct jrpcd_pool_stats stats;
+	uint8_t cls;
+
+	LOG_VERBOSE("%s", "jrpcd_pool_dump");
+
+	for (cls = 0; cls < JRPCD_POOL_NUM_CLASSES; cls++) {
+		jrpcd_pool_stats(cls, &stats);
+		LOG_VERBOSE("Pool class %d bytes : %llu allocs, %llu frees",
+			    stats.size, (unsigned long long)stats.allocs,
+			    (unsigned long long)stats.frees);
+		LOG_VERBOSE("\tcache hits %llu, refills %llu",
+			    (unsigned long long)stats.cache_hits,
+			    (unsigned long long)stats.refills);
+		LOG_VERBOSE("\tin use %d, peak %d, slabs %d", stats.in_use,
+			    stats.peak, stats.slabs);
+	}
+	LOG_VERBOSE("Pool heap fallbacks : %llu",
+		    (unsigned long long)jrpcd_pool_heap_allocs());
+}
@@ -0,0 +1,44 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef JRPCD_POOL_H
+#define JRPCD_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Buffers are handed out from power of two size classes, the largest */
+/* class fits a full message. Bigger requests fall back to the heap. */
+#define JRPCD_POOL_MIN_SHIFT		6
+#define JRPCD_POOL_MAX_SHIFT		12
+#define JRPCD_POOL_NUM_CLASSES		\
+	(JRPCD_POOL_MAX_SHIFT - JRPCD_POOL_MIN_SHIFT + 1)
+
+struct jrpcd_pool_stats {
+	uint32_t size;		/* Usable bytes per buffer in the class */
+	uint64_t allocs;	/* Total allocations */
+	uint64_t frees;		/* Total frees */
+	uint64_t cache_hits;	/* Allocations served by per-thread cache */
+	uint64_t refills;	/* Trips to the shared free list */
+	uint32_t in_use;	/* Buffers currently allocated */
+	uint32_t peak;		/* Highest in_use seen */
+	uint32_t slabs;		/* Slabs carved for the class */
+};
+
+int8_t jrpcd_pool_init(bool hugepages);
+void jrpcd_pool_cleanup(void);
+void *jrpcd_pool_alloc(uint32_t size);
+void jrpcd_pool_free(void *buf);
+void jrpcd_pool_release(void);
+void *jrpcd_pool_ref(void *buf);
+void jrpcd_pool_stats(uint8_t cls, struct jrpcd_pool_stats *stats);
+uint64_t jrpcd_pool_heap_allocs(void);
+void jrpcd_pool_dump(void);
+
+#endif				//JRPCD_POOL_H
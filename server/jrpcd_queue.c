@@ -11,19 +11,22 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <pthread.h>
 #include <time.h>
 #include <sys/queue.h>
 
 #include "jrpcd_queue.h"
+#include "jrpcd_pool.h"
 #include "debug.h"
 
-#define Q_MAX_ITEMS			32
+#define Q_MAX_ITEMS			1024
 
 struct jrpcd_item_desc {
 	void *data;
 	uint32_t size;
-	 LIST_ENTRY(jrpcd_item_desc) entries;
+	uint64_t dl;		/* Not worth sending after this ms, 0 = always */
+	 TAILQ_ENTRY(jrpcd_item_desc) entries;
 };
 
 struct jrpcd_queue_desc {
@@ -31,13 +34,37 @@ struct jrpcd_queue_desc {
 	uint32_t cid;
 	/* Queue lenght or number of items in the queue */
 	uint16_t len;
+	/* Bytes held in the queue and the limit for it */
+	uint32_t bytes;
+	uint32_t budget;
+	/* What to do when the budget is exceeded */
+	uint8_t policy;
+	/* Statistics */
+	uint32_t peak_bytes;
+	uint32_t shed;
+	uint32_t shed_bytes;
+	uint32_t expired;
+	/* No more items will come, see jrpcd_queue_close() */
+	uint8_t closed;
+	/* Reader waits for items, all it took before are done with */
+	uint8_t idle;
 	/* Mutex and condition variable to support blocking queue */
 	pthread_mutex_t mutex;
 	pthread_cond_t dq_cv;
-	/* Linked list to hold the queue items */
-	 LIST_HEAD(q_head, jrpcd_item_desc) q;
+	/* Signalled when the reader goes idle, see jrpcd_queue_drain() */
+	pthread_cond_t idle_cv;
+	/* Tail queue to hold the queue items, oldest item first */
+	 TAILQ_HEAD(q_head, jrpcd_item_desc) q;
 };
 
+static uint64_t jrpcd_queue_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 int8_t jrpcd_queue_init(void)
 {
 	LOG_VERBOSE("%s", "jrpcd_queue_init");
@@ -56,20 +83,21 @@ void jrpcd_queue_destroy(void *queue)
 
 	LOG_VERBOSE("jrpcd_queue_destroy for cid %d", qdesc->cid);
 
-	while (!LIST_EMPTY(&(qdesc->q))) {
-		struct jrpcd_item_desc *q = LIST_FIRST(&(qdesc->q));
+	while (!TAILQ_EMPTY(&(qdesc->q))) {
+		struct jrpcd_item_desc *q = TAILQ_FIRST(&(qdesc->q));
 		if (q->data != NULL) {
-			free(q->data);
+			jrpcd_pool_free(q->data);
 		}
-		LIST_REMOVE(q, entries);
-		free(q);
+		TAILQ_REMOVE(&(qdesc->q), q, entries);
+		jrpcd_pool_free(q);
 	}
 	pthread_mutex_destroy(&qdesc->mutex);
 	pthread_cond_destroy(&qdesc->dq_cv);
+	pthread_cond_destroy(&qdesc->idle_cv);
 	free(qdesc);
 }
 
-void *jrpcd_queue_create(uint32_t cid)
+void *jrpcd_queue_create(uint32_t cid, uint32_t budget, uint8_t policy)
 {
 	struct jrpcd_queue_desc *qdesc;
 
@@ -84,66 +112,213 @@ void *jrpcd_queue_create(uint32_t cid)
 
 	qdesc->cid = cid;
 	qdesc->len = 0;
+	qdesc->bytes = 0;
+	qdesc->budget = budget;
+	qdesc->policy = policy;
+	qdesc->peak_bytes = 0;
+	qdesc->shed = 0;
+	qdesc->shed_bytes = 0;
+	qdesc->expired = 0;
+	qdesc->closed = 0;
+	qdesc->idle = 0;
 	pthread_mutex_init(&qdesc->mutex, NULL);
 	pthread_cond_init(&qdesc->dq_cv, NULL);
-	LIST_INIT(&(qdesc->q));
+	pthread_cond_init(&qdesc->idle_cv, NULL);
+	TAILQ_INIT(&(qdesc->q));
 
 	return ((void *)qdesc);
  exit_0:
 	return NULL;
 }
 
+/* Takes the first live item, called with the queue locked. Items past */
+/* their deadline are dropped on the way. */
+static uint32_t jrpcd_queue_pop(struct jrpcd_queue_desc *qdesc, void **data)
+{
+	struct jrpcd_item_desc *qitem;
+	uint32_t size = 0;
+
+	*data = NULL;
+	while ((*data == NULL) && !TAILQ_EMPTY(&qdesc->q)) {
+		qitem = TAILQ_FIRST(&qdesc->q);
+		*data = qitem->data;
+		size = qitem->size;
+		TAILQ_REMOVE(&qdesc->q, qitem, entries);
+		qdesc->len--;
+		qdesc->bytes -= size;
+
+		/* Nobody waits for a call past its deadline, drop it */
+		if ((qitem->dl != 0) && (qitem->dl <= jrpcd_queue_now())) {
+			qdesc->expired++;
+			jrpcd_pool_free(*data);
+			*data = NULL;
+			size = 0;
+		}
+		jrpcd_pool_free(qitem);
+	}
+	return size;
+}
+
 uint32_t jrpcd_queue_get(void *queue, void **data)
 {
 	struct jrpcd_queue_desc *qdesc = (struct jrpcd_queue_desc *)queue;
-	struct jrpcd_item_desc *qitem = NULL;
 	uint32_t size = 0;
 
 	LOG_VERBOSE("%s", "jrpcd_queue_get");
 	*data = NULL;
 
 	pthread_mutex_lock(&qdesc->mutex);
-	if (LIST_EMPTY(&qdesc->q)) {
-		pthread_cond_wait(&qdesc->dq_cv, &qdesc->mutex);
+	do {
+		while (TAILQ_EMPTY(&qdesc->q) && !qdesc->closed) {
+			qdesc->idle = 1;
+			pthread_cond_broadcast(&qdesc->idle_cv);
+			pthread_cond_wait(&qdesc->dq_cv, &qdesc->mutex);
+		}
+		qdesc->idle = 0;
+		size = jrpcd_queue_pop(qdesc, data);
+	} while ((*data == NULL) && !qdesc->closed);
+	pthread_mutex_unlock(&qdesc->mutex);
+	return size;
+}
+
+/* Waits up to tmo_ms for the queue to be empty and its reader back for */
+/* more, so all it took is sent. Nothing may be put meanwhile. */
+int8_t jrpcd_queue_drain(void *queue, uint32_t tmo_ms)
+{
+	struct jrpcd_queue_desc *qdesc = (struct jrpcd_queue_desc *)queue;
+	struct timespec ts;
+	int8_t ret = 0;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += tmo_ms / 1000;
+	ts.tv_nsec += (tmo_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
 	}
 
-	qitem = LIST_FIRST(&qdesc->q);
-	*data = qitem->data;
-	size = qitem->size;
-	LIST_REMOVE(qitem, entries);
-	free(qitem);
-	qdesc->len--;
+	pthread_mutex_lock(&qdesc->mutex);
+	while (!TAILQ_EMPTY(&qdesc->q) || !qdesc->idle) {
+		if (pthread_cond_timedwait(&qdesc->idle_cv, &qdesc->mutex,
+					   &ts) == ETIMEDOUT) {
+			ret = -1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&qdesc->mutex);
+	return ret;
+}
+
+/* Once the items left are taken, jrpcd_queue_get() returns with data */
+/* NULL instead of waiting for more */
+void jrpcd_queue_close(void *queue)
+{
+	struct jrpcd_queue_desc *qdesc = (struct jrpcd_queue_desc *)queue;
+
+	pthread_mutex_lock(&qdesc->mutex);
+	qdesc->closed = 1;
+	pthread_cond_broadcast(&qdesc->dq_cv);
+	pthread_mutex_unlock(&qdesc->mutex);
+}
+
+/* Same as jrpcd_queue_get, but returns with data NULL if the queue is */
+/* empty instead of waiting */
+uint32_t jrpcd_queue_try_get(void *queue, void **data)
+{
+	struct jrpcd_queue_desc *qdesc = (struct jrpcd_queue_desc *)queue;
+	uint32_t size;
+
+	pthread_mutex_lock(&qdesc->mutex);
+	size = jrpcd_queue_pop(qdesc, data);
 	pthread_mutex_unlock(&qdesc->mutex);
 	return size;
 }
 
 int8_t jrpcd_queue_put(void *queue, void *data, uint32_t size)
+{
+	return jrpcd_queue_put_dl(queue, data, size, 0);
+}
+
+/* Ownership of data passes to the queue, even if the item is not queued. */
+/* An item with a deadline is dropped instead of sent once it has passed. */
+int8_t jrpcd_queue_put_dl(void *queue, void *data, uint32_t size,
+			  uint64_t dl)
 {
 	struct jrpcd_queue_desc *qdesc = (struct jrpcd_queue_desc *)queue;
 	struct jrpcd_item_desc *qitem = NULL;
+	int8_t ret = JRPCD_Q_SHED;
 
 	pthread_mutex_lock(&qdesc->mutex);
 
-	if (qdesc->len == Q_MAX_ITEMS) {
-		LOG_ERR("%s", "!!!Q OVERFLOW!!!");
-		goto exit_0;
+	/* Make room for the new item as per the overflow policy */
+	while ((qdesc->len == Q_MAX_ITEMS) ||
+	       (qdesc->bytes + size > qdesc->budget)) {
+		if ((qdesc->policy != JRPCD_Q_SHED_OLDEST) ||
+		    TAILQ_EMPTY(&qdesc->q)) {
+			if (qdesc->policy == JRPCD_Q_DISCONNECT) {
+				ret = JRPCD_Q_OVERFLOW;
+			}
+			LOG_ERR("!!!Q OVERFLOW!!! cid %d, %d bytes queued",
+				qdesc->cid, qdesc->bytes);
+			goto exit_0;
+		}
+
+		qitem = TAILQ_FIRST(&qdesc->q);
+		TAILQ_REMOVE(&qdesc->q, qitem, entries);
+		qdesc->len--;
+		qdesc->bytes -= qitem->size;
+		qdesc->shed++;
+		qdesc->shed_bytes += qitem->size;
+		jrpcd_pool_free(qitem->data);
+		jrpcd_pool_free(qitem);
 	}
 
-	qitem = (struct jrpcd_item_desc*)malloc(sizeof(struct jrpcd_item_desc));
+	qitem = (struct jrpcd_item_desc *)
+	    jrpcd_pool_alloc(sizeof(struct jrpcd_item_desc));
 	if (qitem == NULL) {
-		LOG_ERR("%s", "malloc failed");
+		LOG_ERR("%s", "pool alloc failed");
 		goto exit_0;
 	}
 	qitem->data = data;
 	qitem->size = size;
+	qitem->dl = dl;
 
-	LIST_INSERT_HEAD(&qdesc->q, qitem, entries);
+	TAILQ_INSERT_TAIL(&qdesc->q, qitem, entries);
 	qdesc->len++;
+	qdesc->bytes += size;
+	if (qdesc->bytes > qdesc->peak_bytes) {
+		qdesc->peak_bytes = qdesc->bytes;
+	}
 
 	pthread_cond_signal(&qdesc->dq_cv);
 	pthread_mutex_unlock(&qdesc->mutex);
-	return 0;
+	return JRPCD_Q_OK;
  exit_0:
+	qdesc->shed++;
+	qdesc->shed_bytes += size;
+	pthread_mutex_unlock(&qdesc->mutex);
+	jrpcd_pool_free(data);
+	return ret;
+}
+
+uint8_t jrpcd_queue_policy(void *queue)
+{
+	struct jrpcd_queue_desc *qdesc = (struct jrpcd_queue_desc *)queue;
+
+	return qdesc->policy;
+}
+
+void jrpcd_queue_stats(void *queue, struct jrpcd_queue_stats *stats)
+{
+	struct jrpcd_queue_desc *qdesc = (struct jrpcd_queue_desc *)queue;
+
+	pthread_mutex_lock(&qdesc->mutex);
+	stats->len = qdesc->len;
+	stats->bytes = qdesc->bytes;
+	stats->budget = qdesc->budget;
+	stats->peak_bytes = qdesc->peak_bytes;
+	stats->shed = qdesc->shed;
+	stats->shed_bytes = qdesc->shed_bytes;
+	stats->expired = qdesc->expired;
 	pthread_mutex_unlock(&qdesc->mutex);
-	return -1;
 }
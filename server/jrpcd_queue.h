@@ -12,11 +12,38 @@
 
 #include <stdint.h>
 
+/* Overflow policies, applied when a queue exceeds its byte budget */
+#define JRPCD_Q_SHED_OLDEST		0x0
+#define JRPCD_Q_SHED_NEWEST		0x1
+#define JRPCD_Q_DISCONNECT		0x2
+
+/* Return values of jrpcd_queue_put() */
+#define JRPCD_Q_OK			0
+#define JRPCD_Q_SHED			-1
+#define JRPCD_Q_OVERFLOW		-2
+
+struct jrpcd_queue_stats {
+	uint16_t len;		/* Items waiting to be sent */
+	uint32_t bytes;		/* Bytes waiting to be sent */
+	uint32_t budget;	/* Byte budget of the queue */
+	uint32_t peak_bytes;	/* Highest bytes ever queued */
+	uint32_t shed;		/* Items dropped due to overflow */
+	uint32_t shed_bytes;	/* Bytes dropped due to overflow */
+	uint32_t expired;	/* Items dropped as their deadline passed */
+};
+
 int8_t jrpcd_queue_init(void);
 void jrpcd_queue_cleanup(void);
-void *jrpcd_queue_create(uint32_t cid);
+void *jrpcd_queue_create(uint32_t cid, uint32_t budget, uint8_t policy);
 void jrpcd_queue_destroy(void *queue);
 uint32_t jrpcd_queue_get(void *queue, void **data);
+uint32_t jrpcd_queue_try_get(void *queue, void **data);
+void jrpcd_queue_close(void *queue);
+int8_t jrpcd_queue_drain(void *queue, uint32_t tmo_ms);
 int8_t jrpcd_queue_put(void *queue, void *data, uint32_t size);
+int8_t jrpcd_queue_put_dl(void *queue, void *data, uint32_t size,
+			  uint64_t dl);
+uint8_t jrpcd_queue_policy(void *queue);
+void jrpcd_queue_stats(void *queue, struct jrpcd_queue_stats *stats);
 
 #endif				//JRPCD_QUEUE_H
@@ -7,6 +7,7 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
+#define _GNU_SOURCE		/* struct ucred */
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -15,19 +16,30 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <sys/select.h>
+#include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 
 #include "jrpcd_server.h"
 #include "jrpcd.h"
 #include "debug.h"
 
+#define IDLE_INTERVAL_MS		1000
+
 /* Socket to accept incoming clients */
 static int sock_fd;
 
+/* Unix socket a newer jrpcd connects to to take over, -1 if none */
+static int up_fd = -1;
+static char up_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static bool handed_off;
+
 int8_t jrpcd_server_init(char *host, uint32_t port)
 {
 	struct sockaddr_in addr;
+	int on = 1;
 
 	/* Create Socket */
 	sock_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -36,6 +48,12 @@ int8_t jrpcd_server_init(char *host, uint32_t port)
 		goto exit_0;
 	}
 
+	/* A restarted daemon takes the port back at once, connections of */
+	/* the previous one may linger in TIME_WAIT on it */
+	if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+		LOG_ERR("%s", "cannot set SO_REUSEADDR");
+	}
+
 	memset(&addr, 0, sizeof(struct sockaddr_in));
 
 	addr.sin_family = AF_INET;
@@ -54,8 +72,9 @@ int8_t jrpcd_server_init(char *host, uint32_t port)
 		goto exit_1;
 	}
 
-	/* Listen on the socket */
-	if (listen(sock_fd, 5) < 0) {
+	/* Listen on the socket. Clients reconnect all at once after a */
+	/* restart, room for all of them. */
+	if (listen(sock_fd, SOMAXCONN) < 0) {
 		LOG_ERR("%s", "cannot listen on socket");
 		goto exit_1;
 	}
@@ -70,29 +89,288 @@ int8_t jrpcd_server_init(char *host, uint32_t port)
 	return -1;
 }
 
+/* Takes the listening socket of a previous daemon instead of binding */
+void jrpcd_server_adopt(int32_t sock)
+{
+	sock_fd = sock;
+	LOG_INFO("%s", "jrpcd_server_adopt: success");
+}
+
+int32_t jrpcd_server_sock(void)
+{
+	return sock_fd;
+}
+
+static int8_t jrpcd_server_unix_addr(char *path, struct sockaddr_un *addr)
+{
+	memset(addr, 0, sizeof(struct sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr->sun_path)) {
+		LOG_ERR("path too long : %s", path);
+		return -1;
+	}
+	strcpy(addr->sun_path, path);
+	return 0;
+}
+
+/* Every client socket passes over the upgrade socket, both ends must be */
+/* run by the same user */
+static bool jrpcd_server_same_user(int32_t usock)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(usock, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) {
+		LOG_ERR("%s", "cannot get peer credentials");
+		return false;
+	}
+	if (cred.uid != geteuid()) {
+		LOG_ERR("upgrade socket peer of uid %d refused", cred.uid);
+		return false;
+	}
+	return true;
+}
+
+/* Listens on path for a newer jrpcd to take over, see jrpcd_handoff() */
+int8_t jrpcd_server_upgrade_init(char *path)
+{
+	struct sockaddr_un addr;
+
+	if (jrpcd_server_unix_addr(path, &addr) < 0) {
+		goto exit_0;
+	}
+	up_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (up_fd < 0) {
+		LOG_ERR("%s", "cannot open socket");
+		goto exit_0;
+	}
+
+	/* Left by a daemon that did not exit cleanly, or by the one just */
+	/* taken over from */
+	/* No one else may connect, it is closed to others before listening */
+	unlink(path);
+	if ((bind(up_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+	    (chmod(path, S_IRUSR | S_IWUSR) < 0) ||
+	    (listen(up_fd, 1) < 0)) {
+		LOG_ERR("cannot listen on %s", path);
+		goto exit_1;
+	}
+	strcpy(up_path, path);
+	handed_off = false;
+
+	LOG_INFO("jrpcd_server_upgrade_init: success, %s", path);
+	return 0;
+
+ exit_1:
+	close(up_fd);
+	up_fd = -1;
+ exit_0:
+	return -1;
+}
+
+/* Connects to the daemon listening on path to take over from it, */
+/* returns the socket or -1 */
+int32_t jrpcd_server_upgrade_connect(char *path)
+{
+	struct sockaddr_un addr;
+	int32_t usock;
+
+	if (jrpcd_server_unix_addr(path, &addr) < 0) {
+		goto exit_0;
+	}
+	usock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (usock < 0) {
+		LOG_ERR("%s", "cannot open socket");
+		goto exit_0;
+	}
+	if (connect(usock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		LOG_INFO("no jrpcd to take over from on %s", path);
+		goto exit_1;
+	}
+	if (!jrpcd_server_same_user(usock)) {
+		goto exit_1;
+	}
+	return usock;
+
+ exit_1:
+	close(usock);
+ exit_0:
+	return -1;
+}
+
+/* Sends one handoff record, with socket fd unless it is -1 */
+int8_t jrpcd_server_send_fd(int32_t usock, uint8_t *data, uint32_t size,
+			    int32_t fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = data;
+	iov.iov_len = size;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (fd >= 0) {
+		memset(&ctl, 0, sizeof(ctl));
+		msg.msg_control = ctl.buf;
+		msg.msg_controllen = sizeof(ctl.buf);
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	}
+
+	if (sendmsg(usock, &msg, MSG_NOSIGNAL) != (ssize_t)size) {
+		LOG_ERR("%s", "handoff send failed");
+		return -1;
+	}
+	return 0;
+}
+
+/* Receives one handoff record and the socket sent with it into fd, -1 if */
+/* there was none. Returns the size of the record, 0 or less if the */
+/* sender is gone. */
+int32_t jrpcd_server_recv_fd(int32_t usock, uint8_t *data, uint32_t size,
+			     int32_t *fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} ctl;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t rc;
+
+	*fd = -1;
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = data;
+	iov.iov_len = size;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctl.buf;
+	msg.msg_controllen = sizeof(ctl.buf);
+
+	do {
+		rc = recvmsg(usock, &msg, MSG_CMSG_CLOEXEC);
+	} while ((rc < 0) && (errno == EINTR));
+	if (rc <= 0) {
+		return rc;
+	}
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if ((cmsg->cmsg_level == SOL_SOCKET) &&
+		    (cmsg->cmsg_type == SCM_RIGHTS)) {
+			memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+		}
+	}
+	if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+		LOG_ERR("%s", "handoff record truncated");
+		if (*fd >= 0) {
+			close(*fd);
+			*fd = -1;
+		}
+		return -1;
+	}
+	return rc;
+}
+
+/* Connects to another daemon, returns the socket or -1 */
+int32_t jrpcd_server_connect(char *host, uint32_t port)
+{
+	struct sockaddr_in addr;
+	int32_t csock;
+
+	csock = socket(AF_INET, SOCK_STREAM, 0);
+	if (csock < 0) {
+		LOG_ERR("%s", "cannot open socket");
+		goto exit_0;
+	}
+
+	memset(&addr, 0, sizeof(struct sockaddr_in));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = inet_addr(host);
+	addr.sin_port = htons(port);
+
+	if (connect(csock, (struct sockaddr *)&addr,
+		    sizeof(struct sockaddr_in)) < 0) {
+		LOG_INFO("cannot connect to %s:%d", host, port);
+		goto exit_1;
+	}
+	return csock;
+
+ exit_1:
+	close(csock);
+ exit_0:
+	return -1;
+}
+
 void jrpcd_server_cleanup(void)
 {
 	LOG_INFO("%s", "jrpcd_server_cleanup");
 	close(sock_fd);
+
+	/* Path is the successor's once handed off */
+	if (up_fd >= 0) {
+		close(up_fd);
+		up_fd = -1;
+		if (!handed_off) {
+			unlink(up_path);
+		}
+	}
+}
+
+bool jrpcd_server_handed_off(void)
+{
+	return handed_off;
 }
 
 void jrpcd_server_loop(void)
 {
 	fd_set readfds;
+	struct timeval tv;
 	int32_t rc;
 	int32_t csock;
 
 	LOG_INFO("%s", "jrpcd_server_loop: begin");
 
 	while (0 == jrpcd_exit_pending()) {
-		/* Wait for clients to connect */
+		/* Wait for clients to connect, or a successor to take */
+		/* over, wake up now and then for housekeeping */
 		FD_ZERO(&readfds);
 		FD_SET(sock_fd, &readfds);
-		rc = select(sock_fd + 1, &readfds, NULL, NULL, NULL);
+		if (up_fd >= 0) {
+			FD_SET(up_fd, &readfds);
+		}
+		tv.tv_sec = IDLE_INTERVAL_MS / 1000;
+		tv.tv_usec = (IDLE_INTERVAL_MS % 1000) * 1000;
+		rc = select((sock_fd > up_fd ? sock_fd : up_fd) + 1, &readfds,
+			    NULL, NULL, &tv);
 		if (rc < 0 && errno != EINTR) {
 			LOG_ERR("%s", "select error");
 			continue;
-		} else if (rc == 0) {
+		} else if (rc <= 0) {
+			jrpcd_idle();
+			continue;
+		}
+
+		if ((up_fd >= 0) && FD_ISSET(up_fd, &readfds)) {
+			csock = accept(up_fd, NULL, 0);
+			if ((csock >= 0) && !jrpcd_server_same_user(csock)) {
+				close(csock);
+				continue;
+			}
+			if ((csock >= 0) && (jrpcd_handoff(csock) == 0)) {
+				/* Successor serves all from now on */
+				handed_off = true;
+				break;
+			}
 			continue;
 		}
 
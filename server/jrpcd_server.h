@@ -11,8 +11,20 @@
 #define JRPCD_SERVER_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 int8_t jrpcd_server_init(char *host, uint32_t port);
+void jrpcd_server_adopt(int32_t sock);
+int32_t jrpcd_server_sock(void);
+int32_t jrpcd_server_connect(char *host, uint32_t port);
+int8_t jrpcd_server_upgrade_init(char *path);
+int32_t jrpcd_server_upgrade_connect(char *path);
+int8_t jrpcd_server_send_fd(int32_t usock, uint8_t *data, uint32_t size,
+			    int32_t fd);
+int32_t jrpcd_server_recv_fd(int32_t usock, uint8_t *data, uint32_t size,
+			     int32_t *fd);
 void jrpcd_server_loop(void);
+void jrpcd_server_cleanup(void);
+bool jrpcd_server_handed_off(void);
 
 #endif				//JRPCD_SERVER_H
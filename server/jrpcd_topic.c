@@ -0,0 +1,261 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
+
+#include "jrpcd_topic.h"
+#include "debug.h"
+
+#define TOPIC_HASH_SZ			64
+
+/* Structure to hold a node subscribed to a topic */
+struct jrpcd_sub_desc {
+	uint32_t cid;		/* Client id of the subscriber */
+	void *node;		/* Handed to the deliver callback */
+
+	LIST_ENTRY(jrpcd_sub_desc) entries;
+};
+
+/* Structure to hold a topic with at least one subscriber */
+struct jrpcd_topic_desc {
+	char name[JRPCD_TOPIC_NAME_SZ];	/* Topic name */
+	uint32_t num_subs;	/* Number of subscribers */
+	uint64_t published;	/* Messages published to the topic */
+	LIST_HEAD(subs_head, jrpcd_sub_desc) subs;	/* Subscribers */
+
+	LIST_ENTRY(jrpcd_topic_desc) entries;
+};
+
+static LIST_HEAD(topic_head, jrpcd_topic_desc) topic_hash[TOPIC_HASH_SZ];
+
+static uint32_t jrpcd_topic_hash(char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*name != '\0') {
+		hash ^= (uint8_t) *name++;
+		hash *= 16777619u;
+	}
+	return hash % TOPIC_HASH_SZ;
+}
+
+static struct jrpcd_topic_desc *jrpcd_topic_find(char *name)
+{
+	struct jrpcd_topic_desc *topic;
+
+	LIST_FOREACH(topic, &topic_hash[jrpcd_topic_hash(name)], entries) {
+		if (strcmp(topic->name, name) == 0) {
+			return topic;
+		}
+	}
+	return NULL;
+}
+
+/* Topics live only as long as they have subscribers */
+static void jrpcd_topic_remove_sub(struct jrpcd_topic_desc *topic,
+				   struct jrpcd_sub_desc *sub)
+{
+	LIST_REMOVE(sub, entries);
+	free(sub);
+	topic->num_subs--;
+
+	if (topic->num_subs == 0) {
+		LIST_REMOVE(topic, entries);
+		free(topic);
+	}
+}
+
+int8_t jrpcd_topic_init(void)
+{
+	uint16_t i;
+
+	LOG_VERBOSE("%s", "jrpcd_topic_init");
+
+	for (i = 0; i < TOPIC_HASH_SZ; i++) {
+		LIST_INIT(&topic_hash[i]);
+	}
+	return 0;
+}
+
+void jrpcd_topic_cleanup(void)
+{
+	struct jrpcd_topic_desc *topic;
+	uint16_t i;
+
+	LOG_VERBOSE("%s", "jrpcd_topic_cleanup");
+
+	for (i = 0; i < TOPIC_HASH_SZ; i++) {
+		while ((topic = LIST_FIRST(&topic_hash[i])) != NULL) {
+			jrpcd_topic_remove_sub(topic, LIST_FIRST(&topic->subs));
+		}
+	}
+}
+
+/* Subscribing twice to a topic is the same as subscribing once */
+int8_t jrpcd_topic_subscribe(char *name, uint32_t cid, void *node)
+{
+	struct jrpcd_topic_desc *topic;
+	struct jrpcd_sub_desc *sub;
+
+	if ((name[0] == '\0') || (strlen(name) >= JRPCD_TOPIC_NAME_SZ)) {
+		LOG_ERR("invalid topic name %s", name);
+		goto exit_0;
+	}
+
+	topic = jrpcd_topic_find(name);
+	if (topic == NULL) {
+		topic = (struct jrpcd_topic_desc *)
+		    malloc(sizeof(struct jrpcd_topic_desc));
+		if (topic == NULL) {
+			LOG_ERR("%s", "malloc failed");
+			goto exit_0;
+		}
+		strcpy(topic->name, name);
+		topic->num_subs = 0;
+		topic->published = 0;
+		LIST_INIT(&topic->subs);
+		LIST_INSERT_HEAD(&topic_hash[jrpcd_topic_hash(name)], topic,
+				 entries);
+	}
+
+	LIST_FOREACH(sub, &topic->subs, entries) {
+		if (sub->cid == cid) {
+			return 0;
+		}
+	}
+
+	sub = (struct jrpcd_sub_desc *)malloc(sizeof(struct jrpcd_sub_desc));
+	if (sub == NULL) {
+		LOG_ERR("%s", "malloc failed");
+		if (topic->num_subs == 0) {
+			LIST_REMOVE(topic, entries);
+			free(topic);
+		}
+		goto exit_0;
+	}
+	sub->cid = cid;
+	sub->node = node;
+	LIST_INSERT_HEAD(&topic->subs, sub, entries);
+	topic->num_subs++;
+
+	LOG_INFO("cid %d subscribed to %s", cid, name);
+	return 0;
+ exit_0:
+	return -1;
+}
+
+int8_t jrpcd_topic_unsubscribe(char *name, uint32_t cid)
+{
+	struct jrpcd_topic_desc *topic;
+	struct jrpcd_sub_desc *sub;
+
+	topic = jrpcd_topic_find(name);
+	if (topic == NULL) {
+		goto exit_0;
+	}
+	LIST_FOREACH(sub, &topic->subs, entries) {
+		if (sub->cid == cid) {
+			LOG_INFO("cid %d unsubscribed from %s", cid, name);
+			jrpcd_topic_remove_sub(topic, sub);
+			return 0;
+		}
+	}
+ exit_0:
+	return -1;
+}
+
+/* Node is gone, drop all its subscriptions */
+void jrpcd_topic_purge(uint32_t cid)
+{
+	struct jrpcd_topic_desc *topic;
+	struct jrpcd_topic_desc *next_topic;
+	struct jrpcd_sub_desc *sub;
+	uint16_t i;
+
+	for (i = 0; i < TOPIC_HASH_SZ; i++) {
+		for (topic = LIST_FIRST(&topic_hash[i]); topic != NULL;
+		     topic = next_topic) {
+			next_topic = LIST_NEXT(topic, entries);
+			LIST_FOREACH(sub, &topic->subs, entries) {
+				if (sub->cid == cid) {
+					jrpcd_topic_remove_sub(topic, sub);
+					break;
+				}
+			}
+		}
+	}
+}
+
+/* Name of topic index of those cid is subscribed to, -1 once index is */
+/* past the last one */
+int8_t jrpcd_topic_get(uint32_t cid, uint16_t index, char *name)
+{
+	struct jrpcd_topic_desc *topic;
+	struct jrpcd_sub_desc *sub;
+	uint16_t i;
+
+	for (i = 0; i < TOPIC_HASH_SZ; i++) {
+		LIST_FOREACH(topic, &topic_hash[i], entries) {
+			LIST_FOREACH(sub, &topic->subs, entries) {
+				if (sub->cid != cid) {
+					continue;
+				}
+				if (index == 0) {
+					strcpy(name, topic->name);
+					return 0;
+				}
+				index--;
+				break;
+			}
+		}
+	}
+	return -1;
+}
+
+/* Hands a published message to all subscribers but the publisher. */
+/* Returns the number of subscribers it was handed to. */
+uint32_t jrpcd_topic_publish(char *name, uint32_t cid,
+			     jrpcd_topic_deliver_t deliver, void *arg)
+{
+	struct jrpcd_topic_desc *topic;
+	struct jrpcd_sub_desc *sub;
+	uint32_t num = 0;
+
+	topic = jrpcd_topic_find(name);
+	if (topic == NULL) {
+		return 0;
+	}
+	topic->published++;
+
+	LIST_FOREACH(sub, &topic->subs, entries) {
+		if (sub->cid != cid) {
+			deliver(sub->node, arg);
+			num++;
+		}
+	}
+	return num;
+}
+
+void jrpcd_topic_dump(void)
+{
+	struct jrpcd_topic_desc *topic;
+	uint16_t i;
+
+	for (i = 0; i < TOPIC_HASH_SZ; i++) {
+		LIST_FOREACH(topic, &topic_hash[i], entries) {
+			LOG_VERBOSE("Topic %s : %d subscribers, %llu published",
+				    topic->name, topic->num_subs,
+				    (unsigned long long)topic->published);
+		}
+	}
+}
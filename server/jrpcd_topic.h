@@ -0,0 +1,33 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#ifndef JRPCD_TOPIC_H
+#define JRPCD_TOPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define JRPCD_TOPIC_NAME_SZ		32
+
+/* Called for every subscriber of a topic that is published to. node is */
+/* what the subscriber gave jrpcd_topic_subscribe(). */
+typedef void (*jrpcd_topic_deliver_t) (void *node, void *arg);
+
+/* Not thread safe, jrpcd serializes all access under its node lock. */
+int8_t jrpcd_topic_init(void);
+void jrpcd_topic_cleanup(void);
+int8_t jrpcd_topic_subscribe(char *topic, uint32_t cid, void *node);
+int8_t jrpcd_topic_unsubscribe(char *topic, uint32_t cid);
+void jrpcd_topic_purge(uint32_t cid);
+int8_t jrpcd_topic_get(uint32_t cid, uint16_t index, char *name);
+uint32_t jrpcd_topic_publish(char *topic, uint32_t cid,
+			     jrpcd_topic_deliver_t deliver, void *arg);
+void jrpcd_topic_dump(void);
+
+#endif				//JRPCD_TOPIC_H
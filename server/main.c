@@ -18,6 +18,7 @@
 #include "version.h"
 #include "debug.h"
 #include "jrpcd_server.h"
+#include "jrpcd_queue.h"
 #include "jrpcd.h"
 
 #define DEFAULT_PORT                           5000
@@ -30,19 +31,26 @@ void handle_sigint(int signal)
 
 void print_usage()
 {
-	printf("jrpcd -i <host> -p <port> \n");
+	printf("jrpcd -i <host> -p <port> -b <tx budget bytes> "
+	       "-o <oldest|newest|disconnect> -P <peer host:port> "
+	       "-U <upgrade socket path>\n");
 	exit(0);
 }
 
 int main(int argc, char *argv[])
 {
 	int32_t c;
+	int32_t bytes;
 	char *host = NULL;
 	uint32_t port = DEFAULT_PORT;
+	uint32_t budget = JRPCD_TX_BUDGET_DEF;
+	uint8_t policy = JRPCD_Q_SHED_NEWEST;
+	bool hugepages = false;
+	bool arena = true;	/* The daemon has the process to itself */
 
 	LOG_INFO("jrpcd %d.%d.%d starting...", VER_MAJ, VER_MIN, VER_PATCH);
 
-	while ((c = getopt(argc, argv, "i:p:")) != -1) {
+	while ((c = getopt(argc, argv, "i:p:b:o:P:U:HA")) != -1) {
 		switch (c) {
 		case 'i':
 			host = optarg;
@@ -50,6 +58,43 @@ int main(int argc, char *argv[])
 		case 'p':
 			port = atoi(optarg);
 			break;
+		case 'b':
+			/* Under one message nothing could ever be queued */
+			bytes = atoi(optarg);
+			if (bytes < (int32_t)JRPCD_MAX_MSG_SZ) {
+				print_usage();
+			}
+			budget = bytes;
+			break;
+		case 'o':
+			/* Overflow policy for nodes over their output budget */
+			if (strcmp(optarg, "oldest") == 0) {
+				policy = JRPCD_Q_SHED_OLDEST;
+			} else if (strcmp(optarg, "newest") == 0) {
+				policy = JRPCD_Q_SHED_NEWEST;
+			} else if (strcmp(optarg, "disconnect") == 0) {
+				policy = JRPCD_Q_DISCONNECT;
+			} else {
+				print_usage();
+			}
+			break;
+		case 'P':
+			/* Peer daemon, may be given several times */
+			if (jrpcd_set_peer(optarg) < 0) {
+				print_usage();
+			}
+			break;
+		case 'U':
+			/* Take over from the daemon on this Unix socket, */
+			/* then listen on it for the next one */
+			jrpcd_set_upgrade(optarg);
+			break;
+		case 'H':
+			hugepages = true;
+			break;
+		case 'A':
+			arena = false;
+			break;
 		case 'h':
 			print_usage();
 			break;
@@ -60,7 +105,9 @@ int main(int argc, char *argv[])
 	signal(SIGINT, handle_sigint);
 	signal(SIGTERM, handle_sigint);
 
-	jrpcd_main(host, port);
+	jrpcd_set_tx_budget(budget, policy);
+	jrpcd_set_hugepages(hugepages);
+	jrpcd_set_arena(arena);
 
-	return 0;
+	return (jrpcd_main(host, port) < 0) ? 1 : 0;
 }
@@ -0,0 +1,49 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "jrpc.h"
+
+/* Counts json allocations done by libjrpc per call to "app_sum".
+ * Run once with JRPC_ARENA=1 and once with JRPC_ARENA=0 to compare. */
+
+#define NUM_CALLS	1000
+
+int main(int argc, char *argv[])
+{
+	struct ej_alloc_stats s1, s2;
+	int i, result, calls;
+
+	calls = (argc > 1) ? atoi(argv[1]) : NUM_CALLS;
+
+	printf("Initializing jrpc...\n");
+	jrpc_init();
+
+	jrpc_register("app_allocs", 0, NULL, NULL);
+
+	/* warm up, the first call creates the arena chunks */
+	jrpc_call("app_sum", "add2", &result, "%d%d", 1, 2);
+
+	ej_alloc_stats(&s1);
+	for (i = 0; i < calls; i++)
+		jrpc_call("app_sum", "add2", &result, "%d%d", i, i);
+	ej_alloc_stats(&s2);
+
+	printf("%d calls of add2\n", calls);
+	printf("heap allocs per call  = %.2f\n",
+	       (double)(s2.heap - s1.heap) / calls);
+	printf("arena allocs per call = %.2f\n",
+	       (double)(s2.arena - s1.arena) / calls);
+	printf("arena chunks created  = %lu\n", s2.chunks - s1.chunks);
+
+	jrpc_exit();
+	return 0;
+}
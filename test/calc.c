@@ -0,0 +1,159 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "calc_jrpc.h"
+
+/* Generated stubs demo, needs jrpcd running.
+ *   calc [calls]
+ * The interfaces of calc.idl are served by process app_calc through the
+ * skeletons jrpcgen made of it. The main process calls them with the stubs,
+ * checks that a call with args of the wrong types fails, and times the add
+ * stub against jrpc_call with an afmt string, both to another process and
+ * to a node of its own. Exit status is the number of failed checks. */
+
+#define VERSION		46
+
+int calc_add_impl(int a, int b, int *ret)
+{
+	*ret = a + b;
+	return 0;
+}
+
+int calc_greet_impl(const char *who, int times, char *ret)
+{
+	int i, len = 0;
+
+	ret[0] = '\0';
+	for (i = 0; (i < times) && (len < BUFF_SIZE / 2); i++)
+		len += snprintf(ret + len, BUFF_SIZE - len, "%shi %s",
+				i ? " " : "", who);
+	return 0;
+}
+
+int calc_square_impl(int x, int *ret)
+{
+	*ret = x * x;
+	return 0;
+}
+
+int calc_version_impl(int *ret)
+{
+	*ret = VERSION;
+	return 0;
+}
+
+int Failed;
+
+void check(int ok, const char *what)
+{
+	if (!ok) {
+		printf("%s FAILED\n", what);
+		Failed++;
+	}
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+void bench(char *node, int calls)
+{
+	struct timeval t1;
+	int i, ret, wrong = 0;
+	long c_us, stub_us;
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < calls; i++) {
+		ret = -1;
+		if ((jrpc_call(node, "add", &ret, "%d%d", i, 1) < 0) ||
+		    (ret != i + 1))
+			wrong++;
+	}
+	c_us = elapsed_us(&t1);
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < calls; i++) {
+		ret = -1;
+		if ((calc_add(node, i, 1, &ret) < 0) || (ret != i + 1))
+			wrong++;
+	}
+	stub_us = elapsed_us(&t1);
+
+	printf("%d calls to %s: jrpc_call %.2f us, calc_add %.2f us per call, "
+	       "%d wrong\n", calls, node, (double)c_us / calls,
+	       (double)stub_us / calls, wrong);
+	Failed += wrong;
+}
+
+int main(int argc, char *argv[])
+{
+	char sret[BUFF_SIZE];
+	int calls = 2000, ret;
+	pid_t pid;
+
+	if (argc > 1)
+		calls = atoi(argv[1]);
+
+	pid = fork();
+	if (pid == 0) {
+		jrpc_init();
+		calc_register("app_calc");
+		pause();
+		exit(0);
+	}
+	usleep(300 * 1000);
+
+	jrpc_init();
+	calc_register("app_calc_main");
+
+	check((calc_add("app_calc", 40, 2, &ret) == 0) && (ret == 42), "add");
+	check((calc_square("app_calc", 7, &ret) == 0) && (ret == 49),
+	      "square");
+	check((calc_version("app_calc", &ret) == 0) && (ret == VERSION),
+	      "version");
+	check((calc_greet("app_calc", "bob", 2, sret) == 0) &&
+	      (strcmp(sret, "hi bob hi bob") == 0), "greet");
+
+	/* strings go out as they are, whatever is in them */
+	check((calc_greet("app_calc", "\"q\" \\ \t\n\x01 \xc3\xa9", 1,
+			  sret) == 0) &&
+	      (strcmp(sret, "hi \"q\" \\ \t\n\x01 \xc3\xa9") == 0),
+	      "greet with escapes");
+
+	/* C peers see the same interfaces */
+	check((jrpc_call("app_calc", "add", &ret, "%d%d", 1, 2) == 0) &&
+	      (ret == 3), "add from jrpc_call");
+
+	/* skeletons check what comes over the wire */
+	check(jrpc_calltm("app_calc", "add", 300, &ret, "%s%d", "1", 2) < 0,
+	      "add(\"1\", 2) rejected");
+	check(jrpc_calltm("app_calc", "add", 300, &ret, "%d", 1) < 0,
+	      "add(1) rejected");
+
+	bench("app_calc", calls);
+	bench("app_calc_main", calls * 100);
+
+	printf("%d failed checks\n", Failed);
+	jrpc_exit();
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return Failed;
+}
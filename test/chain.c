@@ -0,0 +1,130 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "jrpc.h"
+
+/* Call chaining demo.
+ *   chain serve                 node app_inc with inc, node app_dbl with dbl
+ *   chain call <n> <value>      runs inc, dbl, inc n times
+ * The caller runs the pipeline once with jrpc_call_chain and once step by
+ * step with jrpc_call, and prints how long each took. */
+
+int inc(void *ret, char *afmt);
+int dbl(void *ret, char *afmt);
+
+struct if_details inc_ifs[] = {
+	{"inc", inc, "%d", "%d"}
+};
+
+struct if_details dbl_ifs[] = {
+	{"dbl", dbl, "%d", "%d"}
+};
+
+int inc(void *ret, char *afmt)
+{
+	int val;
+
+	if (jrpc_scanargs(afmt, &val) < 0)
+		return -1;
+
+	*RETURN_POINTER(ret, int) = val + 1;
+	return 0;
+}
+
+int dbl(void *ret, char *afmt)
+{
+	int val;
+
+	if (jrpc_scanargs(afmt, &val) < 0)
+		return -1;
+
+	*RETURN_POINTER(ret, int) = val * 2;
+	return 0;
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+int serve(void)
+{
+	/* one connection per node, fork before the library starts */
+	if (fork() == 0) {
+		jrpc_init();
+		jrpc_register("app_dbl", 1, dbl_ifs, NULL);
+		printf("app_dbl serving dbl\n");
+	} else {
+		jrpc_init();
+		jrpc_register("app_inc", 1, inc_ifs, NULL);
+		printf("app_inc serving inc\n");
+	}
+	fflush(stdout);
+	sleep(5 * 60);
+
+	jrpc_exit();
+	return 0;
+}
+
+int call(int calls, int value)
+{
+	struct jrpc_step steps[] = {
+		{"app_inc", "inc"},
+		{"app_dbl", "dbl"},
+		{"app_inc", "inc"}
+	};
+	struct timeval t1;
+	int i, val, chained = 0, stepped = 0;
+
+	jrpc_init();
+	jrpc_register("app_chain", 0, NULL, NULL);
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < calls; i++) {
+		if (jrpc_call_chain(steps, 3, &chained, "%d", value) < 0)
+			break;
+	}
+	printf("jrpc_call_chain x %d took %ld us, result %d\n", calls,
+	       elapsed_us(&t1), chained);
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < calls; i++) {
+		if ((jrpc_call("app_inc", "inc", &val, "%d", value) < 0) ||
+		    (jrpc_call("app_dbl", "dbl", &val, "%d", val) < 0) ||
+		    (jrpc_call("app_inc", "inc", &stepped, "%d", val) < 0))
+			break;
+	}
+	printf("jrpc_call step by step x %d took %ld us, result %d\n", calls,
+	       elapsed_us(&t1), stepped);
+
+	jrpc_exit();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc > 1) && (strcmp(argv[1], "serve") == 0))
+		return serve();
+
+	if ((argc > 3) && (strcmp(argv[1], "call") == 0))
+		return call(atoi(argv[2]), atoi(argv[3]));
+
+	printf("usage: chain serve\n");
+	printf("       chain call <n> <value>\n");
+	return 1;
+}
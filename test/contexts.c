@@ -0,0 +1,130 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "jrpc.h"
+
+/* Context demo, needs jrpcd running.
+ *   contexts [threads] [calls]
+ * Every thread opens a context of its own and registers node app_ctx<i>
+ * on it, whose add returns the sum of its args. Then all threads call the
+ * node of the next thread at once, each over its own connection, and
+ * check the sums. Exit status is the number of failed calls. */
+
+#define MAX_THREADS	16
+
+struct worker {
+	int index;
+	int threads;
+	int calls;
+	int failed;
+	jrpc_ctx_t *ctx;
+	pthread_t tid;
+};
+
+int add(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"add", add, "%d%d", "%d"}
+};
+
+pthread_barrier_t Ready;
+
+int add(void *ret, char *afmt)
+{
+	int a, b;
+
+	if (jrpc_scanargs(afmt, &a, &b) < 0)
+		return -1;
+	*RETURN_POINTER(ret, int) = a + b;
+	return 0;
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+void *worker(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	char name[NAME_SIZE];
+	int i, ret;
+
+	/* the node is up once jrpcd acked the registration */
+	snprintf(name, sizeof(name), "app_ctx%d", w->index);
+	w->ctx = jrpc_ctx_open();
+	if ((w->ctx == NULL) ||
+	    (jrpc_ctx_register(w->ctx, name, 1, ifs, NULL) < 0)) {
+		printf("%s: can't open a context\n", name);
+		w->failed = w->calls;
+	}
+	pthread_barrier_wait(&Ready);
+
+	/* all nodes are up once everyone passed the barrier */
+	snprintf(name, sizeof(name), "app_ctx%d", (w->index + 1) % w->threads);
+	for (i = 0; (w->ctx != NULL) && (i < w->calls); i++) {
+		ret = -1;
+		if ((jrpc_ctx_call(w->ctx, name, "add", &ret, "%d%d", i,
+				   w->index) < 0) || (ret != i + w->index))
+			w->failed++;
+	}
+
+	/* the node stays up till the one calling it is done */
+	pthread_barrier_wait(&Ready);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct worker w[MAX_THREADS];
+	struct timeval t1;
+	int threads = 4, calls = 1000;
+	int i, failed = 0;
+	long us;
+
+	if (argc > 1)
+		threads = atoi(argv[1]);
+	if (argc > 2)
+		calls = atoi(argv[2]);
+	if ((threads < 1) || (threads > MAX_THREADS)) {
+		printf("usage: contexts [threads 1..%d] [calls]\n", MAX_THREADS);
+		return 1;
+	}
+
+	pthread_barrier_init(&Ready, NULL, threads);
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < threads; i++) {
+		memset(&w[i], 0, sizeof(w[i]));
+		w[i].index = i;
+		w[i].threads = threads;
+		w[i].calls = calls;
+		pthread_create(&w[i].tid, NULL, worker, &w[i]);
+	}
+	for (i = 0; i < threads; i++) {
+		pthread_join(w[i].tid, NULL);
+		failed += w[i].failed;
+		if (w[i].ctx != NULL)
+			jrpc_ctx_close(w[i].ctx);
+	}
+	us = elapsed_us(&t1);
+	pthread_barrier_destroy(&Ready);
+
+	printf("%d contexts, %d calls each in %ld ms, %d failed\n", threads,
+	       calls, us / 1000, failed);
+	return failed;
+}
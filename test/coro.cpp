@@ -0,0 +1,172 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <atomic>
+#include <latch>
+#include <string>
+
+#include "jrpc.hpp"
+
+/* Coroutine demo, needs jrpcd running.
+ *   coro [coroutines] [calls]
+ * Process app_coro_leaf has a plain add2. Process app_coro serves add3 as a
+ * coroutine, which co_awaits two add2 of the leaf, and hello, which returns
+ * a string. The main process runs many coroutines at once, each making
+ * calls to add3 in a row, all on the one thread of its connection, and
+ * compares that with blocking calls. Exit status is the number of failed
+ * checks. */
+
+#define TIMEOUT_MS	2000
+
+int add2(void *ret, char *afmt)
+{
+	int a, b;
+
+	if (jrpc_scanargs(afmt, &a, &b) < 0)
+		return -1;
+	*RETURN_POINTER(ret, int) = a + b;
+	return 0;
+}
+
+struct if_details leaf_ifs[] = {
+	{"add2", add2, "%d%d", "%d"}
+};
+
+jrpc::task<int> add3(int a, int b, int c)
+{
+	int ab = co_await jrpc::call<int>("app_coro_leaf", "add2", a, b);
+
+	co_return co_await jrpc::call<int>("app_coro_leaf", "add2", ab, c);
+}
+
+jrpc::task<std::string> hello(std::string who)
+{
+	co_return "hello " + who;
+}
+
+void serve(const char *node, int n_if, struct if_details *ifs)
+{
+	jrpc_init();
+	jrpc_register((char *)node, n_if, ifs, NULL);
+	pause();
+	exit(0);
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+std::atomic<int> Failed;
+
+jrpc::task<void> checks()
+{
+	std::string s = co_await jrpc::call<std::string>("app_coro", "hello",
+							  "coro");
+
+	if (s != "hello coro") {
+		printf("hello FAILED, got \"%s\"\n", s.c_str());
+		Failed++;
+	}
+	try {
+		co_await jrpc::calltm<int>("app_coro_none", "add3", 500, 1, 2, 3);
+		printf("call to a missing node did not throw\n");
+		Failed++;
+	} catch (jrpc::error &e) {
+		printf("call to a missing node: %s\n", e.what());
+	}
+}
+
+jrpc::task<void> worker(int index, int calls, std::latch *done)
+{
+	for (int i = 0; i < calls; i++) {
+		try {
+			int r = co_await jrpc::call<int>("app_coro", "add3", i,
+							 index, 1);
+			if (r != i + index + 1)
+				Failed++;
+		} catch (jrpc::error &) {
+			Failed++;
+		}
+	}
+	done->count_down();
+}
+
+int main(int argc, char *argv[])
+{
+	struct if_details coro_ifs[] = {
+		jrpc::bind<add3>("add3"),
+		jrpc::bind<hello>("hello")
+	};
+	struct timeval t1;
+	int coroutines = 32, calls = 200;
+	int i, ret;
+	pid_t leaf, coro;
+
+	if (argc > 1)
+		coroutines = atoi(argv[1]);
+	if (argc > 2)
+		calls = atoi(argv[2]);
+	if ((coroutines < 1) || (coroutines > 32)) {
+		printf("usage: coro [coroutines 1..32] [calls]\n");
+		return 1;
+	}
+
+	leaf = fork();
+	if (leaf == 0)
+		serve("app_coro_leaf", 1, leaf_ifs);
+	coro = fork();
+	if (coro == 0)
+		serve("app_coro", 2, coro_ifs);
+	usleep(300 * 1000);
+
+	jrpc_init();
+	jrpc_register((char *)"app_coro_main", 0, NULL, NULL);
+
+	jrpc::sync_wait(checks());
+
+	/* blocking calls, one in flight at a time */
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < calls; i++) {
+		ret = -1;
+		if ((jrpc_calltm((char *)"app_coro", (char *)"add3", TIMEOUT_MS,
+				 &ret, (char *)"%d%d%d", i, 0, 1) < 0) ||
+		    (ret != i + 1))
+			Failed++;
+	}
+	printf("%d blocking calls: %ld us per call\n", calls,
+	       elapsed_us(&t1) / calls);
+
+	/* coroutines, one call of each in flight at a time */
+	std::latch done(coroutines);
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < coroutines; i++)
+		jrpc::spawn(worker(i, calls, &done));
+	done.wait();
+	printf("%d coroutines x %d calls: %ld us per call\n", coroutines, calls,
+	       elapsed_us(&t1) / (coroutines * calls));
+
+	printf("%d failed checks\n", Failed.load());
+	jrpc_exit();
+	kill(leaf, SIGTERM);
+	kill(coro, SIGTERM);
+	waitpid(leaf, NULL, 0);
+	waitpid(coro, NULL, 0);
+	return Failed;
+}
@@ -0,0 +1,121 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "jrpc.h"
+
+/* Deadline demo.
+ *   deadline serve                  node app_slow, work takes 200 ms
+ *   deadline call <n> <timeout ms>  n threads call work at once
+ * The node runs one call at a time, so most callers give up. Calls past
+ * their deadline are dropped by jrpcd or the node instead of being run.
+ * The caller prints how often work really ran and the counters of jrpcd. */
+
+#define MAX_CALLERS	64
+
+int Runs;
+int TimeoutMs;
+
+int work(void *ret, char *afmt);
+int runs(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"work", work, "", "%d"},
+	{"runs", runs, "", "%d"}
+};
+
+int work(void *ret, char *afmt)
+{
+	usleep(200 * 1000);
+	*RETURN_POINTER(ret, int) = ++Runs;
+	return 0;
+}
+
+int runs(void *ret, char *afmt)
+{
+	*RETURN_POINTER(ret, int) = Runs;
+	return 0;
+}
+
+int serve(void)
+{
+	jrpc_init();
+	jrpc_register("app_slow", sizeof(ifs) / sizeof(ifs[0]), ifs, NULL);
+
+	printf("app_slow serving work\n");
+	fflush(stdout);
+	sleep(5 * 60);
+
+	jrpc_exit();
+	return 0;
+}
+
+void *caller(void *arg)
+{
+	int ret;
+
+	if (jrpc_calltm("app_slow", "work", TimeoutMs, &ret, "") < 0)
+		*(int *)arg = 0;
+	else
+		*(int *)arg = 1;
+
+	return NULL;
+}
+
+int call(int n, int timeout_ms)
+{
+	pthread_t tids[MAX_CALLERS];
+	int done[MAX_CALLERS];
+	char stats[JRPC_RESULT_SIZE * 4];
+	int i, ok = 0, ran = 0;
+
+	if (n > MAX_CALLERS)
+		n = MAX_CALLERS;
+	TimeoutMs = timeout_ms;
+
+	jrpc_init();
+	jrpc_register("app_deadline", 0, NULL, NULL);
+
+	for (i = 0; i < n; i++)
+		pthread_create(&tids[i], NULL, caller, &done[i]);
+	for (i = 0; i < n; i++) {
+		pthread_join(tids[i], NULL);
+		ok += done[i];
+	}
+
+	/* let the node catch up with what it still has */
+	sleep(1);
+	jrpc_call("app_slow", "runs", &ran, "");
+	printf("%d of %d calls returned in %d ms, work ran %d times\n", ok,
+	       n, timeout_ms, ran);
+
+	if (jrpc_call("jrpcd", "stats", stats, "") == 0)
+		printf("jrpcd stats:\n%s", stats);
+
+	jrpc_exit();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc > 1) && (strcmp(argv[1], "serve") == 0))
+		return serve();
+
+	if ((argc > 3) && (strcmp(argv[1], "call") == 0))
+		return call(atoi(argv[2]), atoi(argv[3]));
+
+	printf("usage: deadline serve\n");
+	printf("       deadline call <n> <timeout ms>\n");
+	return 1;
+}
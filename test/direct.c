@@ -0,0 +1,137 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "jrpc.h"
+
+/* Direct link demo.
+ *   direct serve <node>        node with an interface add
+ *   direct bench <n> <node>    n calls to add through jrpcd, then links up
+ *                              with the node and makes n calls over the link
+ *   direct self <n>            n calls to add of the node of this process
+ * The node takes direct links with JRPC_DIRECT=1, which serve sets. jrpcd
+ * only brokers the link, the calls over it never reach it. If the
+ * node goes away, calls go through jrpcd again. Calls to the node of the
+ * calling process don't leave it at all. */
+
+int add(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"add", add, "%d%d", "%d"}
+};
+
+int add(void *ret, char *afmt)
+{
+	int a, b;
+
+	if (jrpc_scanargs(afmt, &a, &b) < 0)
+		return -1;
+
+	*RETURN_POINTER(ret, int) = a + b;
+	return 0;
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+int serve(char *node)
+{
+	/* take direct links */
+	setenv("JRPC_DIRECT", "1", 1);
+	jrpc_init();
+	jrpc_register(node, sizeof(ifs) / sizeof(ifs[0]), ifs, NULL);
+
+	printf("%s serving add\n", node);
+	fflush(stdout);
+	sleep(5 * 60);
+
+	jrpc_exit();
+	return 0;
+}
+
+/* returns the number of wrong sums */
+int calls(int n, char *node, char *how)
+{
+	struct timeval t1;
+	int i, sum, wrong = 0;
+	long us;
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < n; i++) {
+		sum = -1;
+		if ((jrpc_call(node, "add", &sum, "%d%d", i, 1) < 0) ||
+		    (sum != i + 1))
+			wrong++;
+	}
+	us = elapsed_us(&t1);
+	printf("%d calls %s: %ld us per call, %d wrong\n", n, how,
+	       n ? us / n : 0, wrong);
+	return wrong;
+}
+
+int bench(int n, char *node)
+{
+	int wrong;
+
+	jrpc_init();
+	jrpc_register("app_direct_bench", 0, NULL, NULL);
+
+	wrong = calls(n, node, "through jrpcd");
+
+	if (jrpc_direct(node) < 0) {
+		printf("could not link up with %s\n", node);
+		jrpc_exit();
+		return 1;
+	}
+	wrong += calls(n, node, "over the link");
+
+	jrpc_exit();
+	return wrong ? 1 : 0;
+}
+
+int self(int n)
+{
+	int wrong;
+
+	jrpc_init();
+	jrpc_register("app_direct_self", sizeof(ifs) / sizeof(ifs[0]), ifs,
+		      NULL);
+
+	wrong = calls(n, "app_direct_self", "within the process");
+
+	jrpc_exit();
+	return wrong ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc > 2) && (strcmp(argv[1], "serve") == 0))
+		return serve(argv[2]);
+
+	if ((argc > 3) && (strcmp(argv[1], "bench") == 0))
+		return bench(atoi(argv[2]), argv[3]);
+
+	if ((argc > 2) && (strcmp(argv[1], "self") == 0))
+		return self(atoi(argv[2]));
+
+	printf("usage: direct serve <node>\n");
+	printf("       direct bench <n> <node>\n");
+	printf("       direct self <n>\n");
+	return 1;
+}
@@ -0,0 +1,174 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <jansson.h>
+
+#include "jrpc.h"
+#include "jrpcd.h"
+#include "jrpcd_embed.h"
+
+/* jrpcd linked into a process.
+ *   embed [calls] [port]
+ * Starts jrpcd in the process, serving port for other processes too. The
+ * node app_embed attaches to it in memory with libjrpc. A second component
+ * of the process calls add of app_embed through jrpcd, speaking to it
+ * with jrpcd_embed_send and jrpcd_embed_recv: no socket on the way. Then
+ * another process makes the same calls over a socket to jrpcd. */
+
+int add(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"add", add, "%d%d", "%d"}
+};
+
+int add(void *ret, char *afmt)
+{
+	int a, b;
+
+	if (jrpc_scanargs(afmt, &a, &b) < 0)
+		return -1;
+
+	*RETURN_POINTER(ret, int) = a + b;
+	return 0;
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+/* the return value of a message to the component, -1 if there is none */
+int recv_val(void *link)
+{
+	json_t *jroot;
+	void *msg;
+	int len, val = -1;
+
+	len = jrpcd_embed_recv(link, &msg);
+	if (msg == NULL)
+		return -1;
+	jroot = json_loadb(msg, len, 0, NULL);
+	jrpcd_embed_release(msg);
+	if (jroot != NULL) {
+		val = json_integer_value(json_object_get(json_object_get(
+				jroot, "ret"), "val"));
+		json_decref(jroot);
+	}
+	return val;
+}
+
+/* returns the number of wrong sums */
+int in_memory(int n)
+{
+	struct timeval t1;
+	char msg[BUFF_SIZE];
+	void *link;
+	int i, len, wrong = 0;
+
+	link = jrpcd_embed_attach();
+	len = snprintf(msg, sizeof(msg), "{\"api\":\"register\","
+		       "\"snode\":\"app_embed_caller\",\"interfaces\":[]}");
+	jrpcd_embed_send(link, (uint8_t *)msg, len);
+	recv_val(link);
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < n; i++) {
+		len = snprintf(msg, sizeof(msg), "{\"api\":\"call\","
+			       "\"snode\":\"app_embed_caller\","
+			       "\"dnode\":\"app_embed\",\"if\":\"add\","
+			       "\"id\":%d,\"args\":[{\"type\":\"%%d\","
+			       "\"val\":%d},{\"type\":\"%%d\",\"val\":1}]}",
+			       i + 1, i);
+		jrpcd_embed_send(link, (uint8_t *)msg, len);
+		if (recv_val(link) != i + 1)
+			wrong++;
+	}
+	printf("%d calls in memory: %ld us per call, %d wrong\n", n,
+	       n ? elapsed_us(&t1) / n : 0, wrong);
+
+	len = snprintf(msg, sizeof(msg), "{\"api\":\"exit\","
+		       "\"snode\":\"app_embed_caller\"}");
+	jrpcd_embed_send(link, (uint8_t *)msg, len);
+	jrpcd_embed_detach(link);
+	return wrong;
+}
+
+/* another process calling over a socket */
+int over_socket(int n)
+{
+	struct timeval t1;
+	int i, sum, wrong = 0;
+
+	jrpc_init();
+	jrpc_register("app_embed_remote", 0, NULL, NULL);
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < n; i++) {
+		sum = -1;
+		if ((jrpc_call("app_embed", "add", &sum, "%d%d", i, 1) < 0) ||
+		    (sum != i + 1))
+			wrong++;
+	}
+	printf("%d calls over a socket: %ld us per call, %d wrong\n", n,
+	       n ? elapsed_us(&t1) / n : 0, wrong);
+
+	jrpc_exit();
+	return wrong;
+}
+
+int main(int argc, char *argv[])
+{
+	int n = 2000, port = 7300, wrong, status;
+	char buf[16], calls[16];
+	pid_t pid;
+
+	/* the child, JRPC_PORT is set */
+	if ((argc > 2) && (strcmp(argv[1], "socket") == 0))
+		return over_socket(atoi(argv[2])) ? 1 : 0;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	if (argc > 2)
+		port = atoi(argv[2]);
+	snprintf(buf, sizeof(buf), "%d", port);
+	setenv("JRPC_PORT", buf, 1);
+
+	if (jrpcd_embed_start(NULL, port) < 0) {
+		printf("could not start jrpcd on port %d\n", port);
+		return 1;
+	}
+	jrpc_init_embedded(&jrpcd_transport);
+	jrpc_register("app_embed", sizeof(ifs) / sizeof(ifs[0]), ifs, NULL);
+
+	wrong = in_memory(n);
+
+	/* libjrpc of this process is taken, the other one is a child */
+	fflush(stdout);
+	snprintf(calls, sizeof(calls), "%d", n);
+	pid = fork();
+	if (pid == 0) {
+		execl(argv[0], argv[0], "socket", calls, NULL);
+		exit(1);
+	}
+	waitpid(pid, &status, 0);
+	wrong += WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+	jrpc_exit();
+	jrpcd_embed_stop();
+	return wrong ? 1 : 0;
+}
@@ -0,0 +1,108 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "jrpc.h"
+
+/* Scatter-gather demo.
+ *   fanout serve <name> <delay ms>   node whose getinfo takes delay ms
+ *   fanout call <nodes>              e.g. "app_*" or "app_a,app_b"
+ * The caller runs getinfo on all nodes once with jrpc_call_many and once
+ * node by node with jrpc_call, and prints how long each took. */
+
+#define MAX_RESULTS	32
+#define TIMEOUT_MS	2000
+
+int DelayMs;
+
+int getinfo(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"getinfo", getinfo, "", "%s"}
+};
+
+int getinfo(void *ret, char *afmt)
+{
+	usleep(DelayMs * 1000);
+	sprintf(RETURN_POINTER(ret, char), "pid %d, %d ms", getpid(), DelayMs);
+
+	return 0;
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+int serve(char *name, int delay)
+{
+	DelayMs = delay;
+
+	jrpc_init();
+	jrpc_register(name, sizeof(ifs) / sizeof(ifs[0]), ifs, NULL);
+
+	printf("%s serving getinfo in %d ms\n", name, delay);
+	sleep(5 * 60);
+
+	jrpc_exit();
+	return 0;
+}
+
+int call(char *nodes)
+{
+	struct jrpc_result *res;
+	struct timeval t1;
+	char string[BUFF_SIZE];
+	int i, n;
+
+	res = calloc(MAX_RESULTS, sizeof(struct jrpc_result));
+	if (res == NULL)
+		return 1;
+
+	jrpc_init();
+	jrpc_register("app_fanout", 0, NULL, NULL);
+
+	gettimeofday(&t1, NULL);
+	n = jrpc_call_many(nodes, "getinfo", res, MAX_RESULTS, TIMEOUT_MS, "");
+	printf("jrpc_call_many to %d nodes took %ld us\n", n, elapsed_us(&t1));
+
+	for (i = 0; i < n && i < MAX_RESULTS; i++)
+		printf("  %-16s status %d : %s\n", res[i].node, res[i].status,
+		       res[i].sval);
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < n && i < MAX_RESULTS; i++)
+		jrpc_call(res[i].node, "getinfo", string, "");
+	printf("jrpc_call one by one took %ld us\n", elapsed_us(&t1));
+
+	jrpc_exit();
+	free(res);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc > 3) && (strcmp(argv[1], "serve") == 0))
+		return serve(argv[2], atoi(argv[3]));
+
+	if ((argc > 2) && (strcmp(argv[1], "call") == 0))
+		return call(argv[2]);
+
+	printf("usage: fanout serve <name> <delay ms>\n");
+	printf("       fanout call <nodes>\n");
+	return 1;
+}
@@ -0,0 +1,199 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <libgen.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "jrpc.h"
+
+/* Federation test harness.
+ *   federation [daemons] [base port] [calls]
+ * Starts daemons on localhost ports base, base + 1, ... each peering with
+ * the ones started before it, so they end up fully meshed. Every daemon gets
+ * a node app_fed<i> whose interface where returns i. Then a caller on every
+ * daemon calls where on every node, checks that the call reached the right
+ * daemon and times calls to a local and to a remote node. jrpcd is expected
+ * next to this binary. Exit status is the number of failed checks. */
+
+#define MAX_DAEMONS	4
+#define LINK_WAIT_MS	500
+
+int Index;
+pid_t Daemons[MAX_DAEMONS];
+pid_t Nodes[MAX_DAEMONS];
+
+int where(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"where", where, "", "%d"}
+};
+
+int where(void *ret, char *afmt)
+{
+	*RETURN_POINTER(ret, int) = Index;
+	return 0;
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+void use_daemon(int port)
+{
+	char buf[16];
+
+	snprintf(buf, sizeof(buf), "%d", port);
+	setenv("JRPC_PORT", buf, 1);
+}
+
+pid_t start_daemon(char *jrpcd, int i, int base)
+{
+	char args[2 * MAX_DAEMONS + 4][32];
+	char *argv[2 * MAX_DAEMONS + 4];
+	int j, n = 0;
+	pid_t pid;
+
+	snprintf(args[n++], 32, "%s", "jrpcd");
+	snprintf(args[n++], 32, "%s", "-p");
+	snprintf(args[n++], 32, "%d", base + i);
+	for (j = 0; j < i; j++) {
+		snprintf(args[n++], 32, "%s", "-P");
+		snprintf(args[n++], 32, "127.0.0.1:%d", base + j);
+	}
+	for (j = 0; j < n; j++)
+		argv[j] = args[j];
+	argv[n] = NULL;
+
+	pid = fork();
+	if (pid == 0) {
+		if (getenv("FED_VERBOSE") == NULL) {
+			freopen("/dev/null", "w", stdout);
+			freopen("/dev/null", "w", stderr);
+		}
+		execv(jrpcd, argv);
+		perror("execv");
+		exit(1);
+	}
+	return pid;
+}
+
+pid_t start_node(int i, int base)
+{
+	char name[NAME_SIZE];
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		Index = i;
+		snprintf(name, sizeof(name), "app_fed%d", i);
+		use_daemon(base + i);
+		jrpc_init();
+		jrpc_register(name, sizeof(ifs) / sizeof(ifs[0]), ifs, NULL);
+		pause();
+		exit(0);
+	}
+	return pid;
+}
+
+/* Runs on daemon i, returns the number of failed checks */
+int caller(int i, int n, int base, int calls)
+{
+	struct timeval t1;
+	char name[NAME_SIZE];
+	int j, k, ret, failed = 0;
+	long us;
+
+	use_daemon(base + i);
+	jrpc_init();
+	snprintf(name, sizeof(name), "app_fed_caller%d", i);
+	jrpc_register(name, 0, NULL, NULL);
+
+	for (j = 0; j < n; j++) {
+		snprintf(name, sizeof(name), "app_fed%d", j);
+		ret = -1;
+		if ((jrpc_call(name, "where", &ret, "") < 0) || (ret != j)) {
+			printf("daemon %d: %s FAILED, got %d\n", i, name, ret);
+			failed++;
+			continue;
+		}
+
+		gettimeofday(&t1, NULL);
+		for (k = 0; k < calls; k++)
+			jrpc_call(name, "where", &ret, "");
+		us = elapsed_us(&t1);
+		printf("daemon %d: %s on daemon %d ok, %s, %ld us per call\n",
+		       i, name, ret, (i == j) ? "local " : "remote",
+		       calls ? us / calls : 0);
+	}
+
+	jrpc_exit();
+	return failed;
+}
+
+int main(int argc, char *argv[])
+{
+	char jrpcd[1024];
+	int n = 3, base = 7100, calls = 200;
+	int i, status, failed = 0;
+	pid_t pid;
+
+	if (argc > 1)
+		n = atoi(argv[1]);
+	if (argc > 2)
+		base = atoi(argv[2]);
+	if (argc > 3)
+		calls = atoi(argv[3]);
+	if ((n < 1) || (n > MAX_DAEMONS)) {
+		printf("usage: federation [daemons 1..%d] [base port] "
+		       "[calls]\n", MAX_DAEMONS);
+		return 1;
+	}
+	snprintf(jrpcd, sizeof(jrpcd), "%s/jrpcd", dirname(strdup(argv[0])));
+
+	/* Daemons first, each links up with the ones before it */
+	for (i = 0; i < n; i++) {
+		Daemons[i] = start_daemon(jrpcd, i, base);
+		usleep(100 * 1000);
+	}
+	usleep(LINK_WAIT_MS * 1000);
+
+	for (i = 0; i < n; i++)
+		Nodes[i] = start_node(i, base);
+	usleep(LINK_WAIT_MS * 1000);
+
+	for (i = 0; i < n; i++) {
+		pid = fork();
+		if (pid == 0)
+			exit(caller(i, n, base, calls));
+		waitpid(pid, &status, 0);
+		failed += WIFEXITED(status) ? WEXITSTATUS(status) : n;
+	}
+
+	for (i = 0; i < n; i++) {
+		kill(Nodes[i], SIGTERM);
+		waitpid(Nodes[i], NULL, 0);
+	}
+	for (i = 0; i < n; i++) {
+		kill(Daemons[i], SIGINT);
+		waitpid(Daemons[i], NULL, 0);
+	}
+
+	printf("%d daemons, %d failed checks\n", n, failed);
+	return failed;
+}
@@ -0,0 +1,118 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "jrpc.h"
+
+/* Load balanced service group demo.
+ *   group serve <rr|loc|hash>   start as many of these as you like
+ *   group call <n> [keys]       spreads n calls over the running servers
+ * "work" returns the pid of the server that ran it. With hash, calls are
+ * keyed by i % keys, so every key should stick to one server. */
+
+#define MAX_SERVERS	16
+#define NUM_KEYS	8
+
+int work(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"work", work, "%d", "%d"}
+};
+
+int work(void *ret, char *afmt)
+{
+	int key;
+
+	if (jrpc_scanargs(afmt, &key) < 0)
+		return -1;
+
+	*RETURN_POINTER(ret, int) = getpid();
+	return 0;
+}
+
+int serve(char *policy)
+{
+	enum jrpc_group group = JRPC_GROUP_RR;
+
+	if (strcmp(policy, "loc") == 0)
+		group = JRPC_GROUP_LOC;
+	else if (strcmp(policy, "hash") == 0)
+		group = JRPC_GROUP_HASH;
+
+	jrpc_init();
+	jrpc_register_group("app_group", sizeof(ifs) / sizeof(ifs[0]), ifs,
+			    group, 0);
+
+	printf("pid %d serving app_group (%s)\n", getpid(), policy);
+	sleep(5 * 60);
+
+	jrpc_exit();
+	return 0;
+}
+
+int call(int calls, int keys)
+{
+	int pids[MAX_SERVERS], counts[MAX_SERVERS], owner[NUM_KEYS];
+	int i, j, pid, n = 0, moved = 0;
+
+	memset(owner, 0, sizeof(owner));
+
+	jrpc_init();
+	jrpc_register("app_group_caller", 0, NULL, NULL);
+
+	for (i = 0; i < calls; i++) {
+		if (jrpc_call("app_group", "work", &pid, "%d", i % keys) < 0)
+			continue;
+
+		/* key affinity, only meaningful for hash groups */
+		if ((owner[i % keys] != 0) && (owner[i % keys] != pid))
+			moved++;
+		owner[i % keys] = pid;
+
+		for (j = 0; (j < n) && (pids[j] != pid); j++)
+			;
+		if (j == n) {
+			if (n == MAX_SERVERS)
+				continue;
+			pids[n] = pid;
+			counts[n++] = 0;
+		}
+		counts[j]++;
+	}
+
+	for (j = 0; j < n; j++)
+		printf("pid %d served %d calls\n", pids[j], counts[j]);
+	printf("keys that changed server = %d\n", moved);
+
+	jrpc_exit();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int keys;
+
+	if ((argc > 2) && (strcmp(argv[1], "serve") == 0))
+		return serve(argv[2]);
+
+	if ((argc > 2) && (strcmp(argv[1], "call") == 0)) {
+		keys = (argc > 3) ? atoi(argv[3]) : NUM_KEYS;
+		if ((keys <= 0) || (keys > NUM_KEYS))
+			keys = NUM_KEYS;
+		return call(atoi(argv[2]), keys);
+	}
+
+	printf("usage: group serve <rr|loc|hash>\n");
+	printf("       group call <n> [keys]\n");
+	return 1;
+}
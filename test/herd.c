@@ -0,0 +1,101 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "jrpc.h"
+
+/* Thundering herd demo.
+ *   herd serve              node app_herd, report takes 500 ms
+ *   herd call <n>           n threads call report at the same moment
+ * report is cacheable, so jrpcd forwards one of the calls and hands its
+ * return to all of them. Each caller prints how many times report ran. */
+
+#define MAX_CALLERS	64
+
+int Runs;
+
+int report(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"report", report, "%d", "%d"}
+};
+
+int report(void *ret, char *afmt)
+{
+	int day;
+
+	if (jrpc_scanargs(afmt, &day) < 0)
+		return -1;
+
+	usleep(500 * 1000);
+	*RETURN_POINTER(ret, int) = ++Runs;
+	return 0;
+}
+
+int serve(void)
+{
+	jrpc_init();
+	jrpc_set_cacheable("app_herd", "report", 100);
+	jrpc_register("app_herd", sizeof(ifs) / sizeof(ifs[0]), ifs, NULL);
+
+	printf("app_herd serving report\n");
+	fflush(stdout);
+	sleep(5 * 60);
+
+	jrpc_exit();
+	return 0;
+}
+
+void *caller(void *arg)
+{
+	int runs = -1;
+
+	jrpc_call("app_herd", "report", &runs, "%d", 1);
+	printf("caller %ld: report ran %d time(s)\n", (long)arg, runs);
+
+	return NULL;
+}
+
+int call(int n)
+{
+	pthread_t tids[MAX_CALLERS];
+	long i;
+
+	if (n > MAX_CALLERS)
+		n = MAX_CALLERS;
+
+	jrpc_init();
+	jrpc_register("app_herd_caller", 0, NULL, NULL);
+
+	for (i = 0; i < n; i++)
+		pthread_create(&tids[i], NULL, caller, (void *)i);
+	for (i = 0; i < n; i++)
+		pthread_join(tids[i], NULL);
+
+	jrpc_exit();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc > 1) && (strcmp(argv[1], "serve") == 0))
+		return serve();
+
+	if ((argc > 2) && (strcmp(argv[1], "call") == 0))
+		return call(atoi(argv[2]));
+
+	printf("usage: herd serve\n");
+	printf("       herd call <n>\n");
+	return 1;
+}
@@ -0,0 +1,152 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "jrpc.h"
+
+/* Logical node demo, needs jrpcd running.
+ *   logical [nodes]
+ * A host process registers nodes app_lnode0, app_lnode1, ... over its one
+ * connection to jrpcd, where on app_lnode<i> returns i. Another process
+ * calls every node, fans out to all of them with jrpc_call_many, then has
+ * the host drop the last node and checks that only that one is gone. Exit
+ * status is the number of failed checks. */
+
+#define MAX_NODES	8
+#define TIMEOUT_MS	2000
+
+#define WHERE(i)					\
+int where##i(void *ret, char *afmt)			\
+{							\
+	*RETURN_POINTER(ret, int) = i;			\
+	return 0;					\
+}
+
+WHERE(0) WHERE(1) WHERE(2) WHERE(3) WHERE(4) WHERE(5) WHERE(6) WHERE(7)
+
+int (*wheres[MAX_NODES])(void *, char *) = {
+	where0, where1, where2, where3, where4, where5, where6, where7
+};
+
+int NumNodes = MAX_NODES;
+
+int drop(void *ret, char *afmt)
+{
+	char name[NAME_SIZE];
+
+	snprintf(name, sizeof(name), "app_lnode%d", NumNodes - 1);
+	*RETURN_POINTER(ret, int) = jrpc_unregister(name);
+	return 0;
+}
+
+void host(void)
+{
+	struct if_details ifs[2];
+	char name[NAME_SIZE];
+	int i;
+
+	jrpc_init();
+	for (i = 0; i < NumNodes; i++) {
+		memset(ifs, 0, sizeof(ifs));
+		strcpy(ifs[0].if_name, "where");
+		ifs[0].fnptr = wheres[i];
+		strcpy(ifs[0].rfmt, "%d");
+		strcpy(ifs[1].if_name, "drop");
+		ifs[1].fnptr = drop;
+		strcpy(ifs[1].rfmt, "%d");
+
+		snprintf(name, sizeof(name), "app_lnode%d", i);
+		jrpc_register(name, (i == 0) ? 2 : 1, ifs, NULL);
+	}
+	pause();
+	exit(0);
+}
+
+/* Returns the number of failed checks */
+int check(int n_alive)
+{
+	struct jrpc_result res[MAX_NODES];
+	char name[NAME_SIZE];
+	int i, n, ret, failed = 0;
+
+	for (i = 0; i < NumNodes; i++) {
+		snprintf(name, sizeof(name), "app_lnode%d", i);
+		ret = -1;
+		if ((jrpc_calltm(name, "where", TIMEOUT_MS, &ret, "") < 0) ||
+		    (ret != i)) {
+			if (i >= n_alive)
+				continue;
+			printf("%s FAILED, got %d\n", name, ret);
+			failed++;
+		} else if (i >= n_alive) {
+			printf("%s still answers\n", name);
+			failed++;
+		}
+	}
+
+	n = jrpc_call_many("app_lnode*", "where", res, MAX_NODES,
+			   TIMEOUT_MS, "");
+	if (n != n_alive) {
+		printf("call_many reached %d nodes, expected %d\n", n, n_alive);
+		failed++;
+	}
+	for (i = 0; i < n; i++) {
+		snprintf(name, sizeof(name), "app_lnode%d", res[i].ival);
+		if ((res[i].status != JRPC_OK) ||
+		    (strcmp(name, res[i].node) != 0)) {
+			printf("call_many %s FAILED, got %d\n", res[i].node,
+			       res[i].ival);
+			failed++;
+		}
+	}
+
+	printf("%d nodes on one connection, %d failed checks\n", n_alive,
+	       failed);
+	return failed;
+}
+
+int main(int argc, char *argv[])
+{
+	int ret, failed;
+	pid_t pid;
+
+	if (argc > 1)
+		NumNodes = atoi(argv[1]);
+	if ((NumNodes < 2) || (NumNodes > MAX_NODES)) {
+		printf("usage: logical [nodes 2..%d]\n", MAX_NODES);
+		return 1;
+	}
+
+	pid = fork();
+	if (pid == 0)
+		host();
+	usleep(300 * 1000);
+
+	jrpc_init();
+	jrpc_register("app_logical", 0, NULL, NULL);
+
+	failed = check(NumNodes);
+	if ((jrpc_call("app_lnode0", "drop", &ret, "") < 0) || (ret != 0)) {
+		printf("drop FAILED\n");
+		failed++;
+	}
+	usleep(100 * 1000);
+	failed += check(NumNodes - 1);
+
+	jrpc_exit();
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return failed;
+}
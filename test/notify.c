@@ -0,0 +1,111 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "jrpc.h"
+
+/* One way call demo.
+ *   notify serve        node app_events, counts the events it gets
+ *   notify send <n>     sends n events with jrpc_notify, then n with
+ *                       jrpc_call, and prints the time each took
+ * Notifications don't wait for a return, so they go out as fast as jrpcd
+ * takes them. "count" is a normal call, it returns once the node has run
+ * all the events sent before it. */
+
+int Events;
+
+int event(void *ret, char *afmt);
+int count(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"event", event, "%d", "%d"},
+	{"count", count, "", "%d"}
+};
+
+int event(void *ret, char *afmt)
+{
+	int seq;
+
+	if (jrpc_scanargs(afmt, &seq) < 0)
+		return -1;
+
+	*RETURN_POINTER(ret, int) = ++Events;
+	return 0;
+}
+
+int count(void *ret, char *afmt)
+{
+	*RETURN_POINTER(ret, int) = Events;
+	return 0;
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+int serve(void)
+{
+	jrpc_init();
+	jrpc_register("app_events", sizeof(ifs) / sizeof(ifs[0]), ifs, NULL);
+
+	printf("app_events counting events\n");
+	fflush(stdout);
+	sleep(5 * 60);
+
+	jrpc_exit();
+	return 0;
+}
+
+int send_events(int n)
+{
+	struct timeval t1;
+	int i, ret, before, after;
+
+	jrpc_init();
+	jrpc_register("app_notify", 0, NULL, NULL);
+
+	jrpc_call("app_events", "count", &before, "");
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < n; i++)
+		jrpc_notify("app_events", "event", "%d", i);
+	printf("jrpc_notify x %d took %ld us\n", n, elapsed_us(&t1));
+	jrpc_call("app_events", "count", &after, "");
+	printf("%d events handled after %ld us\n", after - before,
+	       elapsed_us(&t1));
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < n; i++)
+		jrpc_call("app_events", "event", &ret, "%d", i);
+	printf("jrpc_call x %d took %ld us\n", n, elapsed_us(&t1));
+
+	jrpc_exit();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc > 1) && (strcmp(argv[1], "serve") == 0))
+		return serve();
+
+	if ((argc > 2) && (strcmp(argv[1], "send") == 0))
+		return send_events(atoi(argv[2]));
+
+	printf("usage: notify serve\n");
+	printf("       notify send <n>\n");
+	return 1;
+}
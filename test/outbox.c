@@ -0,0 +1,224 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "jrpc.h"
+
+/* Outbox demo, needs jrpcd running.
+ *   outbox [threads] [calls]
+ * Process app_outbox has check, which returns the length of its arg if it
+ * is one letter over and over. Threads of the main process call it at once
+ * over the one connection of jrpc_init, with args of a few KB, so messages
+ * of several threads meet in the outbox and go out together. Then each
+ * thread sends a burst of async calls without waiting for them. Last a
+ * context whose small outbox fails sends when full is flooded with
+ * notifications, some of them are refused, a call on it must work once
+ * the outbox is flushed. They are for a node
+ * nobody registered, jrpcd drops them: a flood of app_outbox would make
+ * jrpcd shed the call after it. Exit status is the number of wrong
+ * returns. */
+
+#define MAX_THREADS	16
+#define ARG_LEN		3000
+#define BURST		4	/* async calls in flight per thread */
+#define TIMEOUT_MS	5000
+
+struct worker {
+	int index;
+	int calls;
+	int wrong;
+	pthread_t tid;
+};
+
+int check(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"check", check, "%s", "%d"}
+};
+
+pthread_barrier_t Ready;
+pthread_mutex_t Mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t Done = PTHREAD_COND_INITIALIZER;
+int Returned, WrongAsync;
+
+int check(void *ret, char *afmt)
+{
+	char arg[BUFF_SIZE];
+	int i, len;
+
+	if (jrpc_scanargs(afmt, arg) < 0)
+		return -1;
+	len = strlen(arg);
+	for (i = 1; i < len; i++) {
+		if (arg[i] != arg[0])
+			break;
+	}
+	*RETURN_POINTER(ret, int) = (i == len) ? len : -1;
+	return 0;
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+/* an arg of len letters of one kind, a mix of two shows a broken stream */
+void fill(char *arg, int index, int len)
+{
+	memset(arg, 'a' + index % 26, len);
+	arg[len] = '\0';
+}
+
+void async_done(struct jrpc_result *res, void *arg)
+{
+	pthread_mutex_lock(&Mutex);
+	if ((res->status != JRPC_OK) || (res->ival != (int)(long)arg))
+		WrongAsync++;
+	Returned++;
+	pthread_cond_signal(&Done);
+	pthread_mutex_unlock(&Mutex);
+}
+
+void *worker(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	char buf[ARG_LEN + 1];
+	int i, len, ret;
+
+	pthread_barrier_wait(&Ready);
+	for (i = 0; i < w->calls; i++) {
+		len = ARG_LEN - (i % 64);
+		fill(buf, w->index + i, len);
+		ret = 0;
+		if ((jrpc_call("app_outbox", "check", &ret, "%s", buf) < 0) ||
+		    (ret != len))
+			w->wrong++;
+	}
+
+	pthread_barrier_wait(&Ready);
+	for (i = 0; i < BURST; i++) {
+		len = ARG_LEN - i;
+		fill(buf, w->index, len);
+		if (jrpc_call_async("app_outbox", "check", TIMEOUT_MS,
+				    async_done, (void *)(long)len, "%s",
+				    buf) < 0)
+			w->wrong++;
+	}
+
+	return NULL;
+}
+
+int flood(int count)
+{
+	char buf[ARG_LEN + 1];
+	jrpc_ctx_t *ctx;
+	int i, ret, refused = 0;
+
+	ctx = jrpc_ctx_open();
+	if (ctx == NULL)
+		return 1;
+	jrpc_ctx_set_outbox(ctx, 2 * BUFF_SIZE, 0);
+	jrpc_ctx_register(ctx, "app_outbox_flood", 0, NULL, NULL);
+
+	fill(buf, 0, ARG_LEN);
+	for (i = 0; i < count; i++) {
+		if (jrpc_ctx_notify(ctx, "app_outbox_none", "check", "%s",
+				    buf) < 0)
+			refused++;
+	}
+	/* refused sends never went out, the rest must get out before the
+	 * call behind them can */
+	jrpc_ctx_flush(ctx);
+	ret = 0;
+	jrpc_ctx_calltm(ctx, "app_outbox", "check", TIMEOUT_MS, &ret, "%s",
+			buf);
+	printf("%d notifications from a small outbox, %d refused, then check "
+	       "returned %d\n", count, refused, ret);
+	jrpc_ctx_close(ctx);
+
+	return (ret == ARG_LEN) ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct worker w[MAX_THREADS];
+	struct timeval t1;
+	int threads = 8, calls = 500, wrong = 0, i;
+	pid_t pid;
+
+	if (argc > 1)
+		threads = atoi(argv[1]);
+	if (argc > 2)
+		calls = atoi(argv[2]);
+	if ((threads < 1) || (threads > MAX_THREADS) || (calls < 1)) {
+		printf("usage: outbox [threads 1..%d] [calls > 0]\n",
+		       MAX_THREADS);
+		return 1;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		jrpc_init();
+		jrpc_register("app_outbox", 1, ifs, NULL);
+		pause();
+		exit(0);
+	}
+	usleep(300 * 1000);
+
+	jrpc_init();
+	jrpc_register("app_outbox_main", 0, NULL, NULL);
+
+	pthread_barrier_init(&Ready, NULL, threads + 1);
+	for (i = 0; i < threads; i++) {
+		w[i].index = i;
+		w[i].calls = calls;
+		w[i].wrong = 0;
+		pthread_create(&w[i].tid, NULL, worker, &w[i]);
+	}
+
+	gettimeofday(&t1, NULL);
+	pthread_barrier_wait(&Ready);
+	pthread_barrier_wait(&Ready);
+	printf("%d threads x %d calls of %d bytes on one connection: %ld us "
+	       "per call\n", threads, calls, ARG_LEN,
+	       elapsed_us(&t1) / (threads * calls));
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(w[i].tid, NULL);
+		wrong += w[i].wrong;
+	}
+	pthread_mutex_lock(&Mutex);
+	while (Returned < threads * BURST) {
+		if (pthread_cond_wait(&Done, &Mutex) != 0)
+			break;
+	}
+	printf("%d async calls in flight at once: %d returned, %d wrong\n",
+	       threads * BURST, Returned, WrongAsync);
+	wrong += WrongAsync;
+	pthread_mutex_unlock(&Mutex);
+
+	wrong += flood(calls * 4);
+
+	printf("%d wrong\n", wrong);
+	jrpc_exit();
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return wrong;
+}
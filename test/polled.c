@@ -0,0 +1,127 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+
+#include "jrpc.h"
+
+/* Polled mode demo, needs jrpcd running.
+ *   polled [calls]
+ * A child serves node app_polled from an epoll loop of its own, libjrpc
+ * starts no thread in it. The parent times calls to its add from a polled
+ * context, where the caller reads the return itself, and from a context
+ * with a receive thread. Exit status is the number of wrong returns. */
+
+int add(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"add", add, "%d%d", "%d"}
+};
+
+int add(void *ret, char *afmt)
+{
+	int a, b;
+
+	if (jrpc_scanargs(afmt, &a, &b) < 0)
+		return -1;
+	*RETURN_POINTER(ret, int) = a + b;
+	return 0;
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+void serve(void)
+{
+	struct epoll_event ev, events[4];
+	int epfd, i, n;
+
+	if (jrpc_init_polled() < 0)
+		exit(1);
+	jrpc_register("app_polled", sizeof(ifs) / sizeof(ifs[0]), ifs, NULL);
+
+	epfd = epoll_create1(0);
+	ev.events = EPOLLIN;
+	ev.data.fd = jrpc_fd();
+	epoll_ctl(epfd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+
+	/* the registration is sent on the first flush */
+	jrpc_flush();
+	for (;;) {
+		n = epoll_wait(epfd, events, 4, 1000);
+		for (i = 0; i < n; i++) {
+			if ((events[i].data.fd == jrpc_fd()) &&
+			    (jrpc_process_ready() < 0))
+				exit(0);
+		}
+	}
+}
+
+int run(jrpc_ctx_t *ctx, char *mode, int calls)
+{
+	struct timeval t1;
+	int i, ret, wrong = 0;
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < calls; i++) {
+		ret = -1;
+		if ((jrpc_ctx_call(ctx, "app_polled", "add", &ret, "%d%d", i,
+				   1) < 0) || (ret != i + 1))
+			wrong++;
+	}
+	printf("%d calls from a %s context: %ld us per call, %d wrong\n",
+	       calls, mode, calls ? elapsed_us(&t1) / calls : 0, wrong);
+
+	return wrong;
+}
+
+int main(int argc, char *argv[])
+{
+	jrpc_ctx_t *ctx;
+	int calls = 2000, wrong = 0;
+	pid_t pid;
+
+	if (argc > 1)
+		calls = atoi(argv[1]);
+
+	pid = fork();
+	if (pid == 0)
+		serve();
+	usleep(300 * 1000);
+
+	ctx = jrpc_ctx_open_polled();
+	if (ctx == NULL)
+		return 1;
+	jrpc_ctx_register(ctx, "app_polled_caller", 0, NULL, NULL);
+	wrong += run(ctx, "polled", calls);
+	jrpc_ctx_close(ctx);
+
+	ctx = jrpc_ctx_open();
+	if (ctx == NULL)
+		return 1;
+	jrpc_ctx_register(ctx, "app_polled_caller", 0, NULL, NULL);
+	wrong += run(ctx, "threaded", calls);
+	jrpc_ctx_close(ctx);
+
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return wrong;
+}
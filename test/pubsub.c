@@ -0,0 +1,122 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "jrpc.h"
+
+/* Publish/subscribe demo.
+ *   pubsub serve <node>           node subscribed to topics temp and reset,
+ *                                 counts the temp messages it gets
+ *   pubsub publish <n> <node>...  resets the counts, publishes n temp
+ *                                 messages and asks each node its count
+ * temp is subscribed with the registration, reset at runtime. Each publish
+ * is sent once, jrpcd hands the same buffer to all subscribers. */
+
+int Msgs;
+
+int temp(void *ret, char *afmt);
+int reset(void *ret, char *afmt);
+int count(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"temp", temp, "%d", "%d"},
+	{"reset", reset, "", "%d"},
+	{"count", count, "", "%d"}
+};
+
+int temp(void *ret, char *afmt)
+{
+	int val;
+
+	if (jrpc_scanargs(afmt, &val) < 0)
+		return -1;
+
+	*RETURN_POINTER(ret, int) = ++Msgs;
+	return 0;
+}
+
+int reset(void *ret, char *afmt)
+{
+	Msgs = 0;
+	*RETURN_POINTER(ret, int) = 0;
+	return 0;
+}
+
+int count(void *ret, char *afmt)
+{
+	*RETURN_POINTER(ret, int) = Msgs;
+	return 0;
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+int serve(char *node)
+{
+	jrpc_init();
+	jrpc_subscribe("temp");
+	jrpc_register(node, sizeof(ifs) / sizeof(ifs[0]), ifs, NULL);
+	jrpc_subscribe("reset");
+
+	printf("%s subscribed to temp and reset\n", node);
+	fflush(stdout);
+	sleep(5 * 60);
+
+	jrpc_exit();
+	return 0;
+}
+
+int publish(int n, char **nodes, int n_nodes)
+{
+	struct timeval t1;
+	int i, msgs;
+
+	jrpc_init();
+	jrpc_register("app_publisher", 0, NULL, NULL);
+
+	jrpc_publish("reset", "");
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < n; i++)
+		jrpc_publish("temp", "%d", 20 + i % 10);
+	printf("jrpc_publish x %d took %ld us\n", n, elapsed_us(&t1));
+
+	/* a call returns after the node ran all messages queued before it */
+	for (i = 0; i < n_nodes; i++) {
+		msgs = -1;
+		jrpc_call(nodes[i], "count", &msgs, "");
+		printf("%s got %d of %d messages\n", nodes[i], msgs, n);
+	}
+	printf("all delivered after %ld us\n", elapsed_us(&t1));
+
+	jrpc_exit();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc > 2) && (strcmp(argv[1], "serve") == 0))
+		return serve(argv[2]);
+
+	if ((argc > 3) && (strcmp(argv[1], "publish") == 0))
+		return publish(atoi(argv[2]), &argv[3], argc - 3);
+
+	printf("usage: pubsub serve <node>\n");
+	printf("       pubsub publish <n> <node>...\n");
+	return 1;
+}
@@ -0,0 +1,229 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "jrpc.h"
+
+/* Reconnect test harness.
+ *   reconnect [port] [restarts]
+ * Starts jrpcd on port and processes app_recon, app_recon_put and
+ * app_recon_idle, all serving add and slow_add, which takes SLOW_MS. Then
+ * jrpcd is killed and started again, restarts times, while the main process
+ * has a slow_add under way to the first two: the one to app_recon is
+ * declared idempotent and must return once the processes reconnected by
+ * themselves, the other must fail at once. No process but jrpcd is
+ * restarted. Prints how soon after jrpcd came back app_recon_idle took
+ * calls again. jrpcd is expected next to this binary. Exit status is the
+ * number of failed checks. */
+
+#define SLOW_MS		300
+#define DOWN_MS		200	/* jrpcd is down so long */
+#define FAST_MS		50	/* calls that can't be retried fail sooner */
+#define BACK_MS		2000
+
+struct slow_call {
+	char *node;
+	int ret;
+	int status;
+	struct timeval end;
+	pthread_t tid;
+};
+
+int add(void *ret, char *afmt);
+int slow_add(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"add", add, "%d%d", "%d"},
+	{"slow_add", slow_add, "%d%d", "%d"}
+};
+
+int Failed;
+
+int add(void *ret, char *afmt)
+{
+	int a, b;
+
+	if (jrpc_scanargs(afmt, &a, &b) < 0)
+		return -1;
+	*RETURN_POINTER(ret, int) = a + b;
+	return 0;
+}
+
+int slow_add(void *ret, char *afmt)
+{
+	usleep(SLOW_MS * 1000);
+	return add(ret, afmt);
+}
+
+void check(int ok, const char *what)
+{
+	if (!ok) {
+		printf("%s FAILED\n", what);
+		Failed++;
+	}
+}
+
+long since_ms(struct timeval *t1, struct timeval *t2)
+{
+	return (t2->tv_sec - t1->tv_sec) * 1000 +
+	       (t2->tv_usec - t1->tv_usec) / 1000;
+}
+
+pid_t start_daemon(char *jrpcd, int port)
+{
+	char buf[16];
+	pid_t pid;
+
+	snprintf(buf, sizeof(buf), "%d", port);
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0) {
+		if (getenv("RECON_VERBOSE") == NULL) {
+			freopen("/dev/null", "w", stdout);
+			freopen("/dev/null", "w", stderr);
+		}
+		execl(jrpcd, "jrpcd", "-p", buf, (char *)NULL);
+		perror("execl");
+		exit(1);
+	}
+	return pid;
+}
+
+pid_t start_node(char *name)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0) {
+		jrpc_init();
+		jrpc_register(name, sizeof(ifs) / sizeof(ifs[0]), ifs, NULL);
+		pause();
+		exit(0);
+	}
+	return pid;
+}
+
+void *slow_thread(void *arg)
+{
+	struct slow_call *c = (struct slow_call *)arg;
+
+	c->ret = 0;
+	c->status = jrpc_calltm(c->node, "slow_add", 5000, &c->ret, "%d%d",
+				20, 22);
+	gettimeofday(&c->end, NULL);
+	return NULL;
+}
+
+/* kills jrpcd with two calls under way and starts it again */
+pid_t restart(char *jrpcd, int port, pid_t daemon)
+{
+	struct slow_call get = { "app_recon" }, put = { "app_recon_put" };
+	struct timeval t_kill, t_up, t;
+	int ret;
+
+	pthread_create(&get.tid, NULL, slow_thread, &get);
+	pthread_create(&put.tid, NULL, slow_thread, &put);
+	usleep(SLOW_MS / 3 * 1000);
+
+	kill(daemon, SIGKILL);
+	waitpid(daemon, NULL, 0);
+	gettimeofday(&t_kill, NULL);
+
+	pthread_join(put.tid, NULL);
+	check(put.status < 0, "slow_add to app_recon_put failed");
+	check(since_ms(&t_kill, &put.end) < FAST_MS,
+	      "slow_add to app_recon_put failed at once");
+
+	usleep(DOWN_MS * 1000);
+	gettimeofday(&t_up, NULL);
+	check(jrpc_calltm("app_recon", "add", 1000, &ret, "%d%d", 1, 2) < 0,
+	      "add with jrpcd down failed");
+	gettimeofday(&t, NULL);
+	check(since_ms(&t_up, &t) < FAST_MS,
+	      "add with jrpcd down failed at once");
+
+	daemon = start_daemon(jrpcd, port);
+	gettimeofday(&t_up, NULL);
+	do {
+		ret = 0;
+		if ((jrpc_calltm("app_recon_idle", "add", 100, &ret, "%d%d",
+				 1, 2) == 0) && (ret == 3))
+			break;
+		usleep(1000);
+		gettimeofday(&t, NULL);
+	} while (since_ms(&t_up, &t) < BACK_MS);
+	gettimeofday(&t, NULL);
+	check(ret == 3, "add after the restart");
+
+	pthread_join(get.tid, NULL);
+	check((get.status == 0) && (get.ret == 42),
+	      "slow_add to app_recon sent again");
+	printf("jrpcd back: app_recon_idle called after %ld ms, slow_add "
+	       "under way returned after %ld ms\n", since_ms(&t_up, &t),
+	       since_ms(&t_up, &get.end));
+
+	return daemon;
+}
+
+int main(int argc, char *argv[])
+{
+	char jrpcd[1024], buf[16];
+	int port = 7300, restarts = 3, ret, i;
+	pid_t daemon, node, node_put, node_idle;
+
+	if (argc > 1)
+		port = atoi(argv[1]);
+	if (argc > 2)
+		restarts = atoi(argv[2]);
+	if ((port <= 0) || (restarts < 1)) {
+		printf("usage: reconnect [port] [restarts > 0]\n");
+		return 1;
+	}
+	snprintf(jrpcd, sizeof(jrpcd), "%s/jrpcd", dirname(strdup(argv[0])));
+	snprintf(buf, sizeof(buf), "%d", port);
+	setenv("JRPC_PORT", buf, 1);
+
+	daemon = start_daemon(jrpcd, port);
+	usleep(200 * 1000);
+	node = start_node("app_recon");
+	node_put = start_node("app_recon_put");
+	node_idle = start_node("app_recon_idle");
+	usleep(300 * 1000);
+
+	jrpc_init();
+	jrpc_register("app_recon_main", 0, NULL, NULL);
+	jrpc_set_idempotent("app_recon", "slow_add");
+	check((jrpc_call("app_recon", "add", &ret, "%d%d", 1, 2) == 0) &&
+	      (ret == 3), "add");
+
+	for (i = 0; i < restarts; i++)
+		daemon = restart(jrpcd, port, daemon);
+
+	printf("%d restarts, %d failed checks\n", restarts, Failed);
+	jrpc_exit();
+	kill(node, SIGTERM);
+	kill(node_put, SIGTERM);
+	kill(node_idle, SIGTERM);
+	waitpid(node, NULL, 0);
+	waitpid(node_put, NULL, 0);
+	waitpid(node_idle, NULL, 0);
+	kill(daemon, SIGINT);
+	waitpid(daemon, NULL, 0);
+	return Failed;
+}
@@ -0,0 +1,180 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "jrpc.h"
+
+/* Startup demo, needs jrpcd running.
+ *   startup [runs]
+ * Process app_startup serves ping. The main process starts itself runs
+ * times over as "startup once", like a short lived tool would be: each run
+ * opens libjrpc, registers a node, calls ping once and exits. The time
+ * from fork to the exit of a run is taken, and each run reports how long
+ * jrpc_init, jrpc_register and the call took. Last a registration jrpcd
+ * refuses must fail. Exit status is the number of failed runs and checks. */
+
+#define MAX_RUNS	1000
+
+int ping(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"ping", ping, "%d", "%d"}
+};
+
+int ping(void *ret, char *afmt)
+{
+	int val;
+
+	if (jrpc_scanargs(afmt, &val) < 0)
+		return -1;
+	*RETURN_POINTER(ret, int) = val;
+	return 0;
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+/* one run, prints the us init, register and the call took */
+int once(void)
+{
+	struct timeval t1;
+	long init_us, reg_us, call_us;
+	char node[NAME_SIZE];
+	int ret = 0;
+
+	gettimeofday(&t1, NULL);
+	if (jrpc_init() < 0)
+		return 1;
+	init_us = elapsed_us(&t1);
+
+	snprintf(node, sizeof(node), "app_startup_%d", getpid());
+	gettimeofday(&t1, NULL);
+	if (jrpc_register(node, 0, NULL, NULL) < 0)
+		return 1;
+	reg_us = elapsed_us(&t1);
+
+	gettimeofday(&t1, NULL);
+	if ((jrpc_call("app_startup", "ping", &ret, "%d", getpid()) < 0) ||
+	    (ret != getpid()))
+		return 1;
+	call_us = elapsed_us(&t1);
+
+	jrpc_exit();
+	printf("%ld %ld %ld\n", init_us, reg_us, call_us);
+	return 0;
+}
+
+/* starts "startup once", gets the us it took till it exited and its
+ * report */
+int run(char *self, long *us, long part_us[3])
+{
+	struct timeval t1;
+	FILE *out;
+	int fd[2], status;
+	pid_t pid;
+
+	if (pipe(fd) < 0)
+		return -1;
+	gettimeofday(&t1, NULL);
+	pid = fork();
+	if (pid == 0) {
+		dup2(fd[1], 1);
+		close(fd[0]);
+		close(fd[1]);
+		execl(self, self, "once", (char *)NULL);
+		exit(1);
+	}
+	close(fd[1]);
+	waitpid(pid, &status, 0);
+	*us = elapsed_us(&t1);
+
+	out = fdopen(fd[0], "r");
+	if ((out == NULL) ||
+	    (fscanf(out, "%ld %ld %ld", &part_us[0], &part_us[1],
+		    &part_us[2]) != 3))
+		status = -1;
+	if (out != NULL)
+		fclose(out);
+	else
+		close(fd[0]);
+
+	return (WIFEXITED(status) && (WEXITSTATUS(status) == 0)) ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	long us, part_us[3], total_us = 0, max_us = 0, sum_us[3] = {0};
+	int runs = 50, ok = 0, failed = 0, i;
+	pid_t pid;
+
+	if ((argc > 1) && (strcmp(argv[1], "once") == 0))
+		return once();
+	if (argc > 1)
+		runs = atoi(argv[1]);
+	if ((runs < 1) || (runs > MAX_RUNS)) {
+		printf("usage: startup [runs 1..%d]\n", MAX_RUNS);
+		return 1;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		jrpc_init();
+		jrpc_register("app_startup", 1, ifs, NULL);
+		jrpc_register_group("app_startup_rr", 1, ifs, JRPC_GROUP_RR,
+				    0);
+		pause();
+		exit(0);
+	}
+	usleep(300 * 1000);
+
+	for (i = 0; i < runs; i++) {
+		if (run(argv[0], &us, part_us) < 0) {
+			failed++;
+			continue;
+		}
+		ok++;
+		total_us += us;
+		if (us > max_us)
+			max_us = us;
+		sum_us[0] += part_us[0];
+		sum_us[1] += part_us[1];
+		sum_us[2] += part_us[2];
+	}
+	if (ok > 0)
+		printf("%d runs from fork to exit: %ld us on average, %ld us "
+		       "at most\ninit %ld us, register %ld us, first call %ld "
+		       "us on average\n", ok, total_us / ok, max_us,
+		       sum_us[0] / ok, sum_us[1] / ok, sum_us[2] / ok);
+
+	/* a group taken under another policy is refused, and said so */
+	jrpc_init();
+	if (jrpc_register_group("app_startup_rr", 1, ifs, JRPC_GROUP_LOC,
+				0) == 0) {
+		printf("registration under another policy did not fail\n");
+		failed++;
+	}
+
+	printf("%d failed\n", failed);
+	jrpc_exit();
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return failed;
+}
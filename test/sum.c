@@ -74,6 +74,7 @@ void main(void)
 	jrpc_init();		// establishes connection with server and creates a thread
 
 	printf("Registering this's public interfaces with jrpc...\n");
+	jrpc_set_cacheable("app_sum", "getinfo", 1000);	/* same answer every time */
 	jrpc_register("app_sum", sizeof(ifs) / sizeof(ifs[0]), ifs, NULL);
 
 	while (sleep_s-- > 0) {
@@ -0,0 +1,146 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <string>
+
+#include "jrpc.hpp"
+
+/* Typed call demo, needs jrpcd running.
+ *   typed [calls]
+ * Process app_typed serves add2 and greet, bound with jrpc::bind, whose
+ * formats come from their C++ types. The main process checks them with
+ * jrpc::call, checks that a call with args of the wrong types fails, and
+ * times calls made with jrpc::call against jrpc_call with an afmt string,
+ * both to another process and to a node of its own. Exit status is the
+ * number of failed checks. */
+
+int add2(int a, int b)
+{
+	return a + b;
+}
+
+std::string greet(const char *who, int times)
+{
+	std::string s;
+
+	for (int i = 0; i < times; i++)
+		s += std::string(i ? " " : "") + "hi " + who;
+	return s;
+}
+
+int Failed;
+
+void check(bool ok, const char *what)
+{
+	if (!ok) {
+		printf("%s FAILED\n", what);
+		Failed++;
+	}
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+void bench(const char *node, int calls)
+{
+	struct timeval t1;
+	int i, ret, wrong = 0;
+	long c_us, cpp_us;
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < calls; i++) {
+		ret = -1;
+		if ((jrpc_call((char *)node, (char *)"add2", &ret,
+			       (char *)"%d%d", i, 1) < 0) || (ret != i + 1))
+			wrong++;
+	}
+	c_us = elapsed_us(&t1);
+
+	gettimeofday(&t1, NULL);
+	for (i = 0; i < calls; i++) {
+		try {
+			if (jrpc::call<int>(node, "add2", i, 1) != i + 1)
+				wrong++;
+		} catch (jrpc::error &) {
+			wrong++;
+		}
+	}
+	cpp_us = elapsed_us(&t1);
+
+	printf("%d calls to %s: jrpc_call %.2f us, jrpc::call %.2f us per "
+	       "call, %d wrong\n", calls, node, (double)c_us / calls,
+	       (double)cpp_us / calls, wrong);
+	Failed += wrong;
+}
+
+int main(int argc, char *argv[])
+{
+	struct if_details ifs[] = {
+		jrpc::bind<add2>("add2"),
+		jrpc::bind<greet>("greet")
+	};
+	int calls = 2000, ret;
+	pid_t pid;
+
+	if (argc > 1)
+		calls = atoi(argv[1]);
+
+	pid = fork();
+	if (pid == 0) {
+		jrpc_init();
+		jrpc_register((char *)"app_typed", 2, ifs, NULL);
+		pause();
+		exit(0);
+	}
+	usleep(300 * 1000);
+
+	jrpc_init();
+	jrpc_register((char *)"app_typed_main", 2, ifs, NULL);
+
+	printf("add2 is \"%s\" -> \"%s\", greet is \"%s\" -> \"%s\"\n",
+	       ifs[0].afmt, ifs[0].rfmt, ifs[1].afmt, ifs[1].rfmt);
+	check(jrpc::call<int>("app_typed", "add2", 40, 2) == 42, "add2");
+	check(jrpc::call<std::string>("app_typed", "greet", "bob", 2).get() ==
+	      "hi bob hi bob", "greet");
+
+	/* C peers see the same interface */
+	check((jrpc_call((char *)"app_typed", (char *)"add2", &ret,
+			 (char *)"%d%d", 1, 2) == 0) && (ret == 3),
+	      "add2 from C");
+
+	/* bound interfaces check what comes over the wire */
+	try {
+		int r = jrpc::calltm<int>("app_typed", "add2", 300, "1", 2);
+		printf("add2(\"1\", 2) returned %d\n", r);
+		Failed++;
+	} catch (jrpc::error &e) {
+		printf("add2(\"1\", 2): %s\n", e.what());
+	}
+
+	bench("app_typed", calls);
+	bench("app_typed_main", calls * 100);
+
+	printf("%d failed checks\n", Failed);
+	jrpc_exit();
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return Failed;
+}
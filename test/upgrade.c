@@ -0,0 +1,270 @@
+/* JRPCD (Json RPC Daemon)
+ * Author: Karthik Shanmugam
+ * Email: kshanmu4@visteon.com
+ * Date: 10-June-2016
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "jrpc.h"
+
+/* Hot restart test harness.
+ *   upgrade [port] [upgrades]
+ * Starts jrpcd on port with an upgrade socket, and processes app_up and
+ * app_up_ping, both serving add and slow_add, which takes SLOW_MS. Then a
+ * new jrpcd is started on the same socket, upgrades times, each taking over
+ * from the one before while a slow_add to app_up is under way and a thread
+ * of the main process calls add of app_up_ping over and over. Reconnecting is off in all processes: every call must
+ * go through, the slow_add must return, and the previous jrpcd must exit.
+ * A new connection after each upgrade must work too. Prints how long each
+ * previous jrpcd took to exit and the longest call meanwhile. jrpcd is
+ * expected next to this binary. Exit status is the number of failed
+ * checks. */
+
+#define SLOW_MS		300
+#define EXIT_MS		2000	/* previous jrpcd must be gone by then */
+
+int add(void *ret, char *afmt);
+int slow_add(void *ret, char *afmt);
+
+struct if_details ifs[] = {
+	{"add", add, "%d%d", "%d"},
+	{"slow_add", slow_add, "%d%d", "%d"}
+};
+
+int Failed;
+volatile int Stop;
+pthread_mutex_t Mutex = PTHREAD_MUTEX_INITIALIZER;
+long Calls, Wrong, MaxUs;
+
+int add(void *ret, char *afmt)
+{
+	int a, b;
+
+	if (jrpc_scanargs(afmt, &a, &b) < 0)
+		return -1;
+	*RETURN_POINTER(ret, int) = a + b;
+	return 0;
+}
+
+int slow_add(void *ret, char *afmt)
+{
+	usleep(SLOW_MS * 1000);
+	return add(ret, afmt);
+}
+
+void check(int ok, const char *what)
+{
+	if (!ok) {
+		printf("%s FAILED\n", what);
+		Failed++;
+	}
+}
+
+long elapsed_us(struct timeval *t1)
+{
+	struct timeval t2;
+
+	gettimeofday(&t2, NULL);
+	return (t2.tv_sec - t1->tv_sec) * 1000000 + (t2.tv_usec - t1->tv_usec);
+}
+
+pid_t start_node(char *name)
+{
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0) {
+		jrpc_init();
+		jrpc_register(name, sizeof(ifs) / sizeof(ifs[0]), ifs, NULL);
+		pause();
+		exit(0);
+	}
+	return pid;
+}
+
+pid_t start_daemon(char *jrpcd, int port, char *path)
+{
+	char buf[16];
+	pid_t pid;
+
+	snprintf(buf, sizeof(buf), "%d", port);
+	fflush(stdout);
+	pid = fork();
+	if (pid == 0) {
+		if (getenv("UPGRADE_VERBOSE") == NULL) {
+			freopen("/dev/null", "w", stdout);
+			freopen("/dev/null", "w", stderr);
+		}
+		execl(jrpcd, "jrpcd", "-p", buf, "-U", path, (char *)NULL);
+		perror("execl");
+		exit(1);
+	}
+	return pid;
+}
+
+/* calls add till told to stop, keeps the longest call */
+void *caller(void *arg)
+{
+	struct timeval t1;
+	long us;
+	int i = 0, ret;
+
+	while (!Stop) {
+		gettimeofday(&t1, NULL);
+		ret = 0;
+		if ((jrpc_calltm("app_up_ping", "add", 2000, &ret, "%d%d", i, 1) <
+		     0) || (ret != i + 1)) {
+			pthread_mutex_lock(&Mutex);
+			Wrong++;
+			pthread_mutex_unlock(&Mutex);
+		}
+		us = elapsed_us(&t1);
+		pthread_mutex_lock(&Mutex);
+		Calls++;
+		if (us > MaxUs)
+			MaxUs = us;
+		pthread_mutex_unlock(&Mutex);
+		i++;
+		usleep(1000);
+	}
+	return NULL;
+}
+
+void *slow_thread(void *arg)
+{
+	int *ret = (int *)arg;
+
+	if (jrpc_calltm("app_up", "slow_add", 5000, ret, "%d%d", 20, 22) < 0)
+		*ret = -1;
+	return NULL;
+}
+
+/* a client that comes after the upgrade is served as well */
+int newcomer(void)
+{
+	jrpc_ctx_t *ctx;
+	int ret = 0;
+
+	ctx = jrpc_ctx_open();
+	if (ctx == NULL)
+		return -1;
+	if ((jrpc_ctx_register(ctx, "app_up_new", 0, NULL, NULL) < 0) ||
+	    (jrpc_ctx_calltm(ctx, "app_up", "add", 1000, &ret, "%d%d", 2, 3)
+	     < 0))
+		ret = -1;
+	jrpc_ctx_close(ctx);
+	return (ret == 5) ? 0 : -1;
+}
+
+/* starts a new jrpcd while a slow_add is under way, the old one must */
+/* exit having handed over */
+pid_t upgrade(char *jrpcd, int port, char *path, pid_t daemon, int n)
+{
+	struct timeval t1;
+	pthread_t slow;
+	pid_t next;
+	long exit_us = -1, max_us;
+	int slow_ret = 0, status;
+
+	pthread_create(&slow, NULL, slow_thread, &slow_ret);
+	usleep(SLOW_MS / 3 * 1000);
+
+	pthread_mutex_lock(&Mutex);
+	MaxUs = 0;
+	pthread_mutex_unlock(&Mutex);
+
+	gettimeofday(&t1, NULL);
+	next = start_daemon(jrpcd, port, path);
+	while (elapsed_us(&t1) < EXIT_MS * 1000) {
+		if (waitpid(daemon, &status, WNOHANG) == daemon) {
+			exit_us = elapsed_us(&t1);
+			break;
+		}
+		usleep(1000);
+	}
+	check((exit_us >= 0) && WIFEXITED(status) &&
+	      (WEXITSTATUS(status) == 0), "previous jrpcd exited");
+	if (exit_us < 0) {
+		kill(daemon, SIGKILL);
+		waitpid(daemon, NULL, 0);
+	}
+
+	pthread_join(slow, NULL);
+	check(slow_ret == 42, "slow_add under way returned");
+	check(newcomer() == 0, "call from a new connection");
+
+	usleep(100 * 1000);
+	pthread_mutex_lock(&Mutex);
+	max_us = MaxUs;
+	pthread_mutex_unlock(&Mutex);
+	printf("upgrade %d: previous jrpcd gone after %ld us, longest add "
+	       "meanwhile %ld us\n", n, exit_us, max_us);
+
+	return next;
+}
+
+int main(int argc, char *argv[])
+{
+	char jrpcd[1024], path[64], buf[16];
+	int port = 7400, upgrades = 3, ret, i;
+	pid_t daemon, node, node_ping;
+	pthread_t tid;
+
+	if (argc > 1)
+		port = atoi(argv[1]);
+	if (argc > 2)
+		upgrades = atoi(argv[2]);
+	if ((port <= 0) || (upgrades < 1)) {
+		printf("usage: upgrade [port] [upgrades > 0]\n");
+		return 1;
+	}
+	snprintf(jrpcd, sizeof(jrpcd), "%s/jrpcd", dirname(strdup(argv[0])));
+	snprintf(path, sizeof(path), "/tmp/jrpcd-upgrade-%d", port);
+	snprintf(buf, sizeof(buf), "%d", port);
+	setenv("JRPC_PORT", buf, 1);
+	/* a connection dropped on the way would show as failed calls */
+	setenv("JRPC_RECONNECT", "0", 1);
+
+	daemon = start_daemon(jrpcd, port, path);
+	usleep(200 * 1000);
+	node = start_node("app_up");
+	node_ping = start_node("app_up_ping");
+	usleep(300 * 1000);
+
+	jrpc_init();
+	jrpc_register("app_up_main", 0, NULL, NULL);
+	check((jrpc_call("app_up", "add", &ret, "%d%d", 1, 2) == 0) &&
+	      (ret == 3), "add");
+	pthread_create(&tid, NULL, caller, NULL);
+
+	for (i = 0; i < upgrades; i++)
+		daemon = upgrade(jrpcd, port, path, daemon, i + 1);
+
+	Stop = 1;
+	pthread_join(tid, NULL);
+	check(Wrong == 0, "adds across the upgrades");
+	printf("%d upgrades, %ld adds, %ld failed, %d failed checks\n",
+	       upgrades, Calls, Wrong, Failed);
+
+	jrpc_exit();
+	kill(node, SIGTERM);
+	kill(node_ping, SIGTERM);
+	waitpid(node, NULL, 0);
+	waitpid(node_ping, NULL, 0);
+	kill(daemon, SIGINT);
+	waitpid(daemon, NULL, 0);
+	return Failed;
+}